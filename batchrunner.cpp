@@ -0,0 +1,362 @@
+#include "batchrunner.h"
+#include "nbody.h"
+#include "nbodyfile.h"
+#include "trajectoryrecorder.h"
+#include "settings.h"
+#include "clplatform.h"
+#include "cldevice.h"
+#include "clexception.h"
+#include <QCoreApplication>
+#include <QStringList>
+#include <QVector>
+#include <stdio.h>
+#include <string.h>
+
+
+#define LOG_WHO "Batch Runner"
+
+
+BatchRunner::BatchRunner(QObject *parent) :
+    QObject(parent)
+{
+    nbody = new NBody(this);
+    recorder = new TrajectoryRecorder(this);
+    body_file = new NBodyFile();
+
+    total_steps = 0;
+    snapshot_steps = 0;
+    record_steps = 0;
+    done_steps = 0;
+    pending_steps = 0;
+    max_steps_per_call = 1;
+    snapshot_index = 0;
+    force_native = false;
+    compress = false;
+    verify = false;
+    exit_code = 0;
+    simulation_ms = 0;
+    bodies_uploaded = false;
+    start_requested = false;
+
+    connect(&Log::instance(), SIGNAL(log(Log::MsgType,QString,QString)),
+            this, SLOT(on_log(Log::MsgType,QString,QString)));
+    // Сигнал может прийти из потока OpenCL,
+    // следующий шаг запускаем из цикла событий.
+    connect(nbody, SIGNAL(simulationFinished()), this, SLOT(on_simulationFinished()), Qt::QueuedConnection);
+    connect(nbody, SIGNAL(bodiesUploaded(bool)), this, SLOT(on_bodiesUploaded(bool)), Qt::QueuedConnection);
+}
+
+BatchRunner::~BatchRunner()
+{
+    nbody->destroy();
+    delete body_file;
+}
+
+bool BatchRunner::isRequested(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i ++){
+        if(strcmp(argv[i], "--batch") == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Разбор параметров командной строки.
+ * @param args Параметры.
+ * @return true в случае успеха, иначе false.
+ */
+bool BatchRunner::parseArguments(const QStringList &args)
+{
+    bool ok = true;
+
+    for(int i = 1; i < args.size() && ok; i ++){
+        const QString& arg = args.at(i);
+        // Параметры со значением.
+        bool has_value = i + 1 < args.size();
+
+        if(arg == "--batch" && has_value){
+            input_file = args.at(++ i);
+        }else if(arg == "--steps" && has_value){
+            total_steps = args.at(++ i).toULongLong(&ok);
+        }else if(arg == "--snapshot" && has_value){
+            snapshot_steps = args.at(++ i).toULongLong(&ok);
+        }else if(arg == "--record" && has_value){
+            record_steps = args.at(++ i).toULongLong(&ok);
+        }else if(arg == "--output" && has_value){
+            output_prefix = args.at(++ i);
+        }else if(arg == "--native"){
+            force_native = true;
+        }else if(arg == "--compress"){
+            compress = true;
+        }else if(arg == "--verify"){
+            verify = true;
+        }else{
+            log(Log::ERROR, LOG_WHO, tr("Invalid argument: %1").arg(arg));
+            ok = false;
+        }
+    }
+
+    if(ok && (input_file.isEmpty() || total_steps == 0)){
+        log(Log::ERROR, LOG_WHO, tr("Usage: qgalaxy --batch FILE --steps N [--snapshot K] [--record K] [--output PREFIX] [--native] [--compress] [--verify]"));
+        ok = false;
+    }
+
+    if(output_prefix.isEmpty()){
+        output_prefix = input_file;
+        if(output_prefix.endsWith(".glx")) output_prefix.chop(4);
+    }
+
+    return ok;
+}
+
+/**
+ * @brief Создание системы и загрузка тел.
+ * @return true в случае успеха, иначе false.
+ */
+bool BatchRunner::init()
+{
+    // Если не удалось открыть файл.
+    if(!body_file->open(input_file, verify)) return false;
+
+    size_t count = body_file->bodiesCount();
+
+    // Установим параметры симуляции из настроек.
+    nbody->setHeadless(true);
+    nbody->setTimeStep(Settings::get().timeStep());
+    nbody->setSolver(static_cast<NBody::Solver>(Settings::get().solver()));
+    nbody->setBarnesHutTheta(Settings::get().barnesHutTheta());
+    nbody->setGpuTreeBuild(Settings::get().gpuTreeBuild());
+    nbody->setFmmOrder(Settings::get().fmmOrder());
+    nbody->setFmmDeviceEvaluation(Settings::get().fmmDeviceEvaluation());
+    nbody->setPmGridSize(Settings::get().pmGridSize());
+    nbody->setPmTsc(Settings::get().pmTsc());
+    nbody->setBlockRungs(Settings::get().blockRungs());
+    nbody->setIntegrator(static_cast<NBody::Integrator>(Settings::get().integrator()));
+    nbody->setPrecision(static_cast<NBody::Precision>(Settings::get().precision()));
+    nbody->setSoftening(static_cast<NBody::Softening>(Settings::get().softening()));
+    nbody->setSofteningLength(Settings::get().softeningLength());
+    nbody->setPackedLayout(Settings::get().packedLayout());
+    nbody->setAutoTune(Settings::get().autoTune());
+    nbody->setProfiling(Settings::get().profiling());
+    nbody->setMultiDevice(Settings::get().multiDevice());
+
+    max_steps_per_call = qMax(Settings::get().stepsPerFrame(), 1);
+
+    bool res = false;
+
+    if(!force_native && !Settings::get().nativeBackend()){
+        try{
+            CLPlatform platform = CLPlatform::byName(Settings::get().clPlatformName());
+            CLDevice device = platform.deviceByName(Settings::get().clDeviceName());
+
+            QString tuning_key = nbody->tuningKey(device, count);
+            nbody->setKernelTuning(NBody::KernelTuning::fromString(Settings::get().kernelTuning(tuning_key)));
+            nbody->setPrecisionReport(Settings::get().precisionReport(tuning_key));
+
+            res = nbody->create(platform, device, count);
+            if(res && nbody->kernelTuning().isValid()){
+                Settings::get().setKernelTuning(tuning_key, nbody->kernelTuning().toString());
+            }
+            if(res && !nbody->precisionReport().isEmpty()){
+                Settings::get().setPrecisionReport(tuning_key, nbody->precisionReport());
+            }
+        }catch(CLException& e){
+            log(Log::ERROR, LOG_WHO, e.what());
+            res = false;
+        }
+        if(!res){
+            log(Log::WARNING, LOG_WHO, tr("OpenCL is unavailable, using native CPU backend"));
+            nbody->destroy();
+        }
+    }
+    if(!res){
+        res = nbody->createNative(count);
+    }
+
+    if(!res){
+        log(Log::ERROR, LOG_WHO, tr("Error initializing NBody system"));
+        return false;
+    }
+
+    // Запись тел из отображения файла ставится в очередь,
+    // пока она идёт, открывается файл траектории.
+    // Симуляция начнётся по сигналу окончания записи.
+    if(!nbody->setBodiesAsync(NBody::BodiesView(body_file->masses(), body_file->positions(),
+                                                body_file->velocities(), count))){
+        log(Log::ERROR, LOG_WHO, tr("Error setting bodies!"));
+        return false;
+    }
+
+    // Запись траектории.
+    if(record_steps != 0){
+        if(!recorder->open(output_prefix + ".glxt", record_steps, compress) ||
+           !nbody->setTrajectoryRecorder(recorder)){
+            log(Log::ERROR, LOG_WHO, tr("Error starting trajectory recording!"));
+            return false;
+        }
+    }
+
+    log(Log::INFO, LOG_WHO, tr("Loaded %1 bodies, simulating %2 steps").arg(count).arg(total_steps));
+
+    return true;
+}
+
+int BatchRunner::exitCode() const
+{
+    return exit_code;
+}
+
+void BatchRunner::start()
+{
+    done_steps = 0;
+    simulation_ms = 0;
+    snapshot_index = 0;
+
+    start_requested = true;
+
+    // Дождёмся окончания записи тел.
+    if(!bodies_uploaded) return;
+
+    simulateNext();
+}
+
+void BatchRunner::on_bodiesUploaded(bool success)
+{
+    // Отображение файла больше не нужно.
+    body_file->close();
+
+    if(!success){
+        log(Log::ERROR, LOG_WHO, tr("Error setting bodies!"));
+        finish(1);
+        return;
+    }
+
+    bodies_uploaded = true;
+
+    if(start_requested) simulateNext();
+}
+
+void BatchRunner::on_simulationFinished()
+{
+    simulation_ms += timer.elapsed();
+    done_steps += pending_steps;
+    pending_steps = 0;
+
+    // Промежуточный снимок.
+    if(snapshot_steps != 0 && done_steps < total_steps && done_steps % snapshot_steps == 0){
+        if(!writeSnapshot()){
+            finish(1);
+            return;
+        }
+    }
+
+    simulateNext();
+}
+
+void BatchRunner::on_log(Log::MsgType type, const QString &who, const QString &msg)
+{
+    static const char* type_names[] = {"", "DEBUG", "INFO", "WARNING", "ERROR"};
+
+    fprintf(stderr, "[%s] %s: %s\n", type_names[type],
+            who.toLocal8Bit().constData(), msg.toLocal8Bit().constData());
+}
+
+/**
+ * @brief Запуск следующей порции шагов.
+ */
+void BatchRunner::simulateNext()
+{
+    // Все шаги выполнены.
+    if(done_steps >= total_steps){
+        double seconds = simulation_ms / 1000.0;
+        fprintf(stdout, "%llu steps, %llu bodies: %.3f s, %.2f steps/s, %.3g body updates/s\n",
+                static_cast<unsigned long long>(done_steps),
+                static_cast<unsigned long long>(nbody->simulatedBodiesCount()),
+                seconds,
+                seconds > 0.0 ? done_steps / seconds : 0.0,
+                seconds > 0.0 ? static_cast<double>(nbody->simulatedBodiesCount()) * done_steps / seconds : 0.0);
+        fflush(stdout);
+
+        finish(writeSnapshot() ? 0 : 1);
+        return;
+    }
+
+    // Шагов до конца, либо до ближайшего снимка.
+    quint64 steps = qMin(max_steps_per_call, total_steps - done_steps);
+    if(snapshot_steps != 0){
+        steps = qMin(steps, snapshot_steps - done_steps % snapshot_steps);
+    }
+    // Число шагов вызова ограничивается и при записи траектории.
+    if(record_steps != 0){
+        steps = qMin(steps, record_steps - done_steps % record_steps);
+    }
+
+    nbody->setStepsPerFrame(steps);
+    pending_steps = steps;
+
+    timer.start();
+
+    if(!nbody->simulate()){
+        log(Log::ERROR, LOG_WHO, tr("Error simulating NBody system"));
+        finish(1);
+    }
+}
+
+/**
+ * @brief Сохранение снимка системы.
+ * @return true в случае успеха, иначе false.
+ */
+bool BatchRunner::writeSnapshot()
+{
+    size_t count = nbody->simulatedBodiesCount();
+
+    QString filename = QString("%1_%2.glx").arg(output_prefix).arg(snapshot_index ++, 6, 10, QChar('0'));
+
+    bool res = false;
+
+    // Данные в памяти хоста записываются без копирования.
+    const float* mass_ptr = nbody->mapBodyData(NBody::BODY_DATA_MASSES);
+    const float* pos_ptr = nbody->mapBodyData(NBody::BODY_DATA_POSITIONS);
+    const float* vel_ptr = nbody->mapBodyData(NBody::BODY_DATA_VELOCITIES);
+
+    if(mass_ptr != nullptr && pos_ptr != nullptr && vel_ptr != nullptr){
+        res = NBodyFile::write(filename, mass_ptr, pos_ptr, vel_ptr, count, 1, nullptr, compress);
+    }else{
+        QVector<float> mass;
+        QVector<Point3f> pos, vel;
+
+        if(!nbody->getMasses(mass, 0, count) ||
+           !nbody->getPositions(pos, 0, count) ||
+           !nbody->getVelocities(vel, 0, count)){
+            log(Log::ERROR, LOG_WHO, tr("Error getting bodies!"));
+        }else{
+            res = NBodyFile::write(filename, mass, pos, vel, compress);
+        }
+    }
+
+    nbody->unmapBodyData(NBody::BODY_DATA_MASSES);
+    nbody->unmapBodyData(NBody::BODY_DATA_POSITIONS);
+    nbody->unmapBodyData(NBody::BODY_DATA_VELOCITIES);
+
+    if(!res) return false;
+
+    log(Log::INFO, LOG_WHO, tr("Snapshot saved: %1 (step %2)").arg(filename).arg(done_steps));
+
+    return true;
+}
+
+/**
+ * @brief Завершение работы.
+ * @param code Код завершения.
+ */
+void BatchRunner::finish(int code)
+{
+    // Допишем кадры траектории.
+    if(recorder->isOpen()){
+        nbody->setTrajectoryRecorder(nullptr);
+        recorder->close();
+    }
+
+    exit_code = code;
+    QCoreApplication::exit(code);
+}
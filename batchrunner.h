@@ -0,0 +1,214 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <QObject>
+#include <QString>
+#include <QElapsedTimer>
+#include "log.h"
+
+class NBody;
+class NBodyFile;
+class TrajectoryRecorder;
+
+
+/**
+ * @class BatchRunner.
+ * @brief Класс пакетной симуляции без графического интерфейса.
+ * Считывает тела из файла, выполняет заданное число шагов,
+ * периодически сохраняя снимки системы, и выводит время расчёта.
+ * Параметры командной строки:
+ * --batch FILE --steps N [--snapshot K] [--record K] [--output PREFIX] [--native] [--compress] [--verify].
+ * С параметром --record каждые K шагов кадр дописывается
+ * в файл траектории PREFIX.glxt.
+ * С параметром --compress снимки и кадры траектории сжимаются.
+ * С параметром --verify проверяются контрольные суммы разделов файла тел.
+ */
+class BatchRunner : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief Конструктор.
+     * @param parent Родитель.
+     */
+    explicit BatchRunner(QObject *parent = 0);
+
+    /**
+     * @brief Деструктор.
+     */
+    ~BatchRunner();
+
+    /**
+     * @brief Проверка наличия пакетного режима в параметрах командной строки.
+     * @param argc Число параметров.
+     * @param argv Параметры.
+     * @return true если задан пакетный режим, иначе false.
+     */
+    static bool isRequested(int argc, char* argv[]);
+
+    /**
+     * @brief Разбор параметров командной строки.
+     * @param args Параметры.
+     * @return true в случае успеха, иначе false.
+     */
+    bool parseArguments(const QStringList& args);
+
+    /**
+     * @brief Создание системы и загрузка тел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool init();
+
+    /**
+     * @brief Получение кода завершения.
+     * @return Код завершения.
+     */
+    int exitCode() const;
+
+public slots:
+    /**
+     * @brief Запуск симуляции.
+     */
+    void start();
+
+private slots:
+    /**
+     * @brief Слот окончания симуляции.
+     */
+    void on_simulationFinished();
+
+    /**
+     * @brief Слот окончания записи тел в буферы.
+     * @param success Флаг успешной записи.
+     */
+    void on_bodiesUploaded(bool success);
+
+    /**
+     * @brief Слот вывода сообщений журнала.
+     * @param type Тип сообщения.
+     * @param who Источник сообщения.
+     * @param msg Сообщение.
+     */
+    void on_log(Log::MsgType type, const QString& who, const QString& msg);
+
+private:
+    /**
+     * @brief Система тел.
+     */
+    NBody* nbody;
+
+    /**
+     * @brief Имя файла с телами.
+     */
+    QString input_file;
+
+    /**
+     * @brief Префикс имён файлов снимков.
+     */
+    QString output_prefix;
+
+    /**
+     * @brief Общее число шагов.
+     */
+    quint64 total_steps;
+
+    /**
+     * @brief Число шагов между снимками, 0 - только в конце.
+     */
+    quint64 snapshot_steps;
+
+    /**
+     * @brief Число шагов между кадрами траектории, 0 - без записи.
+     */
+    quint64 record_steps;
+
+    /**
+     * @brief Запись траектории.
+     */
+    TrajectoryRecorder* recorder;
+
+    /**
+     * @brief Файл тел, отображённый в память.
+     * Держится открытым до окончания записи тел.
+     */
+    NBodyFile* body_file;
+
+    /**
+     * @brief Флаг окончания записи тел.
+     */
+    bool bodies_uploaded;
+
+    /**
+     * @brief Флаг запроса запуска симуляции.
+     */
+    bool start_requested;
+
+    /**
+     * @brief Число выполненных шагов.
+     */
+    quint64 done_steps;
+
+    /**
+     * @brief Число шагов текущего вызова симуляции.
+     */
+    quint64 pending_steps;
+
+    /**
+     * @brief Число шагов за вызов из настроек.
+     */
+    quint64 max_steps_per_call;
+
+    /**
+     * @brief Номер следующего снимка.
+     */
+    int snapshot_index;
+
+    /**
+     * @brief Флаг расчёта на процессоре.
+     */
+    bool force_native;
+
+    /**
+     * @brief Флаг сжатия снимков и траектории.
+     */
+    bool compress;
+
+    /**
+     * @brief Флаг проверки контрольных сумм файла тел.
+     */
+    bool verify;
+
+    /**
+     * @brief Код завершения.
+     */
+    int exit_code;
+
+    /**
+     * @brief Таймер времени симуляции.
+     */
+    QElapsedTimer timer;
+
+    /**
+     * @brief Время симуляции без учёта записи снимков, в мс.
+     */
+    qint64 simulation_ms;
+
+    /**
+     * @brief Запуск следующей порции шагов.
+     */
+    void simulateNext();
+
+    /**
+     * @brief Сохранение снимка системы.
+     * @return true в случае успеха, иначе false.
+     */
+    bool writeSnapshot();
+
+    /**
+     * @brief Завершение работы.
+     * @param code Код завершения.
+     */
+    void finish(int code);
+};
+
+#endif // BATCHRUNNER_H
@@ -182,7 +182,7 @@ bool CLBuffer::enqueueRead(const CLCommandQueue &queue, bool blocking,
 }
 
 bool CLBuffer::enqueueWrite(const CLCommandQueue &queue, bool blocking,
-                            size_t offset, size_t cb, void *ptr,
+                            size_t offset, size_t cb, const void *ptr,
                             const CLEventList *wait_events, CLEvent *event)
 {
     cl_bool clblocking = CL_FALSE;
@@ -205,7 +205,7 @@ bool CLBuffer::enqueueWrite(const CLCommandQueue &queue, bool blocking,
 
     if(event) event_id_ptr = &event_id;
 
-    CL_ERR_THROW(clEnqueueReadBuffer(queue.id(), m_id, clblocking, offset, cb,
+    CL_ERR_THROW(clEnqueueWriteBuffer(queue.id(), m_id, clblocking, offset, cb,
                         ptr, wait_events_vec.size(), wait_events_ptr, event_id_ptr));
 
     if(event) event->setId(event_id);
@@ -213,6 +213,34 @@ bool CLBuffer::enqueueWrite(const CLCommandQueue &queue, bool blocking,
     return true;
 }
 
+bool CLBuffer::enqueueCopy(const CLCommandQueue &queue, const CLBuffer &dst,
+                           size_t src_offset, size_t dst_offset, size_t cb,
+                           const CLEventList *wait_events, CLEvent *event)
+{
+    QVector<cl_event> wait_events_vec;
+    const cl_event* wait_events_ptr = nullptr;
+
+    cl_event event_id = nullptr;
+    cl_event* event_id_ptr = nullptr;
+
+    if(wait_events){
+        for(CLEventList::const_iterator it = wait_events->begin(); it != wait_events->end(); ++ it){
+            wait_events_vec.push_back((*it).id());
+        }
+    }
+
+    if(!wait_events_vec.empty()) wait_events_ptr = wait_events_vec.data();
+
+    if(event) event_id_ptr = &event_id;
+
+    CL_ERR_THROW(clEnqueueCopyBuffer(queue.id(), m_id, dst.id(), src_offset, dst_offset, cb,
+                        wait_events_vec.size(), wait_events_ptr, event_id_ptr));
+
+    if(event) event->setId(event_id);
+
+    return true;
+}
+
 void* CLBuffer::enqueueMap(const CLCommandQueue &queue, bool blocking,
                           cl_map_flags flags, size_t offset, size_t cb,
                           const CLEventList *wait_events, CLEvent *event,
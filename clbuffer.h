@@ -172,9 +172,25 @@ public:
      * @throw CLException в случае ошибки.
      */
     bool enqueueWrite(const CLCommandQueue& queue, bool blocking,
-                      size_t offset, size_t cb, void* ptr,
+                      size_t offset, size_t cb, const void* ptr,
                       const CLEventList* wait_events = nullptr, CLEvent* event = nullptr);
 
+    /**
+     * @brief Помещение в очередь команды копирования данных в другой буфер OpenCL.
+     * @param queue Очередь комманд OpenCL.
+     * @param dst Буфер назначения.
+     * @param src_offset Смещение в этом буфере.
+     * @param dst_offset Смещение в буфере назначения.
+     * @param cb Размер.
+     * @param wait_events Список событий для ожидания.
+     * @param event Отслеживающее событие.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool enqueueCopy(const CLCommandQueue& queue, const CLBuffer& dst,
+                     size_t src_offset, size_t dst_offset, size_t cb,
+                     const CLEventList* wait_events = nullptr, CLEvent* event = nullptr);
+
     /**
      * @brief Помещение в очередь команды отображения в память буфера OpenCL.
      * @param queue Очередь комманд OpenCL.
@@ -41,14 +41,24 @@ bool CLCommandQueue::isValid() const
 }
 
 bool CLCommandQueue::create(const CLContext &clcxt, const CLDevice &device, cl_int* err_code)
+{
+    return create(clcxt, device, 0, err_code);
+}
+
+bool CLCommandQueue::create(const CLContext &clcxt, const CLDevice &device, cl_command_queue_properties properties, cl_int *err_code)
 {
     cl_int res = CL_SUCCESS;
-    m_id = clCreateCommandQueue(clcxt.id(), device.id(), 0, &res);
+    m_id = clCreateCommandQueue(clcxt.id(), device.id(), properties, &res);
     if(err_code) *err_code = res;
     CL_ERR_THROW(res);
     return m_id != nullptr;
 }
 
+bool CLCommandQueue::isProfilingEnabled() const
+{
+    return (getInfoValue<cl_command_queue_properties>(CL_QUEUE_PROPERTIES) & CL_QUEUE_PROFILING_ENABLE) != 0;
+}
+
 bool CLCommandQueue::retain()
 {
     CL_ERR_THROW(clRetainCommandQueue(m_id));
@@ -97,6 +107,17 @@ bool CLCommandQueue::barrier()
     return true;
 }
 
+bool CLCommandQueue::waitForEvent(const CLEvent &event)
+{
+    cl_event event_id = event.id();
+
+    if(event_id == nullptr) return false;
+
+    CL_ERR_THROW(clEnqueueWaitForEvents(m_id, 1, &event_id));
+
+    return true;
+}
+
 cl_context CLCommandQueue::contextId() const
 {
     return getInfoValue<cl_context>(CL_QUEUE_CONTEXT);
@@ -65,6 +65,24 @@ public:
      */
     bool create(const CLContext& clcxt, const CLDevice& device, cl_int *err_code = nullptr);
 
+    /**
+     * @brief Создание очереди команд OpenCL с заданными свойствами.
+     * @param clcxt Контекст OpenCL.
+     * @param device Устройство OpenCL.
+     * @param properties Свойства очереди (например, CL_QUEUE_PROFILING_ENABLE).
+     * @param err_code Код ошибки.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool create(const CLContext& clcxt, const CLDevice& device, cl_command_queue_properties properties, cl_int *err_code = nullptr);
+
+    /**
+     * @brief Получение флага профилирования команд очереди.
+     * @return Флаг профилирования команд очереди.
+     * @throw CLException в случае ошибки.
+     */
+    bool isProfilingEnabled() const;
+
     /**
      * @brief Увеличение числа ссылок на объект.
      * @return true в случае успеха, иначе false.
@@ -109,6 +127,15 @@ public:
      */
     bool barrier();
 
+    /**
+     * @brief Добавляет в очередь ожидание события.
+     * Последующие команды очереди выполнятся после завершения события.
+     * @param event Событие OpenCL.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool waitForEvent(const CLEvent& event);
+
     /**
      * @brief Получение идентификатора контекста OpenCL.
      * @return Идентификатор контекста OpenCL.
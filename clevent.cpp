@@ -51,6 +51,27 @@ bool CLEvent::create(const CLContext &cxt, cl_int *err_code)
     return m_id != nullptr;
 }
 
+bool CLEvent::createFromGLSync(const CLContext &cxt, cl_GLsync sync, cl_int *err_code)
+{
+    static clCreateEventFromGLsyncKHR_fn create_event_from_glsync = nullptr;
+
+    if(create_event_from_glsync == nullptr){
+        create_event_from_glsync = reinterpret_cast<clCreateEventFromGLsyncKHR_fn>(
+                    clGetExtensionFunctionAddress("clCreateEventFromGLsyncKHR"));
+    }
+
+    cl_int res = CL_INVALID_OPERATION;
+
+    if(create_event_from_glsync != nullptr){
+        m_setId(create_event_from_glsync(cxt.id(), sync, &res));
+    }
+    if(err_code) *err_code = res;
+
+    CL_ERR_THROW(res);
+
+    return m_id != nullptr;
+}
+
 bool CLEvent::retain()
 {
     CL_ERR_THROW(clRetainEvent(m_id));
@@ -149,6 +170,26 @@ void CL_CALLBACK CLEvent::event_notify(cl_event /*event*/, cl_int exec_status, v
     }
 }
 
+cl_ulong CLEvent::queuedTime() const
+{
+    return getProfilingValue(CL_PROFILING_COMMAND_QUEUED);
+}
+
+cl_ulong CLEvent::submitTime() const
+{
+    return getProfilingValue(CL_PROFILING_COMMAND_SUBMIT);
+}
+
+cl_ulong CLEvent::startTime() const
+{
+    return getProfilingValue(CL_PROFILING_COMMAND_START);
+}
+
+cl_ulong CLEvent::endTime() const
+{
+    return getProfilingValue(CL_PROFILING_COMMAND_END);
+}
+
 template<class T>
 T CLEvent::getInfoValue(cl_event_info info) const
 {
@@ -158,3 +199,10 @@ T CLEvent::getInfoValue(cl_event_info info) const
     return res;
 }
 
+cl_ulong CLEvent::getProfilingValue(cl_profiling_info info) const
+{
+    cl_ulong res = 0;
+    CL_ERR_THROW(clGetEventProfilingInfo(m_id, info, sizeof(cl_ulong),
+                        static_cast<void*>(&res), nullptr));
+    return res;
+}
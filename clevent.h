@@ -71,6 +71,17 @@ public:
      */
     bool create(const CLContext& cxt, cl_int* err_code = nullptr);
 
+    /**
+     * @brief Создание события OpenCL из объекта синхронизации OpenGL.
+     * Требует расширения cl_khr_gl_event.
+     * @param cxt Контекст OpenCL, созданный с контекстом OpenGL.
+     * @param sync Объект синхронизации OpenGL.
+     * @param err_code Код ошибки.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool createFromGLSync(const CLContext& cxt, cl_GLsync sync, cl_int* err_code = nullptr);
+
     /**
      * @brief Увеличение числа ссылок на объект.
      * @return true в случае успеха, иначе false.
@@ -122,6 +133,35 @@ public:
      */
     bool wait() const;
 
+    /**
+     * @brief Получение времени постановки команды в очередь.
+     * Очередь должна быть создана с CL_QUEUE_PROFILING_ENABLE.
+     * @return Время устройства, нс.
+     * @throw CLException в случае ошибки.
+     */
+    cl_ulong queuedTime() const;
+
+    /**
+     * @brief Получение времени отправки команды на устройство.
+     * @return Время устройства, нс.
+     * @throw CLException в случае ошибки.
+     */
+    cl_ulong submitTime() const;
+
+    /**
+     * @brief Получение времени начала выполнения команды.
+     * @return Время устройства, нс.
+     * @throw CLException в случае ошибки.
+     */
+    cl_ulong startTime() const;
+
+    /**
+     * @brief Получение времени окончания выполнения команды.
+     * @return Время устройства, нс.
+     * @throw CLException в случае ошибки.
+     */
+    cl_ulong endTime() const;
+
     /**
      * @brief Ожидание списка событий OpenCL.
      * @return true в случае успеха, иначе false.
@@ -193,6 +233,14 @@ private:
     template<class T>
     T getInfoValue(cl_event_info info) const;
 
+    /**
+     * @brief Получает информацию профилирования события OpenCL.
+     * @param info Вид информации.
+     * @return Время устройства, нс.
+     * @throw CLException в случае ошибки.
+     */
+    cl_ulong getProfilingValue(cl_profiling_info info) const;
+
     /**
      * @brief Функция обратного вызова для событий OpenCL.
      * @param event Событие OpenCL.
@@ -56,6 +56,25 @@ bool CLProgram::create(const CLContext &clcxt, const QString &source, cl_int* er
     return m_id != nullptr;
 }
 
+bool CLProgram::createWithBinary(const CLContext &clcxt, const CLDevice &device, const QByteArray &binary, cl_int *err_code)
+{
+    cl_int res = CL_SUCCESS;
+    cl_int binary_status = CL_SUCCESS;
+
+    cl_device_id device_id = device.id();
+    size_t binary_size = binary.size();
+    const unsigned char* c_binary = reinterpret_cast<const unsigned char*>(binary.constData());
+
+    m_id = clCreateProgramWithBinary(clcxt.id(), 1, &device_id, &binary_size, &c_binary, &binary_status, &res);
+
+    if(res == CL_SUCCESS) res = binary_status;
+
+    if(err_code) *err_code = res;
+    CL_ERR_THROW(res);
+
+    return m_id != nullptr;
+}
+
 bool CLProgram::retain()
 {
     CL_ERR_THROW(clRetainProgram(m_id));
@@ -110,6 +129,27 @@ QString CLProgram::source() const
     return getInfoValueStr(CL_PROGRAM_SOURCE);
 }
 
+QByteArray CLProgram::binary(const CLDevice &device) const
+{
+    QVector<cl_device_id> dev_ids = getInfoValuev<cl_device_id>(CL_PROGRAM_DEVICES);
+    QVector<size_t> sizes = getInfoValuev<size_t>(CL_PROGRAM_BINARY_SIZES);
+
+    int index = dev_ids.indexOf(device.id());
+    if(index < 0 || index >= sizes.size()) return QByteArray();
+
+    QVector<QByteArray> binaries(sizes.size());
+    QVector<unsigned char*> pointers(sizes.size());
+    for(int i = 0; i < sizes.size(); i ++){
+        binaries[i].resize(sizes[i]);
+        pointers[i] = sizes[i] ? reinterpret_cast<unsigned char*>(binaries[i].data()) : nullptr;
+    }
+
+    CL_ERR_THROW(clGetProgramInfo(m_id, CL_PROGRAM_BINARIES, pointers.size() * sizeof(unsigned char*),
+                        static_cast<void*>(pointers.data()), nullptr));
+
+    return binaries[index];
+}
+
 cl_context CLProgram::contextId() const
 {
     return getInfoValue<cl_context>(CL_PROGRAM_CONTEXT);
@@ -4,6 +4,7 @@
 #include <CL/opencl.h>
 #include <QVector>
 #include <QString>
+#include <QByteArray>
 #include "cldevice.h"
 
 class CLContext;
@@ -66,6 +67,18 @@ public:
      */
     bool create(const CLContext& clcxt, const QString& source, cl_int *err_code = nullptr);
 
+    /**
+     * @brief Создание программы OpenCL из скомпилированного ранее двоичного кода.
+     * Программу всё равно нужно собрать, но компилятор при этом не запускается.
+     * @param clcxt Контекст OpenCL.
+     * @param device Устройство OpenCL.
+     * @param binary Двоичный код программы для устройства.
+     * @param err_code Код ошибки.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool createWithBinary(const CLContext& clcxt, const CLDevice& device, const QByteArray& binary, cl_int *err_code = nullptr);
+
     /**
      * @brief Увеличение числа ссылок на объект.
      * @return true в случае успеха, иначе false.
@@ -114,6 +127,15 @@ public:
      */
     QString source() const;
 
+    /**
+     * @brief Получение двоичного кода собранной программы OpenCL.
+     * @param device Устройство OpenCL.
+     * @return Двоичный код программы для устройства,
+     * пустой массив, если устройство не принадлежит программе.
+     * @throw CLException в случае ошибки.
+     */
+    QByteArray binary(const CLDevice& device) const;
+
     /**
      * @brief Получение идентификатора контекста OpenCL.
      * @return Идентификатор контекста OpenCL.
@@ -0,0 +1,459 @@
+#include "cpuengine.h"
+#include "utils.h"
+#include <QVector>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+//! Выравнивание массивов в байтах.
+#define CPU_ENGINE_ALIGNMENT 64
+//! Число тел в блоке одной задачи.
+#define CPU_ENGINE_BLOCK 256
+//! Число тел-источников в плитке.
+#define CPU_ENGINE_TILE 1024
+//! Минимальный квадрат расстояния между телами, как в ядрах OpenCL.
+//! Обратный куб расстояния остаётся конечным,
+//! поэтому вклад самого тела нулевой.
+#define CPU_ENGINE_R2_MIN NBODY_RADIUS2_MIN
+//! Число массивов тел.
+#define CPU_ENGINE_ARRAYS 11
+//! Доля физической памяти для буферов ускорений потоков.
+#define CPU_ENGINE_PAIR_MEMORY_FRACTION 8
+//! Память буферов ускорений потоков, если объём памяти неизвестен.
+#define CPU_ENGINE_PAIR_MEMORY_DEFAULT (512ULL * 1024 * 1024)
+
+/*
+G, PC^3 / (Msun * Year^2)
+*/
+#define CPU_ENGINE_G 4.4932e-15f
+
+
+/**
+ * @brief Тела - источники для ядер.
+ */
+struct CpuEngineSources
+{
+    const float* x; //!< Позиции по оси x.
+    const float* y; //!< Позиции по оси y.
+    const float* z; //!< Позиции по оси z.
+    const float* mass; //!< Массы.
+    size_t count; //!< Число источников.
+};
+
+/**
+ * @brief Ядра одного набора векторных инструкций.
+ */
+struct CpuEngineKernels
+{
+    //! Имя набора инструкций.
+    const char* name;
+    //! Ускорения блока тел от всех источников.
+    void (*computeBlock)(const CpuEngineSources& src, float* acc_x, float* acc_y, float* acc_z, size_t block);
+    //! Взаимодействие пары блоков тел.
+    void (*computePairBlocks)(const CpuEngineSources& src, size_t block_i, size_t block_j,
+                              float* ax, float* ay, float* az);
+    //! Сумма блока массивов.
+    void (*reduceBlock)(const float* arrays, size_t stride, size_t count, float* sum, size_t block);
+};
+
+
+/*
+ * Наборы векторных инструкций.
+ * На x86 с GCC или Clang ядра компилируются для AVX-512,
+ * AVX2 + FMA и SSE независимо от параметров компиляции,
+ * а нужные выбираются при запуске по возможностям процессора.
+ * Иначе набор инструкций выбирается при компиляции.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+
+#define CPU_ENGINE_DISPATCH
+#include <immintrin.h>
+
+#define CPU_ENGINE_NAMESPACE cpu_engine_avx512
+#define CPU_ENGINE_ISA_AVX512
+#include "cpuenginekernels.h"
+#undef CPU_ENGINE_ISA_AVX512
+#undef CPU_ENGINE_NAMESPACE
+
+#define CPU_ENGINE_NAMESPACE cpu_engine_avx2
+#define CPU_ENGINE_ISA_AVX2
+#include "cpuenginekernels.h"
+#undef CPU_ENGINE_ISA_AVX2
+#undef CPU_ENGINE_NAMESPACE
+
+#define CPU_ENGINE_NAMESPACE cpu_engine_sse
+#define CPU_ENGINE_ISA_SSE
+#include "cpuenginekernels.h"
+#undef CPU_ENGINE_ISA_SSE
+#undef CPU_ENGINE_NAMESPACE
+
+#define CPU_ENGINE_NAMESPACE cpu_engine_scalar
+#include "cpuenginekernels.h"
+#undef CPU_ENGINE_NAMESPACE
+
+#else
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define CPU_ENGINE_ISA_AVX512
+#elif defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define CPU_ENGINE_ISA_AVX2
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CPU_ENGINE_ISA_SSE
+#endif
+
+#define CPU_ENGINE_NAMESPACE cpu_engine_native
+#include "cpuenginekernels.h"
+#undef CPU_ENGINE_NAMESPACE
+
+#endif
+
+
+/**
+ * @brief Выбирает ядра по возможностям процессора.
+ * @return Ядра.
+ */
+static const CpuEngineKernels& cpuEngineSelectKernels()
+{
+#if defined(CPU_ENGINE_DISPATCH)
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx512f")) return cpu_engine_avx512::kernels;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return cpu_engine_avx2::kernels;
+    if(__builtin_cpu_supports("sse")) return cpu_engine_sse::kernels;
+    return cpu_engine_scalar::kernels;
+#else
+    return cpu_engine_native::kernels;
+#endif
+}
+
+//! Ядра, выбранные при запуске.
+static const CpuEngineKernels& cpu_engine_kernels = cpuEngineSelectKernels();
+
+
+/**
+ * @brief Задача вычисления ускорений блока тел.
+ */
+struct CpuEngineBlockTask
+{
+    typedef void result_type;
+
+    CpuEngineBlockTask(CpuEngine* e) : engine(e) {}
+
+    void operator()(const qint32& block) const
+    {
+        engine->computeBlock(block);
+    }
+
+    CpuEngine* engine;
+};
+
+
+/**
+ * @brief Задача симметричного расчёта части пар блоков тел.
+ */
+struct CpuEnginePairTask
+{
+    typedef void result_type;
+
+    CpuEnginePairTask(CpuEngine* e) : engine(e) {}
+
+    void operator()(const qint32& task) const
+    {
+        engine->computePairTask(task);
+    }
+
+    CpuEngine* engine;
+};
+
+
+/**
+ * @brief Задача суммирования ускорений блока тел.
+ */
+struct CpuEngineReduceTask
+{
+    typedef void result_type;
+
+    CpuEngineReduceTask(CpuEngine* e) : engine(e) {}
+
+    void operator()(const qint32& block) const
+    {
+        engine->reducePairBlock(block);
+    }
+
+    CpuEngine* engine;
+};
+
+
+CpuEngine::CpuEngine()
+{
+    bodies_count = 0;
+    padded_count = 0;
+    memory = nullptr;
+    pos_x = pos_y = pos_z = nullptr;
+    mass = nullptr;
+    vel_x = vel_y = vel_z = nullptr;
+    acc_x = acc_y = acc_z = nullptr;
+    src_mass = nullptr;
+    sources_count = 0;
+    pair_memory = nullptr;
+    pair_threads = 0;
+}
+
+CpuEngine::~CpuEngine()
+{
+    destroy();
+}
+
+bool CpuEngine::create(size_t bodies)
+{
+    destroy();
+
+    if(bodies == 0) return false;
+
+    // Округлим до размера блока, чтобы не обрабатывать хвосты.
+    padded_count = (bodies + CPU_ENGINE_BLOCK - 1) / CPU_ENGINE_BLOCK * CPU_ENGINE_BLOCK;
+
+    size_t size = padded_count * sizeof(float) * CPU_ENGINE_ARRAYS;
+    memory = static_cast<float*>(qMallocAligned(size, CPU_ENGINE_ALIGNMENT));
+    if(memory == nullptr) return false;
+
+    // Дополнительные тела имеют нулевую массу
+    // и не влияют на остальные.
+    memset(memory, 0x0, size);
+
+    pos_x = memory;
+    pos_y = pos_x + padded_count;
+    pos_z = pos_y + padded_count;
+    mass  = pos_z + padded_count;
+    vel_x = mass  + padded_count;
+    vel_y = vel_x + padded_count;
+    vel_z = vel_y + padded_count;
+    acc_x = vel_z + padded_count;
+    acc_y = acc_x + padded_count;
+    acc_z = acc_y + padded_count;
+    src_mass = acc_z + padded_count;
+
+    bodies_count = bodies;
+
+    // Буферы ускорений потоков. Без них
+    // ускорения считаются для каждого тела отдельно.
+    size_t threads = static_cast<size_t>(std::max(QThread::idealThreadCount(), 1));
+
+    // Число буферов ограничено долей памяти.
+    quint64 budget = utils::physicalMemory() / CPU_ENGINE_PAIR_MEMORY_FRACTION;
+    if(budget == 0) budget = CPU_ENGINE_PAIR_MEMORY_DEFAULT;
+    quint64 thread_size = static_cast<quint64>(padded_count) * sizeof(float) * 3;
+    pair_threads = static_cast<size_t>(std::min<quint64>(threads, budget / thread_size));
+
+    // Симметричный расчёт вдвое короче, но идёт лишь в pair_threads
+    // потоках - при меньше чем половине потоков он медленнее.
+    if(pair_threads * 2 < threads) pair_threads = 0;
+
+    if(pair_threads != 0){
+        pair_memory = static_cast<float*>(qMallocAligned(pair_threads * thread_size, CPU_ENGINE_ALIGNMENT));
+        if(pair_memory == nullptr) pair_threads = 0;
+    }
+
+    return true;
+}
+
+void CpuEngine::destroy()
+{
+    if(memory) qFreeAligned(memory);
+    if(pair_memory) qFreeAligned(pair_memory);
+
+    memory = nullptr;
+    pair_memory = nullptr;
+    pair_threads = 0;
+    src_mass = nullptr;
+    pos_x = pos_y = pos_z = nullptr;
+    mass = nullptr;
+    vel_x = vel_y = vel_z = nullptr;
+    acc_x = acc_y = acc_z = nullptr;
+    bodies_count = 0;
+    padded_count = 0;
+}
+
+bool CpuEngine::isValid() const
+{
+    return memory != nullptr;
+}
+
+size_t CpuEngine::bodiesCount() const
+{
+    return bodies_count;
+}
+
+size_t CpuEngine::pairThreads() const
+{
+    return pair_threads;
+}
+
+const char *CpuEngine::simdName()
+{
+    return cpu_engine_kernels.name;
+}
+
+void CpuEngine::setBodies(const float *masses, const float *positions, const float *velocities, size_t count)
+{
+    count = std::min(count, bodies_count);
+
+    for(size_t i = 0; i < count; i ++){
+        mass[i] = masses[i];
+        pos_x[i] = positions[i * 3];
+        pos_y[i] = positions[i * 3 + 1];
+        pos_z[i] = positions[i * 3 + 2];
+        vel_x[i] = velocities[i * 3];
+        vel_y[i] = velocities[i * 3 + 1];
+        vel_z[i] = velocities[i * 3 + 2];
+    }
+}
+
+void CpuEngine::getMasses(float *masses, size_t count) const
+{
+    count = std::min(count, bodies_count);
+
+    memcpy(masses, mass, count * sizeof(float));
+}
+
+void CpuEngine::getPositions(float *positions, size_t count) const
+{
+    count = std::min(count, bodies_count);
+
+    for(size_t i = 0; i < count; i ++){
+        positions[i * 3]     = pos_x[i];
+        positions[i * 3 + 1] = pos_y[i];
+        positions[i * 3 + 2] = pos_z[i];
+    }
+}
+
+void CpuEngine::getVelocities(float *velocities, size_t count) const
+{
+    count = std::min(count, bodies_count);
+
+    for(size_t i = 0; i < count; i ++){
+        velocities[i * 3]     = vel_x[i];
+        velocities[i * 3 + 1] = vel_y[i];
+        velocities[i * 3 + 2] = vel_z[i];
+    }
+}
+
+void CpuEngine::computeAccelerations(size_t count)
+{
+    count = std::min(count, bodies_count);
+
+    sources_count = count;
+
+    QVector<qint32> blocks((count + CPU_ENGINE_BLOCK - 1) / CPU_ENGINE_BLOCK);
+    for(int i = 0; i < blocks.size(); i ++) blocks[i] = i;
+
+    // Симметричный расчёт - каждая пара тел один раз.
+    if(pair_memory != nullptr && blocks.size() > 1){
+        // Тела за границей расчёта не являются источниками.
+        memcpy(src_mass, mass, count * sizeof(float));
+        memset(src_mass + count, 0x0, (padded_count - count) * sizeof(float));
+
+        QVector<qint32> tasks(static_cast<int>(pair_threads));
+        for(int i = 0; i < tasks.size(); i ++) tasks[i] = i;
+
+        QtConcurrent::blockingMap(tasks, CpuEnginePairTask(this));
+        QtConcurrent::blockingMap(blocks, CpuEngineReduceTask(this));
+        return;
+    }
+
+    QtConcurrent::blockingMap(blocks, CpuEngineBlockTask(this));
+}
+
+void CpuEngine::setAccelerations(const float *accelerations, size_t count)
+{
+    count = std::min(count, bodies_count);
+
+    for(size_t i = 0; i < count; i ++){
+        acc_x[i] = accelerations[i * 3];
+        acc_y[i] = accelerations[i * 3 + 1];
+        acc_z[i] = accelerations[i * 3 + 2];
+    }
+}
+
+void CpuEngine::integrate(float dt, size_t count)
+{
+    count = std::min(count, bodies_count);
+
+    float gdt = CPU_ENGINE_G * dt;
+
+    // Как и в ядрах OpenCL - полунеявный метод Эйлера.
+    for(size_t i = 0; i < count; i ++){
+        vel_x[i] += acc_x[i] * gdt;
+        vel_y[i] += acc_y[i] * gdt;
+        vel_z[i] += acc_z[i] * gdt;
+        pos_x[i] += vel_x[i] * dt;
+        pos_y[i] += vel_y[i] * dt;
+        pos_z[i] += vel_z[i] * dt;
+    }
+}
+
+void CpuEngine::computeBlock(size_t block)
+{
+    CpuEngineSources src = {pos_x, pos_y, pos_z, mass, sources_count};
+
+    cpu_engine_kernels.computeBlock(src, acc_x, acc_y, acc_z, block);
+}
+
+float *CpuEngine::pairAccelerations(size_t task, size_t axis) const
+{
+    return pair_memory + (task * 3 + axis) * padded_count;
+}
+
+void CpuEngine::computePairTask(size_t task)
+{
+    size_t blocks = (sources_count + CPU_ENGINE_BLOCK - 1) / CPU_ENGINE_BLOCK;
+    size_t pairs = blocks * (blocks + 1) / 2;
+
+    // Пары блоков (i, j), j >= i, по строкам -
+    // блок i остаётся в кэше, пока перебираются блоки j.
+    size_t pair_begin = pairs * task / pair_threads;
+    size_t pair_end = pairs * (task + 1) / pair_threads;
+
+    float* ax = pairAccelerations(task, 0);
+    float* ay = pairAccelerations(task, 1);
+    float* az = pairAccelerations(task, 2);
+
+    memset(ax, 0x0, blocks * CPU_ENGINE_BLOCK * sizeof(float));
+    memset(ay, 0x0, blocks * CPU_ENGINE_BLOCK * sizeof(float));
+    memset(az, 0x0, blocks * CPU_ENGINE_BLOCK * sizeof(float));
+
+    if(pair_begin >= pair_end) return;
+
+    // Найдём первую пару.
+    size_t block_i = 0;
+    size_t row_begin = 0;
+    while(row_begin + (blocks - block_i) <= pair_begin){
+        row_begin += blocks - block_i;
+        block_i ++;
+    }
+    size_t block_j = block_i + (pair_begin - row_begin);
+
+    CpuEngineSources src = {pos_x, pos_y, pos_z, src_mass, sources_count};
+
+    for(size_t pair = pair_begin; pair < pair_end; pair ++){
+        cpu_engine_kernels.computePairBlocks(src, block_i, block_j, ax, ay, az);
+
+        if(++ block_j >= blocks){
+            block_i ++;
+            block_j = block_i;
+        }
+    }
+}
+
+void CpuEngine::reducePairBlock(size_t block)
+{
+    // Буферы задач по оси следуют с шагом в три массива.
+    cpu_engine_kernels.reduceBlock(pairAccelerations(0, 0), padded_count * 3, pair_threads, acc_x, block);
+    cpu_engine_kernels.reduceBlock(pairAccelerations(0, 1), padded_count * 3, pair_threads, acc_y, block);
+    cpu_engine_kernels.reduceBlock(pairAccelerations(0, 2), padded_count * 3, pair_threads, acc_z, block);
+}
@@ -0,0 +1,218 @@
+#ifndef CPUENGINE_H
+#define CPUENGINE_H
+
+#include <QtGlobal>
+#include <stddef.h>
+
+
+/**
+ * @class CpuEngine.
+ * @brief Класс расчёта взаимодействия тел на процессоре.
+ * Используется, когда OpenCL недоступен.
+ * Данные хранятся структурой массивов, выровненных
+ * под векторные регистры. Ускорения вычисляются
+ * векторными инструкциями (AVX-512, AVX2 или SSE,
+ * выбираемыми при запуске по возможностям процессора) блоками тел,
+ * распределёнными по потокам, источники перебираются
+ * плитками, помещающимися в кэш.
+ * Прямой расчёт использует третий закон Ньютона:
+ * каждая пара блоков считается один раз, ускорения
+ * обоих тел пары накапливаются в буфере потока,
+ * затем буферы потоков суммируются.
+ */
+class CpuEngine
+{
+public:
+    /**
+     * @brief Конструктор.
+     */
+    CpuEngine();
+
+    /**
+     * @brief Деструктор.
+     */
+    ~CpuEngine();
+
+    /**
+     * @brief Выделяет память для тел.
+     * @param bodies Число тел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool create(size_t bodies);
+
+    /**
+     * @brief Освобождает память.
+     */
+    void destroy();
+
+    /**
+     * @brief Получение флага готовности.
+     * @return Флаг готовности.
+     */
+    bool isValid() const;
+
+    /**
+     * @brief Получение числа тел.
+     * @return Число тел.
+     */
+    size_t bodiesCount() const;
+
+    /**
+     * @brief Получение числа буферов ускорений потоков
+     * симметричного расчёта.
+     * @return Число буферов или 0, если симметричный расчёт не используется.
+     */
+    size_t pairThreads() const;
+
+    /**
+     * @brief Получение имени набора векторных инструкций.
+     * @return Имя набора инструкций.
+     */
+    static const char* simdName();
+
+    /**
+     * @brief Установка данных тел.
+     * @param masses Массы.
+     * @param positions Позиции (x, y, z).
+     * @param velocities Скорости (x, y, z).
+     * @param count Число тел.
+     */
+    void setBodies(const float* masses, const float* positions, const float* velocities, size_t count);
+
+    /**
+     * @brief Получение масс тел.
+     * @param masses Результат - массы.
+     * @param count Число тел.
+     */
+    void getMasses(float* masses, size_t count) const;
+
+    /**
+     * @brief Получение позиций тел.
+     * @param positions Результат - позиции (x, y, z).
+     * @param count Число тел.
+     */
+    void getPositions(float* positions, size_t count) const;
+
+    /**
+     * @brief Получение скоростей тел.
+     * @param velocities Результат - скорости (x, y, z).
+     * @param count Число тел.
+     */
+    void getVelocities(float* velocities, size_t count) const;
+
+    /**
+     * @brief Вычисляет ускорения прямым расчётом всех пар.
+     * @param count Число моделируемых тел.
+     */
+    void computeAccelerations(size_t count);
+
+    /**
+     * @brief Установка ускорений, вычисленных иначе.
+     * @param accelerations Ускорения (x, y, z) без гравитационной постоянной.
+     * @param count Число тел.
+     */
+    void setAccelerations(const float* accelerations, size_t count);
+
+    /**
+     * @brief Вычисляет новые скорости и позиции.
+     * @param dt Время шага.
+     * @param count Число моделируемых тел.
+     */
+    void integrate(float dt, size_t count);
+
+private:
+    /**
+     * @brief Число тел.
+     */
+    size_t bodies_count;
+
+    /**
+     * @brief Число тел с учётом выравнивания.
+     */
+    size_t padded_count;
+
+    /**
+     * @brief Выделенная память.
+     */
+    float* memory;
+
+    /**
+     * @brief Массивы позиций.
+     */
+    float* pos_x;
+    float* pos_y;
+    float* pos_z;
+
+    /**
+     * @brief Массив масс.
+     */
+    float* mass;
+
+    /**
+     * @brief Массивы скоростей.
+     */
+    float* vel_x;
+    float* vel_y;
+    float* vel_z;
+
+    /**
+     * @brief Массивы ускорений.
+     */
+    float* acc_x;
+    float* acc_y;
+    float* acc_z;
+
+    /**
+     * @brief Массы источников - нулевые для
+     * тел, не участвующих в текущем расчёте.
+     */
+    float* src_mass;
+
+    /**
+     * @brief Число моделируемых тел текущего расчёта.
+     */
+    size_t sources_count;
+
+    /**
+     * @brief Буферы ускорений потоков симметричного расчёта.
+     */
+    float* pair_memory;
+
+    /**
+     * @brief Число буферов ускорений потоков.
+     */
+    size_t pair_threads;
+
+    /**
+     * @brief Вычисляет ускорения блока тел.
+     * @param block Индекс блока.
+     */
+    void computeBlock(size_t block);
+
+    /**
+     * @brief Получение буфера ускорений потока.
+     * @param task Индекс задачи.
+     * @param axis Ось.
+     * @return Массив ускорений по оси.
+     */
+    float* pairAccelerations(size_t task, size_t axis) const;
+
+    /**
+     * @brief Вычисляет свою часть пар блоков тел
+     * с накоплением в буфере задачи.
+     * @param task Индекс задачи.
+     */
+    void computePairTask(size_t task);
+
+    /**
+     * @brief Суммирует ускорения блока тел из буферов задач.
+     * @param block Индекс блока.
+     */
+    void reducePairBlock(size_t block);
+
+    friend struct CpuEngineBlockTask;
+    friend struct CpuEnginePairTask;
+    friend struct CpuEngineReduceTask;
+};
+
+#endif // CPUENGINE_H
@@ -0,0 +1,343 @@
+/*
+ * Векторные ядра CpuEngine для одного набора инструкций.
+ * Файл включается в cpuengine.cpp несколько раз, каждый раз
+ * в своём пространстве имён CPU_ENGINE_NAMESPACE и с набором
+ * инструкций, заданным макросом CPU_ENGINE_ISA_AVX512,
+ * CPU_ENGINE_ISA_AVX2 или CPU_ENGINE_ISA_SSE (без макроса - скалярный код).
+ * При выборе набора во время выполнения (CPU_ENGINE_DISPATCH)
+ * функции компилируются для своего набора инструкций
+ * независимо от параметров компиляции.
+ */
+
+// Аргумент прагмы не раскрывается как макрос,
+// поэтому набор инструкций задан в каждой ветви.
+#if defined(CPU_ENGINE_DISPATCH) && (defined(CPU_ENGINE_ISA_AVX512) || \
+    defined(CPU_ENGINE_ISA_AVX2) || defined(CPU_ENGINE_ISA_SSE))
+#define CPU_ENGINE_TARGET
+#if defined(__clang__)
+#if defined(CPU_ENGINE_ISA_AVX512)
+#pragma clang attribute push (__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(CPU_ENGINE_ISA_AVX2)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#pragma clang attribute push (__attribute__((target("sse"))), apply_to = function)
+#endif
+#else
+#pragma GCC push_options
+#if defined(CPU_ENGINE_ISA_AVX512)
+#pragma GCC target("avx512f")
+#elif defined(CPU_ENGINE_ISA_AVX2)
+#pragma GCC target("avx2,fma")
+#else
+#pragma GCC target("sse")
+#endif
+#endif
+#endif
+
+
+namespace CPU_ENGINE_NAMESPACE {
+
+/*
+ * Векторные операции над группой тел.
+ */
+#if defined(CPU_ENGINE_ISA_AVX512)
+
+//! Число тел в векторе.
+#define SIMD_WIDTH 16
+typedef __m512 simd_t;
+static inline simd_t simd_set1(float v) { return _mm512_set1_ps(v); }
+static inline simd_t simd_load(const float* p) { return _mm512_load_ps(p); }
+static inline void simd_store(float* p, simd_t v) { _mm512_store_ps(p, v); }
+static inline simd_t simd_add(simd_t a, simd_t b) { return _mm512_add_ps(a, b); }
+static inline simd_t simd_sub(simd_t a, simd_t b) { return _mm512_sub_ps(a, b); }
+static inline simd_t simd_mul(simd_t a, simd_t b) { return _mm512_mul_ps(a, b); }
+static inline simd_t simd_fmadd(simd_t a, simd_t b, simd_t c) { return _mm512_fmadd_ps(a, b, c); }
+static inline simd_t simd_max(simd_t a, simd_t b) { return _mm512_max_ps(a, b); }
+static inline simd_t simd_rsqrt(simd_t a) { return _mm512_rsqrt14_ps(a); }
+static const char* simd_name = "AVX-512";
+
+#elif defined(CPU_ENGINE_ISA_AVX2)
+
+#define SIMD_WIDTH 8
+typedef __m256 simd_t;
+static inline simd_t simd_set1(float v) { return _mm256_set1_ps(v); }
+static inline simd_t simd_load(const float* p) { return _mm256_load_ps(p); }
+static inline void simd_store(float* p, simd_t v) { _mm256_store_ps(p, v); }
+static inline simd_t simd_add(simd_t a, simd_t b) { return _mm256_add_ps(a, b); }
+static inline simd_t simd_sub(simd_t a, simd_t b) { return _mm256_sub_ps(a, b); }
+static inline simd_t simd_mul(simd_t a, simd_t b) { return _mm256_mul_ps(a, b); }
+static inline simd_t simd_fmadd(simd_t a, simd_t b, simd_t c) { return _mm256_fmadd_ps(a, b, c); }
+static inline simd_t simd_max(simd_t a, simd_t b) { return _mm256_max_ps(a, b); }
+static inline simd_t simd_rsqrt(simd_t a) { return _mm256_rsqrt_ps(a); }
+static const char* simd_name = "AVX2";
+
+#elif defined(CPU_ENGINE_ISA_SSE)
+
+#define SIMD_WIDTH 4
+typedef __m128 simd_t;
+static inline simd_t simd_set1(float v) { return _mm_set1_ps(v); }
+static inline simd_t simd_load(const float* p) { return _mm_load_ps(p); }
+static inline void simd_store(float* p, simd_t v) { _mm_store_ps(p, v); }
+static inline simd_t simd_add(simd_t a, simd_t b) { return _mm_add_ps(a, b); }
+static inline simd_t simd_sub(simd_t a, simd_t b) { return _mm_sub_ps(a, b); }
+static inline simd_t simd_mul(simd_t a, simd_t b) { return _mm_mul_ps(a, b); }
+static inline simd_t simd_fmadd(simd_t a, simd_t b, simd_t c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+static inline simd_t simd_max(simd_t a, simd_t b) { return _mm_max_ps(a, b); }
+static inline simd_t simd_rsqrt(simd_t a) { return _mm_rsqrt_ps(a); }
+static const char* simd_name = "SSE";
+
+#else
+
+#define SIMD_WIDTH 1
+typedef float simd_t;
+static inline simd_t simd_set1(float v) { return v; }
+static inline simd_t simd_load(const float* p) { return *p; }
+static inline void simd_store(float* p, simd_t v) { *p = v; }
+static inline simd_t simd_add(simd_t a, simd_t b) { return a + b; }
+static inline simd_t simd_sub(simd_t a, simd_t b) { return a - b; }
+static inline simd_t simd_mul(simd_t a, simd_t b) { return a * b; }
+static inline simd_t simd_fmadd(simd_t a, simd_t b, simd_t c) { return a * b + c; }
+static inline simd_t simd_max(simd_t a, simd_t b) { return a > b ? a : b; }
+static inline simd_t simd_rsqrt(simd_t a) { return 1.0f / sqrtf(a); }
+static const char* simd_name = "scalar";
+
+#endif
+
+
+/**
+ * @brief Сумма элементов вектора.
+ */
+static inline float simd_hsum(simd_t v)
+{
+#if SIMD_WIDTH > 1
+    alignas(CPU_ENGINE_ALIGNMENT) float lanes[SIMD_WIDTH];
+    simd_store(lanes, v);
+    float sum = 0.0f;
+    for(int k = 0; k < SIMD_WIDTH; k ++) sum += lanes[k];
+    return sum;
+#else
+    return v;
+#endif
+}
+
+
+/**
+ * @brief Обратный квадратный корень с уточнением
+ * одной итерацией метода Ньютона.
+ */
+static inline simd_t simd_rsqrt_nr(simd_t a)
+{
+#if SIMD_WIDTH > 1
+    simd_t y = simd_rsqrt(a);
+    // y = y * (1.5 - 0.5 * a * y * y).
+    simd_t ayy = simd_mul(simd_mul(a, y), y);
+    return simd_mul(y, simd_sub(simd_set1(1.5f), simd_mul(simd_set1(0.5f), ayy)));
+#else
+    return simd_rsqrt(a);
+#endif
+}
+
+
+/**
+ * @brief Вычисляет ускорения блока тел от всех источников.
+ * @param src Тела - источники и цели.
+ * @param acc_x Ускорения по оси x.
+ * @param acc_y Ускорения по оси y.
+ * @param acc_z Ускорения по оси z.
+ * @param block Индекс блока.
+ */
+static void computeBlock(const CpuEngineSources& src,
+                         float* acc_x, float* acc_y, float* acc_z, size_t block)
+{
+    size_t begin = block * CPU_ENGINE_BLOCK;
+    size_t end = begin + CPU_ENGINE_BLOCK;
+
+    const simd_t eps2 = simd_set1(CPU_ENGINE_R2_MIN);
+
+    // Обнулим ускорения блока.
+    memset(acc_x + begin, 0x0, CPU_ENGINE_BLOCK * sizeof(float));
+    memset(acc_y + begin, 0x0, CPU_ENGINE_BLOCK * sizeof(float));
+    memset(acc_z + begin, 0x0, CPU_ENGINE_BLOCK * sizeof(float));
+
+    // Плитка источников остаётся в кэше,
+    // пока её перебирают все тела блока.
+    for(size_t tile = 0; tile < src.count; tile += CPU_ENGINE_TILE){
+        size_t tile_end = std::min(tile + CPU_ENGINE_TILE, src.count);
+
+        for(size_t i = begin; i < end; i += SIMD_WIDTH){
+            simd_t xi = simd_load(src.x + i);
+            simd_t yi = simd_load(src.y + i);
+            simd_t zi = simd_load(src.z + i);
+
+            simd_t ax = simd_load(acc_x + i);
+            simd_t ay = simd_load(acc_y + i);
+            simd_t az = simd_load(acc_z + i);
+
+            for(size_t j = tile; j < tile_end; j ++){
+                simd_t dx = simd_sub(simd_set1(src.x[j]), xi);
+                simd_t dy = simd_sub(simd_set1(src.y[j]), yi);
+                simd_t dz = simd_sub(simd_set1(src.z[j]), zi);
+
+                simd_t r2 = simd_fmadd(dx, dx, simd_fmadd(dy, dy, simd_mul(dz, dz)));
+                // Предотвратим уход ускорения в бесконечность.
+                // Для самого тела вектор нулевой - вклада нет.
+                r2 = simd_max(r2, eps2);
+
+                simd_t inv_r = simd_rsqrt_nr(r2);
+                simd_t s = simd_mul(simd_set1(src.mass[j]), simd_mul(inv_r, simd_mul(inv_r, inv_r)));
+
+                ax = simd_fmadd(dx, s, ax);
+                ay = simd_fmadd(dy, s, ay);
+                az = simd_fmadd(dz, s, az);
+            }
+
+            simd_store(acc_x + i, ax);
+            simd_store(acc_y + i, ay);
+            simd_store(acc_z + i, az);
+        }
+    }
+}
+
+
+/**
+ * @brief Вычисляет взаимодействие пары блоков тел
+ * по третьему закону Ньютона.
+ * @param src Тела.
+ * @param block_i Индекс первого блока.
+ * @param block_j Индекс второго блока, не меньше первого.
+ * @param ax Ускорения по оси x.
+ * @param ay Ускорения по оси y.
+ * @param az Ускорения по оси z.
+ */
+static void computePairBlocks(const CpuEngineSources& src, size_t block_i, size_t block_j,
+                              float* ax, float* ay, float* az)
+{
+    size_t begin_i = block_i * CPU_ENGINE_BLOCK;
+    size_t end_i = begin_i + CPU_ENGINE_BLOCK;
+    size_t begin_j = block_j * CPU_ENGINE_BLOCK;
+    size_t end_j = begin_j + CPU_ENGINE_BLOCK;
+
+    const simd_t eps2 = simd_set1(CPU_ENGINE_R2_MIN);
+
+    // Внутри блока - каждое тело со всеми,
+    // вклад самого тела нулевой.
+    if(block_i == block_j){
+        for(size_t i = begin_i; i < end_i; i += SIMD_WIDTH){
+            simd_t xi = simd_load(src.x + i);
+            simd_t yi = simd_load(src.y + i);
+            simd_t zi = simd_load(src.z + i);
+
+            simd_t axi = simd_load(ax + i);
+            simd_t ayi = simd_load(ay + i);
+            simd_t azi = simd_load(az + i);
+
+            for(size_t j = begin_j; j < end_j; j ++){
+                simd_t dx = simd_sub(simd_set1(src.x[j]), xi);
+                simd_t dy = simd_sub(simd_set1(src.y[j]), yi);
+                simd_t dz = simd_sub(simd_set1(src.z[j]), zi);
+
+                simd_t r2 = simd_max(simd_fmadd(dx, dx, simd_fmadd(dy, dy, simd_mul(dz, dz))), eps2);
+
+                simd_t inv_r = simd_rsqrt_nr(r2);
+                simd_t s = simd_mul(simd_set1(src.mass[j]), simd_mul(inv_r, simd_mul(inv_r, inv_r)));
+
+                axi = simd_fmadd(dx, s, axi);
+                ayi = simd_fmadd(dy, s, ayi);
+                azi = simd_fmadd(dz, s, azi);
+            }
+
+            simd_store(ax + i, axi);
+            simd_store(ay + i, ayi);
+            simd_store(az + i, azi);
+        }
+        return;
+    }
+
+    // Разные блоки - ускорения тел блока i накапливаются в буфере,
+    // противоположные им ускорения тела j - в векторе.
+    for(size_t j = begin_j; j < end_j; j ++){
+        simd_t xj = simd_set1(src.x[j]);
+        simd_t yj = simd_set1(src.y[j]);
+        simd_t zj = simd_set1(src.z[j]);
+        simd_t mj = simd_set1(src.mass[j]);
+
+        simd_t axj = simd_set1(0.0f);
+        simd_t ayj = simd_set1(0.0f);
+        simd_t azj = simd_set1(0.0f);
+
+        for(size_t i = begin_i; i < end_i; i += SIMD_WIDTH){
+            simd_t dx = simd_sub(xj, simd_load(src.x + i));
+            simd_t dy = simd_sub(yj, simd_load(src.y + i));
+            simd_t dz = simd_sub(zj, simd_load(src.z + i));
+
+            simd_t r2 = simd_max(simd_fmadd(dx, dx, simd_fmadd(dy, dy, simd_mul(dz, dz))), eps2);
+
+            simd_t inv_r = simd_rsqrt_nr(r2);
+            simd_t inv_r3 = simd_mul(inv_r, simd_mul(inv_r, inv_r));
+
+            // Ускорения тел блока i к телу j.
+            simd_t si = simd_mul(mj, inv_r3);
+            simd_store(ax + i, simd_fmadd(dx, si, simd_load(ax + i)));
+            simd_store(ay + i, simd_fmadd(dy, si, simd_load(ay + i)));
+            simd_store(az + i, simd_fmadd(dz, si, simd_load(az + i)));
+
+            // Ускорение тела j к телам блока i.
+            simd_t sj = simd_mul(simd_load(src.mass + i), inv_r3);
+            axj = simd_fmadd(dx, sj, axj);
+            ayj = simd_fmadd(dy, sj, ayj);
+            azj = simd_fmadd(dz, sj, azj);
+        }
+
+        ax[j] -= simd_hsum(axj);
+        ay[j] -= simd_hsum(ayj);
+        az[j] -= simd_hsum(azj);
+    }
+}
+
+
+/**
+ * @brief Суммирует блок массивов, расположенных с постоянным шагом.
+ * @param arrays Первый массив.
+ * @param stride Шаг между массивами.
+ * @param count Число массивов.
+ * @param sum Результат - сумма.
+ * @param block Индекс блока.
+ */
+static void reduceBlock(const float* arrays, size_t stride, size_t count, float* sum, size_t block)
+{
+    size_t begin = block * CPU_ENGINE_BLOCK;
+    size_t end = begin + CPU_ENGINE_BLOCK;
+
+    for(size_t i = begin; i < end; i += SIMD_WIDTH){
+        simd_t s = simd_load(arrays + i);
+        for(size_t k = 1; k < count; k ++){
+            s = simd_add(s, simd_load(arrays + k * stride + i));
+        }
+        simd_store(sum + i, s);
+    }
+}
+
+
+/**
+ * @brief Ядра набора инструкций.
+ */
+static const CpuEngineKernels kernels = {
+    simd_name,
+    computeBlock,
+    computePairBlocks,
+    reduceBlock
+};
+
+} // namespace CPU_ENGINE_NAMESPACE
+
+
+#undef SIMD_WIDTH
+
+#if defined(CPU_ENGINE_TARGET)
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#undef CPU_ENGINE_TARGET
+#endif
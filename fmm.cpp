@@ -0,0 +1,722 @@
+#include "fmm.h"
+#include <QThread>
+#include <QtConcurrentMap>
+#include <math.h>
+
+
+//! Порядок разложения по-умолчанию.
+#define FMM_ORDER_DEFAULT 4
+//! Параметр точности по-умолчанию.
+#define FMM_THETA_DEFAULT 0.5f
+//! Число задач на поток.
+#define FMM_TASKS_PER_THREAD 8
+//! Минимальное расстояние между телами.
+#define FMM_RADIUS_EPSILON 1e-18
+
+
+/**
+ * @brief Задача восходящего прохода по поддереву.
+ */
+struct FmmUpwardTask
+{
+    typedef void result_type;
+
+    FmmUpwardTask(Fmm* f) : fmm(f) {}
+
+    void operator()(const qint32& task) const
+    {
+        qint32 root = fmm->task_roots.at(task);
+        fmm->upward(root, fmm->subtreeEnd(root));
+    }
+
+    Fmm* fmm;
+};
+
+/**
+ * @brief Задача обхода и нисходящего прохода по поддереву.
+ */
+struct FmmTraverseTask
+{
+    typedef void result_type;
+
+    FmmTraverseTask(Fmm* f) : fmm(f) {}
+
+    void operator()(const qint32& task) const
+    {
+        fmm->processTask(task);
+    }
+
+    Fmm* fmm;
+};
+
+/**
+ * @brief Задача вычисления ускорений тел листа.
+ */
+struct FmmEvaluateTask
+{
+    typedef void result_type;
+
+    FmmEvaluateTask(const Fmm* f, float* acc) : fmm(f), accelerations(acc) {}
+
+    void operator()(const qint32& leaf) const
+    {
+        fmm->evaluateLeaf(leaf, accelerations);
+    }
+
+    const Fmm* fmm;
+    float* accelerations;
+};
+
+
+/**
+ * @brief Биномиальный коэффициент.
+ */
+static double binomial(int n, int k)
+{
+    double res = 1.0;
+    for(int i = 1; i <= k; i ++){
+        res = res * (n - k + i) / i;
+    }
+    return res;
+}
+
+
+Fmm::Fmm()
+{
+    fmm_order = FMM_ORDER_DEFAULT;
+    fmm_theta = FMM_THETA_DEFAULT;
+    terms_count = 0;
+    body_positions = nullptr;
+    body_masses = nullptr;
+
+    buildTables();
+}
+
+Fmm::~Fmm()
+{
+}
+
+size_t Fmm::order() const
+{
+    return fmm_order;
+}
+
+void Fmm::setOrder(size_t p)
+{
+    if(p < 1) p = 1;
+    if(p > FMM_ORDER_MAX) p = FMM_ORDER_MAX;
+    if(p == fmm_order) return;
+
+    fmm_order = p;
+    buildTables();
+}
+
+float Fmm::theta() const
+{
+    return fmm_theta;
+}
+
+void Fmm::setTheta(float t)
+{
+    fmm_theta = t;
+}
+
+size_t Fmm::termsCount() const
+{
+    return terms_count;
+}
+
+/**
+ * @brief Строит дерево, разложения и списки ближних листьев.
+ * @param positions Позиции тел (x, y, z).
+ * @param masses Массы тел.
+ * @param count Число тел.
+ * @return true в случае успеха, иначе false.
+ */
+bool Fmm::build(const float *positions, const float *masses, size_t count)
+{
+    // Построим дерево.
+    if(!tree.build(positions, masses, count)) return false;
+
+    body_positions = positions;
+    body_masses = masses;
+
+    const QVector<Octree::Node>& nodes = tree.nodes();
+    const QVector<qint32>& indices = tree.indices();
+    size_t nodes_count = nodes.size();
+
+    // Подготовим разложения.
+    multipoles.fill(0.0, nodes_count * terms_count);
+    locals.fill(0.0, nodes_count * terms_count);
+    radii.fill(0.0, nodes_count);
+
+    // Пронумеруем листья.
+    node_leaf.fill(-1, nodes_count);
+    leaves_list.clear();
+    leaf_of.resize(indices.size());
+
+    for(size_t i = 0; i < nodes_count; i ++){
+        const Octree::Node& node = nodes.at(i);
+        if(node.child >= 0) continue;
+
+        Leaf leaf;
+        leaf.center[0] = node.com[0];
+        leaf.center[1] = node.com[1];
+        leaf.center[2] = node.com[2];
+        leaf.center[3] = 0.0f;
+        leaf.first = node.first;
+        leaf.count = -node.child;
+        leaf.near_begin = 0;
+        leaf.near_end = 0;
+
+        node_leaf[i] = leaves_list.size();
+        for(qint32 j = 0; j < leaf.count; j ++){
+            leaf_of[leaf.first + j] = leaves_list.size();
+        }
+        leaves_list.append(leaf);
+    }
+
+    near_lists.resize(leaves_list.size());
+    for(int i = 0; i < near_lists.size(); i ++){
+        near_lists[i].clear();
+    }
+
+    // Разобьём дерево на поддеревья.
+    selectTasks();
+
+    QVector<qint32> tasks(task_roots.size());
+    for(int i = 0; i < tasks.size(); i ++) tasks[i] = i;
+
+    // Восходящий проход по поддеревьям.
+    QtConcurrent::blockingMap(tasks, FmmUpwardTask(this));
+
+    // Восходящий проход по вершине дерева.
+    for(int i = top_nodes.size() - 1; i >= 0; i --){
+        upwardNode(top_nodes.at(i));
+    }
+
+    // Обход и нисходящий проход.
+    QtConcurrent::blockingMap(tasks, FmmTraverseTask(this));
+
+    // Соберём списки ближних листьев и разложения листьев.
+    near_list.clear();
+    leaf_locals.resize(leaves_list.size() * terms_count);
+
+    for(int i = 0; i < leaves_list.size(); i ++){
+        Leaf& leaf = leaves_list[i];
+        leaf.near_begin = near_list.size();
+        near_list += near_lists.at(i);
+        leaf.near_end = near_list.size();
+    }
+
+    for(size_t i = 0; i < nodes_count; i ++){
+        qint32 leaf = node_leaf.at(i);
+        if(leaf < 0) continue;
+        for(size_t k = 0; k < terms_count; k ++){
+            leaf_locals[leaf * terms_count + k] = static_cast<float>(locals.at(i * terms_count + k));
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Вычисляет ускорения тел на хосте.
+ * @param accelerations Результат - ускорения (x, y, z).
+ * @return true в случае успеха, иначе false.
+ */
+bool Fmm::evaluate(float *accelerations) const
+{
+    if(leaves_list.isEmpty() || accelerations == nullptr) return false;
+
+    QVector<qint32> leaves_ids(leaves_list.size());
+    for(int i = 0; i < leaves_ids.size(); i ++) leaves_ids[i] = i;
+
+    QtConcurrent::blockingMap(leaves_ids, FmmEvaluateTask(this, accelerations));
+
+    return true;
+}
+
+const QVector<qint32> &Fmm::indices() const
+{
+    return tree.indices();
+}
+
+const QVector<Fmm::Leaf> &Fmm::leaves() const
+{
+    return leaves_list;
+}
+
+const QVector<qint32> &Fmm::leafOf() const
+{
+    return leaf_of;
+}
+
+const QVector<qint32> &Fmm::nearLeaves() const
+{
+    return near_list;
+}
+
+const QVector<float> &Fmm::leafLocals() const
+{
+    return leaf_locals;
+}
+
+const QVector<qint32> &Fmm::exponents() const
+{
+    return term_exps;
+}
+
+void Fmm::deviceTables(QVector<qint32> &offsets, QVector<DeviceTerm> &terms) const
+{
+    const QVector<QVector<Term> >* tables[] = {&m2m_terms, &m2l_terms, &l2l_terms};
+
+    offsets.clear();
+    terms.clear();
+
+    for(size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i ++){
+        for(size_t k = 0; k < terms_count; k ++){
+            offsets.append(terms.size());
+
+            const QVector<Term>& table = tables[i]->at(k);
+            for(int t = 0; t < table.size(); t ++){
+                DeviceTerm term;
+                term.src = table.at(t).src;
+                term.aux = table.at(t).aux;
+                term.coef = static_cast<float>(table.at(t).coef);
+                terms.append(term);
+            }
+        }
+        offsets.append(terms.size());
+    }
+}
+
+void Fmm::deviceRecurrence(QVector<qint32> &indices) const
+{
+    indices.fill(-1, terms_count * 8);
+
+    for(size_t i = 0; i < terms_count; i ++){
+        int e[3] = {term_exps.at(i * 4), term_exps.at(i * 4 + 1), term_exps.at(i * 4 + 2)};
+
+        indices[i * 8] = e[0] + e[1] + e[2];
+        indices[i * 8 + 7] = 0;
+
+        for(int k = 0; k < 3; k ++){
+            if(e[k] >= 1){
+                e[k] -= 1;
+                indices[i * 8 + 1 + k] = termIndex(e[0], e[1], e[2]);
+                if(e[k] >= 1){
+                    e[k] -= 1;
+                    indices[i * 8 + 4 + k] = termIndex(e[0], e[1], e[2]);
+                    e[k] += 1;
+                }
+                e[k] += 1;
+            }
+        }
+    }
+}
+
+void Fmm::buildTables()
+{
+    int p = static_cast<int>(fmm_order);
+
+    // Перечислим члены по возрастанию степени.
+    term_exps.clear();
+    term_index.fill(-1, (p + 1) * (p + 1) * (p + 1));
+
+    for(int t = 0; t <= p; t ++){
+        for(int a = t; a >= 0; a --){
+            for(int b = t - a; b >= 0; b --){
+                int c = t - a - b;
+                term_index[(a * (p + 1) + b) * (p + 1) + c] = term_exps.size() / 4;
+                term_exps << a << b << c << 0;
+            }
+        }
+    }
+
+    terms_count = term_exps.size() / 4;
+
+    m2m_terms.resize(terms_count);
+    m2l_terms.resize(terms_count);
+    l2l_terms.resize(terms_count);
+
+    for(size_t i = 0; i < terms_count; i ++){
+        int a = term_exps.at(i * 4);
+        int b = term_exps.at(i * 4 + 1);
+        int c = term_exps.at(i * 4 + 2);
+
+        m2m_terms[i].clear();
+        m2l_terms[i].clear();
+        l2l_terms[i].clear();
+
+        for(size_t j = 0; j < terms_count; j ++){
+            int ja = term_exps.at(j * 4);
+            int jb = term_exps.at(j * 4 + 1);
+            int jc = term_exps.at(j * 4 + 2);
+
+            Term term;
+
+            // M2M: M(k) += C(k, j) M(j) d^(k - j).
+            if(ja <= a && jb <= b && jc <= c){
+                term.src = j;
+                term.aux = termIndex(a - ja, b - jb, c - jc);
+                term.coef = binomial(a, ja) * binomial(b, jb) * binomial(c, jc);
+                m2m_terms[i].append(term);
+            }
+
+            // M2L: L(n) += (-1)^|k| C(n + k, k) M(k) T(n + k).
+            if(a + b + c + ja + jb + jc <= p){
+                term.src = j;
+                term.aux = termIndex(a + ja, b + jb, c + jc);
+                term.coef = binomial(a + ja, ja) * binomial(b + jb, jb) * binomial(c + jc, jc);
+                if((ja + jb + jc) & 1) term.coef = -term.coef;
+                m2l_terms[i].append(term);
+            }
+
+            // L2L: L'(j) += C(n, j) L(n) d^(n - j).
+            if(ja >= a && jb >= b && jc >= c){
+                term.src = j;
+                term.aux = termIndex(ja - a, jb - b, jc - c);
+                term.coef = binomial(ja, a) * binomial(jb, b) * binomial(jc, c);
+                l2l_terms[i].append(term);
+            }
+        }
+    }
+}
+
+qint32 Fmm::termIndex(int a, int b, int c) const
+{
+    int p1 = static_cast<int>(fmm_order) + 1;
+    return term_index.at((a * p1 + b) * p1 + c);
+}
+
+void Fmm::monomials(const double *d, double *powers) const
+{
+    double px[FMM_ORDER_MAX + 1];
+    double py[FMM_ORDER_MAX + 1];
+    double pz[FMM_ORDER_MAX + 1];
+
+    px[0] = py[0] = pz[0] = 1.0;
+    for(size_t i = 1; i <= fmm_order; i ++){
+        px[i] = px[i - 1] * d[0];
+        py[i] = py[i - 1] * d[1];
+        pz[i] = pz[i - 1] * d[2];
+    }
+
+    for(size_t i = 0; i < terms_count; i ++){
+        powers[i] = px[term_exps.at(i * 4)] * py[term_exps.at(i * 4 + 1)] * pz[term_exps.at(i * 4 + 2)];
+    }
+}
+
+/**
+ * @brief Вычисляет коэффициенты Тейлора 1/|r| в точке.
+ * Используется рекуррентное соотношение
+ * |k| r^2 T(k) + (2|k| - 1) sum r_i T(k - e_i) + (|k| - 1) sum T(k - 2e_i) = 0.
+ * @param r Вектор.
+ * @param coefs Результат.
+ */
+void Fmm::derivatives(const double *r, double *coefs) const
+{
+    double r2 = r[0] * r[0] + r[1] * r[1] + r[2] * r[2];
+
+    coefs[0] = 1.0 / sqrt(r2);
+
+    for(size_t i = 1; i < terms_count; i ++){
+        int e[3] = {term_exps.at(i * 4), term_exps.at(i * 4 + 1), term_exps.at(i * 4 + 2)};
+        int n = e[0] + e[1] + e[2];
+
+        double sum1 = 0.0;
+        double sum2 = 0.0;
+
+        for(int k = 0; k < 3; k ++){
+            if(e[k] >= 1){
+                e[k] -= 1;
+                sum1 += r[k] * coefs[termIndex(e[0], e[1], e[2])];
+                if(e[k] >= 1){
+                    e[k] -= 1;
+                    sum2 += coefs[termIndex(e[0], e[1], e[2])];
+                    e[k] += 1;
+                }
+                e[k] += 1;
+            }
+        }
+
+        coefs[i] = -((2 * n - 1) * sum1 + (n - 1) * sum2) / (n * r2);
+    }
+}
+
+void Fmm::selectTasks()
+{
+    const QVector<Octree::Node>& nodes = tree.nodes();
+
+    int target = qMax(1, QThread::idealThreadCount()) * FMM_TASKS_PER_THREAD;
+
+    top_nodes.clear();
+    task_roots.clear();
+    task_roots.append(0);
+
+    // Раскрываем внутренние узлы по уровням,
+    // пока задач не станет достаточно.
+    while(task_roots.size() < target){
+        QVector<qint32> next_roots;
+        bool expanded = false;
+
+        for(int i = 0; i < task_roots.size(); i ++){
+            qint32 node = task_roots.at(i);
+            if(nodes.at(node).child < 0){
+                next_roots.append(node);
+                continue;
+            }
+            top_nodes.append(node);
+            expanded = true;
+
+            qint32 end = subtreeEnd(node);
+            for(qint32 c = nodes.at(node).child; c < end; c = subtreeEnd(c)){
+                next_roots.append(c);
+            }
+        }
+
+        task_roots = next_roots;
+
+        if(!expanded) break;
+    }
+}
+
+void Fmm::upward(qint32 root, qint32 end)
+{
+    // Потомки следуют за родителем, поэтому
+    // обратный порядок обрабатывает их раньше.
+    for(qint32 i = end - 1; i >= root; i --){
+        upwardNode(i);
+    }
+}
+
+void Fmm::upwardNode(qint32 node)
+{
+    const QVector<Octree::Node>& nodes = tree.nodes();
+    const Octree::Node& n = nodes.at(node);
+
+    double powers[(FMM_ORDER_MAX + 1) * (FMM_ORDER_MAX + 2) * (FMM_ORDER_MAX + 3) / 6];
+    double* m = multipoles.data() + node * terms_count;
+    double d[3];
+    double radius = 0.0;
+
+    // Лист - мультиполь по телам (P2M).
+    if(n.child < 0){
+        const QVector<qint32>& indices = tree.indices();
+        for(qint32 i = n.first; i < n.first - n.child; i ++){
+            qint32 body = indices.at(i);
+            const float* p = body_positions + body * 3;
+            double mass = body_masses[body];
+
+            d[0] = p[0] - n.com[0];
+            d[1] = p[1] - n.com[1];
+            d[2] = p[2] - n.com[2];
+
+            radius = qMax(radius, sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+
+            monomials(d, powers);
+            for(size_t k = 0; k < terms_count; k ++){
+                m[k] += mass * powers[k];
+            }
+        }
+    }else{
+        // Внутренний узел - перенос мультиполей потомков (M2M).
+        qint32 end = subtreeEnd(node);
+        for(qint32 c = n.child; c < end; c = subtreeEnd(c)){
+            const Octree::Node& cn = nodes.at(c);
+            const double* mc = multipoles.constData() + c * terms_count;
+
+            d[0] = cn.com[0] - n.com[0];
+            d[1] = cn.com[1] - n.com[1];
+            d[2] = cn.com[2] - n.com[2];
+
+            radius = qMax(radius, sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) + radii.at(c));
+
+            monomials(d, powers);
+            for(size_t k = 0; k < terms_count; k ++){
+                const QVector<Term>& terms = m2m_terms.at(k);
+                double sum = 0.0;
+                for(int t = 0; t < terms.size(); t ++){
+                    const Term& term = terms.at(t);
+                    sum += term.coef * mc[term.src] * powers[term.aux];
+                }
+                m[k] += sum;
+            }
+        }
+    }
+
+    radii[node] = radius;
+}
+
+void Fmm::processTask(qint32 task)
+{
+    qint32 root = task_roots.at(task);
+
+    // Вычислим локальные разложения поддерева.
+    interact(root, 0);
+
+    // Перенесём их в листья.
+    downward(root, subtreeEnd(root));
+}
+
+void Fmm::interact(qint32 target, qint32 source)
+{
+    const QVector<Octree::Node>& nodes = tree.nodes();
+    const Octree::Node& a = nodes.at(target);
+    const Octree::Node& b = nodes.at(source);
+
+    // Источник без массы не влияет.
+    if(b.com[3] == 0.0f) return;
+
+    double r[3] = {static_cast<double>(a.com[0]) - b.com[0],
+                   static_cast<double>(a.com[1]) - b.com[1],
+                   static_cast<double>(a.com[2]) - b.com[2]};
+    double dist = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    double ra = radii.at(target);
+    double rb = radii.at(source);
+
+    // Если ячейки достаточно далеко - M2L.
+    if(ra + rb < fmm_theta * dist){
+        double coefs[(FMM_ORDER_MAX + 1) * (FMM_ORDER_MAX + 2) * (FMM_ORDER_MAX + 3) / 6];
+        const double* m = multipoles.constData() + source * terms_count;
+        double* l = locals.data() + target * terms_count;
+
+        derivatives(r, coefs);
+
+        for(size_t k = 0; k < terms_count; k ++){
+            const QVector<Term>& terms = m2l_terms.at(k);
+            double sum = 0.0;
+            for(int t = 0; t < terms.size(); t ++){
+                const Term& term = terms.at(t);
+                sum += term.coef * m[term.src] * coefs[term.aux];
+            }
+            l[k] += sum;
+        }
+        return;
+    }
+
+    bool a_leaf = a.child < 0;
+    bool b_leaf = b.child < 0;
+
+    // Два листа - прямой расчёт.
+    if(a_leaf && b_leaf){
+        near_lists[node_leaf.at(target)].append(node_leaf.at(source));
+        return;
+    }
+
+    // Раскроем больший узел.
+    if(!a_leaf && (b_leaf || ra >= rb)){
+        qint32 end = subtreeEnd(target);
+        for(qint32 c = a.child; c < end; c = subtreeEnd(c)){
+            interact(c, source);
+        }
+    }else{
+        qint32 end = subtreeEnd(source);
+        for(qint32 c = b.child; c < end; c = subtreeEnd(c)){
+            interact(target, c);
+        }
+    }
+}
+
+void Fmm::downward(qint32 root, qint32 end)
+{
+    const QVector<Octree::Node>& nodes = tree.nodes();
+
+    double powers[(FMM_ORDER_MAX + 1) * (FMM_ORDER_MAX + 2) * (FMM_ORDER_MAX + 3) / 6];
+    double d[3];
+
+    // Родитель предшествует потомкам.
+    for(qint32 node = root; node < end; node ++){
+        const Octree::Node& n = nodes.at(node);
+        if(n.child < 0) continue;
+
+        const double* l = locals.constData() + node * terms_count;
+
+        qint32 node_end = subtreeEnd(node);
+        for(qint32 c = n.child; c < node_end; c = subtreeEnd(c)){
+            const Octree::Node& cn = nodes.at(c);
+            double* lc = locals.data() + c * terms_count;
+
+            d[0] = cn.com[0] - n.com[0];
+            d[1] = cn.com[1] - n.com[1];
+            d[2] = cn.com[2] - n.com[2];
+
+            monomials(d, powers);
+            for(size_t k = 0; k < terms_count; k ++){
+                const QVector<Term>& terms = l2l_terms.at(k);
+                double sum = 0.0;
+                for(int t = 0; t < terms.size(); t ++){
+                    const Term& term = terms.at(t);
+                    sum += term.coef * l[term.src] * powers[term.aux];
+                }
+                lc[k] += sum;
+            }
+        }
+    }
+}
+
+void Fmm::evaluateLeaf(qint32 leaf, float *accelerations) const
+{
+    const Leaf& lf = leaves_list.at(leaf);
+    const QVector<qint32>& indices = tree.indices();
+    const float* l = leaf_locals.constData() + leaf * terms_count;
+
+    double px[FMM_ORDER_MAX + 1];
+    double py[FMM_ORDER_MAX + 1];
+    double pz[FMM_ORDER_MAX + 1];
+
+    for(qint32 s = lf.first; s < lf.first + lf.count; s ++){
+        qint32 body = indices.at(s);
+        const float* p = body_positions + body * 3;
+
+        double acc[3] = {0.0, 0.0, 0.0};
+
+        // Дальнее поле - градиент локального разложения (L2P).
+        px[0] = py[0] = pz[0] = 1.0;
+        for(size_t i = 1; i <= fmm_order; i ++){
+            px[i] = px[i - 1] * (p[0] - lf.center[0]);
+            py[i] = py[i - 1] * (p[1] - lf.center[1]);
+            pz[i] = pz[i - 1] * (p[2] - lf.center[2]);
+        }
+        for(size_t k = 1; k < terms_count; k ++){
+            int a = term_exps.at(k * 4);
+            int b = term_exps.at(k * 4 + 1);
+            int c = term_exps.at(k * 4 + 2);
+            if(a > 0) acc[0] += l[k] * a * px[a - 1] * py[b] * pz[c];
+            if(b > 0) acc[1] += l[k] * b * px[a] * py[b - 1] * pz[c];
+            if(c > 0) acc[2] += l[k] * c * px[a] * py[b] * pz[c - 1];
+        }
+
+        // Ближнее поле - прямой расчёт (P2P).
+        for(qint32 q = lf.near_begin; q < lf.near_end; q ++){
+            const Leaf& src = leaves_list.at(near_list.at(q));
+            for(qint32 t = src.first; t < src.first + src.count; t ++){
+                qint32 j = indices.at(t);
+                if(j == body) continue;
+
+                const float* pj = body_positions + j * 3;
+                double d[3] = {static_cast<double>(pj[0]) - p[0],
+                               static_cast<double>(pj[1]) - p[1],
+                               static_cast<double>(pj[2]) - p[2]};
+                double r = sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+                r = qMax(r, FMM_RADIUS_EPSILON);
+                double f = body_masses[j] / (r * r * r);
+
+                acc[0] += d[0] * f;
+                acc[1] += d[1] * f;
+                acc[2] += d[2] * f;
+            }
+        }
+
+        accelerations[body * 3]     = static_cast<float>(acc[0]);
+        accelerations[body * 3 + 1] = static_cast<float>(acc[1]);
+        accelerations[body * 3 + 2] = static_cast<float>(acc[2]);
+    }
+}
+
+qint32 Fmm::subtreeEnd(qint32 node) const
+{
+    qint32 next = tree.nodes().at(node).next;
+    return next < 0 ? tree.nodes().size() : next;
+}
@@ -0,0 +1,377 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <stddef.h>
+#include "octree.h"
+
+
+//! Максимальный порядок разложения.
+#define FMM_ORDER_MAX 8
+
+
+/**
+ * @class Fmm.
+ * @brief Класс быстрого метода мультиполей.
+ * Использует декартовы разложения Тейлора порядка p
+ * с центрами в центрах масс ячеек октодерева.
+ * Восходящий проход строит мультиполи (P2M, M2M),
+ * двойной обход дерева вычисляет локальные разложения (M2L)
+ * и списки ближних листьев, нисходящий проход
+ * переносит разложения в листья (L2L).
+ * Вычисление ускорений (L2P, P2P) выполняется
+ * либо на хосте, либо ядром kernel_fmm на устройстве OpenCL.
+ * Все этапы распараллелены по поддеревьям.
+ * Таблицы членов разложений используются также
+ * построителем FmmBuilder на устройстве.
+ */
+class Fmm
+{
+public:
+
+    /**
+     * @brief Лист дерева.
+     * Расположение полей совпадает
+     * со структурой fmm_leaf_t в nbody.cl.
+     */
+    struct Leaf
+    {
+        float center[4];    //!< Центр разложения (x, y, z) и масштаб (w), 0 - без масштаба.
+        qint32 first;       //!< Индекс первого тела в массиве индексов.
+        qint32 count;       //!< Число тел.
+        qint32 near_begin;  //!< Начало списка ближних листьев.
+        qint32 near_end;    //!< Конец списка ближних листьев.
+    };
+
+    /**
+     * @brief Член свёртки разложений для устройства.
+     * Расположение полей совпадает
+     * со структурой fmm_term_t в nbody.cl.
+     */
+    struct DeviceTerm
+    {
+        qint32 src;     //!< Индекс исходного коэффициента.
+        qint32 aux;     //!< Индекс вспомогательного коэффициента.
+        float coef;     //!< Множитель.
+    };
+
+    /**
+     * @brief Конструктор.
+     */
+    Fmm();
+
+    /**
+     * @brief Деструктор.
+     */
+    ~Fmm();
+
+    /**
+     * @brief Получение порядка разложения.
+     * @return Порядок разложения.
+     */
+    size_t order() const;
+
+    /**
+     * @brief Установка порядка разложения.
+     * @param p Порядок разложения, от 1 до FMM_ORDER_MAX.
+     */
+    void setOrder(size_t p);
+
+    /**
+     * @brief Получение параметра точности.
+     * @return Параметр точности.
+     */
+    float theta() const;
+
+    /**
+     * @brief Установка параметра точности.
+     * Ячейки радиусов ra и rb на расстоянии r
+     * взаимодействуют через разложения при ra + rb < theta * r.
+     * @param t Параметр точности.
+     */
+    void setTheta(float t);
+
+    /**
+     * @brief Получение числа членов разложения.
+     * @return Число членов разложения.
+     */
+    size_t termsCount() const;
+
+    /**
+     * @brief Строит дерево, разложения и списки ближних листьев.
+     * @param positions Позиции тел (x, y, z).
+     * @param masses Массы тел.
+     * @param count Число тел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool build(const float* positions, const float* masses, size_t count);
+
+    /**
+     * @brief Вычисляет ускорения тел на хосте.
+     * Гравитационная постоянная не учитывается.
+     * @param accelerations Результат - ускорения (x, y, z).
+     * @return true в случае успеха, иначе false.
+     */
+    bool evaluate(float* accelerations) const;
+
+    /**
+     * @brief Получение индексов тел в порядке обхода дерева.
+     * @return Индексы тел.
+     */
+    const QVector<qint32>& indices() const;
+
+    /**
+     * @brief Получение листьев.
+     * @return Листья.
+     */
+    const QVector<Leaf>& leaves() const;
+
+    /**
+     * @brief Получение листа для каждого тела
+     * в порядке обхода дерева.
+     * @return Индексы листьев.
+     */
+    const QVector<qint32>& leafOf() const;
+
+    /**
+     * @brief Получение списков ближних листьев.
+     * @return Индексы ближних листьев.
+     */
+    const QVector<qint32>& nearLeaves() const;
+
+    /**
+     * @brief Получение локальных разложений листьев.
+     * @return Коэффициенты, termsCount() на лист.
+     */
+    const QVector<float>& leafLocals() const;
+
+    /**
+     * @brief Получение степеней членов разложения.
+     * @return Степени (x, y, z, 0) для каждого члена.
+     */
+    const QVector<qint32>& exponents() const;
+
+    /**
+     * @brief Получение таблиц членов M2M, M2L и L2L для устройства.
+     * Члены коэффициента k таблицы kind (0 - M2M, 1 - M2L, 2 - L2L)
+     * занимают диапазон [offsets[kind * (T + 1) + k], offsets[kind * (T + 1) + k + 1]),
+     * где T - число членов разложения.
+     * @param offsets Результат - начала диапазонов.
+     * @param terms Результат - члены.
+     */
+    void deviceTables(QVector<qint32>& offsets, QVector<DeviceTerm>& terms) const;
+
+    /**
+     * @brief Получение индексов рекуррентного соотношения
+     * коэффициентов Тейлора 1/|r| для устройства.
+     * @param indices Результат - по 8 чисел на член:
+     * |k|, индексы k - e_x, k - e_y, k - e_z, k - 2e_x, k - 2e_y, k - 2e_z и 0,
+     * -1 для отсутствующих членов.
+     */
+    void deviceRecurrence(QVector<qint32>& indices) const;
+
+private:
+
+    /**
+     * @brief Член свёртки двух разложений.
+     */
+    struct Term
+    {
+        qint32 src; //!< Индекс исходного коэффициента.
+        qint32 aux; //!< Индекс вспомогательного коэффициента.
+        double coef; //!< Множитель.
+    };
+
+    /**
+     * @brief Порядок разложения.
+     */
+    size_t fmm_order;
+
+    /**
+     * @brief Параметр точности.
+     */
+    float fmm_theta;
+
+    /**
+     * @brief Число членов разложения.
+     */
+    size_t terms_count;
+
+    /**
+     * @brief Октодерево.
+     */
+    Octree tree;
+
+    /**
+     * @brief Позиции тел.
+     */
+    const float* body_positions;
+
+    /**
+     * @brief Массы тел.
+     */
+    const float* body_masses;
+
+    /**
+     * @brief Степени членов разложения, по 4 на член.
+     */
+    QVector<qint32> term_exps;
+
+    /**
+     * @brief Индекс члена по степеням, [x][y][z].
+     */
+    QVector<qint32> term_index;
+
+    /**
+     * @brief Члены M2M для каждого коэффициента.
+     */
+    QVector<QVector<Term> > m2m_terms;
+
+    /**
+     * @brief Члены M2L для каждого коэффициента.
+     */
+    QVector<QVector<Term> > m2l_terms;
+
+    /**
+     * @brief Члены L2L для каждого коэффициента.
+     */
+    QVector<QVector<Term> > l2l_terms;
+
+    /**
+     * @brief Мультипольные разложения узлов.
+     */
+    QVector<double> multipoles;
+
+    /**
+     * @brief Локальные разложения узлов.
+     */
+    QVector<double> locals;
+
+    /**
+     * @brief Радиусы узлов относительно центров масс.
+     */
+    QVector<double> radii;
+
+    /**
+     * @brief Индекс листа для каждого узла, либо -1.
+     */
+    QVector<qint32> node_leaf;
+
+    /**
+     * @brief Корни поддеревьев для параллельной обработки.
+     */
+    QVector<qint32> task_roots;
+
+    /**
+     * @brief Узлы выше корней поддеревьев, в порядке обхода в ширину.
+     */
+    QVector<qint32> top_nodes;
+
+    /**
+     * @brief Ближние листья каждого листа.
+     */
+    QVector<QVector<qint32> > near_lists;
+
+    /**
+     * @brief Листья.
+     */
+    QVector<Leaf> leaves_list;
+
+    /**
+     * @brief Лист каждого тела в порядке обхода дерева.
+     */
+    QVector<qint32> leaf_of;
+
+    /**
+     * @brief Списки ближних листьев подряд.
+     */
+    QVector<qint32> near_list;
+
+    /**
+     * @brief Локальные разложения листьев.
+     */
+    QVector<float> leaf_locals;
+
+    /**
+     * @brief Строит таблицы членов разложений.
+     */
+    void buildTables();
+
+    /**
+     * @brief Индекс члена по степеням.
+     */
+    qint32 termIndex(int a, int b, int c) const;
+
+    /**
+     * @brief Вычисляет одночлены d^k для всех членов.
+     * @param d Вектор.
+     * @param powers Результат.
+     */
+    void monomials(const double* d, double* powers) const;
+
+    /**
+     * @brief Вычисляет коэффициенты Тейлора 1/|r| в точке.
+     * @param r Вектор.
+     * @param coefs Результат.
+     */
+    void derivatives(const double* r, double* coefs) const;
+
+    /**
+     * @brief Выбирает корни поддеревьев для параллельной обработки.
+     */
+    void selectTasks();
+
+    /**
+     * @brief Восходящий проход по поддереву.
+     * @param root Корень поддерева.
+     * @param end Индекс за последним узлом поддерева.
+     */
+    void upward(qint32 root, qint32 end);
+
+    /**
+     * @brief Вычисляет разложение узла по потомкам либо телам.
+     * @param node Узел.
+     */
+    void upwardNode(qint32 node);
+
+    /**
+     * @brief Обрабатывает поддерево: обход и нисходящий проход.
+     * @param task Индекс задачи.
+     */
+    void processTask(qint32 task);
+
+    /**
+     * @brief Двойной обход дерева.
+     * @param target Узел-приёмник.
+     * @param source Узел-источник.
+     */
+    void interact(qint32 target, qint32 source);
+
+    /**
+     * @brief Нисходящий проход по поддереву.
+     * @param root Корень поддерева.
+     * @param end Индекс за последним узлом поддерева.
+     */
+    void downward(qint32 root, qint32 end);
+
+    /**
+     * @brief Вычисляет ускорения тел листа.
+     * @param leaf Индекс листа.
+     * @param accelerations Результат - ускорения.
+     */
+    void evaluateLeaf(qint32 leaf, float* accelerations) const;
+
+    /**
+     * @brief Индекс за последним узлом поддерева.
+     * @param node Узел.
+     * @return Индекс.
+     */
+    qint32 subtreeEnd(qint32 node) const;
+
+    friend struct FmmUpwardTask;
+    friend struct FmmTraverseTask;
+    friend struct FmmEvaluateTask;
+};
+
+#endif // FMM_H
@@ -0,0 +1,693 @@
+#include "fmmbuilder.h"
+#include "treebuilder.h"
+#include "log.h"
+#include "clcontext.h"
+#include "cldevice.h"
+#include "clprogram.h"
+#include "clcommandqueue.h"
+#include "clbuffer.h"
+#include "clkernel.h"
+#include "clexception.h"
+#include <algorithm>
+
+
+#define LOG_WHO "FmmBuilder"
+
+//! Наибольшее число тел листа FMM.
+#define FMM_LEAF_CAPACITY 16
+//! Максимальный размер рабочей группы.
+#define FMM_LOCAL_SIZE_MAX 256
+//! Максимальное число групп префиксной суммы.
+#define FMM_SCAN_GROUPS_MAX 1024
+//! Число рабочих элементов прохода обхода на вычислительный блок.
+#define FMM_TRAVERSE_ITEMS_PER_UNIT 1024
+//! Максимальное число проходов двойного обхода.
+#define FMM_PASSES_MAX 256
+//! Число проходов обхода между чтениями счётчиков.
+#define FMM_PASSES_PER_CHECK 8
+//! Максимальное число повторов обхода при переполнении списков.
+#define FMM_RESTARTS_MAX 16
+//! Начальные размеры списков на слот.
+#define FMM_PAIRS_PER_SLOT 32
+#define FMM_M2L_PER_SLOT 128
+#define FMM_NEAR_PER_SLOT 64
+//! Минимальный размер списков.
+#define FMM_LIST_MIN 1024
+
+//! Счётчики двойного обхода, совпадают с nbody.cl.
+#define FMM_COUNTER_OVERFLOW 0
+#define FMM_COUNTER_M2L 1
+#define FMM_COUNTER_NEAR 2
+#define FMM_COUNTER_PASSES 3
+
+//! Флаги переполнения списков, совпадают с nbody.cl.
+#define FMM_OVERFLOW_PAIRS 1
+#define FMM_OVERFLOW_M2L 2
+#define FMM_OVERFLOW_NEAR 4
+
+
+//! Начальная пара обхода - (корень, корень).
+static const qint32 fmm_root_pair[2] = {0, 0};
+
+
+FmmBuilder::FmmBuilder(QObject *parent) :
+    QObject(parent)
+{
+    is_valid = false;
+    context = nullptr;
+    bodies_count = 0;
+    local_size = 0;
+    traverse_size = 0;
+    tables_order = 0;
+    terms_count = 0;
+    slots_capacity = 0;
+    pairs_capacity = 0;
+    m2l_capacity = 0;
+    near_capacity = 0;
+
+    kernel_weights = new CLKernel();
+    kernel_scan_blocks = new CLKernel();
+    kernel_scan = new CLKernel();
+    kernel_scan_add = new CLKernel();
+    kernel_assign = new CLKernel();
+    kernel_upward = new CLKernel();
+    kernel_reset = new CLKernel();
+    kernel_traverse = new CLKernel();
+    kernel_group = new CLKernel();
+    kernel_m2l = new CLKernel();
+    kernel_downward = new CLKernel();
+
+    weights_buf = new CLBuffer();
+    block_sums_buf = new CLBuffer();
+    slot_of_buf = new CLBuffer();
+    leaf_of_buf = new CLBuffer();
+    counters_buf = new CLBuffer();
+    exps_buf = new CLBuffer();
+    recurrence_buf = new CLBuffer();
+    table_offsets_buf = new CLBuffer();
+    table_buf = new CLBuffer();
+    slot_node_buf = new CLBuffer();
+    flags_buf = new CLBuffer();
+    radii_buf = new CLBuffer();
+    multipoles_buf = new CLBuffer();
+    locals_buf = new CLBuffer();
+    leaves_buf = new CLBuffer();
+    m2l_offsets_buf = new CLBuffer();
+    near_offsets_buf = new CLBuffer();
+    for(size_t i = 0; i < 2; i ++){
+        pairs_buf[i] = new CLBuffer();
+    }
+    m2l_pairs_buf = new CLBuffer();
+    m2l_sources_buf = new CLBuffer();
+    near_pairs_buf = new CLBuffer();
+    near_buf = new CLBuffer();
+}
+
+FmmBuilder::~FmmBuilder()
+{
+    destroy();
+
+    delete kernel_weights;
+    delete kernel_scan_blocks;
+    delete kernel_scan;
+    delete kernel_scan_add;
+    delete kernel_assign;
+    delete kernel_upward;
+    delete kernel_reset;
+    delete kernel_traverse;
+    delete kernel_group;
+    delete kernel_m2l;
+    delete kernel_downward;
+
+    delete weights_buf;
+    delete block_sums_buf;
+    delete slot_of_buf;
+    delete leaf_of_buf;
+    delete counters_buf;
+    delete exps_buf;
+    delete recurrence_buf;
+    delete table_offsets_buf;
+    delete table_buf;
+    delete slot_node_buf;
+    delete flags_buf;
+    delete radii_buf;
+    delete multipoles_buf;
+    delete locals_buf;
+    delete leaves_buf;
+    delete m2l_offsets_buf;
+    delete near_offsets_buf;
+    for(size_t i = 0; i < 2; i ++){
+        delete pairs_buf[i];
+    }
+    delete m2l_pairs_buf;
+    delete m2l_sources_buf;
+    delete near_pairs_buf;
+    delete near_buf;
+}
+
+/**
+ * @brief Создаёт ядра и буферы построения разложений.
+ * Буферы слотов и списков создаются при построении
+ * по мере надобности.
+ * @param cxt Контекст OpenCL.
+ * @param device Устройство OpenCL.
+ * @param program Скомпилированная программа OpenCL.
+ * @param bodies Максимальное число тел.
+ * @return true в случае успеха, иначе false.
+ */
+bool FmmBuilder::create(const CLContext &cxt, const CLDevice &device, const CLProgram &program,
+                        size_t bodies)
+{
+    // Уничтожим ранее созданное.
+    destroy();
+
+    if(bodies <= FMM_LEAF_CAPACITY) return false;
+
+    context = &cxt;
+    bodies_count = bodies;
+
+    try{
+        // Создадим ядра.
+        kernel_weights->create(program, "kernel_fmm_weights");
+        kernel_scan_blocks->create(program, "kernel_scan_blocks");
+        kernel_scan->create(program, "kernel_radix_scan");
+        kernel_scan_add->create(program, "kernel_scan_add");
+        kernel_assign->create(program, "kernel_fmm_assign");
+        kernel_upward->create(program, "kernel_fmm_upward");
+        kernel_reset->create(program, "kernel_fmm_reset");
+        kernel_traverse->create(program, "kernel_fmm_traverse");
+        kernel_group->create(program, "kernel_fmm_group");
+        kernel_m2l->create(program, "kernel_fmm_m2l");
+        kernel_downward->create(program, "kernel_fmm_downward");
+
+        // Размер рабочей группы префиксных сумм -
+        // наибольшая допустимая степень двойки.
+        size_t max_local = std::min(static_cast<size_t>(FMM_LOCAL_SIZE_MAX), device.maxWorkGroupSize());
+        max_local = std::min(max_local, kernel_scan_blocks->workGroupSize(device));
+        max_local = std::min(max_local, kernel_scan->workGroupSize(device));
+
+        local_size = 1;
+        while(local_size * 2 <= max_local) local_size *= 2;
+
+        // Проход обхода обрабатывает пары с шагом по всем элементам.
+        traverse_size = static_cast<size_t>(device.maxComputeUnits()) * FMM_TRAVERSE_ITEMS_PER_UNIT;
+        if(traverse_size == 0) traverse_size = FMM_TRAVERSE_ITEMS_PER_UNIT;
+
+        counters.fill(0, FMM_COUNTER_PASSES + FMM_PASSES_MAX + 1);
+
+        bool res = createBuffer(weights_buf, bodies_count * sizeof(cl_uint)) &&
+                   createBuffer(block_sums_buf, FMM_SCAN_GROUPS_MAX * sizeof(cl_uint)) &&
+                   createBuffer(slot_of_buf, (bodies_count * 2 - 1) * sizeof(cl_int)) &&
+                   createBuffer(leaf_of_buf, bodies_count * sizeof(cl_int)) &&
+                   createBuffer(counters_buf, counters.size() * sizeof(cl_uint));
+
+        if(!res){
+            log(Log::ERROR, LOG_WHO, tr("Error creating FMM buffers"));
+            destroy();
+            return false;
+        }
+
+    }// Если произошла ошибка.
+    catch(CLException& e){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, e.what());
+        destroy();
+        return false;
+    }
+
+    log(Log::INFO, LOG_WHO, tr("Device FMM: leaf capacity %1, work group size %2")
+                            .arg(FMM_LEAF_CAPACITY).arg(local_size));
+
+    is_valid = true;
+
+    return true;
+}
+
+bool FmmBuilder::destroy()
+{
+    is_valid = false;
+    tables_order = 0;
+    terms_count = 0;
+    slots_capacity = 0;
+    pairs_capacity = 0;
+    m2l_capacity = 0;
+    near_capacity = 0;
+
+    CLKernel* kernels[] = {kernel_weights, kernel_scan_blocks, kernel_scan, kernel_scan_add,
+                           kernel_assign, kernel_upward, kernel_reset, kernel_traverse,
+                           kernel_group, kernel_m2l, kernel_downward};
+    CLBuffer* buffers[] = {weights_buf, block_sums_buf, slot_of_buf, leaf_of_buf, counters_buf,
+                           exps_buf, recurrence_buf, table_offsets_buf, table_buf,
+                           slot_node_buf, flags_buf, radii_buf, multipoles_buf, locals_buf,
+                           leaves_buf, m2l_offsets_buf, near_offsets_buf, pairs_buf[0], pairs_buf[1],
+                           m2l_pairs_buf, m2l_sources_buf, near_pairs_buf, near_buf};
+
+    for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i ++){
+        try{
+            if(kernels[i]->isValid()) kernels[i]->release();
+        }catch(CLException& e){
+            log(Log::WARNING, LOG_WHO, e.what());
+        }
+    }
+
+    for(size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i ++){
+        try{
+            if(buffers[i]->isValid()) buffers[i]->release();
+        }catch(CLException& e){
+            log(Log::WARNING, LOG_WHO, e.what());
+        }
+    }
+
+    return true;
+}
+
+bool FmmBuilder::isValid() const
+{
+    return is_valid;
+}
+
+size_t FmmBuilder::leafCapacity() const
+{
+    return FMM_LEAF_CAPACITY;
+}
+
+/**
+ * @brief Ставит в очередь построение разложений.
+ * Слоты разложений получают узлы более чем с leafCapacity() телами
+ * и их потомки-кластеры, число слотов считывается на хост
+ * для выделения буферов.
+ * @param queue Очередь команд OpenCL.
+ * @param positions Буфер позиций тел.
+ * @param masses Буфер масс тел.
+ * @param tree Построитель дерева с построенным деревом.
+ * @param fmm Метод мультиполей.
+ * @param count Число тел.
+ * @return true в случае успеха, иначе false.
+ */
+bool FmmBuilder::enqueueBuild(const CLCommandQueue &queue, const CLBuffer &positions,
+                              const CLBuffer &masses, TreeBuilder &tree, const Fmm &fmm, size_t count)
+{
+    if(!is_valid || count <= FMM_LEAF_CAPACITY || count > bodies_count) return false;
+
+    if(!uploadTables(queue, fmm)) return false;
+
+    CLBuffer* nodes = tree.nodesBuffer();
+    CLBuffer* parents = tree.parentsBuffer();
+    CLBuffer* indices = tree.indicesBuffer();
+
+    size_t global_size = 0;
+
+    // Число слотов узлов.
+    kernel_weights->setArg<cl_int>(0, count);
+    kernel_weights->setArg<cl_int>(1, FMM_LEAF_CAPACITY);
+    kernel_weights->setArg<cl_mem>(2, nodes->id());
+    kernel_weights->setArg<cl_mem>(3, weights_buf->id());
+    global_size = count;
+    kernel_weights->execute(queue, 1, &global_size, nullptr);
+
+    enqueueScan(queue, weights_buf, count);
+
+    // Общее число слотов - последняя префиксная сумма.
+    cl_uint slots = 0;
+    weights_buf->enqueueRead(queue, true, (count - 1) * sizeof(cl_uint), sizeof(cl_uint), &slots);
+
+    if(slots == 0 || slots > count * 2 - 1){
+        log(Log::ERROR, LOG_WHO, tr("Invalid FMM slots count %1").arg(slots));
+        return false;
+    }
+
+    // Если буферы слотов малы - увеличим их.
+    if(slots + 1 > slots_capacity){
+        slots_capacity = (slots + 1) + (slots + 1) / 2;
+
+        bool res = createBuffer(slot_node_buf, slots_capacity * sizeof(cl_int)) &&
+                   createBuffer(flags_buf, slots_capacity * sizeof(cl_int)) &&
+                   createBuffer(radii_buf, slots_capacity * sizeof(cl_float)) &&
+                   createBuffer(multipoles_buf, slots_capacity * terms_count * sizeof(cl_float)) &&
+                   createBuffer(locals_buf, slots_capacity * terms_count * sizeof(cl_float)) &&
+                   createBuffer(leaves_buf, slots_capacity * sizeof(Fmm::Leaf)) &&
+                   createBuffer(m2l_offsets_buf, slots_capacity * sizeof(cl_uint)) &&
+                   createBuffer(near_offsets_buf, slots_capacity * sizeof(cl_uint));
+
+        if(!res){
+            log(Log::ERROR, LOG_WHO, tr("Error creating FMM buffers"));
+            slots_capacity = 0;
+            return false;
+        }
+    }
+
+    // Назначим слоты.
+    kernel_assign->setArg<cl_int>(0, count);
+    kernel_assign->setArg<cl_int>(1, FMM_LEAF_CAPACITY);
+    kernel_assign->setArg<cl_mem>(2, nodes->id());
+    kernel_assign->setArg<cl_mem>(3, weights_buf->id());
+    kernel_assign->setArg<cl_mem>(4, slot_of_buf->id());
+    kernel_assign->setArg<cl_mem>(5, slot_node_buf->id());
+    kernel_assign->setArg<cl_mem>(6, flags_buf->id());
+    global_size = count - 1;
+    kernel_assign->execute(queue, 1, &global_size, nullptr);
+
+    // Восходящий проход.
+    kernel_upward->setArg<cl_int>(0, count);
+    kernel_upward->setArg<cl_int>(1, FMM_LEAF_CAPACITY);
+    kernel_upward->setArg<cl_uint>(2, slots);
+    kernel_upward->setArg<cl_mem>(3, nodes->id());
+    kernel_upward->setArg<cl_mem>(4, parents->id());
+    kernel_upward->setArg<cl_mem>(5, slot_of_buf->id());
+    kernel_upward->setArg<cl_mem>(6, slot_node_buf->id());
+    kernel_upward->setArg<cl_mem>(7, positions.id());
+    kernel_upward->setArg<cl_mem>(8, masses.id());
+    kernel_upward->setArg<cl_mem>(9, indices->id());
+    kernel_upward->setArg<cl_mem>(10, exps_buf->id());
+    kernel_upward->setArg<cl_uint>(11, terms_count);
+    kernel_upward->setArg<cl_mem>(12, table_offsets_buf->id());
+    kernel_upward->setArg<cl_mem>(13, table_buf->id());
+    kernel_upward->setArg<cl_mem>(14, multipoles_buf->id());
+    kernel_upward->setArg<cl_mem>(15, radii_buf->id());
+    kernel_upward->setArg<cl_mem>(16, flags_buf->id());
+    global_size = slots;
+    kernel_upward->execute(queue, 1, &global_size, nullptr);
+
+    // Двойной обход дерева.
+    size_t m2l_count = 0;
+    size_t near_count = 0;
+    if(!enqueueTraverse(queue, tree, count, fmm.theta(), slots, m2l_count, near_count)) return false;
+
+    // Сгруппируем пары по приёмникам.
+    enqueueScan(queue, m2l_offsets_buf, slots + 1);
+    enqueueScan(queue, near_offsets_buf, slots + 1);
+
+    kernel_group->setArg<cl_mem>(2, m2l_offsets_buf->id());
+    kernel_group->setArg<cl_mem>(3, m2l_sources_buf->id());
+    if(m2l_count != 0){
+        kernel_group->setArg<cl_uint>(0, m2l_count);
+        kernel_group->setArg<cl_mem>(1, m2l_pairs_buf->id());
+        global_size = m2l_count;
+        kernel_group->execute(queue, 1, &global_size, nullptr);
+    }
+
+    if(near_count != 0){
+        kernel_group->setArg<cl_uint>(0, near_count);
+        kernel_group->setArg<cl_mem>(1, near_pairs_buf->id());
+        kernel_group->setArg<cl_mem>(2, near_offsets_buf->id());
+        kernel_group->setArg<cl_mem>(3, near_buf->id());
+        global_size = near_count;
+        kernel_group->execute(queue, 1, &global_size, nullptr);
+    }
+
+    // Локальные разложения (M2L).
+    kernel_m2l->setArg<cl_uint>(0, slots);
+    kernel_m2l->setArg<cl_mem>(1, nodes->id());
+    kernel_m2l->setArg<cl_mem>(2, slot_node_buf->id());
+    kernel_m2l->setArg<cl_mem>(3, radii_buf->id());
+    kernel_m2l->setArg<cl_mem>(4, multipoles_buf->id());
+    kernel_m2l->setArg<cl_mem>(5, m2l_offsets_buf->id());
+    kernel_m2l->setArg<cl_mem>(6, m2l_sources_buf->id());
+    kernel_m2l->setArg<cl_mem>(7, locals_buf->id());
+    kernel_m2l->setArg<cl_mem>(8, exps_buf->id());
+    kernel_m2l->setArg<cl_uint>(9, terms_count);
+    kernel_m2l->setArg<cl_mem>(10, recurrence_buf->id());
+    kernel_m2l->setArg<cl_mem>(11, table_offsets_buf->id());
+    kernel_m2l->setArg<cl_mem>(12, table_buf->id());
+    global_size = slots;
+    kernel_m2l->execute(queue, 1, &global_size, nullptr);
+
+    // Нисходящий проход и листья.
+    kernel_downward->setArg<cl_int>(0, count);
+    kernel_downward->setArg<cl_int>(1, FMM_LEAF_CAPACITY);
+    kernel_downward->setArg<cl_uint>(2, slots);
+    kernel_downward->setArg<cl_mem>(3, nodes->id());
+    kernel_downward->setArg<cl_mem>(4, parents->id());
+    kernel_downward->setArg<cl_mem>(5, slot_of_buf->id());
+    kernel_downward->setArg<cl_mem>(6, slot_node_buf->id());
+    kernel_downward->setArg<cl_mem>(7, radii_buf->id());
+    kernel_downward->setArg<cl_mem>(8, locals_buf->id());
+    kernel_downward->setArg<cl_mem>(9, m2l_offsets_buf->id());
+    kernel_downward->setArg<cl_mem>(10, near_offsets_buf->id());
+    kernel_downward->setArg<cl_mem>(11, leaves_buf->id());
+    kernel_downward->setArg<cl_mem>(12, leaf_of_buf->id());
+    kernel_downward->setArg<cl_mem>(13, exps_buf->id());
+    kernel_downward->setArg<cl_uint>(14, terms_count);
+    kernel_downward->setArg<cl_mem>(15, table_offsets_buf->id());
+    kernel_downward->setArg<cl_mem>(16, table_buf->id());
+    global_size = slots;
+    kernel_downward->execute(queue, 1, &global_size, nullptr);
+
+    return true;
+}
+
+CLBuffer *FmmBuilder::leavesBuffer()
+{
+    return leaves_buf;
+}
+
+CLBuffer *FmmBuilder::leafOfBuffer()
+{
+    return leaf_of_buf;
+}
+
+CLBuffer *FmmBuilder::nearBuffer()
+{
+    return near_buf;
+}
+
+CLBuffer *FmmBuilder::localsBuffer()
+{
+    return locals_buf;
+}
+
+CLBuffer *FmmBuilder::expsBuffer()
+{
+    return exps_buf;
+}
+
+bool FmmBuilder::uploadTables(const CLCommandQueue &queue, const Fmm &fmm)
+{
+    if(tables_order == fmm.order()) return true;
+
+    // Копии таблиц живут до конца асинхронной записи.
+    exps_data = fmm.exponents();
+    fmm.deviceRecurrence(recurrence_data);
+    fmm.deviceTables(table_offsets_data, table_data);
+    terms_count = fmm.termsCount();
+
+    bool res = createBuffer(exps_buf, exps_data.size() * sizeof(qint32)) &&
+               createBuffer(recurrence_buf, recurrence_data.size() * sizeof(qint32)) &&
+               createBuffer(table_offsets_buf, table_offsets_data.size() * sizeof(qint32)) &&
+               createBuffer(table_buf, table_data.size() * sizeof(Fmm::DeviceTerm));
+
+    if(!res){
+        log(Log::ERROR, LOG_WHO, tr("Error creating FMM buffers"));
+        tables_order = 0;
+        return false;
+    }
+
+    exps_buf->enqueueWrite(queue, false, 0, exps_data.size() * sizeof(qint32), exps_data.constData());
+    recurrence_buf->enqueueWrite(queue, false, 0,
+                                 recurrence_data.size() * sizeof(qint32), recurrence_data.constData());
+    table_offsets_buf->enqueueWrite(queue, false, 0,
+                                    table_offsets_data.size() * sizeof(qint32), table_offsets_data.constData());
+    table_buf->enqueueWrite(queue, false, 0,
+                            table_data.size() * sizeof(Fmm::DeviceTerm), table_data.constData());
+
+    // Размер разложений изменился - буферы слотов пересоздадутся.
+    slots_capacity = 0;
+    tables_order = fmm.order();
+
+    return true;
+}
+
+void FmmBuilder::enqueueScan(const CLCommandQueue &queue, CLBuffer *data, size_t n)
+{
+    // Блоки - целое число порций по размеру группы.
+    size_t groups = std::min((n + local_size - 1) / local_size, static_cast<size_t>(FMM_SCAN_GROUPS_MAX));
+    groups = std::max(static_cast<size_t>(1), groups);
+    size_t tiles = ((n + groups - 1) / groups + local_size - 1) / local_size;
+    cl_uint block_size = tiles * local_size;
+    groups = (n + block_size - 1) / block_size;
+
+    size_t global_size = groups * local_size;
+
+    kernel_scan_blocks->setArg<cl_uint>(0, n);
+    kernel_scan_blocks->setArg<cl_mem>(1, data->id());
+    kernel_scan_blocks->setArg<cl_uint>(2, block_size);
+    kernel_scan_blocks->setArg<cl_mem>(3, block_sums_buf->id());
+    kernel_scan_blocks->setLocalArgSize(4, local_size * sizeof(cl_uint));
+    kernel_scan_blocks->execute(queue, 1, &global_size, &local_size);
+
+    kernel_scan->setArg<cl_uint>(0, groups);
+    kernel_scan->setArg<cl_mem>(1, block_sums_buf->id());
+    kernel_scan->setLocalArgSize(2, local_size * sizeof(cl_uint));
+    global_size = local_size;
+    kernel_scan->execute(queue, 1, &global_size, &local_size);
+
+    kernel_scan_add->setArg<cl_uint>(0, n);
+    kernel_scan_add->setArg<cl_mem>(1, data->id());
+    kernel_scan_add->setArg<cl_uint>(2, block_size);
+    kernel_scan_add->setArg<cl_mem>(3, block_sums_buf->id());
+    global_size = n;
+    kernel_scan_add->execute(queue, 1, &global_size, nullptr);
+}
+
+/**
+ * @brief Выполняет двойной обход дерева.
+ * Проходы ставятся в очередь пачками, счётчики
+ * считываются после каждой пачки: пустой следующий проход
+ * завершает обход, переполнение списков - повторяет его.
+ * @param queue Очередь команд OpenCL.
+ * @param tree Построитель дерева.
+ * @param count Число тел.
+ * @param theta Параметр точности.
+ * @param slots Число слотов.
+ * @param m2l_count Результат - число пар M2L.
+ * @param near_count Результат - число пар ближних кластеров.
+ * @return true в случае успеха, иначе false.
+ */
+bool FmmBuilder::enqueueTraverse(const CLCommandQueue &queue, TreeBuilder &tree, size_t count, float theta,
+                                 size_t slots, size_t &m2l_count, size_t &near_count)
+{
+    size_t global_size = 0;
+
+    for(size_t attempt = 0; attempt < FMM_RESTARTS_MAX; attempt ++){
+        // Если списки малы - увеличим их.
+        size_t pairs_size = std::max(slots * FMM_PAIRS_PER_SLOT, static_cast<size_t>(FMM_LIST_MIN));
+        size_t m2l_size = std::max(slots * FMM_M2L_PER_SLOT, static_cast<size_t>(FMM_LIST_MIN));
+        size_t near_size = std::max(slots * FMM_NEAR_PER_SLOT, static_cast<size_t>(FMM_LIST_MIN));
+
+        if(pairs_size > pairs_capacity){
+            pairs_capacity = pairs_size;
+            if(!createBuffer(pairs_buf[0], pairs_capacity * sizeof(cl_int2)) ||
+               !createBuffer(pairs_buf[1], pairs_capacity * sizeof(cl_int2))){
+                log(Log::ERROR, LOG_WHO, tr("Error creating FMM buffers"));
+                pairs_capacity = 0;
+                return false;
+            }
+        }
+        if(m2l_size > m2l_capacity){
+            m2l_capacity = m2l_size;
+            if(!createBuffer(m2l_pairs_buf, m2l_capacity * sizeof(cl_int4)) ||
+               !createBuffer(m2l_sources_buf, m2l_capacity * sizeof(cl_int))){
+                log(Log::ERROR, LOG_WHO, tr("Error creating FMM buffers"));
+                m2l_capacity = 0;
+                return false;
+            }
+        }
+        if(near_size > near_capacity){
+            near_capacity = near_size;
+            if(!createBuffer(near_pairs_buf, near_capacity * sizeof(cl_int4)) ||
+               !createBuffer(near_buf, near_capacity * sizeof(cl_int))){
+                log(Log::ERROR, LOG_WHO, tr("Error creating FMM buffers"));
+                near_capacity = 0;
+                return false;
+            }
+        }
+
+        // Начнём с пары (корень, корень).
+        counters.fill(0);
+        counters[FMM_COUNTER_PASSES] = 1;
+        counters_buf->enqueueWrite(queue, false, 0, counters.size() * sizeof(cl_uint), counters.constData());
+        pairs_buf[0]->enqueueWrite(queue, false, 0, sizeof(fmm_root_pair), fmm_root_pair);
+
+        kernel_reset->setArg<cl_uint>(0, slots);
+        kernel_reset->setArg<cl_mem>(1, m2l_offsets_buf->id());
+        kernel_reset->setArg<cl_mem>(2, near_offsets_buf->id());
+        global_size = slots + 1;
+        kernel_reset->execute(queue, 1, &global_size, nullptr);
+
+        kernel_traverse->setArg<cl_int>(0, count);
+        kernel_traverse->setArg<cl_int>(1, FMM_LEAF_CAPACITY);
+        kernel_traverse->setArg<cl_float>(2, theta);
+        kernel_traverse->setArg<cl_mem>(3, tree.nodesBuffer()->id());
+        kernel_traverse->setArg<cl_mem>(4, slot_of_buf->id());
+        kernel_traverse->setArg<cl_mem>(5, radii_buf->id());
+        kernel_traverse->setArg<cl_mem>(7, counters_buf->id());
+        kernel_traverse->setArg<cl_uint>(10, pairs_capacity);
+        kernel_traverse->setArg<cl_mem>(11, m2l_pairs_buf->id());
+        kernel_traverse->setArg<cl_mem>(12, m2l_offsets_buf->id());
+        kernel_traverse->setArg<cl_uint>(13, m2l_capacity);
+        kernel_traverse->setArg<cl_mem>(14, near_pairs_buf->id());
+        kernel_traverse->setArg<cl_mem>(15, near_offsets_buf->id());
+        kernel_traverse->setArg<cl_uint>(16, near_capacity);
+
+        size_t pass = 0;
+        bool done = false;
+        global_size = traverse_size;
+
+        while(!done && pass < FMM_PASSES_MAX){
+            for(size_t i = 0; i < FMM_PASSES_PER_CHECK && pass < FMM_PASSES_MAX; i ++){
+                kernel_traverse->setArg<cl_uint>(6, pass);
+                kernel_traverse->setArg<cl_mem>(8, pairs_buf[pass & 1]->id());
+                kernel_traverse->setArg<cl_mem>(9, pairs_buf[1 - (pass & 1)]->id());
+                kernel_traverse->execute(queue, 1, &global_size, nullptr);
+                pass ++;
+            }
+
+            counters_buf->enqueueRead(queue, true, 0, counters.size() * sizeof(cl_uint), counters.data());
+
+            // Переполнение списков M2L и ближних кластеров не влияет
+            // на проходы - обход доводится до конца ради точных счётчиков.
+            if(counters.at(FMM_COUNTER_OVERFLOW) & FMM_OVERFLOW_PAIRS) break;
+
+            done = counters.at(FMM_COUNTER_PASSES + pass) == 0;
+        }
+
+        quint32 overflow = counters.at(FMM_COUNTER_OVERFLOW);
+
+        if(!done && (overflow & FMM_OVERFLOW_PAIRS) == 0){
+            log(Log::ERROR, LOG_WHO, tr("FMM traversal exceeded %1 passes").arg(FMM_PASSES_MAX));
+            return false;
+        }
+
+        if(overflow == 0){
+            m2l_count = counters.at(FMM_COUNTER_M2L);
+            near_count = counters.at(FMM_COUNTER_NEAR);
+
+            return true;
+        }
+
+        // Списки переполнились - увеличим их и повторим обход.
+        if(overflow & FMM_OVERFLOW_PAIRS){
+            // Проходы после переполненного недосчитаны,
+            // а пар на следующих уровнях обычно больше - запас вчетверо.
+            size_t needed = *std::max_element(counters.constBegin() + FMM_COUNTER_PASSES, counters.constEnd());
+            pairs_capacity = std::max(pairs_capacity * 2, needed * 4);
+            if(!createBuffer(pairs_buf[0], pairs_capacity * sizeof(cl_int2)) ||
+               !createBuffer(pairs_buf[1], pairs_capacity * sizeof(cl_int2))){
+                log(Log::ERROR, LOG_WHO, tr("Error creating FMM buffers"));
+                pairs_capacity = 0;
+                return false;
+            }
+        }
+        if(overflow & FMM_OVERFLOW_M2L){
+            size_t needed = counters.at(FMM_COUNTER_M2L);
+            m2l_capacity = std::max(m2l_capacity * 2, needed + needed / 2);
+            if(!createBuffer(m2l_pairs_buf, m2l_capacity * sizeof(cl_int4)) ||
+               !createBuffer(m2l_sources_buf, m2l_capacity * sizeof(cl_int))){
+                log(Log::ERROR, LOG_WHO, tr("Error creating FMM buffers"));
+                m2l_capacity = 0;
+                return false;
+            }
+        }
+        if(overflow & FMM_OVERFLOW_NEAR){
+            size_t needed = counters.at(FMM_COUNTER_NEAR);
+            near_capacity = std::max(near_capacity * 2, needed + needed / 2);
+            if(!createBuffer(near_pairs_buf, near_capacity * sizeof(cl_int4)) ||
+               !createBuffer(near_buf, near_capacity * sizeof(cl_int))){
+                log(Log::ERROR, LOG_WHO, tr("Error creating FMM buffers"));
+                near_capacity = 0;
+                return false;
+            }
+        }
+    }
+
+    log(Log::ERROR, LOG_WHO, tr("FMM traversal lists overflow"));
+
+    return false;
+}
+
+bool FmmBuilder::createBuffer(CLBuffer *buf, size_t size)
+{
+    if(buf->isValid()) buf->release();
+
+    return buf->create(*context, CL_MEM_READ_WRITE, size, nullptr);
+}
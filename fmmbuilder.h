@@ -0,0 +1,311 @@
+#ifndef FMMBUILDER_H
+#define FMMBUILDER_H
+
+#include <QObject>
+#include <QVector>
+#include <stddef.h>
+#include "fmm.h"
+
+
+class CLContext;
+class CLDevice;
+class CLProgram;
+class CLCommandQueue;
+class CLBuffer;
+class CLKernel;
+class TreeBuilder;
+
+
+/**
+ * @class FmmBuilder.
+ * @brief Класс построения разложений быстрого метода мультиполей
+ * на устройстве OpenCL по дереву TreeBuilder.
+ * Листья FMM - кластеры, наибольшие узлы дерева
+ * не более чем с leafCapacity() телами.
+ * Восходящий проход (P2M, M2M), двойной обход дерева
+ * со списками M2L и ближних кластеров, M2L и нисходящий
+ * проход (L2L) выполняются ядрами устройства,
+ * результат совместим с ядром kernel_fmm.
+ * Таблицы членов разложений берутся из Fmm.
+ * На хост считываются только число слотов разложений
+ * и счётчики двойного обхода.
+ */
+class FmmBuilder : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief Конструктор.
+     * @param parent Объект-родитель.
+     */
+    explicit FmmBuilder(QObject *parent = 0);
+
+    /**
+     * @brief Деструктор.
+     */
+    ~FmmBuilder();
+
+    /**
+     * @brief Создаёт ядра и буферы построения разложений.
+     * @param cxt Контекст OpenCL.
+     * @param device Устройство OpenCL.
+     * @param program Скомпилированная программа OpenCL.
+     * @param bodies Максимальное число тел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool create(const CLContext& cxt, const CLDevice& device, const CLProgram& program,
+                size_t bodies);
+
+    /**
+     * @brief Уничтожает ядра и буферы.
+     * @return true в случае успеха, иначе false.
+     */
+    bool destroy();
+
+    /**
+     * @brief Получение флага готовности.
+     * @return Флаг готовности.
+     */
+    bool isValid() const;
+
+    /**
+     * @brief Получение наибольшего числа тел листа FMM.
+     * Разложения строятся только для большего числа тел.
+     * @return Наибольшее число тел листа.
+     */
+    size_t leafCapacity() const;
+
+    /**
+     * @brief Ставит в очередь построение разложений
+     * по дереву, построенному TreeBuilder.
+     * Ожидает чтения числа слотов разложений
+     * и счётчиков двойного обхода.
+     * @param queue Очередь команд OpenCL.
+     * @param positions Буфер позиций тел.
+     * @param masses Буфер масс тел.
+     * @param tree Построитель дерева с построенным деревом.
+     * @param fmm Метод мультиполей - порядок, точность и таблицы членов.
+     * @param count Число тел, больше leafCapacity().
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool enqueueBuild(const CLCommandQueue& queue, const CLBuffer& positions,
+                      const CLBuffer& masses, TreeBuilder& tree, const Fmm& fmm, size_t count);
+
+    /**
+     * @brief Получение буфера листьев FMM по слотам.
+     * @return Буфер листьев.
+     */
+    CLBuffer* leavesBuffer();
+
+    /**
+     * @brief Получение буфера слотов листьев тел
+     * в порядке обхода дерева.
+     * @return Буфер слотов листьев.
+     */
+    CLBuffer* leafOfBuffer();
+
+    /**
+     * @brief Получение буфера списков ближних листьев.
+     * @return Буфер списков ближних листьев.
+     */
+    CLBuffer* nearBuffer();
+
+    /**
+     * @brief Получение буфера локальных разложений слотов.
+     * @return Буфер локальных разложений.
+     */
+    CLBuffer* localsBuffer();
+
+    /**
+     * @brief Получение буфера степеней членов разложения.
+     * @return Буфер степеней.
+     */
+    CLBuffer* expsBuffer();
+
+private:
+    /**
+     * @brief Флаг готовности.
+     */
+    bool is_valid;
+
+    /**
+     * @brief Контекст OpenCL.
+     */
+    const CLContext* context;
+
+    /**
+     * @brief Максимальное число тел.
+     */
+    size_t bodies_count;
+
+    /**
+     * @brief Размер рабочей группы префиксных сумм.
+     */
+    size_t local_size;
+
+    /**
+     * @brief Число рабочих элементов прохода обхода.
+     */
+    size_t traverse_size;
+
+    /**
+     * @brief Порядок разложения переданных таблиц, 0 - не переданы.
+     */
+    size_t tables_order;
+
+    /**
+     * @brief Число членов разложения.
+     */
+    size_t terms_count;
+
+    /**
+     * @brief Размеры буферов слотов и списков в элементах.
+     */
+    size_t slots_capacity;
+    size_t pairs_capacity;
+    size_t m2l_capacity;
+    size_t near_capacity;
+
+    /**
+     * @brief Таблицы членов разложений.
+     */
+    QVector<qint32> exps_data;
+    QVector<qint32> recurrence_data;
+    QVector<qint32> table_offsets_data;
+    QVector<Fmm::DeviceTerm> table_data;
+
+    /**
+     * @brief Счётчики двойного обхода.
+     */
+    QVector<quint32> counters;
+
+    /**
+     * @brief Ядра построения разложений.
+     */
+    CLKernel* kernel_weights;
+    CLKernel* kernel_scan_blocks;
+    CLKernel* kernel_scan;
+    CLKernel* kernel_scan_add;
+    CLKernel* kernel_assign;
+    CLKernel* kernel_upward;
+    CLKernel* kernel_reset;
+    CLKernel* kernel_traverse;
+    CLKernel* kernel_group;
+    CLKernel* kernel_m2l;
+    CLKernel* kernel_downward;
+
+    /**
+     * @brief Буфер числа слотов узлов и их префиксных сумм.
+     */
+    CLBuffer* weights_buf;
+
+    /**
+     * @brief Буфер сумм блоков префиксной суммы.
+     */
+    CLBuffer* block_sums_buf;
+
+    /**
+     * @brief Буфер слотов узлов.
+     */
+    CLBuffer* slot_of_buf;
+
+    /**
+     * @brief Буфер слотов листьев тел.
+     */
+    CLBuffer* leaf_of_buf;
+
+    /**
+     * @brief Буфер счётчиков двойного обхода.
+     */
+    CLBuffer* counters_buf;
+
+    /**
+     * @brief Буферы таблиц членов разложений.
+     */
+    CLBuffer* exps_buf;
+    CLBuffer* recurrence_buf;
+    CLBuffer* table_offsets_buf;
+    CLBuffer* table_buf;
+
+    /**
+     * @brief Буферы слотов: узлы, флаги посещения,
+     * радиусы, мультиполи, локальные разложения, листья.
+     */
+    CLBuffer* slot_node_buf;
+    CLBuffer* flags_buf;
+    CLBuffer* radii_buf;
+    CLBuffer* multipoles_buf;
+    CLBuffer* locals_buf;
+    CLBuffer* leaves_buf;
+
+    /**
+     * @brief Буферы числа пар M2L и ближних кластеров слотов
+     * и их префиксных сумм.
+     */
+    CLBuffer* m2l_offsets_buf;
+    CLBuffer* near_offsets_buf;
+
+    /**
+     * @brief Буферы пар узлов проходов обхода.
+     */
+    CLBuffer* pairs_buf[2];
+
+    /**
+     * @brief Буферы пар M2L и источников M2L по приёмникам.
+     */
+    CLBuffer* m2l_pairs_buf;
+    CLBuffer* m2l_sources_buf;
+
+    /**
+     * @brief Буферы пар ближних кластеров и списков ближних листьев.
+     */
+    CLBuffer* near_pairs_buf;
+    CLBuffer* near_buf;
+
+    /**
+     * @brief Передаёт устройству таблицы членов разложений,
+     * если изменился порядок разложения.
+     * @param queue Очередь команд OpenCL.
+     * @param fmm Метод мультиполей.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool uploadTables(const CLCommandQueue& queue, const Fmm& fmm);
+
+    /**
+     * @brief Ставит в очередь исключающую префиксную сумму.
+     * @param queue Очередь команд OpenCL.
+     * @param data Буфер данных.
+     * @param n Число элементов.
+     * @throw CLException в случае ошибки.
+     */
+    void enqueueScan(const CLCommandQueue& queue, CLBuffer* data, size_t n);
+
+    /**
+     * @brief Выполняет двойной обход дерева.
+     * При переполнении списков увеличивает их и повторяет обход.
+     * @param queue Очередь команд OpenCL.
+     * @param tree Построитель дерева.
+     * @param count Число тел.
+     * @param theta Параметр точности.
+     * @param slots Число слотов.
+     * @param m2l_count Результат - число пар M2L.
+     * @param near_count Результат - число пар ближних кластеров.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool enqueueTraverse(const CLCommandQueue& queue, TreeBuilder& tree, size_t count, float theta,
+                         size_t slots, size_t& m2l_count, size_t& near_count);
+
+    /**
+     * @brief Создаёт буфер OpenCL, уничтожая прежний.
+     * @param buf Буфер OpenCL.
+     * @param size Размер в байтах.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool createBuffer(CLBuffer* buf, size_t size);
+};
+
+#endif // FMMBUILDER_H
@@ -2,10 +2,12 @@
 #include <QTextCodec>
 #include <QTranslator>
 #include <QLocale>
+#include <QTimer>
 #include <stdlib.h>
 #include <time.h>
 #include "mainwindow.h"
 #include "settings.h"
+#include "batchrunner.h"
 
 //#define LIST_CL_PLATFORMS_DEVICES
 
@@ -34,6 +36,27 @@ int main(int argc, char *argv[])
 {
     QLocale::setDefault(QLocale());
 
+    // Пакетный режим - без графического интерфейса.
+    if(BatchRunner::isRequested(argc, argv)){
+        QCoreApplication a(argc, argv);
+        QTextCodec::setCodecForTr(QTextCodec::codecForName("utf-8"));
+
+        Settings::get().read();
+
+        BatchRunner runner;
+
+        if(!runner.parseArguments(a.arguments()) || !runner.init()) return 1;
+
+        QTimer::singleShot(0, &runner, SLOT(start()));
+
+        int exec_result = a.exec();
+
+        // Сохраним подобранные параметры ядра.
+        Settings::get().write();
+
+        return exec_result;
+    }
+
     QApplication a(argc, argv);
     QTextCodec::setCodecForTr(QTextCodec::codecForName("utf-8"));
 
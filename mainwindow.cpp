@@ -16,6 +16,8 @@
 #include <QRegExp>
 #include <QImage>
 #include <QDateTime>
+#include <QSlider>
+#include <QDoubleSpinBox>
 #include "clplatform.h"
 #include "cldevice.h"
 #include "log.h"
@@ -31,6 +33,9 @@
 
 #define LOG_WHO "Main"
 
+//! Число делений ползунка перемотки на кадр траектории.
+#define REPLAY_SLIDER_SUBSTEPS 10
+
 static const char* log_file_name = "log.txt";
 
 
@@ -57,6 +62,25 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(fpsTimer, SIGNAL(timeout()),
             this, SLOT(fpsTimer_onTimeout()));
 
+    // Перемотка и скорость воспроизведения траектории.
+    replaySlider = new QSlider(Qt::Horizontal, this);
+    replaySlider->setMinimumWidth(300);
+    ui->toolBarReplay->addWidget(replaySlider);
+
+    replayRateSpin = new QDoubleSpinBox(this);
+    replayRateSpin->setRange(-1000.0, 1000.0);
+    replayRateSpin->setDecimals(1);
+    replayRateSpin->setSuffix(tr(" кадр/с"));
+    replayRateSpin->setValue(nbodyWidget->replayRate());
+    ui->toolBarReplay->addWidget(replayRateSpin);
+
+    connect(replaySlider, SIGNAL(sliderMoved(int)),
+            this, SLOT(replaySlider_onMoved(int)));
+    connect(replayRateSpin, SIGNAL(valueChanged(double)),
+            this, SLOT(replayRate_onChanged(double)));
+    connect(nbodyWidget, SIGNAL(replayPositionChanged()),
+            this, SLOT(nbodyWidget_onReplayPositionChanged()));
+
     oclSettingsDlg = nullptr;
 
     editBodyDlg = nullptr;
@@ -156,7 +180,7 @@ void MainWindow::nbodyWidget_onSimulated()
 {
     cur_frames ++;
 
-    simulated_years += nbodyWidget->timeStep();
+    simulated_years += nbodyWidget->timeStep() * nbodyWidget->stepsPerFrame();
 
     QString units;
     qreal years = simulated_years;
@@ -177,7 +201,19 @@ void MainWindow::nbodyWidget_onSimulated()
         units = tr("лет.");
     }
 
-    statusBar()->showMessage(tr("%1 %2 FPS: %3").arg(years, 0, 'f', 6).arg(units).arg(cur_fps));
+    QString message = tr("%1 %2 FPS: %3").arg(years, 0, 'f', 6).arg(units).arg(cur_fps);
+
+    // Профиль шага, если включено профилирование.
+    const NBody::Profile& profile = nbodyWidget->simulationProfile();
+    if(profile.isValid()){
+        message += tr(" Силы: %1 мс, интегрирование: %2 мс, %3 млрд. взаимодействий/с, %4 GFLOP/s")
+                   .arg(profile.force_time, 0, 'f', 2)
+                   .arg(profile.integrate_time, 0, 'f', 2)
+                   .arg(profile.interactions / 1e9, 0, 'f', 2)
+                   .arg(profile.gflops, 0, 'f', 1);
+    }
+
+    statusBar()->showMessage(message);
 }
 
 void MainWindow::fpsTimer_onTimeout()
@@ -216,6 +252,26 @@ void MainWindow::on_actSettingsOCL_triggered()
 
     oclSettingsDlg->setBodiesCount(Settings::get().bodiesCount());
     oclSettingsDlg->setTimeStep(Settings::get().timeStep());
+    oclSettingsDlg->setSolver(Settings::get().solver());
+    oclSettingsDlg->setBarnesHutTheta(Settings::get().barnesHutTheta());
+    oclSettingsDlg->setGpuTreeBuild(Settings::get().gpuTreeBuild());
+    oclSettingsDlg->setFmmOrder(Settings::get().fmmOrder());
+    oclSettingsDlg->setFmmDeviceEvaluation(Settings::get().fmmDeviceEvaluation());
+    oclSettingsDlg->setPmGridSize(Settings::get().pmGridSize());
+    oclSettingsDlg->setPmTsc(Settings::get().pmTsc());
+    oclSettingsDlg->setNativeBackend(Settings::get().nativeBackend());
+    oclSettingsDlg->setBlockRungs(Settings::get().blockRungs());
+    oclSettingsDlg->setIntegrator(Settings::get().integrator());
+    oclSettingsDlg->setStepsPerFrame(Settings::get().stepsPerFrame());
+    oclSettingsDlg->setPackedLayout(Settings::get().packedLayout());
+    oclSettingsDlg->setAutoTune(Settings::get().autoTune());
+    oclSettingsDlg->setProfiling(Settings::get().profiling());
+    oclSettingsDlg->setMultiDevice(Settings::get().multiDevice());
+    oclSettingsDlg->setPipelined(Settings::get().pipelined());
+    oclSettingsDlg->setPrecision(Settings::get().precision());
+    oclSettingsDlg->setSoftening(Settings::get().softening());
+    oclSettingsDlg->setSofteningLength(Settings::get().softeningLength());
+    oclSettingsDlg->setCompressData(Settings::get().compressData());
 
     if(oclSettingsDlg->exec() == QDialog::Accepted){
 
@@ -225,6 +281,26 @@ void MainWindow::on_actSettingsOCL_triggered()
             Settings::get().setClDeviceName(oclSettingsDlg->currentDevice().name());
             Settings::get().setBodiesCount(oclSettingsDlg->bodiesCount());
             Settings::get().setTimeStep(oclSettingsDlg->timeStep());
+            Settings::get().setSolver(oclSettingsDlg->solver());
+            Settings::get().setBarnesHutTheta(oclSettingsDlg->barnesHutTheta());
+            Settings::get().setGpuTreeBuild(oclSettingsDlg->gpuTreeBuild());
+            Settings::get().setFmmOrder(oclSettingsDlg->fmmOrder());
+            Settings::get().setFmmDeviceEvaluation(oclSettingsDlg->fmmDeviceEvaluation());
+            Settings::get().setPmGridSize(oclSettingsDlg->pmGridSize());
+            Settings::get().setPmTsc(oclSettingsDlg->pmTsc());
+            Settings::get().setNativeBackend(oclSettingsDlg->nativeBackend());
+            Settings::get().setBlockRungs(oclSettingsDlg->blockRungs());
+            Settings::get().setIntegrator(oclSettingsDlg->integrator());
+            Settings::get().setStepsPerFrame(oclSettingsDlg->stepsPerFrame());
+            Settings::get().setPackedLayout(oclSettingsDlg->packedLayout());
+            Settings::get().setAutoTune(oclSettingsDlg->autoTune());
+            Settings::get().setProfiling(oclSettingsDlg->profiling());
+            Settings::get().setMultiDevice(oclSettingsDlg->multiDevice());
+            Settings::get().setPipelined(oclSettingsDlg->pipelined());
+            Settings::get().setPrecision(oclSettingsDlg->precision());
+            Settings::get().setSoftening(oclSettingsDlg->softening());
+            Settings::get().setSofteningLength(oclSettingsDlg->softeningLength());
+            Settings::get().setCompressData(oclSettingsDlg->compressData());
 
             nbodyWidget->recreateNBody();
 
@@ -335,6 +411,12 @@ void MainWindow::on_actGenGalaxyCollision_triggered()
     const qreal max_axis_pos = Settings::get().distanceMax() * galaxies_count;
     const qreal max_axis_vel = Settings::get().velocityMax();
 
+    // Галактики собираются в общие массивы
+    // и передаются одной записью.
+    QVector<float> masses(all_stars_count);
+    QVector<Point3f> positions(all_stars_count);
+    QVector<Point3f> velocities(all_stars_count);
+
     for(size_t i = 0; i < galaxies_count; i ++){
         if(i == galaxies_count - 1){
             galaxy.setStarsCount(all_stars_count - stars_per_galaxy * i);
@@ -359,10 +441,24 @@ void MainWindow::on_actGenGalaxyCollision_triggered()
                                                             utils::getRandsf(),
                                                             rand() % 360));
 
-        if(!galaxy.generate() || !nbodyWidget->setBodies(i * stars_per_galaxy, galaxy.starsMasses(), galaxy.starsPositons(), galaxy.starsVelosities())){
+        if(!galaxy.generate()){
             log(Log::ERROR, LOG_WHO, tr("Ошибка генерации галактики!"));
             return;
         }
+
+        size_t offset = i * stars_per_galaxy;
+
+        qCopy(galaxy.starsMasses().constBegin(), galaxy.starsMasses().constEnd(), masses.begin() + offset);
+        qCopy(galaxy.starsPositons().constBegin(), galaxy.starsPositons().constEnd(), positions.begin() + offset);
+        qCopy(galaxy.starsVelosities().constBegin(), galaxy.starsVelosities().constEnd(), velocities.begin() + offset);
+    }
+
+    if(!nbodyWidget->setBodies(0, NBody::BodiesView(masses.constData(),
+                                                    reinterpret_cast<const float*>(positions.constData()),
+                                                    reinterpret_cast<const float*>(velocities.constData()),
+                                                    all_stars_count))){
+        log(Log::ERROR, LOG_WHO, tr("Ошибка генерации галактики!"));
+        return;
     }
     nbodyWidget->setSimulatedBodiesCount(all_stars_count);
 
@@ -460,6 +556,98 @@ void MainWindow::on_actScreenShot_triggered()
 
 }
 
+void MainWindow::on_actRecord_triggered()
+{
+    static int record_interval = 10;
+
+    // Если запись идёт - закончим её.
+    if(nbodyWidget->isRecording()){
+        nbodyWidget->stopRecording();
+        refreshUi();
+        return;
+    }
+
+    ui->actRecord->setChecked(false);
+
+    QString filename = QFileDialog::getSaveFileName(this, tr("Запись траектории"), cur_dir, tr("Trajectory files (*.glxt)"));
+
+    if(filename.isEmpty()) return;
+
+    bool ok = false;
+    record_interval = QInputDialog::getInt(this, tr("Выбор."), tr("Выберите число шагов между кадрами:"), record_interval, 1, 1000000, 1, &ok);
+
+    if(!ok) return;
+
+    cur_dir = QDir(filename).path();
+
+    if(!nbodyWidget->startRecording(filename, record_interval)){
+        log(Log::ERROR, LOG_WHO, tr("Ошибка записи траектории!"));
+    }
+
+    refreshUi();
+}
+
+void MainWindow::on_actReplay_triggered()
+{
+    // Если идёт воспроизведение - закончим его.
+    if(nbodyWidget->isReplaying()){
+        nbodyWidget->closeReplay();
+        resetSimData();
+        refreshUi();
+        return;
+    }
+
+    ui->actReplay->setChecked(false);
+
+    QString filename = QFileDialog::getOpenFileName(this, tr("Воспроизведение траектории"), cur_dir, tr("Trajectory files (*.glxt)"));
+
+    if(filename.isEmpty()) return;
+
+    cur_dir = QDir(filename).path();
+
+    fpsTimer->stop();
+
+    if(nbodyWidget->openReplay(filename)){
+        replaySlider->setRange(0, static_cast<int>(nbodyWidget->replayFramesCount() - 1) * REPLAY_SLIDER_SUBSTEPS);
+        replaySlider->setValue(0);
+    }else{
+        log(Log::ERROR, LOG_WHO, tr("Ошибка открытия траектории!"));
+    }
+
+    resetSimData();
+    refreshUi();
+}
+
+void MainWindow::on_actReplayPlay_triggered()
+{
+    nbodyWidget->setReplayPlaying(ui->actReplayPlay->isChecked());
+}
+
+void MainWindow::replaySlider_onMoved(int value)
+{
+    nbodyWidget->setReplayPosition(static_cast<qreal>(value) / REPLAY_SLIDER_SUBSTEPS);
+}
+
+void MainWindow::replayRate_onChanged(double rate)
+{
+    nbodyWidget->setReplayRate(rate);
+}
+
+void MainWindow::nbodyWidget_onReplayPositionChanged()
+{
+    qreal position = nbodyWidget->replayPosition();
+
+    // Ползунок, перемещаемый пользователем, не трогаем.
+    if(!replaySlider->isSliderDown()){
+        replaySlider->setValue(qRound(position * REPLAY_SLIDER_SUBSTEPS));
+    }
+
+    statusBar()->showMessage(tr("Кадр: %1 из %2, шаг: %3")
+                             .arg(static_cast<int>(position) + 1)
+                             .arg(nbodyWidget->replayFramesCount())
+                             .arg(nbodyWidget->replayStep()));
+}
+
 void MainWindow::on_actAbout_triggered()
 {
     QMessageBox::about(this,tr("О программе"),
@@ -477,7 +665,9 @@ void MainWindow::on_actAboutQt_triggered()
 
 void MainWindow::refreshUi()
 {
-    bool is_ready = nbodyWidget->isReady();
+    bool is_replaying = nbodyWidget->isReplaying();
+    // При воспроизведении траектории система симуляции недоступна.
+    bool is_ready = nbodyWidget->isReady() && !is_replaying;
     bool is_running = nbodyWidget->isSimulationRunning();
     bool is_not_running = is_ready && !is_running;
 
@@ -494,6 +684,16 @@ void MainWindow::refreshUi()
 
     ui->actOpenFile->setEnabled(is_not_running);
     ui->actSaveFile->setEnabled(is_not_running);
+
+    ui->actRecord->setEnabled(is_ready);
+    ui->actRecord->setChecked(nbodyWidget->isRecording());
+
+    ui->actReplay->setEnabled(!is_running);
+    ui->actReplay->setChecked(is_replaying);
+    ui->actReplayPlay->setEnabled(is_replaying);
+    ui->actReplayPlay->setChecked(nbodyWidget->isReplayPlaying());
+    replaySlider->setEnabled(is_replaying);
+    replayRateSpin->setEnabled(is_replaying);
 }
 
 void MainWindow::resetSimData()
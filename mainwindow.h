@@ -12,6 +12,8 @@ class GenSettingsDialog;
 class QFile;
 class QTimer;
 class QCloseEvent;
+class QSlider;
+class QDoubleSpinBox;
 
 namespace Ui {
 class MainWindow;
@@ -129,6 +131,38 @@ private slots:
      */
     void on_actScreenShot_triggered();
 
+    /**
+     * @brief Обработчик действия записи траектории.
+     */
+    void on_actRecord_triggered();
+
+    /**
+     * @brief Обработчик действия воспроизведения траектории.
+     */
+    void on_actReplay_triggered();
+
+    /**
+     * @brief Обработчик действия проигрывания траектории.
+     */
+    void on_actReplayPlay_triggered();
+
+    /**
+     * @brief Обработчик перемотки траектории.
+     * @param value Положение ползунка.
+     */
+    void replaySlider_onMoved(int value);
+
+    /**
+     * @brief Обработчик изменения скорости воспроизведения.
+     * @param rate Скорость, кадров в секунду.
+     */
+    void replayRate_onChanged(double rate);
+
+    /**
+     * @brief Обработчик смены кадра траектории.
+     */
+    void nbodyWidget_onReplayPositionChanged();
+
     /**
      * @brief Обработчик действия о программе.
      */
@@ -177,6 +211,12 @@ private:
     //! Таймер FPS.
     QTimer* fpsTimer;
 
+    //! Ползунок перемотки траектории.
+    QSlider* replaySlider;
+
+    //! Скорость воспроизведения траектории.
+    QDoubleSpinBox* replayRateSpin;
+
     //! Интерфейс пользователя.
     Ui::MainWindow *ui;
 
@@ -1,13 +1,197 @@
-//#pragma OPENCL EXTENSION cl_khr_fp64 : enable
 //#pragma OPENCL EXTENSION cl_amd_printf : enable
 //#pragma FP_CONTRACT on
 //__attribute__((vec_type_hint(float3)))
 
 #define RADIUS_EPSILON 1e-18f
 
+// Нижняя граница квадрата расстояния в силе
+// задаётся опцией компиляции -DNBODY_RADIUS2_MIN,
+// общей с расчётом на процессоре.
+#ifndef NBODY_RADIUS2_MIN
+#error "NBODY_RADIUS2_MIN is not defined"
+#endif
+
+/*
+ * Методы интегрирования.
+ * Выбирается опцией компиляции -DNBODY_INTEGRATOR.
+ */
+#define NBODY_INTEGRATOR_EULER 0
+#define NBODY_INTEGRATOR_LEAPFROG 1
+#define NBODY_INTEGRATOR_HERMITE 2
+#define NBODY_INTEGRATOR_YOSHIDA 3
+
+#ifndef NBODY_INTEGRATOR
+#define NBODY_INTEGRATOR NBODY_INTEGRATOR_EULER
+#endif
+
+// Схемы сдвиг-толчок-сдвиг сдвигают источники перед расчётом ускорений.
+#if NBODY_INTEGRATOR == NBODY_INTEGRATOR_LEAPFROG || NBODY_INTEGRATOR == NBODY_INTEGRATOR_YOSHIDA
+#define NBODY_DRIFT_SOURCES
+#endif
+
+
+/*
+ * Параметры ядра kernel_main, подбираемые под устройство:
+ * NBODY_UNROLL - число развёрнутых итераций внутреннего цикла,
+ * NBODY_BODIES_PER_ITEM - число тел одного work-item'а.
+ */
+#ifndef NBODY_UNROLL
+#define NBODY_UNROLL 1
+#endif
+
+#ifndef NBODY_BODIES_PER_ITEM
+#define NBODY_BODIES_PER_ITEM 1
+#endif
+
+
+/*
+ * Точность суммирования ускорений прямого расчёта.
+ * Выбирается опцией компиляции -DNBODY_PRECISION.
+ * Позиции и скорости всегда хранятся в float.
+ * Компенсированное суммирование складывает ускорения
+ * от звёзд плитки в float, а суммы плиток - по Кэхэну,
+ * двойная точность накапливает ускорения в double.
+ */
+#define NBODY_PRECISION_SINGLE 0
+#define NBODY_PRECISION_COMPENSATED 1
+#define NBODY_PRECISION_DOUBLE 2
+
+#ifndef NBODY_PRECISION
+#define NBODY_PRECISION NBODY_PRECISION_SINGLE
+#endif
+
+#if NBODY_PRECISION == NBODY_PRECISION_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+// Тип суммы ускорений.
+typedef double3 accel_t;
+#define ACCEL_ZERO ((double3)(0.0, 0.0, 0.0))
+#define ACCEL_ADD(sum, value) ((sum) += convert_double3(value))
+#else
+typedef float3 accel_t;
+#define ACCEL_ZERO ((float3)(0.0f, 0.0f, 0.0f))
+#define ACCEL_ADD(sum, value) ((sum) += (value))
+#endif
+
+#if NBODY_PRECISION == NBODY_PRECISION_COMPENSATED
+#define NBODY_TILE_SUMS
+#endif
+
+
+/*
+ * Сглаживание гравитации на малых расстояниях.
+ * Выбирается опцией компиляции -DNBODY_SOFTENING,
+ * длина сглаживания - -DNBODY_SOFTENING_LENGTH.
+ * Пламмер - потенциал -m / sqrt(r^2 + eps^2),
+ * сплайн - кубический сплайн Монагана как в Gadget,
+ * ньютоновский на расстояниях больше 2.8 * eps.
+ */
+#define NBODY_SOFTENING_NONE 0
+#define NBODY_SOFTENING_PLUMMER 1
+#define NBODY_SOFTENING_SPLINE 2
+
+#ifndef NBODY_SOFTENING
+#define NBODY_SOFTENING NBODY_SOFTENING_NONE
+#endif
+
+#ifndef NBODY_SOFTENING_LENGTH
+#define NBODY_SOFTENING_LENGTH 0.0f
+#endif
+
+#if NBODY_SOFTENING == NBODY_SOFTENING_PLUMMER
+// Добавка к квадрату расстояния.
+#define SOFTENING_EPS2 (NBODY_SOFTENING_LENGTH * NBODY_SOFTENING_LENGTH)
+#else
+#define SOFTENING_EPS2 0.0f
+#endif
+
+#if NBODY_SOFTENING == NBODY_SOFTENING_SPLINE
+// Радиус ядра сплайна.
+#define SOFTENING_SPLINE_H (2.8f * NBODY_SOFTENING_LENGTH)
+#endif
+
+// Обратный квадратный корень.
+#ifdef NBODY_NATIVE_RSQRT
+#define NBODY_RSQRT(x) native_rsqrt(x)
+#else
+#define NBODY_RSQRT(x) rsqrt(x)
+#endif
+
+
+/**
+ * @brief Вычисляет множитель ускорения 1 / r^3
+ * с учётом сглаживания одним обратным корнем.
+ * Ускорение от тела - vec_dr * m * soft_inv_r3(r2).
+ * @param r2 Квадрат расстояния.
+ * @return Множитель ускорения.
+ */
+inline float soft_inv_r3(float r2)
+{
+    // Предотвратим уход ускорения в бесконечность.
+    float inv_r = NBODY_RSQRT(max(r2 + SOFTENING_EPS2, NBODY_RADIUS2_MIN));
+    float inv_r3 = inv_r * inv_r * inv_r;
+#if NBODY_SOFTENING == NBODY_SOFTENING_SPLINE
+    float r = r2 * inv_r;
+    if(r < SOFTENING_SPLINE_H){
+        const float inv_h = 1.0f / SOFTENING_SPLINE_H;
+        float u = r * inv_h;
+        float inv_h3 = inv_h * inv_h * inv_h;
+        if(u < 0.5f){
+            inv_r3 = inv_h3 * (10.666666667f + u * u * (32.0f * u - 38.4f));
+        }else{
+            inv_r3 = inv_h3 * (21.333333333f - 48.0f * u + 38.4f * u * u - 10.666666667f * u * u * u) -
+                     0.066666667f * inv_r3;
+        }
+    }
+#endif
+    return inv_r3;
+}
+
+
+/**
+ * @brief Добавляет слагаемое к сумме по Кэхэну.
+ * @param sum Сумма.
+ * @param comp Компенсация ошибки округления суммы.
+ * @param value Слагаемое.
+ */
+inline void kahan_add(float3* sum, float3* comp, float3 value)
+{
+    float3 y = value - *comp;
+    float3 t = *sum + y;
+    *comp = (t - *sum) - y;
+    *sum = t;
+}
+
+
+/**
+ * @brief Толчок скорости суммой ускорений.
+ * @param velocity Скорость.
+ * @param accel Сумма ускорений.
+ * @param k Множитель (G * kick * dt).
+ * @return Новая скорость.
+ */
+inline float3 kick_velocity(float3 velocity, accel_t accel, float k)
+{
+#if NBODY_PRECISION == NBODY_PRECISION_DOUBLE
+    return convert_float3(convert_double3(velocity) + accel * (double)k);
+#else
+    return velocity + accel * k;
+#endif
+}
+
 
 /**
  * @brief Ядро программы OpenCL.
+ * Выполняет подшаг сдвиг-толчок-сдвиг:
+ * позиции сдвигаются на drift_pre * dt,
+ * скорости получают толчок kick * dt ускорения в сдвинутых позициях,
+ * затем позиции сдвигаются на drift_post * dt.
+ * Полунеявный метод Эйлера - (0, 1, 1),
+ * метод с перешагиванием - (1/2, 1, 1/2),
+ * метод Йошиды - три подшага.
+ * Каждый work-item обрабатывает NBODY_BODIES_PER_ITEM тел
+ * с шагом в глобальный размер.
+ * Рассчитываются тела [first_body, end_body) - при расчёте
+ * на нескольких устройствах каждое считает свою часть тел.
  * @param count Число тел.
  * @param positions_in Исходные данные - буфер позиций.
  * @param positions_out Результат - буфер позиций.
@@ -15,33 +199,50 @@
  * @param velocities_out Результат - буфер скоростей.
  * @param masses Исходные данные - буфер масс.
  * @param dt Время шага.
+ * @param drift_pre Доля шага сдвига до толчка.
+ * @param kick Доля шага толчка.
+ * @param drift_post Доля шага сдвига после толчка.
+ * @param first_body Первое рассчитываемое тело.
+ * @param end_body Тело, следующее за последним рассчитываемым.
  */
 __kernel void kernel_main(const unsigned int count,
                            const __global float* positions_in, __global float* positions_out,
                            const __global float* velocities_in, __global float* velocities_out,
                            const __global float* masses, const float dt,
-                           __local float* cached_pos, __local float* cached_mass, unsigned int cache_size)
+                           __local float* cached_pos, __local float* cached_mass, unsigned int cache_size,
+                           const float drift_pre, const float kick, const float drift_post,
+                           const unsigned int first_body, const unsigned int end_body)
 {
     // Локальные переменные. Память: private.
     unsigned int gid;
-    //unsigned int lid;
+    unsigned int lid;
+    unsigned int stride;
     unsigned int i;
+    unsigned int k;
     unsigned int pos_i;
-    
-    float3 position, velocity;
-    float3 accel;
+
+    // Номера, позиции, скорости и ускорения тел work-item'а.
+    unsigned int body_index[NBODY_BODIES_PER_ITEM];
+    float3 position[NBODY_BODIES_PER_ITEM];
+    float3 velocity[NBODY_BODIES_PER_ITEM];
+    accel_t accel[NBODY_BODIES_PER_ITEM];
+#ifdef NBODY_TILE_SUMS
+    // Компенсации ошибок сумм и суммы плитки.
+    float3 accel_comp[NBODY_BODIES_PER_ITEM];
+    float3 tile_accel[NBODY_BODIES_PER_ITEM];
+#define NBODY_ACCEL tile_accel
+#else
+#define NBODY_ACCEL accel
+#endif
+
     float m;
-    
     float3 pos;
     float3 vec_dr;
-    float r;
-
-    /*__local float cached_pos[1024 * 3];
-    __local float cached_mass[1024];
-    unsigned int cache_size = 1024;*/
 
     // Итератор по кэшу.
     unsigned int j;
+    // Итератор развёрнутого цикла.
+    unsigned int u;
     // Индекс work-item'а в кэше.
     unsigned int cache_index;
     // Число звёзд в кэше.
@@ -59,32 +260,73 @@ __kernel void kernel_main(const unsigned int count,
     */
     const float G = 4.4932e-15f;
 
-    // Номер звезды.
+    // Номер work-item'а.
     gid = get_global_id(1) * get_global_size(0) + get_global_id(0);
-    //lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
-    
-    // Если этот рабочий элемент - за пределами массива - прекратить работу.
-    // Почему-то в реализации с кэшем
-    // Это некорректно работает.
-    //if(gid >= count) return;
+    lid = get_local_id(1) * get_local_size(0) + get_local_id(0);
+    // Шаг между телами work-item'а.
+    stride = get_global_size(0) * get_global_size(1);
 
-    // Если work-item - звзеда.
-    if(gid < count){
-        // Загрузим данные.
-        // Позиция звезды.
-        position = vload3(gid, positions_in);
-        // Скорость звезды.
-        velocity = vload3(gid, velocities_in);
+    for(k = 0; k < NBODY_BODIES_PER_ITEM; k ++){
+        // Номер звезды.
+        body_index[k] = first_body + gid + k * stride;
+        // Обнулить ускорение.
+        accel[k] = ACCEL_ZERO;
+#ifdef NBODY_TILE_SUMS
+        accel_comp[k] = (float3)(0.0f, 0.0f, 0.0f);
+#endif
+        position[k] = (float3)(0.0f, 0.0f, 0.0f);
+        velocity[k] = (float3)(0.0f, 0.0f, 0.0f);
+        // Если тело - звзеда.
+        if(body_index[k] < end_body){
+            // Загрузим данные.
+            // Позиция звезды.
+            position[k] = vload3(body_index[k], positions_in);
+            // Скорость звезды.
+            velocity[k] = vload3(body_index[k], velocities_in);
+#ifdef NBODY_DRIFT_SOURCES
+            // Сдвиг до толчка.
+            position[k] += velocity[k] * (drift_pre * dt);
+#endif
+        }
     }
-    
-    // Обнулить ускорение.
-    accel = (float3)(0.0f, 0.0f, 0.0f);
 
     // Используемый кэш.
     cache_size_used = min((unsigned int)(get_local_size(0) * get_local_size(1)), cache_size);
 
     // Индекс в кэше.
-    cache_index = gid % cache_size_used;
+    cache_index = lid;
+
+// Взаимодействие тел work-item'а со звездой кэша.
+#define NBODY_INTERACT(cache_j) \
+    pos = vload3((cache_j), cached_pos); \
+    m = cached_mass[(cache_j)]; \
+    for(k = 0; k < NBODY_BODIES_PER_ITEM; k ++){ \
+        vec_dr = pos - position[k]; \
+        /* Не будем взаимодейтсвовать с собой. */ \
+        ACCEL_ADD(NBODY_ACCEL[k], (i + (cache_j) == body_index[k]) ? (float3)(0.0f, 0.0f, 0.0f) : \
+                                  vec_dr * (m * soft_inv_r3(dot(vec_dr, vec_dr)))); \
+    }
+
+// Взаимодействие с NBODY_UNROLL звёздами кэша подряд.
+// Подбираемые тюнером значения разворачиваются макросами,
+// иначе развёртку выполняет компилятор.
+#define NBODY_INTERACT_2(cache_j) NBODY_INTERACT(cache_j) NBODY_INTERACT((cache_j) + 1)
+#define NBODY_INTERACT_4(cache_j) NBODY_INTERACT_2(cache_j) NBODY_INTERACT_2((cache_j) + 2)
+#define NBODY_INTERACT_8(cache_j) NBODY_INTERACT_4(cache_j) NBODY_INTERACT_4((cache_j) + 4)
+#if NBODY_UNROLL == 8
+#define NBODY_INTERACT_UNROLLED(cache_j) NBODY_INTERACT_8(cache_j)
+#elif NBODY_UNROLL == 4
+#define NBODY_INTERACT_UNROLLED(cache_j) NBODY_INTERACT_4(cache_j)
+#elif NBODY_UNROLL == 2
+#define NBODY_INTERACT_UNROLLED(cache_j) NBODY_INTERACT_2(cache_j)
+#elif NBODY_UNROLL == 1
+#define NBODY_INTERACT_UNROLLED(cache_j) NBODY_INTERACT(cache_j)
+#else
+#define NBODY_INTERACT_UNROLLED(cache_j) \
+    for(u = 0; u < NBODY_UNROLL; u ++){ \
+        NBODY_INTERACT((cache_j) + u) \
+    }
+#endif
 
     for(i = 0; i < count; i += cache_count){
         // Количество данных для загрузки в кэш.
@@ -95,55 +337,2327 @@ __kernel void kernel_main(const unsigned int count,
         if(cache_index < cache_count){
             // Закэшируем данные.
             // Позиция очередной звезды.
+#ifdef NBODY_DRIFT_SOURCES
+            vstore3(vload3(pos_i, positions_in) + vload3(pos_i, velocities_in) * (drift_pre * dt),
+                    cache_index, cached_pos);
+#else
             vstore3(vload3(pos_i, positions_in), cache_index, cached_pos);
+#endif
             // Масса очередной звезды.
             cached_mass[cache_index] = masses[pos_i];
         }
         // Подождём всех.
         barrier(CLK_LOCAL_MEM_FENCE);
 
-        // Если work-item - звзеда.
+#ifdef NBODY_TILE_SUMS
+        for(k = 0; k < NBODY_BODIES_PER_ITEM; k ++){
+            tile_accel[k] = (float3)(0.0f, 0.0f, 0.0f);
+        }
+#endif
+
+        // Посчитаем взаимодействие со звёздами в кэше,
+        // по NBODY_UNROLL звёзд за итерацию.
+        for(j = 0; j + NBODY_UNROLL <= cache_count; j += NBODY_UNROLL){
+            NBODY_INTERACT_UNROLLED(j)
+        }
+        // Оставшиеся звёзды.
+        for(; j < cache_count; j ++){
+            NBODY_INTERACT(j)
+        }
+
+#ifdef NBODY_TILE_SUMS
+        // Добавим суммы плитки к полным суммам.
+        for(k = 0; k < NBODY_BODIES_PER_ITEM; k ++){
+            kahan_add(&accel[k], &accel_comp[k], tile_accel[k]);
+        }
+#endif
+        // Подождём всех.
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+#undef NBODY_INTERACT_UNROLLED
+#undef NBODY_INTERACT_8
+#undef NBODY_INTERACT_4
+#undef NBODY_INTERACT_2
+#undef NBODY_INTERACT
+#undef NBODY_ACCEL
+
+    for(k = 0; k < NBODY_BODIES_PER_ITEM; k ++){
+        // Если тело - звзеда.
+        if(body_index[k] < end_body){
+            // Умножим на вынесенную за скобки
+            // гравитационную постоянную.
+            // Вычислим новую скорость.
+            velocity[k] = kick_velocity(velocity[k], accel[k], G * kick * dt);
+            // Вычислим новую позицию.
+            position[k] += velocity[k] * (drift_post * dt);
+
+            // Сохраним новую скорость в массив.
+            vstore3(velocity[k], body_index[k], velocities_out);
+
+            // Сохраним новую позицию в массив.
+            vstore3(position[k], body_index[k], positions_out);
+        }
+    }
+}
+
+
+/**
+ * @brief Ядро подшага сдвиг-толчок-сдвиг для упакованных данных.
+ * Аналогично kernel_main, но позиции и массы хранятся
+ * выровненными векторами (x, y, z, m) в глобальной
+ * и локальной памяти, что даёт одно 16-байтовое чтение на тело.
+ * @param count Число тел.
+ * @param bodies_in Исходные данные - буфер позиций и масс.
+ * @param bodies_out Результат - буфер позиций и масс.
+ * @param velocities_in Исходные данные - буфер скоростей.
+ * @param velocities_out Результат - буфер скоростей.
+ * @param dt Время шага.
+ * @param cached_bodies Кэш позиций и масс.
+ * @param cache_size Размер кэша.
+ * @param drift_pre Доля шага сдвига до толчка.
+ * @param kick Доля шага толчка.
+ * @param drift_post Доля шага сдвига после толчка.
+ */
+__kernel void kernel_main_packed(const unsigned int count,
+                                 const __global float4* bodies_in, __global float4* bodies_out,
+                                 const __global float* velocities_in, __global float* velocities_out,
+                                 const float dt,
+                                 __local float4* cached_bodies, unsigned int cache_size,
+                                 const float drift_pre, const float kick, const float drift_post)
+{
+    const float G = 4.4932e-15f;
+
+    // Номер звезды.
+    unsigned int gid = get_global_id(0);
+
+    float4 body = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    float3 velocity = (float3)(0.0f, 0.0f, 0.0f);
+
+    if(gid < count){
+        body = bodies_in[gid];
+        velocity = vload3(gid, velocities_in);
+#ifdef NBODY_DRIFT_SOURCES
+        body.xyz += velocity * (drift_pre * dt);
+#endif
+    }
+
+    accel_t accel = ACCEL_ZERO;
+#ifdef NBODY_TILE_SUMS
+    float3 accel_comp = (float3)(0.0f, 0.0f, 0.0f);
+#endif
+
+    // Используемый кэш.
+    unsigned int cache_size_used = min((unsigned int)get_local_size(0), cache_size);
+    // Индекс в кэше.
+    unsigned int cache_index = get_local_id(0);
+
+    unsigned int cache_count;
+    for(unsigned int i = 0; i < count; i += cache_count){
+        cache_count = min(cache_size_used, count - i);
+        if(cache_index < cache_count){
+            float4 src = bodies_in[i + cache_index];
+#ifdef NBODY_DRIFT_SOURCES
+            src.xyz += vload3(i + cache_index, velocities_in) * (drift_pre * dt);
+#endif
+            cached_bodies[cache_index] = src;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
         if(gid < count){
-            // Посчитаем взаимодействие со звёздами в кэше.
-            for(j = 0; j < cache_count; j ++){
-                // Не будем взаимодейтсвовать с собой.
+#ifdef NBODY_TILE_SUMS
+            float3 tile_accel = (float3)(0.0f, 0.0f, 0.0f);
+#define NBODY_ACCEL tile_accel
+#else
+#define NBODY_ACCEL accel
+#endif
+            for(unsigned int j = 0; j < cache_count; j ++){
                 if(i + j == gid) continue;
-                // Получим позицию звезды.
-                pos = vload3(j, cached_pos);
-                // Получим массу звезды.
-                m = cached_mass[j];
-                // Получим направление вектора скорости и ускорения.
-                vec_dr = pos - position;
-                // Получим длину вектора.
-                r = length(vec_dr);
-                // Предотвратим слишком близкое сближение и уход ускорения в бесконечность.
-                r = max(r, RADIUS_EPSILON);
-                // Нормализуем вектор.
-                vec_dr = vec_dr / r;
-                // Вычислим и накомпи ускорение от взаимодействия с очередной звездой.
-                accel += vec_dr * m / ( r * r );
+                float4 src = cached_bodies[j];
+                float3 vec_dr = src.xyz - body.xyz;
+                ACCEL_ADD(NBODY_ACCEL, vec_dr * (src.w * soft_inv_r3(dot(vec_dr, vec_dr))));
             }
+#undef NBODY_ACCEL
+#ifdef NBODY_TILE_SUMS
+            kahan_add(&accel, &accel_comp, tile_accel);
+#endif
         }
-        // Подождём всех.
         barrier(CLK_LOCAL_MEM_FENCE);
     }
+    if(gid < count){
+        velocity = kick_velocity(velocity, accel, G * kick * dt);
+        body.xyz += velocity * (drift_post * dt);
+
+        vstore3(velocity, gid, velocities_out);
+        bodies_out[gid] = body;
+    }
+}
+
+
+/**
+ * @brief Упаковывает позиции и массы в векторы (x, y, z, m).
+ * @param count Число тел.
+ * @param positions Позиции.
+ * @param masses Массы.
+ * @param bodies Результат - позиции и массы.
+ */
+__kernel void kernel_pack_bodies(const unsigned int count,
+                                 const __global float* positions, const __global float* masses,
+                                 __global float4* bodies)
+{
+    unsigned int gid = get_global_id(0);
+
+    if(gid >= count) return;
+
+    bodies[gid] = (float4)(vload3(gid, positions), masses[gid]);
+}
+
+
+/**
+ * @brief Распаковывает позиции из векторов (x, y, z, m)
+ * в буфер позиций для отрисовки.
+ * @param count Число тел.
+ * @param bodies Позиции и массы.
+ * @param positions Результат - позиции.
+ */
+__kernel void kernel_unpack_positions(const unsigned int count,
+                                      const __global float4* bodies, __global float* positions)
+{
+    unsigned int gid = get_global_id(0);
+
+    if(gid >= count) return;
+
+    vstore3(bodies[gid].xyz, gid, positions);
+}
+
+/**
+ * @brief Узел октодерева.
+ * Расположение полей совпадает
+ * со структурой Octree::Node.
+ */
+typedef struct _tree_node {
+    float4 com;  //!< Центр масс (x, y, z) и масса (w).
+    float size;  //!< Размер ячейки.
+    int child;   //!< Индекс первого потомка, либо число тел листа со знаком минус.
+    int next;    //!< Индекс узла, следующего за поддеревом, либо -1.
+    int first;   //!< Индекс первого тела узла в массиве индексов.
+} tree_node_t;
+
+
+/**
+ * @brief Вычисляет ускорение от тела без
+ * гравитационной постоянной.
+ * @param vec_dr Вектор до тела.
+ * @param m Масса тела.
+ * @return Ускорение.
+ */
+inline float3 body_accel(float3 vec_dr, float m)
+{
+    // Ускорение от взаимодействия.
+    return vec_dr * (m * soft_inv_r3(dot(vec_dr, vec_dr)));
+}
+
+
+/**
+ * @brief Ядро расчёта методом Барнса-Хата.
+ * @param count Число тел.
+ * @param positions_in Исходные данные - буфер позиций.
+ * @param positions_out Результат - буфер позиций.
+ * @param velocities_in Исходные данные - буфер скоростей.
+ * @param velocities_out Результат - буфер скоростей.
+ * @param masses Исходные данные - буфер масс.
+ * @param dt Время шага.
+ * @param nodes Узлы октодерева в порядке обхода в глубину.
+ * @param indices Индексы тел в порядке обхода дерева.
+ * @param theta2 Квадрат параметра точности.
+ */
+__kernel void kernel_barnes_hut(const unsigned int count,
+                                const __global float* positions_in, __global float* positions_out,
+                                const __global float* velocities_in, __global float* velocities_out,
+                                const __global float* masses, const float dt,
+                                const __global tree_node_t* nodes, const __global int* indices,
+                                const float theta2)
+{
+    unsigned int gid;
+    int node;
+    int k;
+    int j;
+
+    float3 position, velocity;
+    float3 accel;
+    float3 vec_dr;
+    float r2;
+
+    tree_node_t cur;
+
+    /*
+    G, PC^3 / (Msun * Year^2)
+    */
+    const float G = 4.4932e-15f;
+
+    // Номер звезды.
+    gid = get_global_id(0);
+
+    // Если этот рабочий элемент - за пределами массива - прекратить работу.
+    if(gid >= count) return;
+
+    // Позиция звезды.
+    position = vload3(gid, positions_in);
+    // Скорость звезды.
+    velocity = vload3(gid, velocities_in);
+
+    // Обнулить ускорение.
+    accel = (float3)(0.0f, 0.0f, 0.0f);
+
+    // Обойдём дерево начиная с корня.
+    node = 0;
+    while(node >= 0){
+        cur = nodes[node];
+
+        // Если узел - лист.
+        if(cur.child < 0){
+            // Посчитаем взаимодействие с каждым телом листа.
+            for(k = 0; k < -cur.child; k ++){
+                j = indices[cur.first + k];
+                // Не будем взаимодейтсвовать с собой.
+                if(j == (int)gid) continue;
+                accel += body_accel(vload3(j, positions_in) - position, masses[j]);
+            }
+            node = cur.next;
+            continue;
+        }
+
+        // Направление на центр масс ячейки.
+        vec_dr = cur.com.xyz - position;
+        // Квадрат расстояния.
+        r2 = dot(vec_dr, vec_dr);
+
+        // Если ячейка достаточно далеко -
+        // заменим её содержимое центром масс.
+        if(cur.size * cur.size < theta2 * r2){
+            accel += body_accel(vec_dr, cur.com.w);
+            node = cur.next;
+        }else{
+            // Иначе спустимся к потомкам.
+            node = cur.child;
+        }
+    }
+
     // Умножим на вынесенную за скобки
     // гравитационную постоянную.
-    accel *=  G;
+    accel *= G;
 
-    // Если work-item - звзеда.
-    if(gid < count){
-        // Вычислим новую скорость.
-        velocity += accel * dt;
-        // Вычислим новую позицию.
-        position += velocity * dt;
+    // Вычислим новую скорость.
+    velocity += accel * dt;
+    // Вычислим новую позицию.
+    position += velocity * dt;
 
-        //velocity = (float3)((float)gid, (float)lid, (float)i);
+    // Сохраним новую скорость в массив.
+    vstore3(velocity, gid, velocities_out);
+    // Сохраним новую позицию в массив.
+    vstore3(position, gid, positions_out);
+}
 
-        // Сохраним новую скорость в массив.
-        vstore3(velocity, gid, velocities_out);
 
-        // Сохраним новую позицию в массив.
-        vstore3(position, gid, positions_out);
+/*
+ * Построение дерева на устройстве.
+ * Тела упорядочиваются по кодам Мортона поразрядной сортировкой,
+ * по отсортированным кодам строится бинарное дерево (Karras, 2012),
+ * совместимое по формату узлов с ядром kernel_barnes_hut:
+ * внутренние узлы имеют индексы 0 .. count - 2 (корень - 0),
+ * листья - count - 1 .. 2 * count - 2.
+ */
+
+#ifdef NBODY_MORTON_64
+//! Код Мортона - 63 бита.
+typedef ulong morton_t;
+//! Число бит кода на одну ось.
+#define MORTON_AXIS_BITS 21
+//! Число бит ключа.
+#define MORTON_KEY_BITS 64
+#else
+//! Код Мортона - 30 бит.
+typedef uint morton_t;
+//! Число бит кода на одну ось.
+#define MORTON_AXIS_BITS 10
+//! Число бит ключа.
+#define MORTON_KEY_BITS 32
+#endif
+
+//! Число бит разряда поразрядной сортировки.
+#define RADIX_BITS 4
+//! Число значений разряда.
+#define RADIX_DIGITS 16
+
+
+/**
+ * @brief Первый этап вычисления ограничивающего параллелепипеда.
+ * Размер рабочей группы должен быть степенью двойки.
+ * @param count Число тел.
+ * @param positions Позиции тел.
+ * @param partial Результат - минимум и максимум для каждой группы.
+ * @param local_min Локальный буфер минимумов.
+ * @param local_max Локальный буфер максимумов.
+ */
+__kernel void kernel_tree_bounds(const unsigned int count, const __global float* positions,
+                                 __global float4* partial,
+                                 __local float4* local_min, __local float4* local_max)
+{
+    unsigned int lid = get_local_id(0);
+    unsigned int i;
+    unsigned int s;
+
+    float4 bmin = (float4)(MAXFLOAT);
+    float4 bmax = (float4)(-MAXFLOAT);
+    float4 p;
+
+    // Пройдём по телам с шагом в глобальный размер.
+    for(i = get_global_id(0); i < count; i += get_global_size(0)){
+        p = (float4)(vload3(i, positions), 0.0f);
+        bmin = fmin(bmin, p);
+        bmax = fmax(bmax, p);
+    }
+
+    local_min[lid] = bmin;
+    local_max[lid] = bmax;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Редукция в локальной памяти.
+    for(s = get_local_size(0) >> 1; s > 0; s >>= 1){
+        if(lid < s){
+            local_min[lid] = fmin(local_min[lid], local_min[lid + s]);
+            local_max[lid] = fmax(local_max[lid], local_max[lid + s]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(lid == 0){
+        partial[get_group_id(0) * 2] = local_min[0];
+        partial[get_group_id(0) * 2 + 1] = local_max[0];
+    }
+}
+
+/**
+ * @brief Второй этап вычисления ограничивающего параллелепипеда.
+ * Выполняется одной рабочей группой.
+ * @param groups Число результатов первого этапа.
+ * @param partial Минимумы и максимумы групп первого этапа.
+ * @param bounds Результат - минимум и максимум.
+ * @param local_min Локальный буфер минимумов.
+ * @param local_max Локальный буфер максимумов.
+ */
+__kernel void kernel_tree_bounds_merge(const unsigned int groups, const __global float4* partial,
+                                       __global float4* bounds,
+                                       __local float4* local_min, __local float4* local_max)
+{
+    unsigned int lid = get_local_id(0);
+    unsigned int i;
+    unsigned int s;
+
+    float4 bmin = (float4)(MAXFLOAT);
+    float4 bmax = (float4)(-MAXFLOAT);
+
+    for(i = lid; i < groups; i += get_local_size(0)){
+        bmin = fmin(bmin, partial[i * 2]);
+        bmax = fmax(bmax, partial[i * 2 + 1]);
+    }
+
+    local_min[lid] = bmin;
+    local_max[lid] = bmax;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(s = get_local_size(0) >> 1; s > 0; s >>= 1){
+        if(lid < s){
+            local_min[lid] = fmin(local_min[lid], local_min[lid + s]);
+            local_max[lid] = fmax(local_max[lid], local_max[lid + s]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(lid == 0){
+        bounds[0] = local_min[0];
+        bounds[1] = local_max[0];
+    }
+}
+
+#ifdef NBODY_MORTON_64
+/**
+ * @brief Разносит младшие 21 бит числа через два бита.
+ * @param v Число.
+ * @return Результат.
+ */
+inline morton_t morton_expand(morton_t v)
+{
+    v &= 0x1fffffUL;
+    v = (v | v << 32) & 0x1f00000000ffffUL;
+    v = (v | v << 16) & 0x1f0000ff0000ffUL;
+    v = (v | v << 8)  & 0x100f00f00f00f00fUL;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3UL;
+    v = (v | v << 2)  & 0x1249249249249249UL;
+    return v;
+}
+#else
+/**
+ * @brief Разносит младшие 10 бит числа через два бита.
+ * @param v Число.
+ * @return Результат.
+ */
+inline morton_t morton_expand(morton_t v)
+{
+    v = (v * 0x00010001u) & 0xff0000ffu;
+    v = (v * 0x00000101u) & 0x0f00f00fu;
+    v = (v * 0x00000011u) & 0xc30c30c3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+#endif
+
+/**
+ * @brief Вычисление кодов Мортона.
+ * @param count Число тел.
+ * @param positions Позиции тел.
+ * @param bounds Ограничивающий параллелепипед.
+ * @param keys Результат - коды Мортона.
+ * @param values Результат - индексы тел.
+ */
+__kernel void kernel_tree_morton(const unsigned int count, const __global float* positions,
+                                 const __global float4* bounds,
+                                 __global morton_t* keys, __global int* values)
+{
+    unsigned int gid = get_global_id(0);
+
+    if(gid >= count) return;
+
+    const float cells = (float)((1 << MORTON_AXIS_BITS) - 1);
+
+    float3 lo = bounds[0].xyz;
+    float3 ext = max(bounds[1].xyz - lo, (float3)(RADIUS_EPSILON));
+
+    // Нормализованная позиция.
+    float3 t = clamp((vload3(gid, positions) - lo) / ext, 0.0f, 1.0f) * cells;
+
+    keys[gid] = (morton_expand((morton_t)t.x) << 2) |
+                (morton_expand((morton_t)t.y) << 1) |
+                 morton_expand((morton_t)t.z);
+    values[gid] = gid;
+}
+
+/**
+ * @brief Гистограмма разряда поразрядной сортировки.
+ * Размер рабочей группы - не менее RADIX_DIGITS.
+ * @param count Число ключей.
+ * @param keys Ключи.
+ * @param shift Сдвиг разряда.
+ * @param block_size Число ключей, обрабатываемых группой.
+ * @param histogram Результат - гистограмма, [разряд][группа].
+ */
+__kernel void kernel_radix_histogram(const unsigned int count, const __global morton_t* keys,
+                                     const unsigned int shift, const unsigned int block_size,
+                                     __global unsigned int* histogram)
+{
+    __local unsigned int local_hist[RADIX_DIGITS];
+
+    unsigned int lid = get_local_id(0);
+    unsigned int begin = get_group_id(0) * block_size;
+    unsigned int end = min(begin + block_size, count);
+    unsigned int i;
+
+    if(lid < RADIX_DIGITS) local_hist[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(i = begin + lid; i < end; i += get_local_size(0)){
+        atomic_inc(&local_hist[(unsigned int)(keys[i] >> shift) & (RADIX_DIGITS - 1)]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if(lid < RADIX_DIGITS){
+        histogram[lid * get_num_groups(0) + get_group_id(0)] = local_hist[lid];
     }
 }
+
+/**
+ * @brief Исключающая префиксная сумма.
+ * Выполняется одной рабочей группой.
+ * @param n Число элементов.
+ * @param data Данные.
+ * @param sums Локальный буфер сумм.
+ */
+__kernel void kernel_radix_scan(const unsigned int n, __global unsigned int* data,
+                                __local unsigned int* sums)
+{
+    unsigned int lid = get_local_id(0);
+    unsigned int lsize = get_local_size(0);
+    unsigned int chunk = (n + lsize - 1) / lsize;
+    unsigned int begin = lid * chunk;
+    unsigned int end = min(begin + chunk, n);
+    unsigned int sum = 0;
+    unsigned int run;
+    unsigned int v;
+    unsigned int i;
+    unsigned int off;
+
+    // Сумма своего участка.
+    for(i = begin; i < end; i ++) sum += data[i];
+
+    sums[lid] = sum;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Включающая сумма по участкам.
+    for(off = 1; off < lsize; off <<= 1){
+        v = (lid >= off) ? sums[lid - off] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        sums[lid] += v;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Исключающая сумма внутри участка.
+    run = sums[lid] - sum;
+    for(i = begin; i < end; i ++){
+        v = data[i];
+        data[i] = run;
+        run += v;
+    }
+}
+
+/**
+ * @brief Устойчивое перемещение ключей по разряду.
+ * Группа обрабатывает свой блок порциями по размеру группы,
+ * каждая порция сортируется в локальной памяти
+ * четырьмя однобитными разбиениями.
+ * Размер рабочей группы - степень двойки, не менее RADIX_DIGITS.
+ * @param count Число ключей.
+ * @param keys_in Исходные ключи.
+ * @param values_in Исходные значения.
+ * @param keys_out Результат - ключи.
+ * @param values_out Результат - значения.
+ * @param shift Сдвиг разряда.
+ * @param block_size Число ключей, обрабатываемых группой.
+ * @param histogram Префиксные суммы гистограммы.
+ * @param tile_keys Локальный буфер ключей.
+ * @param tile_values Локальный буфер значений.
+ * @param tile_scan Локальный буфер префиксных сумм.
+ */
+__kernel void kernel_radix_scatter(const unsigned int count,
+                                   const __global morton_t* keys_in, const __global int* values_in,
+                                   __global morton_t* keys_out, __global int* values_out,
+                                   const unsigned int shift, const unsigned int block_size,
+                                   const __global unsigned int* histogram,
+                                   __local morton_t* tile_keys, __local int* tile_values,
+                                   __local unsigned int* tile_scan)
+{
+    __local unsigned int digit_offset[RADIX_DIGITS];
+    __local unsigned int digit_start[RADIX_DIGITS];
+    __local unsigned int digit_count[RADIX_DIGITS];
+
+    unsigned int lid = get_local_id(0);
+    unsigned int lsize = get_local_size(0);
+    unsigned int begin = get_group_id(0) * block_size;
+    unsigned int end = min(begin + block_size, count);
+    unsigned int base;
+    unsigned int tile_count;
+    unsigned int b;
+    unsigned int off;
+    unsigned int v;
+    unsigned int bit;
+    unsigned int excl;
+    unsigned int total_false;
+    unsigned int pos;
+    unsigned int digit;
+
+    morton_t key;
+    int value;
+
+    if(lid < RADIX_DIGITS){
+        digit_offset[lid] = histogram[lid * get_num_groups(0) + get_group_id(0)];
+    }
+
+    for(base = begin; base < end; base += lsize){
+        tile_count = min(lsize, end - base);
+
+        // Недостающие элементы имеют наибольший разряд
+        // и после устойчивой сортировки остаются в конце.
+        if(lid < tile_count){
+            key = keys_in[base + lid];
+            value = values_in[base + lid];
+        }else{
+            key = ~(morton_t)0;
+            value = -1;
+        }
+
+        if(lid < RADIX_DIGITS) digit_count[lid] = 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if(lid < tile_count){
+            atomic_inc(&digit_count[(unsigned int)(key >> shift) & (RADIX_DIGITS - 1)]);
+        }
+
+        // Отсортируем порцию по разряду.
+        for(b = 0; b < RADIX_BITS; b ++){
+            bit = (unsigned int)(key >> (shift + b)) & 1;
+
+            tile_scan[lid] = 1 - bit;
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            for(off = 1; off < lsize; off <<= 1){
+                v = (lid >= off) ? tile_scan[lid - off] : 0;
+                barrier(CLK_LOCAL_MEM_FENCE);
+                tile_scan[lid] += v;
+                barrier(CLK_LOCAL_MEM_FENCE);
+            }
+
+            excl = tile_scan[lid] - (1 - bit);
+            total_false = tile_scan[lsize - 1];
+            pos = bit ? total_false + (lid - excl) : excl;
+
+            tile_keys[pos] = key;
+            tile_values[pos] = value;
+            barrier(CLK_LOCAL_MEM_FENCE);
+
+            key = tile_keys[lid];
+            value = tile_values[lid];
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        // Начала разрядов в порции.
+        digit = (unsigned int)(key >> shift) & (RADIX_DIGITS - 1);
+        if(lid == 0 || digit != ((unsigned int)(tile_keys[lid - 1] >> shift) & (RADIX_DIGITS - 1))){
+            digit_start[digit] = lid;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if(lid < tile_count){
+            pos = digit_offset[digit] + lid - digit_start[digit];
+            keys_out[pos] = key;
+            values_out[pos] = value;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if(lid < RADIX_DIGITS) digit_offset[lid] += digit_count[lid];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+/**
+ * @brief Длина общего префикса ключей.
+ * Для равных ключей учитываются индексы.
+ * @param keys Отсортированные ключи.
+ * @param count Число ключей.
+ * @param i Индекс первого ключа.
+ * @param j Индекс второго ключа.
+ * @return Длина общего префикса, -1 если j вне массива.
+ */
+inline int tree_delta(const __global morton_t* keys, int count, int i, int j)
+{
+    morton_t ki, kj;
+
+    if(j < 0 || j >= count) return -1;
+
+    ki = keys[i];
+    kj = keys[j];
+
+    if(ki == kj) return MORTON_KEY_BITS + (int)clz((unsigned int)(i ^ j));
+
+    return (int)clz(ki ^ kj);
+}
+
+/**
+ * @brief Построение внутренних узлов дерева.
+ * @param count Число тел.
+ * @param keys Отсортированные коды Мортона.
+ * @param nodes Результат - узлы дерева (поля child и first).
+ * @param parents Результат - родители узлов.
+ * @param split_right Результат - правый потомок узла по точке разбиения.
+ * @param range_last Результат - последнее тело узла.
+ * @param flags Флаги посещения узлов, обнуляются.
+ */
+__kernel void kernel_tree_internal(const int count, const __global morton_t* keys,
+                                   __global tree_node_t* nodes, __global int* parents,
+                                   __global int* split_right, __global int* range_last,
+                                   __global int* flags)
+{
+    int i = get_global_id(0);
+    int d;
+    int dmin;
+    int dnode;
+    int lmax;
+    int l;
+    int s;
+    int t;
+    int j;
+    int gamma;
+    int first;
+    int last;
+    int left;
+    int right;
+
+    if(i >= count - 1) return;
+
+    // Направление диапазона.
+    d = (tree_delta(keys, count, i, i + 1) - tree_delta(keys, count, i, i - 1)) >= 0 ? 1 : -1;
+
+    // Верхняя граница длины диапазона.
+    dmin = tree_delta(keys, count, i, i - d);
+    lmax = 2;
+    while(tree_delta(keys, count, i, i + lmax * d) > dmin) lmax <<= 1;
+
+    // Длина диапазона.
+    l = 0;
+    for(t = lmax >> 1; t >= 1; t >>= 1){
+        if(tree_delta(keys, count, i, i + (l + t) * d) > dmin) l += t;
+    }
+    j = i + l * d;
+
+    // Точка разбиения.
+    dnode = tree_delta(keys, count, i, j);
+    s = 0;
+    t = l;
+    do{
+        t = (t + 1) >> 1;
+        if(tree_delta(keys, count, i, i + (s + t) * d) > dnode) s += t;
+    }while(t > 1);
+    gamma = i + s * d + min(d, 0);
+
+    first = min(i, j);
+    last = max(i, j);
+
+    left = (first == gamma) ? (count - 1 + gamma) : gamma;
+    right = (last == gamma + 1) ? (count + gamma) : (gamma + 1);
+
+    nodes[i].child = left;
+    nodes[i].first = first;
+    range_last[i] = last;
+    split_right[gamma] = right;
+    parents[left] = i;
+    parents[right] = i;
+    flags[i] = 0;
+
+    if(i == 0) parents[0] = -1;
+}
+
+/**
+ * @brief Заполнение листьев и вычисление
+ * центров масс и размеров узлов снизу вверх.
+ * Узел обрабатывается вторым пришедшим к нему потомком.
+ * @param count Число тел.
+ * @param positions Позиции тел.
+ * @param masses Массы тел.
+ * @param values Индексы тел в порядке кодов Мортона.
+ * @param nodes Узлы дерева.
+ * @param boxes Ограничивающие параллелепипеды узлов.
+ * @param parents Родители узлов.
+ * @param split_right Правый потомок узла по точке разбиения.
+ * @param range_last Последнее тело узла.
+ * @param flags Флаги посещения узлов.
+ */
+__kernel void kernel_tree_summarize(const int count,
+                                    const __global float* positions, const __global float* masses,
+                                    const __global int* values,
+                                    __global tree_node_t* nodes, volatile __global float4* boxes,
+                                    const __global int* parents, const __global int* split_right,
+                                    const __global int* range_last, volatile __global int* flags)
+{
+    int j = get_global_id(0);
+    int body;
+    int leaf;
+    int node;
+    int left;
+    int right;
+    int gamma;
+    int last;
+
+    float3 p;
+    float4 cl, cr;
+    float4 bmin, bmax;
+    float4 ext;
+    float m;
+
+    tree_node_t n;
+
+    if(j >= count) return;
+
+    body = values[j];
+    leaf = count - 1 + j;
+    p = vload3(body, positions);
+
+    // Лист - одно тело.
+    n.com = (float4)(p, masses[body]);
+    n.size = 0.0f;
+    n.child = -1;
+    n.next = (j == count - 1) ? -1 : split_right[j];
+    n.first = j;
+    nodes[leaf] = n;
+
+    boxes[leaf * 2] = (float4)(p, 0.0f);
+    boxes[leaf * 2 + 1] = (float4)(p, 0.0f);
+
+    if(count == 1) return;
+
+    node = parents[leaf];
+    while(node >= 0){
+        mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+        // Первый пришедший потомок завершает работу.
+        if(atomic_inc(&flags[node]) == 0) return;
+
+        left = nodes[node].child;
+        gamma = (left < count - 1) ? left : (left - (count - 1));
+        right = split_right[gamma];
+
+        cl = *(volatile __global float4*)&nodes[left].com;
+        cr = *(volatile __global float4*)&nodes[right].com;
+
+        m = cl.w + cr.w;
+        if(m > 0.0f){
+            n.com = (float4)((cl.xyz * cl.w + cr.xyz * cr.w) / m, m);
+        }else{
+            n.com = (float4)((cl.xyz + cr.xyz) * 0.5f, 0.0f);
+        }
+
+        bmin = fmin(boxes[left * 2], boxes[right * 2]);
+        bmax = fmax(boxes[left * 2 + 1], boxes[right * 2 + 1]);
+        ext = bmax - bmin;
+
+        last = range_last[node];
+
+        nodes[node].com = n.com;
+        nodes[node].size = max(ext.x, max(ext.y, ext.z));
+        nodes[node].next = (last == count - 1) ? -1 : split_right[last];
+
+        boxes[node * 2] = bmin;
+        boxes[node * 2 + 1] = bmax;
+
+        node = parents[node];
+    }
+}
+
+
+//! Максимальный порядок разложения FMM.
+#define FMM_ORDER_MAX 8
+
+/**
+ * @brief Лист дерева FMM.
+ * Расположение полей совпадает
+ * со структурой Fmm::Leaf.
+ */
+typedef struct _fmm_leaf {
+    float4 center;  //!< Центр разложения (x, y, z) и масштаб (w), 0 - без масштаба.
+    int first;      //!< Индекс первого тела в массиве индексов.
+    int count;      //!< Число тел.
+    int near_begin; //!< Начало списка ближних листьев.
+    int near_end;   //!< Конец списка ближних листьев.
+} fmm_leaf_t;
+
+
+//! Число членов разложения максимального порядка.
+#define FMM_TERMS_MAX ((FMM_ORDER_MAX + 1) * (FMM_ORDER_MAX + 2) * (FMM_ORDER_MAX + 3) / 6)
+//! Нижняя граница масштаба разложений относительно размера дерева.
+#define FMM_SCALE_FLOOR 1e-6f
+
+//! Счётчики двойного обхода дерева.
+#define FMM_COUNTER_OVERFLOW 0
+#define FMM_COUNTER_M2L 1
+#define FMM_COUNTER_NEAR 2
+#define FMM_COUNTER_PASSES 3
+
+//! Флаги переполнения списков двойного обхода.
+#define FMM_OVERFLOW_PAIRS 1
+#define FMM_OVERFLOW_M2L 2
+#define FMM_OVERFLOW_NEAR 4
+
+//! Таблицы членов свёртки разложений.
+#define FMM_TABLE_M2M 0
+#define FMM_TABLE_M2L 1
+#define FMM_TABLE_L2L 2
+
+/**
+ * @brief Член свёртки разложений.
+ * Расположение полей совпадает
+ * со структурой Fmm::DeviceTerm.
+ */
+typedef struct _fmm_term {
+    int src;    //!< Индекс исходного коэффициента.
+    int aux;    //!< Индекс вспомогательного коэффициента.
+    float coef; //!< Множитель.
+} fmm_term_t;
+
+
+/**
+ * @brief Число тел узла дерева.
+ * @param nodes Узлы дерева.
+ * @param count Число тел.
+ * @param node Узел.
+ * @return Число тел.
+ */
+inline int fmm_node_count(const __global tree_node_t* nodes, int count, int node)
+{
+    int next = nodes[node].next;
+    return (next >= 0 ? nodes[next].first : count) - nodes[node].first;
+}
+
+/**
+ * @brief Масштаб разложений узла.
+ * Коэффициенты хранятся в единицах масштаба узла,
+ * чтобы степени высокого порядка оставались
+ * в пределах чисел одинарной точности.
+ * @param radius Радиус узла.
+ * @param root_size Размер корня дерева.
+ * @return Масштаб.
+ */
+inline float fmm_scale(float radius, float root_size)
+{
+    return fmax(radius, fmax(root_size * FMM_SCALE_FLOOR, FLT_MIN));
+}
+
+/**
+ * @brief Степени числа от 0 до FMM_ORDER_MAX.
+ * @param x Число.
+ * @param powers Результат.
+ */
+inline void fmm_powers(float x, float* powers)
+{
+    int t;
+
+    powers[0] = 1.0f;
+    for(t = 1; t <= FMM_ORDER_MAX; t ++) powers[t] = powers[t - 1] * x;
+}
+
+/**
+ * @brief Одночлены d^k для всех членов разложения.
+ * @param d Вектор.
+ * @param exps Степени членов разложения.
+ * @param terms Число членов разложения.
+ * @param powers Результат.
+ */
+inline void fmm_monomials(float3 d, const __global int4* exps, unsigned int terms, float* powers)
+{
+    float px[FMM_ORDER_MAX + 1];
+    float py[FMM_ORDER_MAX + 1];
+    float pz[FMM_ORDER_MAX + 1];
+    unsigned int t;
+    int4 e;
+
+    fmm_powers(d.x, px);
+    fmm_powers(d.y, py);
+    fmm_powers(d.z, pz);
+
+    for(t = 0; t < terms; t ++){
+        e = exps[t];
+        powers[t] = px[e.x] * py[e.y] * pz[e.z];
+    }
+}
+
+/**
+ * @brief Коэффициенты Тейлора 1/|u| для единичного вектора.
+ * Используется рекуррентное соотношение
+ * |k| T(k) + (2|k| - 1) sum u_i T(k - e_i) + (|k| - 1) sum T(k - 2e_i) = 0.
+ * @param u Единичный вектор.
+ * @param recurrence Индексы рекуррентного соотношения, по два на член.
+ * @param terms Число членов разложения.
+ * @param coefs Результат.
+ */
+inline void fmm_derivatives(float3 u, const __global int4* recurrence, unsigned int terms, float* coefs)
+{
+    unsigned int t;
+    int4 a, b;
+    float sum1, sum2;
+
+    coefs[0] = 1.0f;
+
+    for(t = 1; t < terms; t ++){
+        a = recurrence[t * 2];
+        b = recurrence[t * 2 + 1];
+
+        sum1 = 0.0f;
+        if(a.y >= 0) sum1 += u.x * coefs[a.y];
+        if(a.z >= 0) sum1 += u.y * coefs[a.z];
+        if(a.w >= 0) sum1 += u.z * coefs[a.w];
+
+        sum2 = 0.0f;
+        if(b.x >= 0) sum2 += coefs[b.x];
+        if(b.y >= 0) sum2 += coefs[b.y];
+        if(b.z >= 0) sum2 += coefs[b.z];
+
+        coefs[t] = -((2 * a.x - 1) * sum1 + (a.x - 1) * sum2) / a.x;
+    }
+}
+
+/**
+ * @brief Добавляет пару узлов в список следующего прохода обхода.
+ */
+inline void fmm_push_pair(__global unsigned int* counters, unsigned int pass,
+                          __global int2* pairs, unsigned int capacity, int target, int source)
+{
+    unsigned int idx = atomic_inc(&counters[FMM_COUNTER_PASSES + pass + 1]);
+
+    if(idx < capacity) pairs[idx] = (int2)(target, source);
+    else atomic_or(&counters[FMM_COUNTER_OVERFLOW], FMM_OVERFLOW_PAIRS);
+}
+
+/**
+ * @brief Добавляет пару слотов в список взаимодействий.
+ * Запоминается номер пары в группе приёмника.
+ */
+inline void fmm_push_list(__global unsigned int* counters, unsigned int counter, unsigned int overflow,
+                          __global int4* list, __global unsigned int* group_counts, unsigned int capacity,
+                          int target, int source)
+{
+    unsigned int idx = atomic_inc(&counters[counter]);
+    unsigned int k = atomic_inc(&group_counts[target]);
+
+    if(idx < capacity) list[idx] = (int4)(target, source, (int)k, 0);
+    else atomic_or(&counters[FMM_COUNTER_OVERFLOW], overflow);
+}
+
+/**
+ * @brief Исключающая префиксная сумма внутри блоков.
+ * Группа обрабатывает свой блок порциями по размеру группы.
+ * @param n Число элементов.
+ * @param data Данные.
+ * @param block_size Число элементов, обрабатываемых группой.
+ * @param block_sums Результат - суммы блоков.
+ * @param sums Локальный буфер сумм.
+ */
+__kernel void kernel_scan_blocks(const unsigned int n, __global unsigned int* data,
+                                 const unsigned int block_size, __global unsigned int* block_sums,
+                                 __local unsigned int* sums)
+{
+    unsigned int lid = get_local_id(0);
+    unsigned int lsize = get_local_size(0);
+    unsigned int begin = get_group_id(0) * block_size;
+    unsigned int end = min(begin + block_size, n);
+    unsigned int run = 0;
+    unsigned int base;
+    unsigned int off;
+    unsigned int i;
+    unsigned int v;
+    unsigned int u;
+
+    for(base = begin; base < end; base += lsize){
+        i = base + lid;
+        v = (i < end) ? data[i] : 0;
+
+        sums[lid] = v;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for(off = 1; off < lsize; off <<= 1){
+            u = (lid >= off) ? sums[lid - off] : 0;
+            barrier(CLK_LOCAL_MEM_FENCE);
+            sums[lid] += u;
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        if(i < end) data[i] = run + sums[lid] - v;
+
+        run += sums[lsize - 1];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(lid == 0) block_sums[get_group_id(0)] = run;
+}
+
+/**
+ * @brief Прибавляет к элементам префиксные суммы их блоков.
+ * @param n Число элементов.
+ * @param data Данные.
+ * @param block_size Число элементов блока.
+ * @param block_sums Префиксные суммы блоков.
+ */
+__kernel void kernel_scan_add(const unsigned int n, __global unsigned int* data,
+                              const unsigned int block_size, const __global unsigned int* block_sums)
+{
+    unsigned int i = get_global_id(0);
+
+    if(i >= n) return;
+
+    data[i] += block_sums[i / block_size];
+}
+
+/**
+ * @brief Число слотов разложений каждого внутреннего узла.
+ * Разложения хранятся для узлов, содержащих больше capacity тел,
+ * и для их потомков-кластеров, содержащих не более capacity тел.
+ * Кластеры служат листьями FMM.
+ * @param count Число тел.
+ * @param capacity Наибольшее число тел кластера.
+ * @param nodes Узлы дерева.
+ * @param weights Результат - число слотов узла,
+ * элемент count - 1 обнуляется.
+ */
+__kernel void kernel_fmm_weights(const int count, const int capacity,
+                                 const __global tree_node_t* nodes, __global unsigned int* weights)
+{
+    int i = get_global_id(0);
+    int left;
+    int right;
+    unsigned int w;
+
+    if(i >= count) return;
+
+    if(i == count - 1 || fmm_node_count(nodes, count, i) <= capacity){
+        weights[i] = 0;
+        return;
+    }
+
+    left = nodes[i].child;
+    right = nodes[left].next;
+
+    w = 1;
+    if(fmm_node_count(nodes, count, left) <= capacity) w ++;
+    if(fmm_node_count(nodes, count, right) <= capacity) w ++;
+
+    weights[i] = w;
+}
+
+/**
+ * @brief Назначение слотов разложений узлам.
+ * @param count Число тел.
+ * @param capacity Наибольшее число тел кластера.
+ * @param nodes Узлы дерева.
+ * @param offsets Префиксные суммы числа слотов узлов.
+ * @param slot_of Результат - слот каждого узла с разложением.
+ * @param slot_node Результат - узел каждого слота.
+ * @param flags Флаги посещения слотов, обнуляются.
+ */
+__kernel void kernel_fmm_assign(const int count, const int capacity,
+                                const __global tree_node_t* nodes, const __global unsigned int* offsets,
+                                __global int* slot_of, __global int* slot_node, __global int* flags)
+{
+    int i = get_global_id(0);
+    int s;
+    int left;
+    int right;
+
+    if(i >= count - 1) return;
+    if(fmm_node_count(nodes, count, i) <= capacity) return;
+
+    s = offsets[i];
+    left = nodes[i].child;
+    right = nodes[left].next;
+
+    slot_of[i] = s;
+    slot_node[s] = i;
+    flags[s] = 0;
+    s ++;
+
+    if(fmm_node_count(nodes, count, left) <= capacity){
+        slot_of[left] = s;
+        slot_node[s] = left;
+        flags[s] = 0;
+        s ++;
+    }
+
+    if(fmm_node_count(nodes, count, right) <= capacity){
+        slot_of[right] = s;
+        slot_node[s] = right;
+        flags[s] = 0;
+    }
+}
+
+/**
+ * @brief Восходящий проход FMM.
+ * Рабочий элемент кластера строит его мультиполь по телам (P2M),
+ * затем поднимается к корню, перенося мультиполи потомков (M2M).
+ * Узел обрабатывается вторым пришедшим к нему потомком.
+ * @param count Число тел.
+ * @param capacity Наибольшее число тел кластера.
+ * @param slots Число слотов.
+ * @param nodes Узлы дерева.
+ * @param parents Родители узлов.
+ * @param slot_of Слоты узлов.
+ * @param slot_node Узлы слотов.
+ * @param positions Позиции тел.
+ * @param masses Массы тел.
+ * @param indices Индексы тел в порядке обхода дерева.
+ * @param exps Степени членов разложения.
+ * @param terms Число членов разложения.
+ * @param table_offsets Начала диапазонов членов свёртки.
+ * @param table Члены свёртки.
+ * @param multipoles Результат - мультиполи слотов.
+ * @param radii Результат - радиусы слотов.
+ * @param flags Флаги посещения слотов.
+ */
+__kernel void kernel_fmm_upward(const int count, const int capacity, const unsigned int slots,
+                                const __global tree_node_t* nodes, const __global int* parents,
+                                const __global int* slot_of, const __global int* slot_node,
+                                const __global float* positions, const __global float* masses,
+                                const __global int* indices,
+                                const __global int4* exps, const unsigned int terms,
+                                const __global int* table_offsets, const __global fmm_term_t* table,
+                                volatile __global float* multipoles, volatile __global float* radii,
+                                volatile __global int* flags)
+{
+    unsigned int s = get_global_id(0);
+    unsigned int t;
+    unsigned int k;
+    int node;
+    int first;
+    int n;
+    int j;
+    int child;
+    int cs;
+    int q;
+    int body;
+
+    float4 c;
+    float3 d;
+    float root_size;
+    float radius;
+    float scale;
+    float mass;
+    float sum;
+
+    fmm_term_t term;
+    volatile __global float* m;
+
+    float powers[FMM_TERMS_MAX];
+    float scaled[FMM_TERMS_MAX];
+    float ratio[FMM_ORDER_MAX + 1];
+
+    if(s >= slots) return;
+
+    node = slot_node[s];
+    n = fmm_node_count(nodes, count, node);
+
+    // Поднимаются только кластеры.
+    if(n > capacity) return;
+
+    root_size = nodes[0].size;
+    c = nodes[node].com;
+    first = nodes[node].first;
+
+    // Радиус кластера.
+    radius = 0.0f;
+    for(j = 0; j < n; j ++){
+        body = indices[first + j];
+        radius = fmax(radius, length(vload3(body, positions) - c.xyz));
+    }
+    scale = fmm_scale(radius, root_size);
+
+    // Мультиполь по телам (P2M).
+    for(t = 0; t < terms; t ++) scaled[t] = 0.0f;
+    for(j = 0; j < n; j ++){
+        body = indices[first + j];
+        mass = masses[body];
+        fmm_monomials((vload3(body, positions) - c.xyz) / scale, exps, terms, powers);
+        for(t = 0; t < terms; t ++) scaled[t] += mass * powers[t];
+    }
+
+    m = multipoles + s * terms;
+    for(t = 0; t < terms; t ++) m[t] = scaled[t];
+    radii[s] = radius;
+
+    // Перенос мультиполей потомков (M2M).
+    node = parents[node];
+    while(node >= 0){
+        s = slot_of[node];
+
+        mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+        // Первый пришедший потомок завершает работу.
+        if(atomic_inc(&flags[s]) == 0) return;
+
+        c = nodes[node].com;
+
+        radius = 0.0f;
+        child = nodes[node].child;
+        for(j = 0; j < 2; j ++){
+            radius = fmax(radius, length(nodes[child].com.xyz - c.xyz) + radii[slot_of[child]]);
+            child = nodes[child].next;
+        }
+        scale = fmm_scale(radius, root_size);
+
+        m = multipoles + s * terms;
+        for(t = 0; t < terms; t ++) m[t] = 0.0f;
+
+        child = nodes[node].child;
+        for(j = 0; j < 2; j ++){
+            cs = slot_of[child];
+
+            d = (nodes[child].com.xyz - c.xyz) / scale;
+            fmm_monomials(d, exps, terms, powers);
+            fmm_powers(fmm_scale(radii[cs], root_size) / scale, ratio);
+
+            for(t = 0; t < terms; t ++){
+                scaled[t] = multipoles[cs * terms + t] * ratio[exps[t].x + exps[t].y + exps[t].z];
+            }
+
+            for(k = 0; k < terms; k ++){
+                sum = 0.0f;
+                for(q = table_offsets[FMM_TABLE_M2M * (terms + 1) + k];
+                    q < table_offsets[FMM_TABLE_M2M * (terms + 1) + k + 1]; q ++){
+                    term = table[q];
+                    sum += term.coef * scaled[term.src] * powers[term.aux];
+                }
+                m[k] += sum;
+            }
+
+            child = nodes[child].next;
+        }
+
+        radii[s] = radius;
+
+        node = parents[node];
+    }
+}
+
+/**
+ * @brief Обнуление числа пар в группах слотов.
+ * @param slots Число слотов.
+ * @param m2l_counts Результат - число пар M2L слотов.
+ * @param near_counts Результат - число ближних кластеров слотов.
+ */
+__kernel void kernel_fmm_reset(const unsigned int slots,
+                               __global unsigned int* m2l_counts, __global unsigned int* near_counts)
+{
+    unsigned int s = get_global_id(0);
+
+    if(s > slots) return;
+
+    m2l_counts[s] = 0;
+    near_counts[s] = 0;
+}
+
+/**
+ * @brief Проход двойного обхода дерева.
+ * Пары далёких узлов добавляются в список M2L,
+ * пары кластеров - в список прямого расчёта,
+ * у остальных пар раскрывается больший узел.
+ * Число пар прохода pass хранится в счётчике FMM_COUNTER_PASSES + pass.
+ * @param count Число тел.
+ * @param capacity Наибольшее число тел кластера.
+ * @param theta Параметр точности.
+ * @param nodes Узлы дерева.
+ * @param slot_of Слоты узлов.
+ * @param radii Радиусы слотов.
+ * @param pass Номер прохода.
+ * @param counters Счётчики обхода.
+ * @param pairs_in Пары узлов прохода.
+ * @param pairs_out Результат - пары узлов следующего прохода.
+ * @param pairs_capacity Размер списков пар узлов.
+ * @param m2l_pairs Результат - пары слотов M2L.
+ * @param m2l_counts Число пар M2L слотов.
+ * @param m2l_capacity Размер списка пар M2L.
+ * @param near_pairs Результат - пары ближних кластеров.
+ * @param near_counts Число ближних кластеров слотов.
+ * @param near_capacity Размер списка пар ближних кластеров.
+ */
+__kernel void kernel_fmm_traverse(const int count, const int capacity, const float theta,
+                                  const __global tree_node_t* nodes, const __global int* slot_of,
+                                  const __global float* radii, const unsigned int pass,
+                                  __global unsigned int* counters,
+                                  const __global int2* pairs_in, __global int2* pairs_out,
+                                  const unsigned int pairs_capacity,
+                                  __global int4* m2l_pairs, __global unsigned int* m2l_counts,
+                                  const unsigned int m2l_capacity,
+                                  __global int4* near_pairs, __global unsigned int* near_counts,
+                                  const unsigned int near_capacity)
+{
+    unsigned int n = min(counters[FMM_COUNTER_PASSES + pass], pairs_capacity);
+    unsigned int i;
+    int sa;
+    int sb;
+    int child;
+    bool a_leaf;
+    bool b_leaf;
+
+    int2 pair;
+    tree_node_t a, b;
+    float ra, rb;
+
+    for(i = get_global_id(0); i < n; i += get_global_size(0)){
+        pair = pairs_in[i];
+        b = nodes[pair.y];
+
+        // Источник без массы не влияет.
+        if(b.com.w == 0.0f) continue;
+
+        a = nodes[pair.x];
+        sa = slot_of[pair.x];
+        sb = slot_of[pair.y];
+        ra = radii[sa];
+        rb = radii[sb];
+
+        // Если узлы достаточно далеко - M2L.
+        if(ra + rb < theta * length(a.com.xyz - b.com.xyz)){
+            fmm_push_list(counters, FMM_COUNTER_M2L, FMM_OVERFLOW_M2L,
+                          m2l_pairs, m2l_counts, m2l_capacity, sa, sb);
+            continue;
+        }
+
+        a_leaf = fmm_node_count(nodes, count, pair.x) <= capacity;
+        b_leaf = fmm_node_count(nodes, count, pair.y) <= capacity;
+
+        // Два кластера - прямой расчёт.
+        if(a_leaf && b_leaf){
+            fmm_push_list(counters, FMM_COUNTER_NEAR, FMM_OVERFLOW_NEAR,
+                          near_pairs, near_counts, near_capacity, sa, sb);
+            continue;
+        }
+
+        // Раскроем больший узел.
+        if(!a_leaf && (b_leaf || ra >= rb)){
+            child = a.child;
+            fmm_push_pair(counters, pass, pairs_out, pairs_capacity, child, pair.y);
+            fmm_push_pair(counters, pass, pairs_out, pairs_capacity, nodes[child].next, pair.y);
+        }else{
+            child = b.child;
+            fmm_push_pair(counters, pass, pairs_out, pairs_capacity, pair.x, child);
+            fmm_push_pair(counters, pass, pairs_out, pairs_capacity, pair.x, nodes[child].next);
+        }
+    }
+}
+
+/**
+ * @brief Группировка списка пар по слотам-приёмникам.
+ * @param n Число пар.
+ * @param pairs Пары (приёмник, источник, номер в группе).
+ * @param offsets Начала групп слотов.
+ * @param sources Результат - источники, сгруппированные по приёмникам.
+ */
+__kernel void kernel_fmm_group(const unsigned int n, const __global int4* pairs,
+                               const __global unsigned int* offsets, __global int* sources)
+{
+    unsigned int i = get_global_id(0);
+    int4 pair;
+
+    if(i >= n) return;
+
+    pair = pairs[i];
+    sources[offsets[pair.x] + pair.z] = pair.y;
+}
+
+/**
+ * @brief Локальные разложения слотов по мультиполям источников (M2L).
+ * @param slots Число слотов.
+ * @param nodes Узлы дерева.
+ * @param slot_node Узлы слотов.
+ * @param radii Радиусы слотов.
+ * @param multipoles Мультиполи слотов.
+ * @param m2l_offsets Начала групп пар M2L слотов.
+ * @param m2l_sources Источники M2L, сгруппированные по приёмникам.
+ * @param locals Результат - локальные разложения слотов.
+ * @param exps Степени членов разложения.
+ * @param terms Число членов разложения.
+ * @param recurrence Индексы рекуррентного соотношения.
+ * @param table_offsets Начала диапазонов членов свёртки.
+ * @param table Члены свёртки.
+ */
+__kernel void kernel_fmm_m2l(const unsigned int slots,
+                             const __global tree_node_t* nodes, const __global int* slot_node,
+                             const __global float* radii, const __global float* multipoles,
+                             const __global unsigned int* m2l_offsets, const __global int* m2l_sources,
+                             __global float* locals,
+                             const __global int4* exps, const unsigned int terms,
+                             const __global int4* recurrence,
+                             const __global int* table_offsets, const __global fmm_term_t* table)
+{
+    unsigned int s = get_global_id(0);
+    unsigned int t;
+    unsigned int k;
+    unsigned int q;
+    int src;
+    int j;
+
+    float3 c;
+    float3 r;
+    float root_size;
+    float scale;
+    float rho;
+    float sum;
+    int4 e;
+
+    fmm_term_t term;
+    __global float* l;
+
+    float coefs[FMM_TERMS_MAX];
+    float scaled[FMM_TERMS_MAX];
+    float ratio[FMM_ORDER_MAX + 1];
+
+    if(s >= slots) return;
+
+    root_size = nodes[0].size;
+    c = nodes[slot_node[s]].com.xyz;
+    scale = fmm_scale(radii[s], root_size);
+
+    l = locals + s * terms;
+    for(t = 0; t < terms; t ++) l[t] = 0.0f;
+
+    for(q = m2l_offsets[s]; q < m2l_offsets[s + 1]; q ++){
+        src = m2l_sources[q];
+
+        r = c - nodes[slot_node[src]].com.xyz;
+        rho = length(r);
+
+        fmm_derivatives(r / rho, recurrence, terms, coefs);
+
+        // Мультиполь в единицах расстояния между центрами.
+        fmm_powers(fmm_scale(radii[src], root_size) / rho, ratio);
+        for(t = 0; t < terms; t ++){
+            e = exps[t];
+            scaled[t] = multipoles[src * terms + t] * ratio[e.x + e.y + e.z];
+        }
+
+        fmm_powers(scale / rho, ratio);
+        for(k = 0; k < terms; k ++){
+            sum = 0.0f;
+            for(j = table_offsets[FMM_TABLE_M2L * (terms + 1) + k];
+                j < table_offsets[FMM_TABLE_M2L * (terms + 1) + k + 1]; j ++){
+                term = table[j];
+                sum += term.coef * scaled[term.src] * coefs[term.aux];
+            }
+            e = exps[k];
+            l[k] += sum * ratio[e.x + e.y + e.z] / rho;
+        }
+    }
+}
+
+/**
+ * @brief Нисходящий проход FMM.
+ * Рабочий элемент кластера переносит в его центр (L2L)
+ * локальные разложения всех предков, что равносильно
+ * последовательному переносу от корня, и заполняет лист FMM.
+ * @param count Число тел.
+ * @param capacity Наибольшее число тел кластера.
+ * @param slots Число слотов.
+ * @param nodes Узлы дерева.
+ * @param parents Родители узлов.
+ * @param slot_of Слоты узлов.
+ * @param slot_node Узлы слотов.
+ * @param radii Радиусы слотов.
+ * @param locals Локальные разложения слотов.
+ * @param m2l_offsets Начала групп пар M2L слотов.
+ * @param near_offsets Начала списков ближних кластеров слотов.
+ * @param leaves Результат - листья FMM по слотам.
+ * @param leaf_of Результат - слот кластера каждого тела в порядке обхода дерева.
+ * @param exps Степени членов разложения.
+ * @param terms Число членов разложения.
+ * @param table_offsets Начала диапазонов членов свёртки.
+ * @param table Члены свёртки.
+ */
+__kernel void kernel_fmm_downward(const int count, const int capacity, const unsigned int slots,
+                                  const __global tree_node_t* nodes, const __global int* parents,
+                                  const __global int* slot_of, const __global int* slot_node,
+                                  const __global float* radii, __global float* locals,
+                                  const __global unsigned int* m2l_offsets,
+                                  const __global unsigned int* near_offsets,
+                                  __global fmm_leaf_t* leaves, __global int* leaf_of,
+                                  const __global int4* exps, const unsigned int terms,
+                                  const __global int* table_offsets, const __global fmm_term_t* table)
+{
+    unsigned int s = get_global_id(0);
+    unsigned int k;
+    int node;
+    int n;
+    int sa;
+    int j;
+
+    float4 c;
+    float root_size;
+    float scale;
+    float anc_scale;
+    float sum;
+    int4 e;
+
+    fmm_term_t term;
+    fmm_leaf_t leaf;
+    __global float* l;
+    const __global float* la;
+
+    float powers[FMM_TERMS_MAX];
+    float ratio[FMM_ORDER_MAX + 1];
+
+    if(s >= slots) return;
+
+    node = slot_node[s];
+    n = fmm_node_count(nodes, count, node);
+
+    // Листья FMM - только кластеры.
+    if(n > capacity) return;
+
+    root_size = nodes[0].size;
+    c = nodes[node].com;
+    scale = fmm_scale(radii[s], root_size);
+
+    l = locals + s * terms;
+
+    for(node = parents[node]; node >= 0; node = parents[node]){
+        sa = slot_of[node];
+
+        // Предок без собственных M2L ничего не добавляет.
+        if(m2l_offsets[sa + 1] == m2l_offsets[sa]) continue;
+
+        anc_scale = fmm_scale(radii[sa], root_size);
+        fmm_monomials((c.xyz - nodes[node].com.xyz) / anc_scale, exps, terms, powers);
+        fmm_powers(scale / anc_scale, ratio);
+
+        la = locals + sa * terms;
+        for(k = 0; k < terms; k ++){
+            sum = 0.0f;
+            for(j = table_offsets[FMM_TABLE_L2L * (terms + 1) + k];
+                j < table_offsets[FMM_TABLE_L2L * (terms + 1) + k + 1]; j ++){
+                term = table[j];
+                sum += term.coef * la[term.src] * powers[term.aux];
+            }
+            e = exps[k];
+            l[k] += sum * ratio[e.x + e.y + e.z];
+        }
+    }
+
+    node = slot_node[s];
+
+    leaf.center = (float4)(c.xyz, scale);
+    leaf.first = nodes[node].first;
+    leaf.count = n;
+    leaf.near_begin = near_offsets[s];
+    leaf.near_end = near_offsets[s + 1];
+    leaves[s] = leaf;
+
+    for(j = 0; j < n; j ++) leaf_of[leaf.first + j] = s;
+}
+
+
+/**
+ * @brief Ядро вычисления ускорений быстрым методом мультиполей.
+ * Дальнее поле вычисляется по локальным разложениям листьев,
+ * построенным на хосте либо на устройстве, ближнее - прямым расчётом.
+ * Разложения листьев с масштабом хранятся в единицах масштаба.
+ * Рабочий элемент обрабатывает тело в порядке обхода дерева,
+ * так что тела одной группы принадлежат соседним листьям.
+ * @param count Число тел.
+ * @param positions_in Исходные данные - буфер позиций.
+ * @param positions_out Результат - буфер позиций.
+ * @param velocities_in Исходные данные - буфер скоростей.
+ * @param velocities_out Результат - буфер скоростей.
+ * @param masses Исходные данные - буфер масс.
+ * @param dt Время шага.
+ * @param leaves Листья.
+ * @param leaf_of Лист каждого тела в порядке обхода дерева.
+ * @param near_leaves Списки ближних листьев.
+ * @param locals Локальные разложения листьев.
+ * @param exps Степени членов разложения.
+ * @param terms Число членов разложения.
+ * @param indices Индексы тел в порядке обхода дерева.
+ */
+__kernel void kernel_fmm(const unsigned int count,
+                         const __global float* positions_in, __global float* positions_out,
+                         const __global float* velocities_in, __global float* velocities_out,
+                         const __global float* masses, const float dt,
+                         const __global fmm_leaf_t* leaves, const __global int* leaf_of,
+                         const __global int* near_leaves, const __global float* locals,
+                         const __global int4* exps, const unsigned int terms,
+                         const __global int* indices)
+{
+    unsigned int gid;
+    unsigned int t;
+    int body;
+    int q;
+    int k;
+    int j;
+
+    float3 position, velocity;
+    float3 accel;
+    float3 d;
+    float l;
+    float scale;
+    int4 e;
+
+    fmm_leaf_t leaf;
+    fmm_leaf_t src;
+
+    // Степени смещения от центра разложения.
+    float px[FMM_ORDER_MAX + 1];
+    float py[FMM_ORDER_MAX + 1];
+    float pz[FMM_ORDER_MAX + 1];
+
+    /*
+    G, PC^3 / (Msun * Year^2)
+    */
+    const float G = 4.4932e-15f;
+
+    gid = get_global_id(0);
+
+    if(gid >= count) return;
+
+    body = indices[gid];
+    leaf = leaves[leaf_of[gid]];
+
+    // Позиция звезды.
+    position = vload3(body, positions_in);
+    // Скорость звезды.
+    velocity = vload3(body, velocities_in);
+
+    // Обнулить ускорение.
+    accel = (float3)(0.0f, 0.0f, 0.0f);
+
+    // Дальнее поле - градиент локального разложения.
+    scale = leaf.center.w > 0.0f ? leaf.center.w : 1.0f;
+    d = (position - leaf.center.xyz) / scale;
+    px[0] = py[0] = pz[0] = 1.0f;
+    for(t = 1; t <= FMM_ORDER_MAX; t ++){
+        px[t] = px[t - 1] * d.x;
+        py[t] = py[t - 1] * d.y;
+        pz[t] = pz[t - 1] * d.z;
+    }
+
+    locals += leaf_of[gid] * terms;
+    for(t = 1; t < terms; t ++){
+        e = exps[t];
+        l = locals[t];
+        if(e.x > 0) accel.x += l * e.x * px[e.x - 1] * py[e.y] * pz[e.z];
+        if(e.y > 0) accel.y += l * e.y * px[e.x] * py[e.y - 1] * pz[e.z];
+        if(e.z > 0) accel.z += l * e.z * px[e.x] * py[e.y] * pz[e.z - 1];
+    }
+    accel /= scale;
+
+    // Ближнее поле - прямой расчёт.
+    for(q = leaf.near_begin; q < leaf.near_end; q ++){
+        src = leaves[near_leaves[q]];
+        for(k = 0; k < src.count; k ++){
+            j = indices[src.first + k];
+            // Не будем взаимодейтсвовать с собой.
+            if(j == body) continue;
+            accel += body_accel(vload3(j, positions_in) - position, masses[j]);
+        }
+    }
+
+    // Умножим на вынесенную за скобки
+    // гравитационную постоянную.
+    accel *= G;
+
+    // Вычислим новую скорость.
+    velocity += accel * dt;
+    // Вычислим новую позицию.
+    position += velocity * dt;
+
+    // Сохраним новую скорость в массив.
+    vstore3(velocity, body, velocities_out);
+    // Сохраним новую позицию в массив.
+    vstore3(position, body, positions_out);
+}
+
+
+/**
+ * @brief Ядро симметричного расчёта ускорений всех пар.
+ * Для процессорных устройств: каждый work-item - поток,
+ * считающий свою часть пар блоков тел по третьему закону Ньютона,
+ * каждую пару тел один раз. Ускорения обоих тел пары
+ * накапливаются в буфере частичных сумм work-item'а.
+ * @param count Число тел.
+ * @param positions Позиции.
+ * @param masses Массы.
+ * @param partial Результат - частичные суммы ускорений
+ * без гравитационной постоянной: на work-item
+ * по count значений x, затем y, затем z.
+ * @param block_size Число тел в блоке.
+ */
+__kernel void kernel_pairs_symmetric(const unsigned int count,
+                                     const __global float* positions, const __global float* masses,
+                                     __global float* partial, const unsigned int block_size)
+{
+    unsigned int gid = get_global_id(0);
+    unsigned int threads = get_global_size(0);
+
+    // Буферы частичных сумм work-item'а по осям.
+    __global float* acc_x = partial + gid * count * 3;
+    __global float* acc_y = acc_x + count;
+    __global float* acc_z = acc_y + count;
+
+    unsigned int blocks = (count + block_size - 1) / block_size;
+    unsigned int pairs = blocks * (blocks + 1) / 2;
+
+    // Пары блоков (i, j), j >= i, work-item'а.
+    unsigned int pair_begin = (unsigned int)(((ulong)pairs * gid) / threads);
+    unsigned int pair_end = (unsigned int)(((ulong)pairs * (gid + 1)) / threads);
+
+    unsigned int i, j;
+
+    for(i = 0; i < count; i ++){
+        acc_x[i] = 0.0f;
+        acc_y[i] = 0.0f;
+        acc_z[i] = 0.0f;
+    }
+
+    // Найдём первую пару.
+    unsigned int block_i = 0;
+    unsigned int row_begin = 0;
+    while(block_i < blocks && row_begin + (blocks - block_i) <= pair_begin){
+        row_begin += blocks - block_i;
+        block_i ++;
+    }
+    unsigned int block_j = block_i + (pair_begin - row_begin);
+
+    for(unsigned int pair = pair_begin; pair < pair_end; pair ++){
+        unsigned int end_i = min((block_i + 1) * block_size, count);
+        unsigned int end_j = min((block_j + 1) * block_size, count);
+
+        for(i = block_i * block_size; i < end_i; i ++){
+            float3 position = vload3(i, positions);
+            float m = masses[i];
+            float3 accel = (float3)(0.0f, 0.0f, 0.0f);
+
+            // Внутри блока - пары с большими индексами.
+            for(j = (block_i == block_j) ? i + 1 : block_j * block_size; j < end_j; j ++){
+                float3 vec_dr = vload3(j, positions) - position;
+                float w = soft_inv_r3(dot(vec_dr, vec_dr));
+                float3 back = vec_dr * (m * w);
+                accel += vec_dr * (masses[j] * w);
+                acc_x[j] -= back.x;
+                acc_y[j] -= back.y;
+                acc_z[j] -= back.z;
+            }
+
+            acc_x[i] += accel.x;
+            acc_y[i] += accel.y;
+            acc_z[i] += accel.z;
+        }
+
+        if(++ block_j >= blocks){
+            block_i ++;
+            block_j = block_i;
+        }
+    }
+}
+
+
+/**
+ * @brief Ядро суммирования частичных сумм ускорений
+ * симметричного расчёта.
+ * @param count Число тел.
+ * @param partial Частичные суммы ускорений.
+ * @param threads Число частичных сумм на тело.
+ * @param accelerations Результат - ускорения без гравитационной постоянной.
+ */
+__kernel void kernel_pairs_reduce(const unsigned int count, const __global float* partial,
+                                  const unsigned int threads, __global float* accelerations)
+{
+    unsigned int gid = get_global_id(0);
+
+    if(gid >= count) return;
+
+    float3 accel = (float3)(0.0f, 0.0f, 0.0f);
+    for(unsigned int t = 0; t < threads; t ++){
+        const __global float* acc = partial + t * count * 3;
+        accel += (float3)(acc[gid], acc[count + gid], acc[count * 2 + gid]);
+    }
+
+    vstore3(accel, gid, accelerations);
+}
+
+
+/**
+ * @brief Ядро интегрирования по ускорениям,
+ * вычисленным вне устройства.
+ * @param count Число тел.
+ * @param positions_in Исходные данные - буфер позиций.
+ * @param positions_out Результат - буфер позиций.
+ * @param velocities_in Исходные данные - буфер скоростей.
+ * @param velocities_out Результат - буфер скоростей.
+ * @param accelerations Ускорения без гравитационной постоянной.
+ * @param dt Время шага.
+ */
+__kernel void kernel_integrate(const unsigned int count,
+                               const __global float* positions_in, __global float* positions_out,
+                               const __global float* velocities_in, __global float* velocities_out,
+                               const __global float* accelerations, const float dt)
+{
+    unsigned int gid;
+
+    float3 position, velocity;
+    float3 accel;
+
+    /*
+    G, PC^3 / (Msun * Year^2)
+    */
+    const float G = 4.4932e-15f;
+
+    gid = get_global_id(0);
+
+    if(gid >= count) return;
+
+    position = vload3(gid, positions_in);
+    velocity = vload3(gid, velocities_in);
+    accel = vload3(gid, accelerations) * G;
+
+    // Вычислим новую скорость.
+    velocity += accel * dt;
+    // Вычислим новую позицию.
+    position += velocity * dt;
+
+    // Сохраним новую скорость в массив.
+    vstore3(velocity, gid, velocities_out);
+    // Сохраним новую позицию в массив.
+    vstore3(position, gid, positions_out);
+}
+
+
+/**
+ * @brief Ядро шага блочной схемы индивидуальных шагов.
+ * Тело на уровне rung имеет шаг dt / 2^rung,
+ * подшаг сетки времени - dt / 2^rung_max.
+ * Для тел, шаг которых заканчивается на подшаге tick,
+ * выполняет закрывающий толчок и выбирает новый уровень,
+ * для тел, шаг которых начинается, - открывающий толчок,
+ * затем сдвигает все тела на подшаг и добавляет тела,
+ * шаг которых закончится на следующем подшаге,
+ * в список активных.
+ * На подшаге 0 данные читаются из входных буферов,
+ * на остальных - из выходных.
+ * @param count Число тел.
+ * @param positions_in Исходные данные - буфер позиций.
+ * @param positions_out Результат - буфер позиций.
+ * @param velocities_in Исходные данные - буфер скоростей.
+ * @param velocities_out Результат - буфер скоростей.
+ * @param accelerations Ускорения (x, y, z) и желаемый уровень (w).
+ * @param rungs Уровни шагов тел.
+ * @param active Результат - индексы активных тел.
+ * @param counters Число активных тел для каждого подшага.
+ * @param tick Номер подшага.
+ * @param rung_max Максимальный уровень.
+ * @param dt Время шага нулевого уровня.
+ */
+__kernel void kernel_block_step(const unsigned int count,
+                                const __global float* positions_in, __global float* positions_out,
+                                const __global float* velocities_in, __global float* velocities_out,
+                                const __global float4* accelerations, __global int* rungs,
+                                __global int* active, __global int* counters,
+                                const int tick, const int rung_max, const float dt)
+{
+    unsigned int gid;
+
+    float3 position, velocity;
+    float4 accel;
+    int rung, wanted;
+    // Длина шага тела в подшагах.
+    int len;
+    // Число подшагов.
+    int ticks = 1 << rung_max;
+
+    gid = get_global_id(0);
+
+    if(gid >= count) return;
+
+    position = vload3(gid, positions_in);
+    velocity = vload3(gid, velocities_in);
+    accel = accelerations[gid];
+
+    wanted = clamp((int)accel.w, 0, rung_max);
+
+    if(tick == 0){
+        // В начале шага все уровни синхронны.
+        rung = wanted;
+    }else{
+        rung = rungs[gid];
+        len = 1 << (rung_max - rung);
+
+        // Если шаг тела закончился - закрывающий толчок.
+        if(tick % len == 0){
+            velocity += accel.xyz * (0.5f * dt / (float)(1 << rung));
+
+            if(tick < ticks){
+                // Уменьшать шаг можно сразу.
+                if(wanted > rung){
+                    rung = wanted;
+                }// Увеличивать - на один уровень и только на границе шага уровня.
+                else if(wanted < rung && tick % (len << 1) == 0){
+                    rung --;
+                }
+            }
+        }
+    }
+
+    if(tick < ticks){
+        len = 1 << (rung_max - rung);
+
+        // Если шаг тела начинается - открывающий толчок.
+        if(tick % len == 0){
+            velocity += accel.xyz * (0.5f * dt / (float)(1 << rung));
+        }
+
+        // Сдвиг на подшаг.
+        position += velocity * (dt / (float)ticks);
+
+        // Если шаг закончится на следующем подшаге - тело активно.
+        if((tick + 1) % len == 0){
+            active[atomic_inc(&counters[tick])] = gid;
+        }
+
+        rungs[gid] = rung;
+    }
+
+    vstore3(velocity, gid, velocities_out);
+    vstore3(position, gid, positions_out);
+}
+
+
+/**
+ * @brief Ядро вычисления ускорений и рывков активных тел
+ * прямым расчётом всех пар.
+ * По отношению модуля ускорения к модулю рывка
+ * выбирается желаемый уровень шага.
+ * @param count Число тел.
+ * @param positions Позиции тел.
+ * @param velocities Скорости тел.
+ * @param masses Массы тел.
+ * @param accelerations Результат - ускорения (x, y, z) и желаемый уровень (w).
+ * @param active Индексы активных тел.
+ * @param counters Число активных тел для каждого подшага.
+ * @param tick Номер подшага, либо -1 для расчёта всех тел.
+ * @param rung_max Максимальный уровень.
+ * @param dt Время шага нулевого уровня.
+ * @param eta Параметр точности выбора шага.
+ * @param cached_pos Кэш позиций.
+ * @param cached_vel Кэш скоростей.
+ * @param cached_mass Кэш масс.
+ * @param cache_size Размер кэша.
+ */
+__kernel void kernel_block_force(const unsigned int count,
+                                 const __global float* positions, const __global float* velocities,
+                                 const __global float* masses, __global float4* accelerations,
+                                 const __global int* active, const __global int* counters,
+                                 const int tick, const int rung_max, const float dt, const float eta,
+                                 __local float* cached_pos, __local float* cached_vel,
+                                 __local float* cached_mass, unsigned int cache_size)
+{
+    unsigned int lid;
+    unsigned int i, j;
+    unsigned int pos_i;
+    // Число активных тел.
+    unsigned int active_count;
+    // Индекс тела.
+    int index = -1;
+
+    float3 position, velocity;
+    float3 accel, jerk;
+    float3 vec_dr, vec_dv;
+    float r2, inv_r3, rv, m;
+    float a2, j2, dt_body;
+    int rung;
+
+    unsigned int cache_count;
+    unsigned int cache_size_used;
+
+    /*
+    G, PC^3 / (Msun * Year^2)
+    */
+    const float G = 4.4932e-15f;
+
+    active_count = tick < 0 ? count : (unsigned int)counters[tick];
+
+    // Группы без активных тел не участвуют в расчёте.
+    // Условие одинаково для всей группы, поэтому барьеры корректны.
+    if(get_group_id(0) * get_local_size(0) >= active_count) return;
+
+    lid = get_local_id(0);
+
+    if(get_global_id(0) < active_count){
+        index = tick < 0 ? (int)get_global_id(0) : active[get_global_id(0)];
+        position = vload3(index, positions);
+        velocity = vload3(index, velocities);
+    }
+
+    accel = (float3)(0.0f, 0.0f, 0.0f);
+    jerk = (float3)(0.0f, 0.0f, 0.0f);
+
+    cache_size_used = min((unsigned int)get_local_size(0), cache_size);
+
+    for(i = 0; i < count; i += cache_size_used){
+        cache_count = min(cache_size_used, count - i);
+        pos_i = i + lid;
+        // Кэшируем источники.
+        if(lid < cache_count){
+            vstore3(vload3(pos_i, positions), lid, cached_pos);
+            vstore3(vload3(pos_i, velocities), lid, cached_vel);
+            cached_mass[lid] = masses[pos_i];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if(index >= 0){
+            for(j = 0; j < cache_count; j ++){
+                // Не будем взаимодейтсвовать с собой.
+                if(i + j == (unsigned int)index) continue;
+
+                vec_dr = vload3(j, cached_pos) - position;
+                vec_dv = vload3(j, cached_vel) - velocity;
+                m = cached_mass[j];
+
+                r2 = dot(vec_dr, vec_dr);
+                inv_r3 = m * soft_inv_r3(r2);
+                rv = 3.0f * dot(vec_dr, vec_dv) / max(r2 + SOFTENING_EPS2, NBODY_RADIUS2_MIN);
+
+                accel += vec_dr * inv_r3;
+                jerk += (vec_dv - vec_dr * rv) * inv_r3;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(index < 0) return;
+
+    accel *= G;
+    jerk *= G;
+
+    // Желаемый шаг тела.
+    a2 = dot(accel, accel);
+    j2 = dot(jerk, jerk);
+    dt_body = j2 > 0.0f ? eta * sqrt(a2 / j2) : dt;
+
+    // Уровень, шаг которого не больше желаемого.
+    rung = dt_body >= dt ? 0 : (int)ceil(log2(dt / dt_body));
+    rung = clamp(rung, 0, rung_max);
+
+    accelerations[index] = (float4)(accel, (float)rung);
+}
+
+
+/**
+ * @brief Ядро предсказания метода Эрмита 4-го порядка.
+ * @param count Число тел.
+ * @param positions Исходные данные - буфер позиций.
+ * @param velocities Исходные данные - буфер скоростей.
+ * @param accelerations Ускорения тел.
+ * @param jerks Рывки тел.
+ * @param positions_pred Результат - предсказанные позиции.
+ * @param velocities_pred Результат - предсказанные скорости.
+ * @param dt Время шага.
+ */
+__kernel void kernel_hermite_predict(const unsigned int count,
+                                     const __global float* positions, const __global float* velocities,
+                                     const __global float4* accelerations, const __global float4* jerks,
+                                     __global float* positions_pred, __global float* velocities_pred,
+                                     const float dt)
+{
+    unsigned int gid;
+
+    float3 position, velocity;
+    float3 accel, jerk;
+
+    gid = get_global_id(0);
+
+    if(gid >= count) return;
+
+    position = vload3(gid, positions);
+    velocity = vload3(gid, velocities);
+    accel = accelerations[gid].xyz;
+    jerk = jerks[gid].xyz;
+
+    // Ряд Тейлора по ускорению и рывку.
+    vstore3(position + dt * (velocity + dt * (accel * 0.5f + dt * jerk * (1.0f / 6.0f))), gid, positions_pred);
+    vstore3(velocity + dt * (accel + dt * jerk * 0.5f), gid, velocities_pred);
+}
+
+
+/**
+ * @brief Ядро вычисления ускорений и рывков
+ * и коррекции метода Эрмита 4-го порядка.
+ * Ускорения вычисляются в предсказанных позициях и скоростях,
+ * при correct == 0 только сохраняются ускорения и рывки.
+ * @param count Число тел.
+ * @param positions_pred Предсказанные позиции.
+ * @param velocities_pred Предсказанные скорости.
+ * @param masses Массы тел.
+ * @param positions_in Исходные данные - буфер позиций.
+ * @param positions_out Результат - буфер позиций.
+ * @param velocities_in Исходные данные - буфер скоростей.
+ * @param velocities_out Результат - буфер скоростей.
+ * @param accelerations Ускорения тел, заменяются новыми.
+ * @param jerks Рывки тел, заменяются новыми.
+ * @param dt Время шага.
+ * @param correct Флаг коррекции.
+ * @param cached_pos Кэш позиций.
+ * @param cached_vel Кэш скоростей.
+ * @param cached_mass Кэш масс.
+ * @param cache_size Размер кэша.
+ */
+__kernel void kernel_hermite_correct(const unsigned int count,
+                                     const __global float* positions_pred, const __global float* velocities_pred,
+                                     const __global float* masses,
+                                     const __global float* positions_in, __global float* positions_out,
+                                     const __global float* velocities_in, __global float* velocities_out,
+                                     __global float4* accelerations, __global float4* jerks,
+                                     const float dt, const int correct,
+                                     __local float* cached_pos, __local float* cached_vel,
+                                     __local float* cached_mass, unsigned int cache_size)
+{
+    unsigned int gid, lid;
+    unsigned int i, j;
+    unsigned int pos_i;
+
+    float3 position, velocity;
+    float3 accel, jerk;
+    float3 accel0, jerk0;
+    float3 vec_dr, vec_dv;
+    float r2, inv_r3, rv;
+
+    unsigned int cache_count;
+    unsigned int cache_size_used;
+
+    /*
+    G, PC^3 / (Msun * Year^2)
+    */
+    const float G = 4.4932e-15f;
+
+    gid = get_global_id(0);
+    lid = get_local_id(0);
+
+    if(gid < count){
+        position = vload3(gid, positions_pred);
+        velocity = vload3(gid, velocities_pred);
+    }
+
+    accel = (float3)(0.0f, 0.0f, 0.0f);
+    jerk = (float3)(0.0f, 0.0f, 0.0f);
+
+    cache_size_used = min((unsigned int)get_local_size(0), cache_size);
+
+    for(i = 0; i < count; i += cache_size_used){
+        cache_count = min(cache_size_used, count - i);
+        pos_i = i + lid;
+        // Кэшируем источники.
+        if(lid < cache_count){
+            vstore3(vload3(pos_i, positions_pred), lid, cached_pos);
+            vstore3(vload3(pos_i, velocities_pred), lid, cached_vel);
+            cached_mass[lid] = masses[pos_i];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if(gid < count){
+            for(j = 0; j < cache_count; j ++){
+                // Не будем взаимодейтсвовать с собой.
+                if(i + j == gid) continue;
+
+                vec_dr = vload3(j, cached_pos) - position;
+                vec_dv = vload3(j, cached_vel) - velocity;
+
+                r2 = dot(vec_dr, vec_dr);
+                inv_r3 = cached_mass[j] * soft_inv_r3(r2);
+                rv = 3.0f * dot(vec_dr, vec_dv) / max(r2 + SOFTENING_EPS2, NBODY_RADIUS2_MIN);
+
+                accel += vec_dr * inv_r3;
+                jerk += (vec_dv - vec_dr * rv) * inv_r3;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(gid >= count) return;
+
+    accel *= G;
+    jerk *= G;
+
+    if(correct){
+        position = vload3(gid, positions_in);
+        velocity = vload3(gid, velocities_in);
+        accel0 = accelerations[gid].xyz;
+        jerk0 = jerks[gid].xyz;
+
+        // Корректор: интерполяция Эрмита по концам шага.
+        float3 velocity1 = velocity + (accel0 + accel) * (0.5f * dt) + (jerk0 - jerk) * (dt * dt / 12.0f);
+        position += (velocity + velocity1) * (0.5f * dt) + (accel0 - accel) * (dt * dt / 12.0f);
+
+        vstore3(velocity1, gid, velocities_out);
+        vstore3(position, gid, positions_out);
+    }
+
+    accelerations[gid] = (float4)(accel, 0.0f);
+    jerks[gid] = (float4)(jerk, 0.0f);
+}
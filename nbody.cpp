@@ -7,13 +7,34 @@
 #include "clkernel.h"
 #include "clexception.h"
 #include "clevent.h"
+#include "octree.h"
+#include "treebuilder.h"
+#include "fmmbuilder.h"
+#include "fmm.h"
+#include "particlemesh.h"
+#include "cpuengine.h"
+#include "utils.h"
 #include <QString>
 #include <QFile>
+#include <QStringList>
+#include <QRegExp>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QCryptographicHash>
+#include <QDesktopServices>
+#include <QThread>
+#include <QtConcurrentRun>
+#include <QGLContext>
 #include <math.h>
+#include <string.h>
 
 
 #define LOG_WHO "NBody"
 
+
+PFNGLFENCESYNCPROC NBody::glFenceSync = nullptr;
+PFNGLDELETESYNCPROC NBody::glDeleteSync = nullptr;
+
 /**
  * @brief Имя файла программы OpenCL.
  */
@@ -24,6 +45,67 @@ static const char* clprogram_file_name = "nbody.cl";
  */
 static const char* clprogram_kernel_name = "kernel_main";
 
+/**
+ * @brief Имя каталога кэша двоичного кода программ OpenCL.
+ */
+static const char* clprogram_cache_dir_name = "qgalaxy_clcache";
+
+/**
+ * @brief Имя функции - ядра метода Барнса-Хата.
+ */
+static const char* clprogram_bh_kernel_name = "kernel_barnes_hut";
+
+/**
+ * @brief Имя функции - ядра быстрого метода мультиполей.
+ */
+static const char* clprogram_fmm_kernel_name = "kernel_fmm";
+
+/**
+ * @brief Имя функции - ядра интегрирования по готовым ускорениям.
+ */
+static const char* clprogram_integrate_kernel_name = "kernel_integrate";
+
+/**
+ * @brief Имя функции - ядра шага блочной схемы.
+ */
+static const char* clprogram_block_step_kernel_name = "kernel_block_step";
+
+/**
+ * @brief Имя функции - ядра ускорений активных тел блочной схемы.
+ */
+static const char* clprogram_block_force_kernel_name = "kernel_block_force";
+
+/**
+ * @brief Имя функции - ядра предсказания метода Эрмита.
+ */
+static const char* clprogram_hermite_predict_kernel_name = "kernel_hermite_predict";
+
+/**
+ * @brief Имя функции - ядра коррекции метода Эрмита.
+ */
+static const char* clprogram_hermite_correct_kernel_name = "kernel_hermite_correct";
+
+/**
+ * @brief Имя функции - ядра подшага для упакованных данных.
+ */
+static const char* clprogram_packed_kernel_name = "kernel_main_packed";
+
+/**
+ * @brief Имя функции - ядра упаковки позиций и масс.
+ */
+static const char* clprogram_pack_kernel_name = "kernel_pack_bodies";
+
+/**
+ * @brief Имя функции - ядра распаковки позиций.
+ */
+static const char* clprogram_unpack_kernel_name = "kernel_unpack_positions";
+
+/**
+ * @brief Имена функций - ядер симметричного расчёта всех пар.
+ */
+static const char* clprogram_pairs_kernel_name = "kernel_pairs_symmetric";
+static const char* clprogram_pairs_reduce_kernel_name = "kernel_pairs_reduce";
+
 /*
  * Константы - индексы аргументов ядра OpenCL.
  */
@@ -37,6 +119,222 @@ static const char* clprogram_kernel_name = "kernel_main";
 #define KERNEL_MAIN_ARG_POS_CACHE 7
 #define KERNEL_MAIN_ARG_MASS_CACHE 8
 #define KERNEL_MAIN_ARG_CACHE_SIZE 9
+#define KERNEL_MAIN_ARG_DRIFT_PRE 10
+#define KERNEL_MAIN_ARG_KICK 11
+#define KERNEL_MAIN_ARG_DRIFT_POST 12
+#define KERNEL_MAIN_ARG_FIRST_BODY 13
+#define KERNEL_MAIN_ARG_END_BODY 14
+
+/*
+ * Константы - индексы аргументов ядра метода Барнса-Хата.
+ */
+#define KERNEL_BH_ARG_COUNT 0
+#define KERNEL_BH_ARG_POSITIONS_IN 1
+#define KERNEL_BH_ARG_POSITIONS_OUT 2
+#define KERNEL_BH_ARG_VELOCITIES_IN 3
+#define KERNEL_BH_ARG_VELOCITIES_OUT 4
+#define KERNEL_BH_ARG_MASSES 5
+#define KERNEL_BH_ARG_DT 6
+#define KERNEL_BH_ARG_NODES 7
+#define KERNEL_BH_ARG_INDICES 8
+#define KERNEL_BH_ARG_THETA2 9
+
+/*
+ * Константы - индексы аргументов ядра быстрого метода мультиполей.
+ */
+#define KERNEL_FMM_ARG_COUNT 0
+#define KERNEL_FMM_ARG_POSITIONS_IN 1
+#define KERNEL_FMM_ARG_POSITIONS_OUT 2
+#define KERNEL_FMM_ARG_VELOCITIES_IN 3
+#define KERNEL_FMM_ARG_VELOCITIES_OUT 4
+#define KERNEL_FMM_ARG_MASSES 5
+#define KERNEL_FMM_ARG_DT 6
+#define KERNEL_FMM_ARG_LEAVES 7
+#define KERNEL_FMM_ARG_LEAF_OF 8
+#define KERNEL_FMM_ARG_NEAR 9
+#define KERNEL_FMM_ARG_LOCALS 10
+#define KERNEL_FMM_ARG_EXPS 11
+#define KERNEL_FMM_ARG_TERMS 12
+#define KERNEL_FMM_ARG_INDICES 13
+
+/*
+ * Константы - индексы аргументов ядра интегрирования.
+ */
+#define KERNEL_INTEGRATE_ARG_COUNT 0
+#define KERNEL_INTEGRATE_ARG_POSITIONS_IN 1
+#define KERNEL_INTEGRATE_ARG_POSITIONS_OUT 2
+#define KERNEL_INTEGRATE_ARG_VELOCITIES_IN 3
+#define KERNEL_INTEGRATE_ARG_VELOCITIES_OUT 4
+#define KERNEL_INTEGRATE_ARG_ACCELERATIONS 5
+#define KERNEL_INTEGRATE_ARG_DT 6
+
+/*
+ * Константы - индексы аргументов ядра шага блочной схемы.
+ */
+#define KERNEL_BLOCK_STEP_ARG_COUNT 0
+#define KERNEL_BLOCK_STEP_ARG_POSITIONS_IN 1
+#define KERNEL_BLOCK_STEP_ARG_POSITIONS_OUT 2
+#define KERNEL_BLOCK_STEP_ARG_VELOCITIES_IN 3
+#define KERNEL_BLOCK_STEP_ARG_VELOCITIES_OUT 4
+#define KERNEL_BLOCK_STEP_ARG_ACCELERATIONS 5
+#define KERNEL_BLOCK_STEP_ARG_RUNGS 6
+#define KERNEL_BLOCK_STEP_ARG_ACTIVE 7
+#define KERNEL_BLOCK_STEP_ARG_COUNTERS 8
+#define KERNEL_BLOCK_STEP_ARG_TICK 9
+#define KERNEL_BLOCK_STEP_ARG_RUNG_MAX 10
+#define KERNEL_BLOCK_STEP_ARG_DT 11
+
+/*
+ * Константы - индексы аргументов ядра ускорений блочной схемы.
+ */
+#define KERNEL_BLOCK_FORCE_ARG_COUNT 0
+#define KERNEL_BLOCK_FORCE_ARG_POSITIONS 1
+#define KERNEL_BLOCK_FORCE_ARG_VELOCITIES 2
+#define KERNEL_BLOCK_FORCE_ARG_MASSES 3
+#define KERNEL_BLOCK_FORCE_ARG_ACCELERATIONS 4
+#define KERNEL_BLOCK_FORCE_ARG_ACTIVE 5
+#define KERNEL_BLOCK_FORCE_ARG_COUNTERS 6
+#define KERNEL_BLOCK_FORCE_ARG_TICK 7
+#define KERNEL_BLOCK_FORCE_ARG_RUNG_MAX 8
+#define KERNEL_BLOCK_FORCE_ARG_DT 9
+#define KERNEL_BLOCK_FORCE_ARG_ETA 10
+#define KERNEL_BLOCK_FORCE_ARG_POS_CACHE 11
+#define KERNEL_BLOCK_FORCE_ARG_VEL_CACHE 12
+#define KERNEL_BLOCK_FORCE_ARG_MASS_CACHE 13
+#define KERNEL_BLOCK_FORCE_ARG_CACHE_SIZE 14
+
+/*
+ * Константы - индексы аргументов ядра предсказания метода Эрмита.
+ */
+#define KERNEL_HERMITE_PREDICT_ARG_COUNT 0
+#define KERNEL_HERMITE_PREDICT_ARG_POSITIONS 1
+#define KERNEL_HERMITE_PREDICT_ARG_VELOCITIES 2
+#define KERNEL_HERMITE_PREDICT_ARG_ACCELERATIONS 3
+#define KERNEL_HERMITE_PREDICT_ARG_JERKS 4
+#define KERNEL_HERMITE_PREDICT_ARG_POSITIONS_PRED 5
+#define KERNEL_HERMITE_PREDICT_ARG_VELOCITIES_PRED 6
+#define KERNEL_HERMITE_PREDICT_ARG_DT 7
+
+/*
+ * Константы - индексы аргументов ядра коррекции метода Эрмита.
+ */
+#define KERNEL_HERMITE_CORRECT_ARG_COUNT 0
+#define KERNEL_HERMITE_CORRECT_ARG_POSITIONS_PRED 1
+#define KERNEL_HERMITE_CORRECT_ARG_VELOCITIES_PRED 2
+#define KERNEL_HERMITE_CORRECT_ARG_MASSES 3
+#define KERNEL_HERMITE_CORRECT_ARG_POSITIONS_IN 4
+#define KERNEL_HERMITE_CORRECT_ARG_POSITIONS_OUT 5
+#define KERNEL_HERMITE_CORRECT_ARG_VELOCITIES_IN 6
+#define KERNEL_HERMITE_CORRECT_ARG_VELOCITIES_OUT 7
+#define KERNEL_HERMITE_CORRECT_ARG_ACCELERATIONS 8
+#define KERNEL_HERMITE_CORRECT_ARG_JERKS 9
+#define KERNEL_HERMITE_CORRECT_ARG_DT 10
+#define KERNEL_HERMITE_CORRECT_ARG_CORRECT 11
+#define KERNEL_HERMITE_CORRECT_ARG_POS_CACHE 12
+#define KERNEL_HERMITE_CORRECT_ARG_VEL_CACHE 13
+#define KERNEL_HERMITE_CORRECT_ARG_MASS_CACHE 14
+#define KERNEL_HERMITE_CORRECT_ARG_CACHE_SIZE 15
+
+#define KERNEL_PACKED_ARG_COUNT 0
+#define KERNEL_PACKED_ARG_BODIES_IN 1
+#define KERNEL_PACKED_ARG_BODIES_OUT 2
+#define KERNEL_PACKED_ARG_VELOCITIES_IN 3
+#define KERNEL_PACKED_ARG_VELOCITIES_OUT 4
+#define KERNEL_PACKED_ARG_DT 5
+#define KERNEL_PACKED_ARG_BODY_CACHE 6
+#define KERNEL_PACKED_ARG_CACHE_SIZE 7
+#define KERNEL_PACKED_ARG_DRIFT_PRE 8
+#define KERNEL_PACKED_ARG_KICK 9
+#define KERNEL_PACKED_ARG_DRIFT_POST 10
+
+#define KERNEL_PACK_ARG_COUNT 0
+#define KERNEL_PACK_ARG_POSITIONS 1
+#define KERNEL_PACK_ARG_MASSES 2
+#define KERNEL_PACK_ARG_BODIES 3
+
+#define KERNEL_UNPACK_ARG_COUNT 0
+#define KERNEL_UNPACK_ARG_BODIES 1
+#define KERNEL_UNPACK_ARG_POSITIONS 2
+
+#define KERNEL_PAIRS_ARG_COUNT 0
+#define KERNEL_PAIRS_ARG_POSITIONS 1
+#define KERNEL_PAIRS_ARG_MASSES 2
+#define KERNEL_PAIRS_ARG_PARTIAL 3
+#define KERNEL_PAIRS_ARG_BLOCK_SIZE 4
+
+#define KERNEL_PAIRS_REDUCE_ARG_COUNT 0
+#define KERNEL_PAIRS_REDUCE_ARG_PARTIAL 1
+#define KERNEL_PAIRS_REDUCE_ARG_THREADS 2
+#define KERNEL_PAIRS_REDUCE_ARG_ACCELERATIONS 3
+
+//! Число тел в блоке симметричного расчёта.
+#define PAIRS_BLOCK_SIZE 64
+
+//! Доля физической памяти под частичные суммы симметричного расчёта.
+#define PAIRS_MEMORY_FRACTION 8
+//! Память частичных сумм, если объём физической памяти неизвестен.
+#define PAIRS_MEMORY_DEFAULT (512ULL * 1024 * 1024)
+
+//! Параметр точности метода Барнса-Хата по-умолчанию.
+#define BARNES_HUT_THETA_DEFAULT 0.5f
+
+//! Число тел, начиная с которого используются 63-битные коды Мортона.
+#define MORTON_64_BODIES_COUNT (1 << 20)
+
+//! Порядок разложения FMM по-умолчанию.
+#define FMM_ORDER_DEFAULT 4
+
+//! Параметр точности выбора индивидуального шага.
+#define BLOCK_TIME_STEP_ETA 0.02f
+
+//! Коэффициенты метода Йошиды 4-го порядка: 1 / (2 - 2^(1/3)) и -2^(1/3) / (2 - 2^(1/3)).
+#define YOSHIDA_W1 1.35120719195965763f
+#define YOSHIDA_W0 -1.70241438391931527f
+
+//! Число тел для подбора параметров ядра.
+#define TUNE_BODIES_COUNT 8192
+
+//! Число запусков каждого варианта ядра при подборе.
+#define TUNE_RUNS 3
+
+//! Минимальный перебираемый размер рабочей группы.
+#define TUNE_LOCAL_SIZE_MIN 32
+
+//! Число тел для измерения ошибки суммирования.
+#define PRECISION_BODIES_COUNT 4096
+
+//! Число запусков ядра при измерении производительности.
+#define PRECISION_RUNS 3
+
+//! Размер рабочей группы при измерении без подобранных параметров.
+#define PRECISION_LOCAL_SIZE 128
+
+//! Гравитационная постоянная и минимальное расстояние программы OpenCL.
+#define PRECISION_G 4.4932e-15
+
+//! Длина сглаживания по-умолчанию.
+#define SOFTENING_LENGTH_DEFAULT 0.1f
+
+//! Отношение радиуса ядра сплайна к длине сглаживания.
+#define SOFTENING_SPLINE_RATIO 2.8
+
+//! Маркеры границ этапов шага.
+#define PROFILE_MARKER_START 0
+#define PROFILE_MARKER_ACQUIRED 1
+#define PROFILE_MARKER_COMPUTED 2
+#define PROFILE_MARKER_UNPACKED 3
+
+//! Число операций с плавающей точкой на взаимодействие пары тел.
+#define PROFILE_FLOPS_PER_INTERACTION 20
+
+//! Число операций с плавающей точкой на взаимодействие с расчётом рывка.
+#define PROFILE_FLOPS_PER_JERK_INTERACTION 60
+
+//! Наибольшее число профилируемых запусков ядер интегрирования за шаг.
+#define PROFILE_INTEGRATE_EVENTS_MAX 256
+
+//! Число шагов между выводами профиля в лог.
+#define PROFILE_LOG_FRAMES 100
 
 
 
@@ -47,8 +345,59 @@ NBody::NBody(QObject *parent) :
     simulated_bodies_count = 0;
 
     time_step = 0.0f;
+    steps_per_frame = 1;
+    frame_steps = 1;
+
+    nbody_solver = SOLVER_ALL_PAIRS;
+    bh_theta = BARNES_HUT_THETA_DEFAULT;
+    gpu_tree_build = true;
+    tree_builder_tried = false;
+    fmm_builder_tried = false;
+    fmm_device_eval = true;
+    block_rungs = 0;
+    acc_reset = true;
+    nbody_integrator = INTEGRATOR_EULER;
+    program_integrator = INTEGRATOR_EULER;
+    nbody_precision = PRECISION_SINGLE;
+    program_precision = PRECISION_SINGLE;
+    nbody_softening = SOFTENING_NONE;
+    softening_length = SOFTENING_LENGTH_DEFAULT;
+    packed_layout = false;
+    program_packed = false;
+    packed_sync = true;
+    jerk_local_size = 0;
+    jerk_global_size = 0;
+    auto_tune = false;
+    multi_device = false;
+    device_parts_event = 0;
+    device_parts_active = false;
+    device_parts_measured = false;
+    profiling_enabled = false;
+    clqueue_profiling = false;
+    profile_pending = false;
+    profile_frames = 0;
+    native_step_time = 0;
+    native_integrate_time = 0;
+    integrate_launches = 0;
+    profile_force_passes = 0;
+    pipelined_mode = false;
+    program_pipelined = false;
+    display_sync = true;
+    display_frame = 0;
+    display_front = 0;
 
     is_ready = false;
+    native_backend = false;
+    native_sync = false;
+    headless = false;
+    gl_cl_sync = false;
+    for(size_t i = 0; i < shared_buffers_count; i ++){
+        gl_acquired[i] = false;
+        host_mapped[i] = nullptr;
+    }
+    zero_copy = false;
+    host_arena = nullptr;
+    host_arena_section = 0;
 
     current_in = 0;
     current_out = 1;
@@ -61,27 +410,129 @@ NBody::NBody(QObject *parent) :
         gl_vel_buf[i] = new NBodyGLBuffer(NBodyGLBuffer::VertexBuffer);
         cl_pos_buf[i] = new CLBuffer();
         cl_vel_buf[i] = new CLBuffer();
+        cl_packed_buf[i] = new CLBuffer();
     }
+    for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT; i ++){
+        gl_display_buf[i] = new NBodyGLBuffer(NBodyGLBuffer::VertexBuffer);
+        cl_display_buf[i] = new CLBuffer();
+        cldisplay_events[i] = new CLEvent();
+        display_frames[i] = 0;
+    }
+    trajectory_recorder = nullptr;
+    record_step = 0;
+    for(size_t i = 0; i < TRAJECTORY_SLOTS_COUNT; i ++){
+        cl_record_buf[i] = new CLBuffer();
+        clrecord_events[i] = new CLEvent();
+        record_ptr[i] = nullptr;
+    }
+    cl_tree_nodes_buf = new CLBuffer();
+    cl_tree_indices_buf = new CLBuffer();
+    tree_nodes_capacity = 0;
+    cl_acc_buf = new CLBuffer();
+    cl_pairs_buf = new CLBuffer();
+    pairs_threads = 0;
+    cl_fmm_leaves_buf = new CLBuffer();
+    cl_fmm_leaf_of_buf = new CLBuffer();
+    cl_fmm_near_buf = new CLBuffer();
+    cl_fmm_locals_buf = new CLBuffer();
+    cl_fmm_exps_buf = new CLBuffer();
+    fmm_leaves_capacity = 0;
+    fmm_near_capacity = 0;
+    fmm_locals_capacity = 0;
+    fmm_exps_capacity = 0;
+    cl_block_acc_buf = new CLBuffer();
+    cl_block_rung_buf = new CLBuffer();
+    cl_block_active_buf = new CLBuffer();
+    cl_block_counters_buf = new CLBuffer();
+    cl_hermite_pos_buf = new CLBuffer();
+    cl_hermite_vel_buf = new CLBuffer();
+    cl_hermite_acc_buf = new CLBuffer();
+    cl_hermite_jerk_buf = new CLBuffer();
+    block_counters.fill(0, 1 << BLOCK_RUNGS_MAX);
+
+    octree = new Octree();
+    tree_builder = new TreeBuilder(this);
+    fmm_builder = new FmmBuilder(this);
+    fmm = new Fmm();
+    fmm->setOrder(FMM_ORDER_DEFAULT);
+    particle_mesh = new ParticleMesh();
+    cpu_engine = new CpuEngine();
+    native_watcher = new QFutureWatcher<void>(this);
 
     global_dims[0] = 0;
     local_dims[0] = 0;
+    main_global_dims[0] = 0;
 #if NDRANGE_DIMENSIONS > 1
     global_dims[1] = 0;
     local_dims[1] = 0;
+    main_global_dims[1] = 0;
 #endif
 
     clcxt = new CLContext();
     clqueue = new CLCommandQueue();
     clprogram = new CLProgram();
     clkernel = new CLKernel();
+    clkernel_bh = new CLKernel();
+    clkernel_fmm = new CLKernel();
+    clkernel_integrate = new CLKernel();
+    clkernel_block_step = new CLKernel();
+    clkernel_block_force = new CLKernel();
+    clkernel_hermite_predict = new CLKernel();
+    clkernel_hermite_correct = new CLKernel();
+    clkernel_packed = new CLKernel();
+    clkernel_pack = new CLKernel();
+    clkernel_unpack = new CLKernel();
+    clkernel_pairs = new CLKernel();
+    clkernel_pairs_reduce = new CLKernel();
     clevent = new CLEvent();
+    clupload_event = new CLEvent();
+    clglevent = new CLEvent();
+    for(size_t i = 0; i < PROFILE_MARKERS_COUNT; i ++){
+        clprofile_events[i] = new CLEvent();
+    }
+    cltransfer_glevent = new CLEvent();
+    cltransfer_queue = new CLCommandQueue();
 
-    connect(clevent, SIGNAL(completed(int)), this, SIGNAL(simulationFinished()));
+    connect(clevent, SIGNAL(completed(int)), this, SLOT(on_simulationCompleted()));
+    connect(clupload_event, SIGNAL(completed(int)), this, SLOT(on_bodiesUploaded(int)));
+    for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT; i ++){
+        connect(cldisplay_events[i], SIGNAL(completed(int)), this, SIGNAL(displayUpdated()));
+    }
+    connect(native_watcher, SIGNAL(finished()), this, SLOT(on_nativeStepFinished()));
 }
 
 NBody::~NBody()
 {
+    delete cltransfer_queue;
+    delete cltransfer_glevent;
+    for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT; i ++){
+        delete cldisplay_events[i];
+        delete cl_display_buf[i];
+        delete gl_display_buf[i];
+    }
+    for(size_t i = 0; i < PROFILE_MARKERS_COUNT; i ++){
+        delete clprofile_events[i];
+    }
+    qDeleteAll(clintegrate_events);
+    for(size_t i = 0; i < TRAJECTORY_SLOTS_COUNT; i ++){
+        delete clrecord_events[i];
+        delete cl_record_buf[i];
+    }
+    delete clglevent;
+    delete clupload_event;
     delete clevent;
+    delete clkernel_pairs_reduce;
+    delete clkernel_pairs;
+    delete clkernel_unpack;
+    delete clkernel_pack;
+    delete clkernel_packed;
+    delete clkernel_hermite_correct;
+    delete clkernel_hermite_predict;
+    delete clkernel_block_force;
+    delete clkernel_block_step;
+    delete clkernel_integrate;
+    delete clkernel_fmm;
+    delete clkernel_bh;
     delete clkernel;
     delete clprogram;
     delete clqueue;
@@ -93,9 +544,34 @@ NBody::~NBody()
     for(size_t i = 0; i < switch_buffers_count; i ++){
         delete cl_pos_buf[i];
         delete cl_vel_buf[i];
+        delete cl_packed_buf[i];
         delete gl_pos_buf[i];
         delete gl_vel_buf[i];
     }
+    delete cl_tree_nodes_buf;
+    delete cl_tree_indices_buf;
+    delete cl_acc_buf;
+    delete cl_fmm_leaves_buf;
+    delete cl_fmm_leaf_of_buf;
+    delete cl_fmm_near_buf;
+    delete cl_fmm_locals_buf;
+    delete cl_fmm_exps_buf;
+    delete cl_block_acc_buf;
+    delete cl_block_rung_buf;
+    delete cl_block_active_buf;
+    delete cl_block_counters_buf;
+    delete cl_hermite_pos_buf;
+    delete cl_hermite_vel_buf;
+    delete cl_hermite_acc_buf;
+    delete cl_hermite_jerk_buf;
+
+    if(host_arena) qFreeAligned(host_arena);
+
+    native_watcher->waitForFinished();
+    delete cpu_engine;
+    delete particle_mesh;
+    delete fmm;
+    delete octree;
 }
 
 size_t NBody::bodiesCount() const
@@ -111,6 +587,7 @@ size_t NBody::simulatedBodiesCount() const
 bool NBody::setSimulatedBodiesCount(size_t count)
 {
     if(count > bodies_count) return false;
+    if(count != simulated_bodies_count) acc_reset = true;
     simulated_bodies_count = count;
     return true;
 }
@@ -122,344 +599,2235 @@ float NBody::timeStep() const
 
 void NBody::setTimeStep(float dt)
 {
+    // Желаемые уровни шагов зависят от шага.
+    if(dt != time_step) acc_reset = true;
     time_step = dt;
 }
 
-CLContext *NBody::clcontext()
+size_t NBody::stepsPerFrame() const
 {
-    return clcxt;
+    return steps_per_frame;
 }
 
-/**
- * @brief Инициализация систему NBody.
- * @param platform Платформа OpenCL.
- * @param device Устройство OpenCL.
- * @param bodies Число тел.
- * @return true в случае успеха, иначе false.
- */
-bool NBody::create(const CLPlatform& platform, const CLDevice& device, size_t bodies)
+void NBody::setStepsPerFrame(size_t steps)
 {
-    // Нет смысла инициализировать систему из 0 тел.
-    if(bodies == 0) return false;
+    steps_per_frame = qMax<size_t>(steps, 1);
+}
 
-    try{
-        // Получим максимальную доступную нам память устрйоства.
-        size_t mem_size = device.maxMemAllocSize();
-        // Если нам нужно больше.
-        if(mem_size < bodies * sizeof(float) * (3 * 2 /*pos,vel_in*/ + 3 * 2 /*pos,vel_out*/ + 1 /*masses*/)){
-            // Сообщим об этом.
-            log(Log::ERROR, LOG_WHO, tr("Out of memory!"));
-            // Возврат.
-            return false;
-        }
-    }// Если произошка ошибка.
-    catch(CLException& e){
-        // Сообщим об этом и считаем что памяти достаточно.
-        log(Log::WARNING, LOG_WHO, e.what());
-    }
+NBody::Solver NBody::solver() const
+{
+    return nbody_solver;
+}
 
-    // Если система уже была создана - уничтожим её.
-    if(is_ready) destroy();
+void NBody::setSolver(Solver s)
+{
+    nbody_solver = s;
+}
 
-    // Теперь система не создана.
-    is_ready = false;
-    // Установим новое число тел.
-    bodies_count = bodies;
-    // Установим моделируемое число тел.
-    simulated_bodies_count = bodies;
+float NBody::barnesHutTheta() const
+{
+    return bh_theta;
+}
 
-    // Если не удалось создать буфера OpenGL.
-    if(!createGLBuffers()){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, tr("Error creating OpenGL buffers!"));
-        // Возврат.
-        return false;
-    }
+void NBody::setBarnesHutTheta(float theta)
+{
+    bh_theta = theta;
+}
 
-    // Если не удалось проинииализировать OpenCL.
-    if(!initOpenCL(platform, device)){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, tr("Error initializing OpenCL!"));
-        // Уничтожим буферы OpenGL.
-        destroyGLBuffers();
-        // Возврат.
-        return false;
-    }
+bool NBody::gpuTreeBuild() const
+{
+    return gpu_tree_build;
+}
 
-    // Установим флаг готовности к симуляции.
-    is_ready = true;
+void NBody::setGpuTreeBuild(bool enabled)
+{
+    gpu_tree_build = enabled;
+}
 
-    // Возврат успеха.
-    return true;
+size_t NBody::fmmOrder() const
+{
+    return fmm->order();
 }
 
-bool NBody::destroy()
+void NBody::setFmmOrder(size_t order)
 {
-    if(!is_ready) return false;
+    fmm->setOrder(order);
+}
 
-    try{
-        clqueue->finish();
-    }catch(CLException& e){
-        log(Log::WARNING, LOG_WHO, e.what());
-    }
-    is_ready = false;
+bool NBody::fmmDeviceEvaluation() const
+{
+    return fmm_device_eval;
+}
 
-    termOpenCL();
-    destroyGLBuffers();
+void NBody::setFmmDeviceEvaluation(bool enabled)
+{
+    fmm_device_eval = enabled;
+}
 
-    return true;
+size_t NBody::pmGridSize() const
+{
+    return particle_mesh->gridSize();
 }
 
-bool NBody::reset()
+void NBody::setPmGridSize(size_t size)
 {
-    if(!isReady() || isRunning()) return false;
+    particle_mesh->setGridSize(size);
+}
 
-    simulated_bodies_count = bodies_count;
+bool NBody::pmTsc() const
+{
+    return particle_mesh->assignment() == ParticleMesh::ASSIGNMENT_TSC;
+}
 
-    QVector<Point3f> data(bodies_count);
+void NBody::setPmTsc(bool tsc)
+{
+    particle_mesh->setAssignment(tsc ? ParticleMesh::ASSIGNMENT_TSC : ParticleMesh::ASSIGNMENT_CIC);
+}
 
-    if(!setGLBufferData(gl_mass_buf, *reinterpret_cast<QVector<float>*>(&data))) return false;
-    for(size_t i = 0; i < switch_buffers_count; i ++){
-        if(!setGLBufferData(gl_pos_buf[i], data)) return false;
-        if(!setGLBufferData(gl_vel_buf[i], data)) return false;
-    }
+NBody::Integrator NBody::integrator() const
+{
+    return nbody_integrator;
+}
 
-    return true;
+void NBody::setIntegrator(Integrator i)
+{
+    if(i != nbody_integrator) acc_reset = true;
+    nbody_integrator = i;
 }
 
-bool NBody::isReady() const
+NBody::Precision NBody::precision() const
 {
-    return is_ready;
+    return nbody_precision;
 }
 
-bool NBody::isRunning() const
+void NBody::setPrecision(Precision p)
 {
-    if(!clevent->isValid()) return false;
+    nbody_precision = p;
+}
 
-    bool res = false;
-    try{
-        res = clevent->isRunning();
-    }catch(CLException& e){
-        log(Log::WARNING, LOG_WHO, e.what());
-    }
-    return res;
+NBody::Softening NBody::softening() const
+{
+    return nbody_softening;
 }
 
-bool NBody::wait() const
+void NBody::setSoftening(Softening s)
 {
-    if(!isReady() || !isRunning()) return false;
+    nbody_softening = s;
+}
 
-    try{
-        return clevent->wait();
-    }catch(CLException& e){
-        log(Log::WARNING, LOG_WHO, e.what());
-    }
-    return false;
+float NBody::softeningLength() const
+{
+    return softening_length;
 }
 
-bool NBody::setMasses(const QVector<qreal> &data, size_t offset)
+void NBody::setSofteningLength(float length)
 {
-    if(!isReady() || isRunning()) return false;
-    return setGLBufferData(gl_mass_buf, data, offset);
+    softening_length = std::max(length, 0.0f);
 }
 
-bool NBody::setMasses(const QVector<float> &data, size_t offset)
+NBody::Profile::Profile()
 {
-    if(!isReady() || isRunning()) return false;
-    return setGLBufferData(gl_mass_buf, data, offset);
+    acquire_time = 0.0;
+    compute_time = 0.0;
+    force_time = 0.0;
+    integrate_time = 0.0;
+    unpack_time = 0.0;
+    release_time = 0.0;
+    device_time = 0.0;
+    total_time = 0.0;
+    interactions = 0.0;
+    gflops = 0.0;
 }
 
-bool NBody::setPositions(const QVector<QVector3D> &data, size_t offset)
+bool NBody::Profile::isValid() const
 {
-    if(!isReady() || isRunning()) return false;
-    return setGLBufferData(gl_pos_buf[current_in], data, offset);
+    return device_time > 0.0;
 }
 
-bool NBody::setPositions(const QVector<Point3f> &data, size_t offset)
+NBody::KernelTuning::KernelTuning()
 {
-    if(!isReady() || isRunning()) return false;
-    return setGLBufferData(gl_pos_buf[current_in], data, offset);
+    local_size = 0;
+    tile_size = 0;
+    unroll = 0;
+    bodies_per_item = 0;
 }
 
-bool NBody::setVelocities(const QVector<QVector3D> &data, size_t offset)
+NBody::BodiesView::BodiesView(const float *masses, const float *positions,
+                              const float *velocities, size_t count)
 {
-    if(!isReady() || isRunning()) return false;
-    return setGLBufferData(gl_vel_buf[current_in], data, offset);
+    this->masses = masses;
+    this->positions = positions;
+    this->velocities = velocities;
+    this->count = count;
 }
 
-bool NBody::setVelocities(const QVector<Point3f> &data, size_t offset)
+bool NBody::KernelTuning::isValid() const
 {
-    if(!isReady() || isRunning()) return false;
-    return setGLBufferData(gl_vel_buf[current_in], data, offset);
+    return local_size != 0 && tile_size != 0 && tile_size <= local_size &&
+           unroll > 0 && bodies_per_item > 0;
 }
 
-bool NBody::getMasses(QVector<qreal> &data, size_t offset, size_t count) const
+QString NBody::KernelTuning::toString() const
 {
-    if(!isReady() || isRunning()) return false;
-    return getGLBufferData(gl_mass_buf, data, offset, count);
+    return QString("%1,%2,%3,%4").arg(local_size).arg(tile_size).arg(unroll).arg(bodies_per_item);
 }
 
-bool NBody::getMasses(QVector<float> &data, size_t offset, size_t count) const
+NBody::KernelTuning NBody::KernelTuning::fromString(const QString &str)
 {
-    if(!isReady() || isRunning()) return false;
-    return getGLBufferData(gl_mass_buf, data, offset, count);
+    KernelTuning tuning;
+
+    QStringList values = str.split(',');
+    if(values.size() != 4) return tuning;
+
+    tuning.local_size = values.at(0).toUInt();
+    tuning.tile_size = values.at(1).toUInt();
+    tuning.unroll = values.at(2).toInt();
+    tuning.bodies_per_item = values.at(3).toInt();
+
+    if(!tuning.isValid()) return KernelTuning();
+
+    return tuning;
 }
 
-bool NBody::getPositions(QVector<QVector3D> &data, size_t offset, size_t count) const
+bool NBody::packedLayout() const
 {
-    if(!isReady() || isRunning()) return false;
-    return getGLBufferData(gl_pos_buf[current_in], data, offset, count);
+    return packed_layout;
 }
 
-bool NBody::getPositions(QVector<Point3f> &data, size_t offset, size_t count) const
+void NBody::setPackedLayout(bool packed)
 {
-    if(!isReady() || isRunning()) return false;
-    return getGLBufferData(gl_pos_buf[current_in], data, offset, count);
+    packed_layout = packed;
 }
 
-bool NBody::getVelocities(QVector<QVector3D> &data, size_t offset, size_t count) const
+bool NBody::multiDevice() const
 {
-    if(!isReady() || isRunning()) return false;
-    return getGLBufferData(gl_vel_buf[current_in], data, offset, count);
+    return multi_device;
 }
 
-bool NBody::getVelocities(QVector<Point3f> &data, size_t offset, size_t count) const
+void NBody::setMultiDevice(bool enabled)
 {
-    if(!isReady() || isRunning()) return false;
-    return getGLBufferData(gl_vel_buf[current_in], data, offset, count);
+    multi_device = enabled;
 }
 
-NBodyGLBuffer *NBody::indexBuffer()
+bool NBody::autoTune() const
 {
-    return gl_index_buf;
+    return auto_tune;
 }
 
-NBodyGLBuffer *NBody::massBuffer()
+void NBody::setAutoTune(bool enabled)
 {
-    return gl_mass_buf;
+    auto_tune = enabled;
 }
 
-NBodyGLBuffer *NBody::posBuffer()
+bool NBody::profiling() const
 {
-    return gl_pos_buf[current_in];
+    return profiling_enabled;
 }
 
-NBodyGLBuffer *NBody::velBuffer()
+void NBody::setProfiling(bool enabled)
 {
-    return gl_vel_buf[current_in];
+    profiling_enabled = enabled;
+    last_profile = Profile();
+    profile_sum = Profile();
+    profile_frames = 0;
 }
 
-/**
- * @brief Запускает расчёт симуляции очередного шага.
- * Использует установленное время шага.
- * @return true в случае успеха, иначе false.
- */
-bool NBody::simulate()
+bool NBody::pipelined() const
 {
-    // Запустить симуляцию с ранее установленным временем шага.
-    return simulate(time_step);
+    return pipelined_mode;
 }
 
-/**
- * @brief Запускает расчёт симуляции очередного шага.
+void NBody::setPipelined(bool enabled)
+{
+    pipelined_mode = enabled;
+}
+
+bool NBody::canDrawWhileRunning() const
+{
+    return program_pipelined && !native_backend && !display_sync;
+}
+
+bool NBody::setTrajectoryRecorder(TrajectoryRecorder *recorder)
+{
+    if(isRunning()) return false;
+
+    // Допишем кадры прежней записи.
+    destroyRecordBuffers();
+
+    trajectory_recorder = recorder;
+    record_step = 0;
+
+    if(trajectory_recorder == nullptr) return true;
+
+    if(!isReady() || !createRecordBuffers()){
+        log(Log::ERROR, LOG_WHO, tr("Error creating trajectory buffers"));
+        destroyRecordBuffers();
+        trajectory_recorder = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+TrajectoryRecorder *NBody::trajectoryRecorder() const
+{
+    return trajectory_recorder;
+}
+
+const NBody::Profile &NBody::profile() const
+{
+    return last_profile;
+}
+
+const NBody::KernelTuning &NBody::kernelTuning() const
+{
+    return kernel_tuning;
+}
+
+void NBody::setKernelTuning(const KernelTuning &tuning)
+{
+    kernel_tuning = tuning;
+}
+
+const QString &NBody::precisionReport() const
+{
+    return precision_report;
+}
+
+void NBody::setPrecisionReport(const QString &report)
+{
+    precision_report = report;
+}
+
+QString NBody::tuningKey(const CLDevice &device, size_t bodies) const
+{
+    // Группа числа тел - степень двойки.
+    int bodies_log2 = 0;
+    while((static_cast<size_t>(2) << bodies_log2) <= bodies) bodies_log2 ++;
+
+    // Сглаживание меняет код ядра.
+    int softening = softening_length > 0.0f ? static_cast<int>(nbody_softening) : static_cast<int>(SOFTENING_NONE);
+
+    QString key = device.name().simplified() + " " + device.driverVersion().simplified() +
+                  QString(" p%1 s%2 n%3").arg(static_cast<int>(nbody_precision)).arg(softening).arg(bodies_log2);
+    // Ключ настроек не должен содержать разделителей групп.
+    key.replace(QRegExp("[^A-Za-z0-9._-]"), "_");
+    return key;
+}
+
+size_t NBody::blockRungs() const
+{
+    return block_rungs;
+}
+
+void NBody::setBlockRungs(size_t rungs)
+{
+    if(rungs > BLOCK_RUNGS_MAX) rungs = BLOCK_RUNGS_MAX;
+    if(rungs != block_rungs) acc_reset = true;
+    block_rungs = rungs;
+}
+
+CLContext *NBody::clcontext()
+{
+    return clcxt;
+}
+
+/**
+ * @brief Инициализация систему NBody.
+ * @param platform Платформа OpenCL.
+ * @param device Устройство OpenCL.
+ * @param bodies Число тел.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::create(const CLPlatform& platform, const CLDevice& device, size_t bodies)
+{
+    // Нет смысла инициализировать систему из 0 тел.
+    if(bodies == 0) return false;
+
+    try{
+        // Получим максимальную доступную нам память устрйоства.
+        size_t mem_size = device.maxMemAllocSize();
+        // Если нам нужно больше.
+        if(mem_size < bodies * sizeof(float) * (3 * 2 /*pos,vel_in*/ + 3 * 2 /*pos,vel_out*/ + 1 /*masses*/)){
+            // Сообщим об этом.
+            log(Log::ERROR, LOG_WHO, tr("Out of memory!"));
+            // Возврат.
+            return false;
+        }
+    }// Если произошка ошибка.
+    catch(CLException& e){
+        // Сообщим об этом и считаем что памяти достаточно.
+        log(Log::WARNING, LOG_WHO, e.what());
+    }
+
+    // Если система уже была создана - уничтожим её.
+    if(is_ready) destroy();
+
+    // Теперь система не создана.
+    is_ready = false;
+    // Установим новое число тел.
+    bodies_count = bodies;
+    // Установим моделируемое число тел.
+    simulated_bodies_count = bodies;
+
+    // Буферы отображения нужны только для отрисовки.
+    program_pipelined = pipelined_mode && !headless;
+
+    // Если не удалось создать буфера OpenGL.
+    if(!createGLBuffers()){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error creating OpenGL buffers!"));
+        // Возврат.
+        return false;
+    }
+
+    // Расчёт на устройстве OpenCL.
+    native_backend = false;
+    // Метод интегрирования программы OpenCL.
+    program_integrator = nbody_integrator;
+    // Упакованные буферы.
+    program_packed = packed_layout;
+    packed_sync = true;
+    // Буферы отображения заполняются перед первым шагом.
+    display_sync = true;
+
+    // Если не удалось проинииализировать OpenCL.
+    if(!initOpenCL(platform, device)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error initializing OpenCL!"));
+        // Уничтожим буферы OpenGL.
+        destroyGLBuffers();
+        // Возврат.
+        return false;
+    }
+
+    // Ускорения для блочной схемы будут вычислены на первом шаге.
+    acc_reset = true;
+    if(block_rungs != 0 && nbody_solver != SOLVER_ALL_PAIRS){
+        log(Log::WARNING, LOG_WHO, tr("Block time steps are available only for all pairs solver"));
+    }
+    if(program_integrator != INTEGRATOR_EULER && nbody_solver != SOLVER_ALL_PAIRS){
+        log(Log::WARNING, LOG_WHO, tr("Integrators are available only for all pairs solver, using Euler"));
+    }
+    if(block_rungs != 0 && (program_integrator == INTEGRATOR_HERMITE || program_integrator == INTEGRATOR_YOSHIDA)){
+        log(Log::WARNING, LOG_WHO, tr("Block time steps use leapfrog integrator"));
+    }
+
+    // Установим флаг готовности к симуляции.
+    is_ready = true;
+
+    // Возврат успеха.
+    return true;
+}
+
+/**
+ * @brief Инициализация системы NBody без OpenCL.
+ * @param bodies Число тел.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::createNative(size_t bodies)
+{
+    // Нет смысла инициализировать систему из 0 тел.
+    if(bodies == 0) return false;
+
+    // Если система уже была создана - уничтожим её.
+    if(is_ready) destroy();
+
+    // Теперь система не создана.
+    is_ready = false;
+    // Установим новое число тел.
+    bodies_count = bodies;
+    // Установим моделируемое число тел.
+    simulated_bodies_count = bodies;
+
+    // Отображаются буферы позиций.
+    program_pipelined = false;
+
+    // Если не удалось создать буфера OpenGL.
+    if(!createGLBuffers()){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error creating OpenGL buffers!"));
+        // Возврат.
+        return false;
+    }
+
+    // Если не удалось выделить память.
+    if(!cpu_engine->create(bodies)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Out of memory!"));
+        // Уничтожим буферы OpenGL.
+        destroyGLBuffers();
+        // Возврат.
+        return false;
+    }
+
+    // Расчёт на процессоре.
+    native_backend = true;
+    // Данные будут считаны из буферов OpenGL перед первым шагом.
+    markBodiesChanged();
+
+    // Сообщим об используемом расчёте.
+    log(Log::INFO, LOG_WHO, tr("Using native CPU backend: %1, %2 thread(s)")
+                            .arg(CpuEngine::simdName()).arg(QThread::idealThreadCount()));
+    if(cpu_engine->pairThreads() != 0){
+        log(Log::INFO, LOG_WHO, tr("Using symmetric all pairs with %1 thread buffer(s)").arg(cpu_engine->pairThreads()));
+    }else{
+        log(Log::INFO, LOG_WHO, tr("Not enough memory for symmetric all pairs, computing each body separately"));
+    }
+    if(nbody_solver == SOLVER_BARNES_HUT){
+        log(Log::WARNING, LOG_WHO, tr("Barnes-Hut solver is not available on CPU, computing all pairs"));
+    }
+    if(block_rungs != 0){
+        log(Log::WARNING, LOG_WHO, tr("Block time steps are not available on CPU"));
+    }
+    if(nbody_softening != SOFTENING_NONE){
+        log(Log::WARNING, LOG_WHO, tr("Softening is not available on CPU"));
+    }
+    if(nbody_integrator != INTEGRATOR_EULER){
+        log(Log::WARNING, LOG_WHO, tr("Integrators are not available on CPU, using Euler"));
+    }
+
+    // Установим флаг готовности к симуляции.
+    is_ready = true;
+
+    // Возврат успеха.
+    return true;
+}
+
+bool NBody::isNative() const
+{
+    return native_backend;
+}
+
+bool NBody::isHeadless() const
+{
+    return headless;
+}
+
+void NBody::setHeadless(bool enabled)
+{
+    // Изменить режим созданной системы нельзя.
+    if(is_ready) return;
+    headless = enabled;
+}
+
+bool NBody::destroy()
+{
+    if(!is_ready) return false;
+
+    // Если расчёт на процессоре.
+    if(native_backend){
+        native_watcher->waitForFinished();
+        is_ready = false;
+
+        destroyRecordBuffers();
+        trajectory_recorder = nullptr;
+
+        cpu_engine->destroy();
+        destroyGLBuffers();
+
+        return true;
+    }
+
+    // Вернём буферы OpenGL.
+    releaseGLObjects();
+
+    try{
+        clqueue->finish();
+    }catch(CLException& e){
+        log(Log::WARNING, LOG_WHO, e.what());
+    }
+    is_ready = false;
+
+    destroyRecordBuffers();
+    trajectory_recorder = nullptr;
+
+    termOpenCL();
+    destroyGLBuffers();
+
+    return true;
+}
+
+bool NBody::reset()
+{
+    if(!isReady() || isRunning()) return false;
+
+    simulated_bodies_count = bodies_count;
+
+    QVector<Point3f> data(bodies_count);
+
+    if(!setGLBufferData(gl_mass_buf, *reinterpret_cast<QVector<float>*>(&data))) return false;
+    for(size_t i = 0; i < switch_buffers_count; i ++){
+        if(!setGLBufferData(gl_pos_buf[i], data)) return false;
+        if(!setGLBufferData(gl_vel_buf[i], data)) return false;
+    }
+
+    markBodiesChanged();
+
+    return true;
+}
+
+bool NBody::isReady() const
+{
+    return is_ready;
+}
+
+bool NBody::isRunning() const
+{
+    if(native_backend) return native_watcher->isRunning();
+
+    if(!clevent->isValid()) return false;
+
+    bool res = false;
+    try{
+        res = clevent->isRunning();
+    }catch(CLException& e){
+        log(Log::WARNING, LOG_WHO, e.what());
+    }
+    return res;
+}
+
+bool NBody::wait() const
+{
+    if(!isReady() || !isRunning()) return false;
+
+    if(native_backend){
+        native_watcher->waitForFinished();
+        return true;
+    }
+
+    try{
+        return clevent->wait();
+    }catch(CLException& e){
+        log(Log::WARNING, LOG_WHO, e.what());
+    }
+    return false;
+}
+
+bool NBody::setMasses(const QVector<qreal> &data, size_t offset)
+{
+    if(!isReady() || isRunning()) return false;
+    markBodiesChanged();
+    return setGLBufferData(gl_mass_buf, data, offset);
+}
+
+bool NBody::setMasses(const QVector<float> &data, size_t offset)
+{
+    if(!isReady() || isRunning()) return false;
+    markBodiesChanged();
+    return setGLBufferData(gl_mass_buf, data, offset);
+}
+
+bool NBody::setPositions(const QVector<QVector3D> &data, size_t offset)
+{
+    if(!isReady() || isRunning()) return false;
+    markBodiesChanged();
+    return setGLBufferData(gl_pos_buf[current_in], data, offset);
+}
+
+bool NBody::setPositions(const QVector<Point3f> &data, size_t offset)
+{
+    if(!isReady() || isRunning()) return false;
+    markBodiesChanged();
+    return setGLBufferData(gl_pos_buf[current_in], data, offset);
+}
+
+bool NBody::setVelocities(const QVector<QVector3D> &data, size_t offset)
+{
+    if(!isReady() || isRunning()) return false;
+    markBodiesChanged();
+    return setGLBufferData(gl_vel_buf[current_in], data, offset);
+}
+
+bool NBody::setVelocities(const QVector<Point3f> &data, size_t offset)
+{
+    if(!isReady() || isRunning()) return false;
+    markBodiesChanged();
+    return setGLBufferData(gl_vel_buf[current_in], data, offset);
+}
+
+bool NBody::setBodyData(BodyData data, const float *values, size_t count, size_t offset)
+{
+    if(!isReady() || isRunning()) return false;
+    markBodiesChanged();
+    switch(data){
+    case BODY_DATA_MASSES:
+        return setGLBufferData(gl_mass_buf, values, offset, count);
+    case BODY_DATA_POSITIONS:
+        return setGLBufferData(gl_pos_buf[current_in], values, offset * 3, count * 3);
+    case BODY_DATA_VELOCITIES:
+        return setGLBufferData(gl_vel_buf[current_in], values, offset * 3, count * 3);
+    }
+    return false;
+}
+
+bool NBody::setBodies(const BodiesView &bodies, size_t offset)
+{
+    if(!isReady() || isRunning()) return false;
+    if(offset + bodies.count > bodies_count) return false;
+    markBodiesChanged();
+    if(bodies.masses &&
+       !setGLBufferData(gl_mass_buf, bodies.masses, offset, bodies.count)) return false;
+    if(bodies.positions &&
+       !setGLBufferData(gl_pos_buf[current_in], bodies.positions, offset * 3, bodies.count * 3)) return false;
+    if(bodies.velocities &&
+       !setGLBufferData(gl_vel_buf[current_in], bodies.velocities, offset * 3, bodies.count * 3)) return false;
+    return true;
+}
+
+bool NBody::setBodiesAsync(const BodiesView &bodies, size_t offset)
+{
+    if(!isReady() || isRunning()) return false;
+    if(offset + bodies.count > bodies_count) return false;
+
+    // Без буферов в памяти устройства OpenCL
+    // запись выполняется сразу.
+    if(!headless || native_backend || zero_copy){
+        bool res = setBodies(bodies, offset);
+        QMetaObject::invokeMethod(this, "bodiesUploaded", Qt::QueuedConnection, Q_ARG(bool, res));
+        return res;
+    }
+
+    markBodiesChanged();
+
+    const float* values[] = {bodies.masses, bodies.positions, bodies.velocities};
+    NBodyGLBuffer* bufs[] = {gl_mass_buf, gl_pos_buf[current_in], gl_vel_buf[current_in]};
+
+    // Событие ставится на последнюю запись,
+    // очередь выполняет команды по порядку.
+    int last = -1;
+    for(int i = 0; i < 3; i ++){
+        if(values[i]) last = i;
+    }
+
+    if(last < 0){
+        QMetaObject::invokeMethod(this, "bodiesUploaded", Qt::QueuedConnection, Q_ARG(bool, true));
+        return true;
+    }
+
+    try{
+        // Дождёмся предыдущей записи.
+        if(clupload_event->isValid()){
+            clupload_event->wait();
+            clupload_event->release();
+        }
+
+        for(int i = 0; i <= last; i ++){
+            if(values[i] == nullptr) continue;
+
+            int index = sharedBufferIndex(bufs[i]);
+            size_t item_size = sharedItemSize(index) * sizeof(float);
+
+            sharedCLBuffer(index)->enqueueWrite(*clqueue, false, offset * item_size,
+                                                bodies.count * item_size, values[i],
+                                                nullptr, i == last ? clupload_event : nullptr);
+        }
+
+        clqueue->flush();
+    }catch(CLException& e){
+        log(Log::ERROR, LOG_WHO, e.what());
+        // Если событие последней записи не создано,
+        // сигнал окончания не придёт - пошлём его сами.
+        if(!clupload_event->isValid()){
+            QMetaObject::invokeMethod(this, "bodiesUploaded", Qt::QueuedConnection, Q_ARG(bool, false));
+        }
+        return false;
+    }
+
+    return true;
+}
+
+bool NBody::getMasses(QVector<qreal> &data, size_t offset, size_t count) const
+{
+    if(!isReady() || isRunning()) return false;
+    return getGLBufferData(gl_mass_buf, data, offset, count);
+}
+
+bool NBody::getMasses(QVector<float> &data, size_t offset, size_t count) const
+{
+    if(!isReady() || isRunning()) return false;
+    return getGLBufferData(gl_mass_buf, data, offset, count);
+}
+
+bool NBody::getPositions(QVector<QVector3D> &data, size_t offset, size_t count) const
+{
+    if(!isReady() || isRunning()) return false;
+    return getGLBufferData(gl_pos_buf[current_in], data, offset, count);
+}
+
+bool NBody::getPositions(QVector<Point3f> &data, size_t offset, size_t count) const
+{
+    if(!isReady() || isRunning()) return false;
+    return getGLBufferData(gl_pos_buf[current_in], data, offset, count);
+}
+
+bool NBody::getVelocities(QVector<QVector3D> &data, size_t offset, size_t count) const
+{
+    if(!isReady() || isRunning()) return false;
+    return getGLBufferData(gl_vel_buf[current_in], data, offset, count);
+}
+
+bool NBody::getVelocities(QVector<Point3f> &data, size_t offset, size_t count) const
+{
+    if(!isReady() || isRunning()) return false;
+    return getGLBufferData(gl_vel_buf[current_in], data, offset, count);
+}
+
+NBodyGLBuffer *NBody::indexBuffer()
+{
+    return gl_index_buf;
+}
+
+NBodyGLBuffer *NBody::massBuffer()
+{
+    return gl_mass_buf;
+}
+
+NBodyGLBuffer *NBody::posBuffer()
+{
+    return gl_pos_buf[current_in];
+}
+
+NBodyGLBuffer *NBody::velBuffer()
+{
+    return gl_vel_buf[current_in];
+}
+
+NBodyGLBuffer *NBody::drawBuffer()
+{
+    if(!program_pipelined || native_backend || display_sync) return posBuffer();
+
+    // Отображаем самый новый из скопированных кадров.
+    size_t front = display_front;
+    for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT; i ++){
+        if(display_frames[i] <= display_frames[front]) continue;
+        try{
+            if(cldisplay_events[i]->isValid() && !cldisplay_events[i]->isCompleted()) continue;
+        }catch(CLException& e){
+            log(Log::WARNING, LOG_WHO, e.what());
+            continue;
+        }
+        front = i;
+    }
+    display_front = front;
+
+    return gl_display_buf[display_front];
+}
+
+/**
+ * @brief Запускает расчёт симуляции очередного шага.
+ * Использует установленное время шага.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::simulate()
+{
+    // Запустить симуляцию с ранее установленным временем шага.
+    return simulate(time_step);
+}
+
+/**
+ * @brief Запускает расчёт симуляции очередного шага.
+ * @param dt Время шага.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::simulate(float dt)
+{
+    // Если не готовы, либо симуляция уже просчитывается - возврат.
+    if(!isReady() || isRunning()) return false;
+
+    // Число шагов запуска с учётом записи траектории.
+    frame_steps = nextFrameSteps();
+
+    // Счётчики профиля шага.
+    integrate_launches = 0;
+    profile_force_passes = 0;
+
+    // Если расчёт на процессоре.
+    if(native_backend) return simulateNative(dt);
+
+    // Запись кадра траектории после шагов.
+    bool record = recordDue(frame_steps);
+
+    // Результат.
+    bool res = true;
+
+    // Если событие OpenCL создано.
+    if(clevent->isValid()){
+        // Уничтожим его.
+        try{ clevent->release(); }catch(CLException& e){ log(Log::WARNING, LOG_WHO, e.what()); }
+    }
+
+    // Расчёт изменит данные, отображённые в память хоста.
+    unmapHostBuffers();
+
+    // Число шагов, поставленных в очередь полностью.
+    size_t steps_done = 0;
+
+    try{
+        // Начало шага.
+        enqueueProfileMarker(PROFILE_MARKER_START);
+
+        // Захватим буферы OpenGL, освобождённые после прошлого шага.
+        if(!headless) acquireGLObjects();
+
+        enqueueProfileMarker(PROFILE_MARKER_ACQUIRED);
+
+        // Конвейерная отрисовка.
+        if(program_pipelined){
+            // Заполним буферы отображения после изменения данных.
+            if(display_sync) syncDisplay();
+            // Иначе расчёт не должен перезаписать позиции,
+            // пока их копирует очередь отображения.
+            else{
+                size_t last = 0;
+                for(size_t i = 1; i < DISPLAY_BUFFERS_COUNT; i ++){
+                    if(display_frames[i] > display_frames[last]) last = i;
+                }
+                if(cldisplay_events[last]->isValid()) clqueue->waitForEvent(*cldisplay_events[last]);
+            }
+        }
+
+        // Расчёт на нескольких устройствах.
+        if(useDeviceParts()) beginDeviceParts();
+
+        // Шаги на упакованных данных.
+        bool packed = usePackedLayout();
+
+        // Упакуем изменённые вне упакованного расчёта данные.
+        if(packed && packed_sync){
+            enqueuePackBodies();
+            packed_sync = false;
+        }
+
+        // Поставим в очередь шаги подряд.
+        for(size_t step = 0; step < frame_steps && res; step ++){
+            // Расчёты ускорений шага, пока не сброшен флаг их пересчёта.
+            size_t force_passes = forcePassesPerStep();
+
+            // Если используется метод Барнса-Хата.
+            if(nbody_solver == SOLVER_BARNES_HUT){
+                // Построим дерево и запустим расчёт.
+                res = enqueueBarnesHut(dt);
+            }
+            // Если используется быстрый метод мультиполей.
+            else if(nbody_solver == SOLVER_FMM){
+                // Построим разложения и запустим расчёт.
+                res = enqueueFmm(dt);
+            }
+            // Если используется метод частица-сетка.
+            else if(nbody_solver == SOLVER_PM){
+                // Вычислим ускорения и запустим расчёт.
+                res = enqueueParticleMesh(dt);
+            }
+            // Если используются индивидуальные шаги.
+            else if(block_rungs != 0){
+                // Запустим подшаги блочной схемы.
+                res = enqueueBlockSteps(dt);
+            }else{
+                // Запустим шаг выбранным методом интегрирования.
+                enqueueAllPairs(dt);
+            }
+
+            // Результат шага - входные данные следующего.
+            if(res){
+                profile_force_passes += force_passes;
+                switchCurrentBuffers();
+                steps_done ++;
+                record_step ++;
+            }
+        }
+
+        if(device_parts_active) endDeviceParts();
+
+        enqueueProfileMarker(PROFILE_MARKER_COMPUTED);
+
+        // Позиции для отрисовки.
+        if(packed){
+            if(res) enqueueUnpackPositions();
+        }else{
+            packed_sync = true;
+        }
+
+        enqueueProfileMarker(PROFILE_MARKER_UNPACKED);
+
+        // Прочитаем кадр траектории, пока буферы захвачены.
+        if(res && record) enqueueRecordFrame();
+
+    }// Если произошла ошибка.
+    catch(CLException& e){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, e.what());
+        // Результат - ошибка.
+        res = false;
+    }
+
+    device_parts_active = false;
+
+    // Если шаги поставлены в очередь не все.
+    // Поставленные шаги выполнятся, поэтому буферы остаются
+    // результатом последнего из них.
+    if(steps_done != frame_steps){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, tr("Simulation stopped after %1 of %2 steps").arg(steps_done).arg(frame_steps));
+    }
+
+    // Освободим буферы OpenGL.
+    if(!headless){
+        // Для отрисовки нужен только буфер новых позиций,
+        // остальные остаются захваченными до следующего шага.
+        // При конвейерной отрисовке позиции копируются
+        // в буфер отображения и все буферы остаются захваченными.
+        if(!res) releaseGLObjects();
+        else if(!program_pipelined) releaseGLObject(static_cast<int>(1 + current_in));
+    }
+
+    // Если всё прошло успешно.
+    if(res){
+
+        // Флаг установки маркера в очередь OpenCL.
+        bool add_marker_res = false;
+        try{
+            // Установим маркер в очередь OpenCL.
+            add_marker_res = clqueue->marker(clevent);
+            // Скопируем новые позиции для отображения.
+            if(add_marker_res && program_pipelined) enqueueDisplayTransfer();
+            // Если расчёт уже закончен.
+            if(clevent->isCompleted()){
+                // Вычислим профиль шага.
+                updateProfile();
+                // Пошлём сообщение окончания расчётов.
+                emit simulationFinished();
+            }else{
+                // Отправим все команды на устройство.
+                clqueue->flush();
+            }
+        }// Если произошла ошибка.
+        catch(CLException& e){
+            // Сообщим об этом.
+            log(Log::WARNING, LOG_WHO, e.what());
+        }
+
+        // Если маркер не установлен.
+        if(!add_marker_res){
+            // Сообщим об этом.
+            log(Log::WARNING, LOG_WHO, tr("Error enqueueing marker, waiting"));
+            try{
+                // Подождём завершения вычислений.
+                res = clqueue->finish();
+            }// Если произошла ошибка.
+            catch(CLException& e){
+                // Сообщим об этом.
+                log(Log::WARNING, LOG_WHO, e.what());
+            }
+            // Пошлём сообщение окончания расчётов.
+            emit simulationFinished();
+        }
+    }
+
+    // Возврат результата.
+    return res;
+}
+
+/**
+ * @brief Запускает шаги расчёта на процессоре.
+ * @param dt Время шага.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::simulateNative(float dt)
+{
+    // Если данные тел изменены - передадим их расчёту.
+    if(native_sync && !syncNative()){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error reading OpenGL buffers"));
+        // Возврат.
+        return false;
+    }
+
+    // Запись кадра траектории после шагов.
+    bool record = recordDue(frame_steps);
+    record_step += frame_steps;
+
+    // Запустим шаг в пуле потоков.
+    native_watcher->setFuture(QtConcurrent::run(this, &NBody::nativeStep, dt, frame_steps, record));
+
+    return true;
+}
+
+/**
+ * @brief Передаёт данные буферов OpenGL расчёту на процессоре.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::syncNative()
+{
+    QVector<float> masses;
+    QVector<float> positions;
+    QVector<float> velocities;
+
+    if(!getGLBufferData(gl_mass_buf, masses, 0, bodies_count) ||
+       !getGLBufferData(gl_pos_buf[current_in], positions, 0, bodies_count * 3) ||
+       !getGLBufferData(gl_vel_buf[current_in], velocities, 0, bodies_count * 3)) return false;
+
+    cpu_engine->setBodies(masses.constData(), positions.constData(), velocities.constData(), bodies_count);
+
+    native_sync = false;
+
+    return true;
+}
+
+/**
+ * @brief Шаги расчёта на процессоре.
+ * @param dt Время шага.
+ * @param steps Число шагов.
+ * @param record Флаг записи кадра траектории после шагов.
+ */
+void NBody::nativeStep(float dt, size_t steps, bool record)
+{
+    size_t count = simulated_bodies_count;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Время интегрирования.
+    QElapsedTimer integrate_timer;
+    qint64 integrate_time = 0;
+
+    for(size_t step = 0; step < steps; step ++){
+        // Флаг вычисления ускорений приближёнными методами.
+        bool computed = false;
+
+        if(nbody_solver == SOLVER_FMM || nbody_solver == SOLVER_PM){
+            tree_positions.resize(count * 3);
+            tree_masses.resize(count);
+            host_accelerations.resize(count * 3);
+
+            cpu_engine->getPositions(tree_positions.data(), count);
+            cpu_engine->getMasses(tree_masses.data(), count);
+
+            if(nbody_solver == SOLVER_FMM){
+                fmm->setTheta(bh_theta);
+                computed = fmm->build(tree_positions.constData(), tree_masses.constData(), count) &&
+                           fmm->evaluate(host_accelerations.data());
+            }else{
+                computed = particle_mesh->compute(tree_positions.constData(), tree_masses.constData(),
+                                                  count, host_accelerations.data());
+            }
+
+            if(computed) cpu_engine->setAccelerations(host_accelerations.constData(), count);
+        }
+
+        // Иначе - прямой расчёт всех пар.
+        if(!computed) cpu_engine->computeAccelerations(count);
+
+        integrate_timer.start();
+        cpu_engine->integrate(dt, count);
+        integrate_time += integrate_timer.nsecsElapsed();
+    }
+
+    // Подготовим данные для буферов OpenGL.
+    native_positions.resize(count * 3);
+    native_velocities.resize(count * 3);
+    cpu_engine->getPositions(native_positions.data(), count);
+    cpu_engine->getVelocities(native_velocities.data(), count);
+
+    native_step_time = timer.nsecsElapsed();
+    native_integrate_time = integrate_time;
+
+    // Кадр траектории.
+    if(record) recordNativeFrame(count);
+}
+
+/**
+ * @brief Слот завершения шага на процессоре.
+ */
+void NBody::on_nativeStepFinished()
+{
+    // Если система уничтожена во время шага.
+    if(!is_ready || !native_backend) return;
+
+    // Запишем результаты в буферы OpenGL для записи.
+    if(!setGLBufferData(gl_pos_buf[current_out], native_positions) ||
+       !setGLBufferData(gl_vel_buf[current_out], native_velocities)){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, tr("Error writing OpenGL buffers"));
+    }
+
+    // Переключим буферы для чтения и записи.
+    switchCurrentBuffers();
+
+    // Вычислим профиль шага.
+    profile_pending = true;
+    profile_force_passes = frame_steps;
+    updateProfile(native_step_time, native_integrate_time);
+
+    // Пошлём сообщение окончания расчётов.
+    emit simulationFinished();
+}
+
+/**
+ * @brief Слот завершения команд шага в очереди OpenCL.
+ */
+void NBody::on_simulationCompleted()
+{
+    // Вычислим профиль шага.
+    updateProfile();
+
+    // Пошлём сообщение окончания расчётов.
+    emit simulationFinished();
+}
+
+void NBody::on_bodiesUploaded(int status)
+{
+    emit bodiesUploaded(status == CL_COMPLETE);
+}
+
+/**
+ * @brief Ставит в очередь маркер границы этапа шага.
+ * @param marker Номер маркера.
+ */
+void NBody::enqueueProfileMarker(size_t marker)
+{
+    if(!clqueue_profiling) return;
+
+    CLEvent* event = clprofile_events[marker];
+
+    // Уничтожим маркер прошлого шага.
+    if(event->isValid()) event->release();
+
+    clqueue->marker(event);
+
+    profile_pending = true;
+}
+
+/**
+ * @brief Получение события для запуска ядра интегрирования.
+ * @return Событие, либо nullptr, если запуск не профилируется.
+ */
+CLEvent* NBody::integrateProfileEvent()
+{
+    if(!clqueue_profiling) return nullptr;
+
+    // Число событий ограничено, время остальных запусков
+    // оценивается по профилируемым.
+    size_t index = integrate_launches ++;
+    if(index >= PROFILE_INTEGRATE_EVENTS_MAX) return nullptr;
+
+    if(index >= static_cast<size_t>(clintegrate_events.size())){
+        clintegrate_events.append(new CLEvent());
+    }
+
+    CLEvent* event = clintegrate_events[index];
+
+    // Уничтожим событие прошлого шага.
+    if(event->isValid()) event->release();
+
+    return event;
+}
+
+/**
+ * @brief Получение числа расчётов ускорений всех тел
+ * очередного шага выбранным методом интегрирования.
+ * @return Число расчётов ускорений.
+ */
+size_t NBody::forcePassesPerStep() const
+{
+    // Приближённые методы считают ускорения один раз.
+    if(nbody_solver != SOLVER_ALL_PAIRS) return 1;
+
+    // Блочная схема и метод Эрмита пересчитывают ускорения
+    // всех тел после изменения их данных.
+    size_t reset = acc_reset ? 1 : 0;
+
+    // Подшаги блочной схемы в пересчёте на все тела.
+    if(block_rungs != 0) return 1 + reset;
+
+    switch(program_integrator){
+    case INTEGRATOR_YOSHIDA:
+        // Три подшага.
+        return 3;
+    case INTEGRATOR_HERMITE:
+        // Ускорения в предсказанных позициях.
+        return 1 + reset;
+    default:
+        break;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Получение интервала между временами устройства.
+ * @param begin Начало, нс.
+ * @param end Конец, нс.
+ * @return Интервал, мс.
+ */
+static double profileInterval(cl_ulong begin, cl_ulong end)
+{
+    return end > begin ? static_cast<double>(end - begin) / 1e6 : 0.0;
+}
+
+/**
+ * @brief Вычисляет профиль завершённого шага.
+ * @param device_time Время шага на устройстве, нс, либо отрицательное.
+ */
+void NBody::updateProfile(qint64 device_time, qint64 integrate_time)
+{
+    if(!profiling_enabled || !profile_pending) return;
+
+    profile_pending = false;
+
+    Profile prof;
+
+    if(device_time >= 0){
+        // Известно только время расчёта.
+        prof.compute_time = static_cast<double>(device_time) / 1e6;
+        prof.integrate_time = static_cast<double>(integrate_time) / 1e6;
+        prof.device_time = prof.compute_time;
+        prof.total_time = prof.compute_time;
+    }else{
+        if(!clqueue_profiling) return;
+
+        try{
+            cl_ulong queued = clprofile_events[PROFILE_MARKER_START]->queuedTime();
+            cl_ulong start = clprofile_events[PROFILE_MARKER_START]->endTime();
+            cl_ulong acquired = clprofile_events[PROFILE_MARKER_ACQUIRED]->endTime();
+            cl_ulong computed = clprofile_events[PROFILE_MARKER_COMPUTED]->endTime();
+            cl_ulong unpacked = clprofile_events[PROFILE_MARKER_UNPACKED]->endTime();
+            cl_ulong end = clevent->endTime();
+
+            prof.acquire_time = profileInterval(start, acquired);
+            prof.compute_time = profileInterval(acquired, computed);
+            prof.unpack_time = profileInterval(computed, unpacked);
+            prof.release_time = profileInterval(unpacked, end);
+            prof.device_time = profileInterval(start, end);
+            prof.total_time = profileInterval(queued, end);
+
+            // Время ядер интегрирования.
+            size_t timed = qMin<size_t>(integrate_launches, PROFILE_INTEGRATE_EVENTS_MAX);
+            for(size_t i = 0; i < timed; i ++){
+                CLEvent* event = clintegrate_events[i];
+                prof.integrate_time += profileInterval(event->startTime(), event->endTime());
+            }
+            if(timed != 0) prof.integrate_time *= static_cast<double>(integrate_launches) / timed;
+        }// Если произошла ошибка.
+        catch(CLException& e){
+            // Сообщим об этом и не будем больше пытаться.
+            log(Log::WARNING, LOG_WHO, e.what());
+            log(Log::WARNING, LOG_WHO, tr("Profiling info is not available, profiling disabled"));
+            clqueue_profiling = false;
+            return;
+        }
+    }
+
+    // Расчёт ускорений - остаток времени расчёта.
+    prof.integrate_time = qMin(prof.integrate_time, prof.compute_time);
+    prof.force_time = prof.compute_time - prof.integrate_time;
+
+    // Производительность в пересчёте на прямой расчёт всех пар.
+    if(prof.force_time > 0.0){
+        double pairs = static_cast<double>(simulated_bodies_count) * simulated_bodies_count * profile_force_passes;
+        prof.interactions = pairs / (prof.force_time / 1e3);
+
+        // Метод Эрмита и блочная схема вычисляют и рывки.
+        bool jerks = nbody_solver == SOLVER_ALL_PAIRS && !native_backend &&
+                     (block_rungs != 0 || program_integrator == INTEGRATOR_HERMITE);
+        int flops = jerks ? PROFILE_FLOPS_PER_JERK_INTERACTION : PROFILE_FLOPS_PER_INTERACTION;
+        prof.gflops = prof.interactions * flops / 1e9;
+    }
+
+    last_profile = prof;
+
+    profile_sum.acquire_time += prof.acquire_time;
+    profile_sum.compute_time += prof.compute_time;
+    profile_sum.force_time += prof.force_time;
+    profile_sum.integrate_time += prof.integrate_time;
+    profile_sum.unpack_time += prof.unpack_time;
+    profile_sum.release_time += prof.release_time;
+    profile_sum.device_time += prof.device_time;
+    profile_sum.total_time += prof.total_time;
+    profile_sum.interactions += prof.interactions;
+    profile_sum.gflops += prof.gflops;
+
+    // Периодически выведем средний профиль.
+    if(++ profile_frames >= PROFILE_LOG_FRAMES){
+        double n = static_cast<double>(profile_frames);
+
+        log(Log::INFO, LOG_WHO, tr("Profile (%1 frames avg): acquire %2 ms, force %3 ms, integrate %4 ms, unpack %5 ms, "
+                                   "release %6 ms, device %7 ms, total %8 ms, %9 G interactions/s, %10 GFLOP/s")
+                                .arg(profile_frames)
+                                .arg(profile_sum.acquire_time / n, 0, 'f', 3)
+                                .arg(profile_sum.force_time / n, 0, 'f', 3)
+                                .arg(profile_sum.integrate_time / n, 0, 'f', 3)
+                                .arg(profile_sum.unpack_time / n, 0, 'f', 3)
+                                .arg(profile_sum.release_time / n, 0, 'f', 3)
+                                .arg(profile_sum.device_time / n, 0, 'f', 3)
+                                .arg(profile_sum.total_time / n, 0, 'f', 3)
+                                .arg(profile_sum.interactions / n / 1e9, 0, 'f', 3)
+                                .arg(profile_sum.gflops / n, 0, 'f', 1));
+
+        profile_sum = Profile();
+        profile_frames = 0;
+    }
+}
+
+/**
+ * @brief Строит октодерево по текущим позициям
+ * и ставит в очередь расчёт методом Барнса-Хата.
+ * @param dt Время шага.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::enqueueBarnesHut(float dt)
+{
+    // Нечего считать.
+    if(simulated_bodies_count == 0) return true;
+
+    // Буферы дерева.
+    CLBuffer* nodes_buf = cl_tree_nodes_buf;
+    CLBuffer* indices_buf = cl_tree_indices_buf;
+
+    // Если дерево строится на устройстве.
+    if(gpu_tree_build && createTreeBuilder()){
+        // Поставим в очередь построение дерева.
+        if(!tree_builder->enqueueBuild(*clqueue, *cl_pos_buf[current_in], *cl_mass_buf, simulated_bodies_count)){
+            // Сообщим об этом.
+            log(Log::ERROR, LOG_WHO, tr("Error building octree"));
+            // Возврат.
+            return false;
+        }
+        nodes_buf = tree_builder->nodesBuffer();
+        indices_buf = tree_builder->indicesBuffer();
+    }
+    // Иначе построим дерево на хосте.
+    else if(!buildHostTree()){
+        return false;
+    }
+
+    // Установим аргументы ядра OpenCL.
+    clkernel_bh->setArg<float>(KERNEL_BH_ARG_DT, dt);
+    clkernel_bh->setArg<cl_mem>(KERNEL_BH_ARG_POSITIONS_IN,  cl_pos_buf[current_in ]->id());
+    clkernel_bh->setArg<cl_mem>(KERNEL_BH_ARG_POSITIONS_OUT, cl_pos_buf[current_out]->id());
+    clkernel_bh->setArg<cl_mem>(KERNEL_BH_ARG_VELOCITIES_IN,  cl_vel_buf[current_in ]->id());
+    clkernel_bh->setArg<cl_mem>(KERNEL_BH_ARG_VELOCITIES_OUT, cl_vel_buf[current_out]->id());
+    clkernel_bh->setArg<unsigned int>(KERNEL_BH_ARG_COUNT, simulated_bodies_count);
+    clkernel_bh->setArg<cl_mem>(KERNEL_BH_ARG_NODES, nodes_buf->id());
+    clkernel_bh->setArg<cl_mem>(KERNEL_BH_ARG_INDICES, indices_buf->id());
+    clkernel_bh->setArg<float>(KERNEL_BH_ARG_THETA2, bh_theta * bh_theta);
+
+    // Запустим программу OpenCL.
+    // Размер рабочей группы выберет реализация.
+    clkernel_bh->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, nullptr);
+
+    return true;
+}
+
+/**
+ * @brief Считывает позиции, строит октодерево на хосте
+ * и передаёт его устройству.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::buildHostTree()
+{
+    // Считаем текущие позиции и массы тел.
+    readHostBodies();
+
+    // Построим дерево.
+    if(!octree->build(tree_positions.constData(), tree_masses.constData(), simulated_bodies_count)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error building octree"));
+        // Возврат.
+        return false;
+    }
+
+    const QVector<Octree::Node>& nodes = octree->nodes();
+    const QVector<qint32>& indices = octree->indices();
+
+    // Если буфер узлов мал - увеличим его.
+    reserveCLBuffer(cl_tree_nodes_buf, tree_nodes_capacity, nodes.size() * sizeof(Octree::Node));
+
+    // Передадим дерево устройству.
+    cl_tree_nodes_buf->enqueueWrite(*clqueue, false, 0,
+                                    nodes.size() * sizeof(Octree::Node), nodes.constData());
+    cl_tree_indices_buf->enqueueWrite(*clqueue, false, 0,
+                                      indices.size() * sizeof(qint32), indices.constData());
+
+    return true;
+}
+
+/**
+ * @brief Считывает текущие позиции и массы тел на хост.
+ */
+void NBody::readHostBodies()
+{
+    tree_positions.resize(simulated_bodies_count * 3);
+    tree_masses.resize(simulated_bodies_count);
+
+    cl_pos_buf[current_in]->enqueueRead(*clqueue, false, 0,
+                                        simulated_bodies_count * sizeof(float) * 3, tree_positions.data());
+    cl_mass_buf->enqueueRead(*clqueue, true, 0,
+                             simulated_bodies_count * sizeof(float), tree_masses.data());
+}
+
+/**
+ * @brief Строит разложения быстрого метода мультиполей
+ * и ставит в очередь расчёт шага.
+ * При расчёте на устройстве с деревом на устройстве
+ * дерево, разложения и списки ближних листьев строятся
+ * ядрами OpenCL без чтения тел на хост.
+ * Иначе дерево, мультиполи и локальные разложения
+ * вычисляются на хосте, ближнее поле - на устройстве,
+ * либо также на хосте.
+ * @param dt Время шага.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::enqueueFmm(float dt)
+{
+    // Нечего считать.
+    if(simulated_bodies_count == 0) return true;
+
+    fmm->setTheta(bh_theta);
+
+    // Если всё считается на устройстве.
+    if(fmm_device_eval && gpu_tree_build && createTreeBuilder() && createFmmBuilder() &&
+       simulated_bodies_count > fmm_builder->leafCapacity()){
+        // Поставим в очередь построение дерева и разложений.
+        if(!tree_builder->enqueueBuild(*clqueue, *cl_pos_buf[current_in], *cl_mass_buf, simulated_bodies_count) ||
+           !fmm_builder->enqueueBuild(*clqueue, *cl_pos_buf[current_in], *cl_mass_buf,
+                                      *tree_builder, *fmm, simulated_bodies_count)){
+            // Сообщим об этом.
+            log(Log::ERROR, LOG_WHO, tr("Error building FMM expansions"));
+            // Возврат.
+            return false;
+        }
+
+        // Установим аргументы ядра OpenCL.
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_LEAVES, fmm_builder->leavesBuffer()->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_LEAF_OF, fmm_builder->leafOfBuffer()->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_NEAR, fmm_builder->nearBuffer()->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_LOCALS, fmm_builder->localsBuffer()->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_EXPS, fmm_builder->expsBuffer()->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_INDICES, tree_builder->indicesBuffer()->id());
+
+        return enqueueFmmEvaluate(dt);
+    }
+
+    // Считаем текущие позиции и массы тел.
+    readHostBodies();
+
+    // Построим дерево и разложения.
+    if(!fmm->build(tree_positions.constData(), tree_masses.constData(), simulated_bodies_count)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error building FMM expansions"));
+        // Возврат.
+        return false;
+    }
+
+    // Если ближнее поле считается на устройстве.
+    if(fmm_device_eval){
+        const QVector<qint32>& indices = fmm->indices();
+        const QVector<Fmm::Leaf>& leaves = fmm->leaves();
+        const QVector<qint32>& leaf_of = fmm->leafOf();
+        const QVector<qint32>& near_leaves = fmm->nearLeaves();
+        const QVector<float>& locals = fmm->leafLocals();
+        const QVector<qint32>& exps = fmm->exponents();
+
+        // Если буферы малы - увеличим их.
+        reserveCLBuffer(cl_fmm_leaves_buf, fmm_leaves_capacity, leaves.size() * sizeof(Fmm::Leaf));
+        reserveCLBuffer(cl_fmm_near_buf, fmm_near_capacity, near_leaves.size() * sizeof(qint32));
+        reserveCLBuffer(cl_fmm_locals_buf, fmm_locals_capacity, locals.size() * sizeof(float));
+        reserveCLBuffer(cl_fmm_exps_buf, fmm_exps_capacity, exps.size() * sizeof(qint32));
+
+        // Передадим данные устройству.
+        cl_tree_indices_buf->enqueueWrite(*clqueue, false, 0,
+                                          indices.size() * sizeof(qint32), indices.constData());
+        cl_fmm_leaves_buf->enqueueWrite(*clqueue, false, 0,
+                                        leaves.size() * sizeof(Fmm::Leaf), leaves.constData());
+        cl_fmm_leaf_of_buf->enqueueWrite(*clqueue, false, 0,
+                                         leaf_of.size() * sizeof(qint32), leaf_of.constData());
+        cl_fmm_near_buf->enqueueWrite(*clqueue, false, 0,
+                                      near_leaves.size() * sizeof(qint32), near_leaves.constData());
+        cl_fmm_locals_buf->enqueueWrite(*clqueue, false, 0,
+                                        locals.size() * sizeof(float), locals.constData());
+        cl_fmm_exps_buf->enqueueWrite(*clqueue, false, 0,
+                                      exps.size() * sizeof(qint32), exps.constData());
+
+        // Установим аргументы ядра OpenCL.
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_LEAVES, cl_fmm_leaves_buf->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_LEAF_OF, cl_fmm_leaf_of_buf->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_NEAR, cl_fmm_near_buf->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_LOCALS, cl_fmm_locals_buf->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_EXPS, cl_fmm_exps_buf->id());
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_INDICES, cl_tree_indices_buf->id());
+
+        return enqueueFmmEvaluate(dt);
+    }
+
+    // Вычислим ускорения на хосте.
+    host_accelerations.resize(simulated_bodies_count * 3);
+    fmm->evaluate(host_accelerations.data());
+
+    // Проинтегрируем на устройстве.
+    enqueueIntegrate(dt);
+
+    return true;
+}
+
+/**
+ * @brief Ставит в очередь расчёт шага ядром FMM
+ * по уже установленным буферам листьев и разложений.
+ * @param dt Время шага.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::enqueueFmmEvaluate(float dt)
+{
+    // Установим аргументы ядра OpenCL.
+    clkernel_fmm->setArg<float>(KERNEL_FMM_ARG_DT, dt);
+    clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_POSITIONS_IN,  cl_pos_buf[current_in ]->id());
+    clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_POSITIONS_OUT, cl_pos_buf[current_out]->id());
+    clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_VELOCITIES_IN,  cl_vel_buf[current_in ]->id());
+    clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_VELOCITIES_OUT, cl_vel_buf[current_out]->id());
+    clkernel_fmm->setArg<unsigned int>(KERNEL_FMM_ARG_COUNT, simulated_bodies_count);
+    clkernel_fmm->setArg<unsigned int>(KERNEL_FMM_ARG_TERMS, fmm->termsCount());
+
+    // Запустим программу OpenCL.
+    clkernel_fmm->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, nullptr);
+
+    return true;
+}
+
+/**
+ * @brief Вычисляет ускорения методом частица-сетка
+ * и ставит в очередь расчёт шага.
+ * @param dt Время шага.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::enqueueParticleMesh(float dt)
+{
+    // Нечего считать.
+    if(simulated_bodies_count == 0) return true;
+
+    // Считаем текущие позиции и массы тел.
+    readHostBodies();
+
+    // Вычислим ускорения на хосте.
+    host_accelerations.resize(simulated_bodies_count * 3);
+    if(!particle_mesh->compute(tree_positions.constData(), tree_masses.constData(),
+                               simulated_bodies_count, host_accelerations.data())){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error computing particle-mesh forces"));
+        // Возврат.
+        return false;
+    }
+
+    // Проинтегрируем на устройстве.
+    enqueueIntegrate(dt);
+
+    return true;
+}
+
+/**
+ * @brief Передаёт устройству ускорения, вычисленные на хосте,
+ * и ставит в очередь интегрирование.
+ * @param dt Время шага.
+ */
+void NBody::enqueueIntegrate(float dt)
+{
+    // Передадим ускорения устройству.
+    cl_acc_buf->enqueueWrite(*clqueue, false, 0,
+                             host_accelerations.size() * sizeof(float), host_accelerations.constData());
+
+    // Установим аргументы ядра OpenCL.
+    clkernel_integrate->setArg<float>(KERNEL_INTEGRATE_ARG_DT, dt);
+    clkernel_integrate->setArg<cl_mem>(KERNEL_INTEGRATE_ARG_POSITIONS_IN,  cl_pos_buf[current_in ]->id());
+    clkernel_integrate->setArg<cl_mem>(KERNEL_INTEGRATE_ARG_POSITIONS_OUT, cl_pos_buf[current_out]->id());
+    clkernel_integrate->setArg<cl_mem>(KERNEL_INTEGRATE_ARG_VELOCITIES_IN,  cl_vel_buf[current_in ]->id());
+    clkernel_integrate->setArg<cl_mem>(KERNEL_INTEGRATE_ARG_VELOCITIES_OUT, cl_vel_buf[current_out]->id());
+    clkernel_integrate->setArg<unsigned int>(KERNEL_INTEGRATE_ARG_COUNT, simulated_bodies_count);
+
+    // Запустим программу OpenCL.
+    clkernel_integrate->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, nullptr, integrateProfileEvent());
+}
+
+/**
+ * @brief Ставит в очередь шаг прямого расчёта всех пар
+ * выбранным методом интегрирования.
+ * @param dt Время шага.
+ */
+void NBody::enqueueAllPairs(float dt)
+{
+    switch(program_integrator){
+    case INTEGRATOR_LEAPFROG:
+        // Сдвиг на полшага, толчок, сдвиг на полшага.
+        enqueueDriftKick(dt, current_in, current_out, 0.5f, 1.0f, 0.5f);
+        break;
+    case INTEGRATOR_YOSHIDA:
+        // Три подшага метода с перешагиванием с коэффициентами Йошиды.
+        // Промежуточные результаты - в буферах для чтения.
+        enqueueDriftKick(dt, current_in, current_out, 0.5f * YOSHIDA_W1, YOSHIDA_W1, 0.0f);
+        enqueueDriftKick(dt, current_out, current_in, 0.5f * (YOSHIDA_W1 + YOSHIDA_W0), YOSHIDA_W0, 0.0f);
+        enqueueDriftKick(dt, current_in, current_out, 0.5f * (YOSHIDA_W0 + YOSHIDA_W1), YOSHIDA_W1, 0.5f * YOSHIDA_W1);
+        break;
+    case INTEGRATOR_HERMITE:
+        enqueueHermite(dt);
+        break;
+    default:
+        // Полунеявный метод Эйлера.
+        if(useSymmetricPairs()) enqueueSymmetricPairs(dt);
+        else enqueueDriftKick(dt, current_in, current_out, 0.0f, 1.0f, 1.0f);
+        break;
+    }
+}
+
+/**
+ * @brief Получение флага симметричного расчёта всех пар.
+ * @return Флаг симметричного расчёта.
+ */
+bool NBody::useSymmetricPairs() const
+{
+    return pairs_threads != 0 && program_precision == PRECISION_SINGLE &&
+           !usePackedLayout() && !device_parts_active;
+}
+
+/**
+ * @brief Ставит в очередь шаг полунеявным методом Эйлера
+ * с симметричным расчётом ускорений.
+ * @param dt Время шага.
+ */
+void NBody::enqueueSymmetricPairs(float dt)
+{
+    // Ускорения по парам тел.
+    size_t threads = pairs_threads;
+    size_t local_size = 1;
+    clkernel_pairs->setArg<unsigned int>(KERNEL_PAIRS_ARG_COUNT, simulated_bodies_count);
+    clkernel_pairs->setArg<cl_mem>(KERNEL_PAIRS_ARG_POSITIONS, cl_pos_buf[current_in]->id());
+    clkernel_pairs->execute(*clqueue, 1, &threads, &local_size);
+
+    // Суммы потоков.
+    clkernel_pairs_reduce->setArg<unsigned int>(KERNEL_PAIRS_REDUCE_ARG_COUNT, simulated_bodies_count);
+    clkernel_pairs_reduce->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, nullptr);
+
+    // Интегрирование.
+    clkernel_integrate->setArg<float>(KERNEL_INTEGRATE_ARG_DT, dt);
+    clkernel_integrate->setArg<cl_mem>(KERNEL_INTEGRATE_ARG_POSITIONS_IN,  cl_pos_buf[current_in ]->id());
+    clkernel_integrate->setArg<cl_mem>(KERNEL_INTEGRATE_ARG_POSITIONS_OUT, cl_pos_buf[current_out]->id());
+    clkernel_integrate->setArg<cl_mem>(KERNEL_INTEGRATE_ARG_VELOCITIES_IN,  cl_vel_buf[current_in ]->id());
+    clkernel_integrate->setArg<cl_mem>(KERNEL_INTEGRATE_ARG_VELOCITIES_OUT, cl_vel_buf[current_out]->id());
+    clkernel_integrate->setArg<unsigned int>(KERNEL_INTEGRATE_ARG_COUNT, simulated_bodies_count);
+    clkernel_integrate->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, nullptr, integrateProfileEvent());
+}
+
+/**
+ * @brief Ставит в очередь подшаг сдвиг-толчок-сдвиг.
+ * @param dt Время шага.
+ * @param src Индекс буферов для чтения.
+ * @param dst Индекс буферов для записи.
+ * @param drift_pre Доля шага сдвига до толчка.
+ * @param kick Доля шага толчка.
+ * @param drift_post Доля шага сдвига после толчка.
+ */
+void NBody::enqueueDriftKick(float dt, size_t src, size_t dst,
+                             float drift_pre, float kick, float drift_post)
+{
+    // Расчёт на упакованных данных.
+    if(usePackedLayout()){
+        clkernel_packed->setArg<unsigned int>(KERNEL_PACKED_ARG_COUNT, simulated_bodies_count);
+        clkernel_packed->setArg<float>(KERNEL_PACKED_ARG_DT, dt);
+        clkernel_packed->setArg<cl_mem>(KERNEL_PACKED_ARG_BODIES_IN,  cl_packed_buf[src]->id());
+        clkernel_packed->setArg<cl_mem>(KERNEL_PACKED_ARG_BODIES_OUT, cl_packed_buf[dst]->id());
+        clkernel_packed->setArg<cl_mem>(KERNEL_PACKED_ARG_VELOCITIES_IN,  cl_vel_buf[src]->id());
+        clkernel_packed->setArg<cl_mem>(KERNEL_PACKED_ARG_VELOCITIES_OUT, cl_vel_buf[dst]->id());
+        clkernel_packed->setArg<float>(KERNEL_PACKED_ARG_DRIFT_PRE, drift_pre);
+        clkernel_packed->setArg<float>(KERNEL_PACKED_ARG_KICK, kick);
+        clkernel_packed->setArg<float>(KERNEL_PACKED_ARG_DRIFT_POST, drift_post);
+
+        clkernel_packed->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, local_dims);
+        return;
+    }
+
+    // Установим аргументы ядра OpenCL.
+    clkernel->setArg<float>(KERNEL_MAIN_ARG_DT, dt);
+    clkernel->setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_IN,  cl_pos_buf[src]->id());
+    clkernel->setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_OUT, cl_pos_buf[dst]->id());
+    clkernel->setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_IN,  cl_vel_buf[src]->id());
+    clkernel->setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_OUT, cl_vel_buf[dst]->id());
+    clkernel->setArg<unsigned int>(KERNEL_MAIN_ARG_COUNT, simulated_bodies_count);//bodies_count
+    clkernel->setArg<float>(KERNEL_MAIN_ARG_DRIFT_PRE, drift_pre);
+    clkernel->setArg<float>(KERNEL_MAIN_ARG_KICK, kick);
+    clkernel->setArg<float>(KERNEL_MAIN_ARG_DRIFT_POST, drift_post);
+
+    // Части тел считаются на нескольких устройствах.
+    if(device_parts_active){
+        enqueueDeviceParts();
+        return;
+    }
+
+    clkernel->setArg<unsigned int>(KERNEL_MAIN_ARG_FIRST_BODY, 0);
+    clkernel->setArg<unsigned int>(KERNEL_MAIN_ARG_END_BODY, simulated_bodies_count);
+
+    // Запустим программу OpenCL.
+    clkernel->execute(*clqueue, NDRANGE_DIMENSIONS, main_global_dims, local_dims);
+}
+
+/**
+ * @brief Получение флага расчёта шага на упакованных данных.
+ * @return Флаг расчёта на упакованных данных.
+ */
+bool NBody::usePackedLayout() const
+{
+    return program_packed && nbody_solver == SOLVER_ALL_PAIRS &&
+           block_rungs == 0 && program_integrator != INTEGRATOR_HERMITE;
+}
+
+/**
+ * @brief Создаёт очереди команд дополнительных устройств контекста.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::createDeviceParts()
+{
+    destroyDeviceParts();
+
+    CLDeviceList devices = clcxt->devices();
+
+    // Одно устройство - обычный расчёт.
+    if(devices.size() < 2){
+        if(multi_device){
+            log(Log::WARNING, LOG_WHO, tr("Only one OpenCL device is available in context, using single device"));
+        }
+        return true;
+    }
+
+    try{
+        for(int i = 0; i < devices.size(); i ++){
+            DevicePart part;
+            part.device_id = devices[i].id();
+            part.queue = (i == 0) ? clqueue : new CLCommandQueue();
+            part.events[0] = new CLEvent();
+            part.events[1] = new CLEvent();
+            part.local_size = 1;
+            part.cache_size = 1;
+            part.first_body = 0;
+            part.bodies_count = 0;
+            // Оценка производительности до первого измерения.
+            part.throughput = static_cast<double>(devices[i].maxComputeUnits()) *
+                              std::max<cl_uint>(devices[i].maxClockFrequency(), 1);
+            device_parts.push_back(part);
+
+            // Время выполнения ядер нужно для распределения тел.
+            if(i != 0) part.queue->create(*clcxt, devices[i], CL_QUEUE_PROFILING_ENABLE);
+
+            log(Log::INFO, LOG_WHO, tr("Using OpenCL device %1 for a part of bodies").arg(devices[i].name()));
+        }
+    }// Если произошла ошибка.
+    catch(CLException& e){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, e.what());
+        destroyDeviceParts();
+        return false;
+    }
+
+    if(!calculateDevicePartsSizes()){
+        destroyDeviceParts();
+        return false;
+    }
+
+    device_parts_measured = false;
+    balanceDeviceParts();
+
+    return true;
+}
+
+/**
+ * @brief Уничтожает очереди команд и события устройств.
+ */
+void NBody::destroyDeviceParts()
+{
+    for(int i = 0; i < device_parts.size(); i ++){
+        DevicePart& part = device_parts[i];
+        if(part.queue != clqueue){
+            // Дождёмся ядер, события которых будут уничтожены.
+            try{
+                if(part.queue->isValid()) part.queue->finish();
+            }catch(CLException& e){
+                log(Log::WARNING, LOG_WHO, e.what());
+            }
+        }
+        for(size_t e = 0; e < 2; e ++){
+            destroyCLObject(part.events[e]);
+            delete part.events[e];
+        }
+        if(part.queue != clqueue){
+            destroyCLObject(part.queue);
+            delete part.queue;
+        }
+    }
+    device_parts.clear();
+    device_parts_event = 0;
+    device_parts_active = false;
+}
+
+/**
+ * @brief Вычисляет размеры рабочих групп и кэшей устройств.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::calculateDevicePartsSizes()
+{
+    try{
+        for(int i = 0; i < device_parts.size(); i ++){
+            DevicePart& part = device_parts[i];
+            CLDevice device(part.device_id);
+
+            // Размер рабочей группы.
+            size_t kernel_work_grp_size = clkernel->workGroupSize(device);
+            size_t local_size = std::min<size_t>(device.maxWorkGroupSize(), kernel_work_grp_size);
+            if(kernel_tuning.isValid()) local_size = std::min<size_t>(local_size, kernel_tuning.local_size);
+
+            // Размер кэша - так же, как для основного устройства.
+            size_t local_mem = device.localMemSize() - clkernel->localMemSize(device);
+            size_t cache_size = local_mem / (sizeof(unsigned int) + sizeof(float) * 3);
+            if(cache_size == 0){
+                log(Log::ERROR, LOG_WHO, tr("Local memory is too small!"));
+                return false;
+            }
+            cache_size = std::min(cache_size, kernel_work_grp_size);
+            if(kernel_tuning.isValid()) cache_size = std::min<size_t>(cache_size, kernel_tuning.tile_size);
+
+            // Основное устройство использует общий размер групп.
+            part.local_size = (i == 0) ? local_dims[0] : local_size;
+            part.cache_size = cache_size;
+
+            log(Log::INFO, LOG_WHO, tr("Device %1: local work size %2, cache size %3")
+                                    .arg(device.name()).arg(part.local_size).arg(part.cache_size));
+        }
+    }// Если произошла ошибка.
+    catch(CLException& e){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, e.what());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Получение флага расчёта шага на нескольких устройствах.
+ * @return Флаг расчёта на нескольких устройствах.
+ */
+bool NBody::useDeviceParts() const
+{
+    return device_parts.size() > 1 && nbody_solver == SOLVER_ALL_PAIRS &&
+           block_rungs == 0 && program_integrator != INTEGRATOR_HERMITE &&
+           !usePackedLayout();
+}
+
+/**
+ * @brief Начинает расчёт шагов на нескольких устройствах.
+ */
+void NBody::beginDeviceParts()
+{
+    size_t cur = device_parts_event;
+
+    // Производительность по последнему подшагу прошлого кадра.
+    bool measured = false;
+    double min_throughput = 0.0;
+    for(int i = 0; i < device_parts.size(); i ++){
+        DevicePart& part = device_parts[i];
+        CLEvent* event = part.events[cur];
+        if(part.bodies_count == 0 || !event->isValid()) continue;
+        try{
+            cl_ulong start = event->startTime();
+            cl_ulong end = event->endTime();
+            if(end > start){
+                double throughput = static_cast<double>(part.bodies_count) / (end - start);
+                // Сгладим измерения.
+                part.throughput = device_parts_measured ? 0.5 * (part.throughput + throughput) : throughput;
+                if(!measured || part.throughput < min_throughput) min_throughput = part.throughput;
+                measured = true;
+            }
+        }catch(CLException& e){
+            log(Log::WARNING, LOG_WHO, e.what());
+        }
+    }
+
+    if(measured){
+        // Устройства без тел не измерены - сравняем их с самым медленным.
+        if(!device_parts_measured){
+            for(int i = 0; i < device_parts.size(); i ++){
+                if(device_parts[i].bodies_count == 0) device_parts[i].throughput = min_throughput;
+            }
+        }
+        device_parts_measured = true;
+    }
+
+    // Число моделируемых тел могло измениться.
+    balanceDeviceParts();
+
+    // События прошлого кадра больше не нужны.
+    for(int i = 0; i < device_parts.size(); i ++){
+        for(size_t e = 0; e < 2; e ++){
+            if(device_parts[i].events[e]->isValid()) device_parts[i].events[e]->release();
+        }
+    }
+
+    // Точка синхронизации - все устройства ждут
+    // захвата буферов основным устройством.
+    device_parts_event = 0;
+    clqueue->marker(device_parts[0].events[0]);
+
+    device_parts_active = true;
+}
+
+/**
+ * @brief Заканчивает расчёт шагов на нескольких устройствах.
+ */
+void NBody::endDeviceParts()
+{
+    size_t cur = device_parts_event;
+
+    for(int i = 1; i < device_parts.size(); i ++){
+        if(device_parts[i].events[cur]->isValid()) clqueue->waitForEvent(*device_parts[i].events[cur]);
+    }
+
+    device_parts_active = false;
+}
+
+/**
+ * @brief Ставит в очереди устройств подшаг с установленными аргументами ядра.
+ */
+void NBody::enqueueDeviceParts()
+{
+    size_t prev = device_parts_event;
+    size_t next = 1 - prev;
+
+    // Каждое устройство ждёт окончания предыдущего подшага на остальных,
+    // своя очередь выполняется по порядку.
+    for(int i = 0; i < device_parts.size(); i ++){
+        if(device_parts[i].bodies_count == 0) continue;
+        for(int j = 0; j < device_parts.size(); j ++){
+            if(i == j || !device_parts[j].events[prev]->isValid()) continue;
+            device_parts[i].queue->waitForEvent(*device_parts[j].events[prev]);
+        }
+    }
+
+    size_t bodies_per_item = kernel_tuning.isValid() ? kernel_tuning.bodies_per_item : 1;
+
+    // Основное устройство - последним, чтобы аргументы
+    // кэша ядра остались установленными для него.
+    for(int i = device_parts.size() - 1; i >= 0; i --){
+        DevicePart& part = device_parts[i];
+
+        if(part.events[next]->isValid()) part.events[next]->release();
+
+        if(part.bodies_count == 0) continue;
+
+        clkernel->setArg<unsigned int>(KERNEL_MAIN_ARG_FIRST_BODY, part.first_body);
+        clkernel->setArg<unsigned int>(KERNEL_MAIN_ARG_END_BODY, part.first_body + part.bodies_count);
+        clkernel->setLocalArgSize(KERNEL_MAIN_ARG_POS_CACHE, part.cache_size * sizeof(float) * 3);
+        clkernel->setLocalArgSize(KERNEL_MAIN_ARG_MASS_CACHE, part.cache_size * sizeof(float));
+        clkernel->setArg<unsigned int>(KERNEL_MAIN_ARG_CACHE_SIZE, part.cache_size);
+
+        size_t items = (part.bodies_count + bodies_per_item - 1) / bodies_per_item;
+        size_t global_size = (items + part.local_size - 1) / part.local_size * part.local_size;
+
+        clkernel->execute(*part.queue, 1, &global_size, &part.local_size, nullptr, part.events[next]);
+
+        if(part.queue != clqueue) part.queue->flush();
+    }
+
+    // События предыдущего подшага уже в списках ожидания.
+    for(int i = 0; i < device_parts.size(); i ++){
+        if(device_parts[i].events[prev]->isValid()) device_parts[i].events[prev]->release();
+    }
+
+    device_parts_event = next;
+}
+
+/**
+ * @brief Делит тела между устройствами пропорционально производительности.
+ */
+void NBody::balanceDeviceParts()
+{
+    double total = 0.0;
+    for(int i = 0; i < device_parts.size(); i ++){
+        total += device_parts[i].throughput;
+    }
+
+    size_t count = simulated_bodies_count;
+    size_t first = 0;
+
+    for(int i = 0; i < device_parts.size(); i ++){
+        DevicePart& part = device_parts[i];
+
+        size_t part_count = count - first;
+        if(i != device_parts.size() - 1 && total > 0.0){
+            part_count = std::min(part_count, static_cast<size_t>(count * part.throughput / total + 0.5));
+        }
+
+        part.first_body = first;
+        part.bodies_count = part_count;
+        first += part_count;
+    }
+}
+
+/**
+ * @brief Ставит в очередь упаковку текущих позиций и масс.
+ */
+void NBody::enqueuePackBodies()
+{
+    clkernel_pack->setArg<unsigned int>(KERNEL_PACK_ARG_COUNT, bodies_count);
+    clkernel_pack->setArg<cl_mem>(KERNEL_PACK_ARG_POSITIONS, cl_pos_buf[current_in]->id());
+    clkernel_pack->setArg<cl_mem>(KERNEL_PACK_ARG_BODIES, cl_packed_buf[current_in]->id());
+
+    clkernel_pack->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, nullptr);
+}
+
+/**
+ * @brief Ставит в очередь распаковку текущих позиций
+ * в буфер для отрисовки.
+ */
+void NBody::enqueueUnpackPositions()
+{
+    clkernel_unpack->setArg<unsigned int>(KERNEL_UNPACK_ARG_COUNT, simulated_bodies_count);
+    clkernel_unpack->setArg<cl_mem>(KERNEL_UNPACK_ARG_BODIES, cl_packed_buf[current_in]->id());
+    clkernel_unpack->setArg<cl_mem>(KERNEL_UNPACK_ARG_POSITIONS, cl_pos_buf[current_in]->id());
+
+    clkernel_unpack->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, nullptr);
+}
+
+/**
+ * @brief Ставит в очередь шаг метода Эрмита 4-го порядка.
  * @param dt Время шага.
- * @return true в случае успеха, иначе false.
  */
-bool NBody::simulate(float dt)
+void NBody::enqueueHermite(float dt)
 {
-    // Если не готовы, либо симуляция уже просчитывается - возврат.
-    if(!isReady() || isRunning()) return false;
+    clkernel_hermite_predict->setArg<unsigned int>(KERNEL_HERMITE_PREDICT_ARG_COUNT, simulated_bodies_count);
+    clkernel_hermite_predict->setArg<float>(KERNEL_HERMITE_PREDICT_ARG_DT, dt);
+    clkernel_hermite_predict->setArg<cl_mem>(KERNEL_HERMITE_PREDICT_ARG_POSITIONS, cl_pos_buf[current_in]->id());
+    clkernel_hermite_predict->setArg<cl_mem>(KERNEL_HERMITE_PREDICT_ARG_VELOCITIES, cl_vel_buf[current_in]->id());
+
+    clkernel_hermite_correct->setArg<unsigned int>(KERNEL_HERMITE_CORRECT_ARG_COUNT, simulated_bodies_count);
+    clkernel_hermite_correct->setArg<float>(KERNEL_HERMITE_CORRECT_ARG_DT, dt);
+    clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_POSITIONS_IN,  cl_pos_buf[current_in ]->id());
+    clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_POSITIONS_OUT, cl_pos_buf[current_out]->id());
+    clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_VELOCITIES_IN,  cl_vel_buf[current_in ]->id());
+    clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_VELOCITIES_OUT, cl_vel_buf[current_out]->id());
+
+    // Если данные тел изменились - вычислим ускорения и рывки в текущих позициях.
+    if(acc_reset){
+        clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_POSITIONS_PRED, cl_pos_buf[current_in]->id());
+        clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_VELOCITIES_PRED, cl_vel_buf[current_in]->id());
+        clkernel_hermite_correct->setArg<int>(KERNEL_HERMITE_CORRECT_ARG_CORRECT, 0);
+        clkernel_hermite_correct->execute(*clqueue, 1, &jerk_global_size, &jerk_local_size);
+
+        acc_reset = false;
+    }
 
-    // Результат.
-    bool res = true;
+    // Предсказание.
+    clkernel_hermite_predict->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, nullptr, integrateProfileEvent());
 
-    // Подождём завершения операций OpenGL.
-    glFinish();
+    // Ускорения в предсказанных позициях и коррекция.
+    clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_POSITIONS_PRED, cl_hermite_pos_buf->id());
+    clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_VELOCITIES_PRED, cl_hermite_vel_buf->id());
+    clkernel_hermite_correct->setArg<int>(KERNEL_HERMITE_CORRECT_ARG_CORRECT, 1);
+    clkernel_hermite_correct->execute(*clqueue, 1, &jerk_global_size, &jerk_local_size);
+}
 
-    // Если событие OpenCL создано.
-    if(clevent->isValid()){
-        // Уничтожим его.
-        try{ clevent->release(); }catch(CLException& e){ log(Log::WARNING, LOG_WHO, e.what()); }
+/**
+ * @brief Ставит в очередь шаг блочной схемы индивидуальных шагов.
+ * @param dt Время шага нулевого уровня.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::enqueueBlockSteps(float dt)
+{
+    // Число подшагов.
+    int ticks = 1 << block_rungs;
+
+    clkernel_block_step->setArg<unsigned int>(KERNEL_BLOCK_STEP_ARG_COUNT, simulated_bodies_count);
+    clkernel_block_step->setArg<int>(KERNEL_BLOCK_STEP_ARG_RUNG_MAX, block_rungs);
+    clkernel_block_step->setArg<float>(KERNEL_BLOCK_STEP_ARG_DT, dt);
+    clkernel_block_step->setArg<cl_mem>(KERNEL_BLOCK_STEP_ARG_POSITIONS_OUT, cl_pos_buf[current_out]->id());
+    clkernel_block_step->setArg<cl_mem>(KERNEL_BLOCK_STEP_ARG_VELOCITIES_OUT, cl_vel_buf[current_out]->id());
+
+    clkernel_block_force->setArg<unsigned int>(KERNEL_BLOCK_FORCE_ARG_COUNT, simulated_bodies_count);
+    clkernel_block_force->setArg<int>(KERNEL_BLOCK_FORCE_ARG_RUNG_MAX, block_rungs);
+    clkernel_block_force->setArg<float>(KERNEL_BLOCK_FORCE_ARG_DT, dt);
+
+    // Обнулим счётчики активных тел.
+    if(!cl_block_counters_buf->enqueueWrite(*clqueue, false, 0, ticks * sizeof(qint32),
+                                            block_counters.constData())) return false;
+
+    // Если данные тел изменились - вычислим ускорения и уровни всех тел.
+    if(acc_reset){
+        clkernel_block_force->setArg<cl_mem>(KERNEL_BLOCK_FORCE_ARG_POSITIONS, cl_pos_buf[current_in]->id());
+        clkernel_block_force->setArg<cl_mem>(KERNEL_BLOCK_FORCE_ARG_VELOCITIES, cl_vel_buf[current_in]->id());
+        clkernel_block_force->setArg<int>(KERNEL_BLOCK_FORCE_ARG_TICK, -1);
+        clkernel_block_force->execute(*clqueue, 1, &jerk_global_size, &jerk_local_size);
+
+        acc_reset = false;
     }
 
-    try{
-        // Захватим буфера OpenGL.
-        cl_mass_buf->enqueueAcquireGLObject(*clqueue);
-        for(size_t i = 0; i < switch_buffers_count; i ++){
-            cl_pos_buf[i]->enqueueAcquireGLObject(*clqueue);
-            cl_vel_buf[i]->enqueueAcquireGLObject(*clqueue);
-        }
+    // Подшаги работают с буферами для записи.
+    clkernel_block_force->setArg<cl_mem>(KERNEL_BLOCK_FORCE_ARG_POSITIONS, cl_pos_buf[current_out]->id());
+    clkernel_block_force->setArg<cl_mem>(KERNEL_BLOCK_FORCE_ARG_VELOCITIES, cl_vel_buf[current_out]->id());
 
-        // Установим аргументы ядра OpenCL.
-        clkernel->setArg<float>(KERNEL_MAIN_ARG_DT, dt);
-        clkernel->setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_IN,  cl_pos_buf[current_in ]->id());
-        clkernel->setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_OUT, cl_pos_buf[current_out]->id());
-        clkernel->setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_IN,  cl_vel_buf[current_in ]->id());
-        clkernel->setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_OUT, cl_vel_buf[current_out]->id());
-        clkernel->setArg<unsigned int>(KERNEL_MAIN_ARG_COUNT, simulated_bodies_count);//bodies_count
+    for(int tick = 0; tick <= ticks; tick ++){
+        // Первый подшаг читает буферы для чтения, остальные - результат предыдущего.
+        size_t src = tick == 0 ? current_in : current_out;
 
-        // Запустим программу OpenCL.
-        clkernel->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, local_dims);
+        clkernel_block_step->setArg<cl_mem>(KERNEL_BLOCK_STEP_ARG_POSITIONS_IN, cl_pos_buf[src]->id());
+        clkernel_block_step->setArg<cl_mem>(KERNEL_BLOCK_STEP_ARG_VELOCITIES_IN, cl_vel_buf[src]->id());
+        clkernel_block_step->setArg<int>(KERNEL_BLOCK_STEP_ARG_TICK, tick);
+        clkernel_block_step->execute(*clqueue, NDRANGE_DIMENSIONS, global_dims, nullptr, integrateProfileEvent());
 
-    }// Если произошла ошибка.
-    catch(CLException& e){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, e.what());
-        // Результат - ошибка.
-        res = false;
+        // Последний подшаг только закрывает шаги всех тел.
+        if(tick == ticks) break;
+
+        // Ускорения тел, шаг которых заканчивается.
+        clkernel_block_force->setArg<int>(KERNEL_BLOCK_FORCE_ARG_TICK, tick);
+        clkernel_block_force->execute(*clqueue, 1, &jerk_global_size, &jerk_local_size);
     }
 
-    // Освободим буферы OpenGL.
-    try{cl_mass_buf->enqueueReleaseGLObject(*clqueue); }catch(CLException& e){ log(Log::WARNING, LOG_WHO, e.what()); }
-    for(size_t i = 0; i < switch_buffers_count; i ++){
-        try{ cl_pos_buf[i]->enqueueReleaseGLObject(*clqueue); }catch(CLException& e){ log(Log::WARNING, LOG_WHO, e.what()); }
-        try{ cl_vel_buf[i]->enqueueReleaseGLObject(*clqueue); }catch(CLException& e){ log(Log::WARNING, LOG_WHO, e.what()); }
+    return true;
+}
+
+/**
+ * @brief Создаёт построитель дерева на устройстве при первом обращении.
+ * @return true если построитель готов, иначе false.
+ */
+bool NBody::createTreeBuilder()
+{
+    if(tree_builder->isValid()) return true;
+    // Не будем повторять неудачную попытку каждый шаг.
+    if(tree_builder_tried) return false;
+
+    tree_builder_tried = true;
+
+    if(!tree_builder->create(*clcxt, clcxt->devices().first(), *clprogram,
+                             bodies_count, bodies_count > MORTON_64_BODIES_COUNT)){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, tr("Device tree build is unavailable, building tree on host"));
+        return false;
     }
 
-    // Если всё прошло успешно.
-    if(res){
+    return true;
+}
 
-        // Переключим буферы для чтения и записи.
-        switchCurrentBuffers();
+/**
+ * @brief Создаёт построитель разложений FMM на устройстве при первом обращении.
+ * @return true если построитель готов, иначе false.
+ */
+bool NBody::createFmmBuilder()
+{
+    if(fmm_builder->isValid()) return true;
+    // Не будем повторять неудачную попытку каждый шаг.
+    if(fmm_builder_tried) return false;
 
-        // Флаг установки маркера в очередь OpenCL.
-        bool add_marker_res = false;
-        try{
-            // Установим маркер в очередь OpenCL.
-            add_marker_res = clqueue->marker(clevent);
-            // Если расчёт уже закончен.
-            if(clevent->isCompleted()){
-                // Пошлём сообщение окончания расчётов.
-                emit simulationFinished();
-            }else{
-                // Отправим все команды на устройство.
-                clqueue->flush();
-            }
-        }// Если произошла ошибка.
-        catch(CLException& e){
-            // Сообщим об этом.
-            log(Log::WARNING, LOG_WHO, e.what());
-        }
+    fmm_builder_tried = true;
 
-        // Если маркер не установлен.
-        if(!add_marker_res){
-            // Сообщим об этом.
-            log(Log::WARNING, LOG_WHO, tr("Error enqueueing marker, waiting"));
-            try{
-                // Подождём завершения вычислений.
-                res = clqueue->finish();
-            }// Если произошла ошибка.
-            catch(CLException& e){
-                // Сообщим об этом.
-                log(Log::WARNING, LOG_WHO, e.what());
-            }
-            // Пошлём сообщение окончания расчётов.
-            emit simulationFinished();
-        }
+    if(!fmm_builder->create(*clcxt, clcxt->devices().first(), *clprogram, bodies_count)){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, tr("Device FMM is unavailable, building expansions on host"));
+        return false;
     }
 
-    // Возврат результата.
-    return res;
+    return true;
 }
 
 /**
@@ -474,20 +2842,81 @@ bool NBody::initOpenCL(const CLPlatform &platform, const CLDevice &device)
         // Сообщим используемое устройство OpenCL.
         log(Log::INFO, LOG_WHO, tr("Using OpenCL device: %1").arg(device.name()));
 
+        // Устройства контекста, основное - первое.
+        CLDeviceList devices;
+        devices << device;
+        if(multi_device){
+            CLDeviceList platform_devices = platform.getDevices();
+            for(CLDeviceList::iterator it = platform_devices.begin(); it != platform_devices.end(); ++ it){
+                if(!((*it) == device)) devices << (*it);
+            }
+        }
+
         // Если не удалось сосздать контекст OpenCL.
-        if(!clcxt->create(platform, CLDeviceList() << device, true)){
+        if(!clcxt->create(platform, devices, !headless)){
             // Возврат.
             return false;
         }
 
         // Если не удалось создать очередь команд OpenCL.
-        if(!clqueue->create(*clcxt, device)){
+        // Производительность устройств при расчёте на нескольких
+        // устройствах измеряется по событиям ядер.
+        bool queue_profiling = profiling_enabled || clcxt->devices().size() > 1;
+        if(!clqueue->create(*clcxt, device, queue_profiling ? CL_QUEUE_PROFILING_ENABLE : 0)){
+            // Уничтожим OpenCL.
+            termOpenCL();
+            // Возврат.
+            return false;
+        }
+        clqueue_profiling = profiling_enabled;
+
+        // Очередь копирования позиций для конвейерной отрисовки.
+        if(program_pipelined && !cltransfer_queue->create(*clcxt, device)){
             // Уничтожим OpenCL.
             termOpenCL();
             // Возврат.
             return false;
         }
 
+        // На процессоре каждая пара тел считается один раз
+        // потоками со своими буферами частичных сумм.
+        // Частичные суммы - одинарной точности.
+        pairs_threads = 0;
+        if(device.type() == CL_DEVICE_TYPE_CPU && clcxt->devices().size() == 1 &&
+           nbody_precision == PRECISION_SINGLE){
+            size_t threads = device.maxComputeUnits();
+            quint64 thread_size = static_cast<quint64>(bodies_count) * sizeof(float) * 3;
+            // Память частичных сумм ограничена долей физической памяти,
+            // а весь буфер - наибольшим размером буфера устройства.
+            quint64 budget = utils::physicalMemory() / PAIRS_MEMORY_FRACTION;
+            if(budget == 0) budget = PAIRS_MEMORY_DEFAULT;
+            budget = std::min<quint64>(budget, device.maxMemAllocSize());
+            pairs_threads = thread_size != 0 ? static_cast<size_t>(std::min<quint64>(threads, budget / thread_size)) : 0;
+            // Симметричный расчёт вдвое короче, но идёт лишь в pairs_threads
+            // потоках - при меньше чем половине потоков он медленнее.
+            if(pairs_threads * 2 < threads) pairs_threads = 0;
+            if(pairs_threads != 0){
+                log(Log::INFO, LOG_WHO, tr("Using symmetric all pairs kernel with %1 thread(s)").arg(pairs_threads));
+            }else{
+                log(Log::INFO, LOG_WHO, tr("Not enough memory for symmetric all pairs kernel, computing each body separately"));
+            }
+        }
+
+        // Синхронизация с OpenGL без glFinish().
+        gl_cl_sync = !headless && glFenceSync != nullptr && glDeleteSync != nullptr &&
+                     device.hasExtension("cl_khr_gl_event");
+        if(gl_cl_sync){
+            log(Log::INFO, LOG_WHO, tr("Using OpenGL sync objects (cl_khr_gl_event)"));
+        }
+
+        // Без OpenGL на процессоре или встроенном графическом
+        // процессоре буферы размещаются в памяти хоста
+        // и читаются отображением без копирования.
+        zero_copy = headless && clcxt->devices().size() == 1 && device.hostUnifiedMemory();
+        if(zero_copy){
+            log(Log::INFO, LOG_WHO, tr("Using zero-copy host memory buffers"));
+        }
+
         // Если не удалось создать буферы OpenCL.
         if(!createCLBuffers()){
             // Уничтожим OpenCL.
@@ -496,6 +2925,38 @@ bool NBody::initOpenCL(const CLPlatform &platform, const CLDevice &device)
             return false;
         }
 
+        // Точность суммирования ускорений.
+        program_precision = nbody_precision;
+        if(program_precision == PRECISION_DOUBLE){
+            CLDeviceList cxt_devices = clcxt->devices();
+            for(CLDeviceList::iterator it = cxt_devices.begin(); it != cxt_devices.end(); ++ it){
+                if(!(*it).hasExtension("cl_khr_fp64")){
+                    log(Log::WARNING, LOG_WHO, tr("Device %1 does not support cl_khr_fp64, using compensated summation")
+                                               .arg((*it).name()));
+                    program_precision = PRECISION_COMPENSATED;
+                    break;
+                }
+            }
+        }
+
+        // Подберём параметры ядра прямого расчёта,
+        // если они не были подобраны ранее.
+        if(auto_tune && !kernel_tuning.isValid()){
+            tuneKernel(device);
+        }
+
+        // Сообщим цену и выигрыш повышенной точности,
+        // замерив их, если они не были замерены ранее.
+        if(program_precision != PRECISION_SINGLE){
+            if(precision_report.isEmpty()){
+                measurePrecision(device);
+            }else{
+                foreach(const QString& line, precision_report.split('\n', QString::SkipEmptyParts)){
+                    log(Log::INFO, LOG_WHO, line);
+                }
+            }
+        }
+
         // Если не удалось создать программу OpenCL.
         if(!createCLProgram()){
             // Уничтожим OpenCL.
@@ -511,6 +2972,14 @@ bool NBody::initOpenCL(const CLPlatform &platform, const CLDevice &device)
             // Возврат.
             return false;
         }
+
+        // Если не удалось подготовить расчёт на нескольких устройствах.
+        if(!createDeviceParts()){
+            // Уничтожим OpenCL.
+            termOpenCL();
+            // Возврат.
+            return false;
+        }
     }// Если произошла ошибка.
     catch(CLException& e){
         // Сообщим об этом.
@@ -526,9 +2995,57 @@ bool NBody::initOpenCL(const CLPlatform &platform, const CLDevice &device)
 
 bool NBody::termOpenCL()
 {
+    fmm_builder->destroy();
+    fmm_builder_tried = false;
+    tree_builder->destroy();
+    tree_builder_tried = false;
+    destroyCLObject(clkernel_pairs_reduce);
+    destroyCLObject(clkernel_pairs);
+    destroyCLObject(clkernel_unpack);
+    destroyCLObject(clkernel_pack);
+    destroyCLObject(clkernel_packed);
+    destroyCLObject(clkernel_hermite_correct);
+    destroyCLObject(clkernel_hermite_predict);
+    destroyCLObject(clkernel_block_force);
+    destroyCLObject(clkernel_block_step);
+    destroyCLObject(clkernel_integrate);
+    destroyCLObject(clkernel_fmm);
+    destroyCLObject(clkernel_bh);
     destroyCLObject(clkernel);
     destroyCLObject(clprogram);
+    destroyCLObject(clglevent);
+    destroyCLObject(clupload_event);
+    destroyDeviceParts();
+    for(size_t i = 0; i < PROFILE_MARKERS_COUNT; i ++){
+        destroyCLObject(clprofile_events[i]);
+    }
+    for(int i = 0; i < clintegrate_events.size(); i ++){
+        destroyCLObject(clintegrate_events[i]);
+        delete clintegrate_events[i];
+    }
+    clintegrate_events.clear();
+    integrate_launches = 0;
+    clqueue_profiling = false;
+    profile_pending = false;
+    if(cltransfer_queue->isValid()){
+        try{ cltransfer_queue->finish(); }catch(CLException& e){ log(Log::WARNING, LOG_WHO, e.what()); }
+    }
+    destroyCLObject(cltransfer_glevent);
+    for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT; i ++){
+        destroyCLObject(cldisplay_events[i]);
+        display_frames[i] = 0;
+    }
+    display_frame = 0;
+    display_front = 0;
+    display_sync = true;
     destroyCLBuffers();
+    zero_copy = false;
+    pairs_threads = 0;
+    for(size_t i = 0; i < shared_buffers_count; i ++){
+        gl_acquired[i] = false;
+    }
+    gl_cl_sync = false;
+    destroyCLObject(cltransfer_queue);
     destroyCLObject(clqueue);
     destroyCLObject(clcxt);
     return true;
@@ -620,6 +3137,10 @@ bool NBody::calculateDimsSizes()
         size_t dev_work_grp_size = device.maxWorkGroupSize();
         // Получим размер рабочей группы ядра.
         size_t knl_work_grp_size = clkernel->workGroupSize(device);
+        // Ядро упакованных данных запускается с теми же размерами.
+        if(program_packed){
+            knl_work_grp_size = std::min(knl_work_grp_size, clkernel_packed->workGroupSize(device));
+        }
         // Получим число вычислительных элементов.
         size_t dev_compute_units = device.maxComputeUnits();
 
@@ -631,6 +3152,8 @@ bool NBody::calculateDimsSizes()
         // Выберем допустимый размер рабочей группы.
         size_t local_work_size = std::min(dev_work_grp_size,
                                           knl_work_grp_size);
+        // Подобранный размер рабочей группы.
+        if(kernel_tuning.isValid()) local_work_size = std::min<size_t>(local_work_size, kernel_tuning.local_size);
 
         // Установим размер локальных измерений.
         local_dims[0] = local_work_size;
@@ -642,6 +3165,13 @@ bool NBody::calculateDimsSizes()
 #if NDRANGE_DIMENSIONS > 1
         global_dims[1] = 1;
 #endif
+        // Ядро прямого расчёта может обрабатывать несколько тел на work-item.
+        size_t bodies_per_item = kernel_tuning.isValid() ? kernel_tuning.bodies_per_item : 1;
+        size_t main_items = (bodies_count + bodies_per_item - 1) / bodies_per_item;
+        main_global_dims[0] = (main_items + local_work_size - 1) / local_work_size * local_work_size;
+#if NDRANGE_DIMENSIONS > 1
+        main_global_dims[1] = 1;
+#endif
 
         // Сообщим рекомендованное число звёзд.
         log(Log::INFO, LOG_WHO, tr("Recommended maximum number of stars: %1").arg(local_work_size * dev_compute_units));
@@ -669,54 +3199,543 @@ bool NBody::calculateDimsSizes()
         return false;
     }
 
-    // Возврат успеха.
+    // Возврат успеха.
+    return true;
+}
+
+/**
+ * @brief Считывает исходный код программы OpenCL.
+ * @param source Результат - исходный код.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::readCLProgramSource(QString &source)
+{
+    // Файл программы.
+    QFile file(clprogram_file_name);
+    // Если не удалось открыть файл.
+    if(!file.open(QIODevice::ReadOnly)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error open OpenCL program file"));
+        // Возврат.
+        return false;
+    }
+
+    // Считаем код программы из файла.
+    source = file.readAll();
+
+    // Закроем файл.
+    file.close();
+
+    // Если файл пуст, либо произошла ошибка чтения.
+    if(source.isEmpty()){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Invalid OpenCL program from file"));
+        // Возврат.
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Получение опций компиляции программы OpenCL.
+ * @param tuning Параметры ядра прямого расчёта.
+ * @param precision Точность суммирования ускорений.
+ * @return Опции компиляции.
+ */
+QStringList NBody::clProgramOptions(const KernelTuning &tuning, Precision precision) const
+{
+    // Опции компиляции.
+    QStringList options;
+    options << "-cl-mad-enable";
+    // Перестановка операций сводит компенсацию ошибки к нулю.
+    if(precision == PRECISION_SINGLE) options << "-cl-fast-relaxed-math" << "-DNBODY_NATIVE_RSQRT";
+    options << QString("-DNBODY_PRECISION=%1").arg(static_cast<int>(precision));
+    options << QString("-DNBODY_RADIUS2_MIN=%1f").arg(static_cast<double>(NBODY_RADIUS2_MIN), 0, 'e', 9);
+    // Сглаживание.
+    if(nbody_softening != SOFTENING_NONE && softening_length > 0.0f){
+        options << QString("-DNBODY_SOFTENING=%1").arg(static_cast<int>(nbody_softening))
+                << QString("-DNBODY_SOFTENING_LENGTH=%1f").arg(static_cast<double>(softening_length), 0, 'e', 8);
+    }
+    // Для большого числа тел коды Мортона 30 бит слишком грубы.
+    if(bodies_count > MORTON_64_BODIES_COUNT) options << "-DNBODY_MORTON_64";
+    // Метод интегрирования.
+    options << QString("-DNBODY_INTEGRATOR=%1").arg(static_cast<int>(program_integrator));
+    // Параметры ядра прямого расчёта.
+    if(tuning.isValid()){
+        options << QString("-DNBODY_UNROLL=%1").arg(tuning.unroll)
+                << QString("-DNBODY_BODIES_PER_ITEM=%1").arg(tuning.bodies_per_item);
+    }
+    return options;
+}
+
+/**
+ * @brief Получение имени файла кэша двоичного кода программы OpenCL.
+ * @param source Исходный код.
+ * @param options Опции компиляции.
+ * @param device Устройство OpenCL.
+ * @return Имя файла кэша, пустая строка, если кэш недоступен.
+ */
+QString NBody::clProgramCacheFileName(const QString &source, const QStringList &options, const CLDevice &device)
+{
+    QString dir_name = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+    if(dir_name.isEmpty()) dir_name = QDir::tempPath();
+    dir_name += QString("/") + clprogram_cache_dir_name;
+
+    // Создадим каталог кэша.
+    if(!QDir().mkpath(dir_name)) return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(source.toUtf8());
+    hash.addData(options.join(" ").toUtf8());
+    hash.addData(device.name().toUtf8());
+    hash.addData(device.driverVersion().toUtf8());
+
+    return dir_name + "/" + QString(hash.result().toHex()) + ".bin";
+}
+
+/**
+ * @brief Создаёт и собирает программу OpenCL.
+ * @param program Программа OpenCL.
+ * @param source Исходный код.
+ * @param options Опции компиляции.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::buildCLProgram(CLProgram *program, const QString &source, const QStringList &options)
+{
+    // Программа собирается для единственного устройства контекста.
+    CLDevice device = clcxt->devices().first();
+
+    // Двоичный код кэшируется для контекста из одного устройства.
+    QString cache_file_name;
+    if(clcxt->devices().size() == 1) cache_file_name = clProgramCacheFileName(source, options, device);
+
+    // Попытаемся загрузить двоичный код из кэша.
+    if(!cache_file_name.isEmpty()){
+        QFile file(cache_file_name);
+        if(file.open(QIODevice::ReadOnly)){
+            QByteArray binary = file.readAll();
+            file.close();
+
+            try{
+                program->createWithBinary(*clcxt, device, binary);
+                program->build(clcxt->devices(), options);
+
+                log(Log::INFO, LOG_WHO, tr("Using cached OpenCL program binary %1").arg(cache_file_name));
+
+                return true;
+            }// Если произошла ошибка - кэш устарел или повреждён.
+            catch(CLException& e){
+                log(Log::WARNING, LOG_WHO, e.what());
+                destroyCLObject(program);
+                program->setId(nullptr);
+                file.remove();
+            }
+        }
+    }
+
+    // Скомпилируем программу из исходного кода.
+    program->create(*clcxt, source);
+    program->build(clcxt->devices(), options);
+
+    if(cache_file_name.isEmpty()) return true;
+
+    // Сохраним двоичный код в кэш.
+    try{
+        QByteArray binary = program->binary(device);
+        if(!binary.isEmpty()){
+            // Запись через временный файл, чтобы
+            // другой процесс не прочитал неполный файл.
+            QString tmp_file_name = cache_file_name + ".tmp";
+            QFile file(tmp_file_name);
+            if(file.open(QIODevice::WriteOnly)){
+                bool written = file.write(binary) == binary.size();
+                file.close();
+                QFile::remove(cache_file_name);
+                if(!written || !QFile::rename(tmp_file_name, cache_file_name)){
+                    QFile::remove(tmp_file_name);
+                    log(Log::WARNING, LOG_WHO, tr("Error writing OpenCL program cache %1").arg(cache_file_name));
+                }
+            }
+        }
+    }// Если произошла ошибка.
+    catch(CLException& e){
+        // Программа собрана - ошибка кэша не критична.
+        log(Log::WARNING, LOG_WHO, e.what());
+    }
+
+    return true;
+}
+
+/**
+ * @brief Подбирает параметры ядра прямого расчёта.
+ * @param device Устройство OpenCL.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::tuneKernel(const CLDevice &device)
+{
+    // Перебираемые развёртки цикла и числа тел work-item'а.
+    static const int unrolls[] = {1, 2, 4, 8};
+    static const int bodies_per_items[] = {1, 2, 4};
+
+    // Код программы.
+    QString source;
+    if(!readCLProgramSource(source)) return false;
+
+    // Число тел для замеров.
+    size_t count = std::min<size_t>(bodies_count, TUNE_BODIES_COUNT);
+
+    log(Log::INFO, LOG_WHO, tr("Tuning kernel for %1 on %2 bodies...").arg(device.name()).arg(count));
+
+    // Тела на решётке - чтобы не было совпадающих позиций.
+    QVector<float> positions(count * 3);
+    QVector<float> velocities(count * 3);
+    QVector<float> masses(count, 1.0f);
+    for(size_t i = 0; i < count; i ++){
+        positions[i * 3]     = static_cast<float>(i % 32);
+        positions[i * 3 + 1] = static_cast<float>((i / 32) % 32);
+        positions[i * 3 + 2] = static_cast<float>(i / 1024);
+    }
+
+    CLBuffer pos_in, pos_out, vel_in, vel_out, mass;
+    CLProgram program;
+    CLKernel kernel;
+
+    // Лучший вариант.
+    KernelTuning best;
+    qint64 best_time = -1;
+
+    try{
+        pos_in.create(*clcxt, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, positions.size() * sizeof(float), positions.data());
+        vel_in.create(*clcxt, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, velocities.size() * sizeof(float), velocities.data());
+        mass.create(*clcxt, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, masses.size() * sizeof(float), masses.data());
+        pos_out.create(*clcxt, CL_MEM_WRITE_ONLY, positions.size() * sizeof(float), nullptr);
+        vel_out.create(*clcxt, CL_MEM_WRITE_ONLY, velocities.size() * sizeof(float), nullptr);
+
+        for(size_t ui = 0; ui < sizeof(unrolls) / sizeof(unrolls[0]); ui ++){
+            for(size_t bi = 0; bi < sizeof(bodies_per_items) / sizeof(bodies_per_items[0]); bi ++){
+                KernelTuning variant;
+                variant.unroll = unrolls[ui];
+                variant.bodies_per_item = bodies_per_items[bi];
+                variant.local_size = 1;
+                variant.tile_size = 1;
+
+                // Соберём вариант программы.
+                try{
+                    buildCLProgram(&program, source, clProgramOptions(variant, program_precision));
+                    kernel.create(program, clprogram_kernel_name);
+                }catch(CLException& e){
+                    // Вариант не собирается на устройстве - пропустим его.
+                    log(Log::DEBUG, LOG_WHO, e.what());
+                    destroyCLObject(&kernel);
+                    destroyCLObject(&program);
+                    continue;
+                }
+
+                size_t max_local_size = std::min(device.maxWorkGroupSize(), kernel.workGroupSize(device));
+                size_t local_mem = device.localMemSize() - kernel.localMemSize(device);
+
+                kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_COUNT, count);
+                kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_IN, pos_in.id());
+                kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_OUT, pos_out.id());
+                kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_IN, vel_in.id());
+                kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_OUT, vel_out.id());
+                kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_MASSES, mass.id());
+                kernel.setArg<float>(KERNEL_MAIN_ARG_DT, 0.0f);
+                kernel.setArg<float>(KERNEL_MAIN_ARG_DRIFT_PRE, 0.0f);
+                kernel.setArg<float>(KERNEL_MAIN_ARG_KICK, 1.0f);
+                kernel.setArg<float>(KERNEL_MAIN_ARG_DRIFT_POST, 1.0f);
+                kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_FIRST_BODY, 0);
+                kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_END_BODY, count);
+
+                size_t local_size = std::min<size_t>(TUNE_LOCAL_SIZE_MIN, max_local_size);
+                for(; local_size <= max_local_size; local_size *= 2){
+                    // Плитки от полной группы до её четверти.
+                    for(size_t tile_size = local_size; tile_size >= std::max<size_t>(1, local_size / 4); tile_size /= 2){
+                        // Кэшируются позиции и массы.
+                        if(tile_size * sizeof(float) * 4 > local_mem) continue;
+
+                        kernel.setLocalArgSize(KERNEL_MAIN_ARG_POS_CACHE, tile_size * sizeof(float) * 3);
+                        kernel.setLocalArgSize(KERNEL_MAIN_ARG_MASS_CACHE, tile_size * sizeof(float));
+                        kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_CACHE_SIZE, tile_size);
+
+                        size_t items = (count + variant.bodies_per_item - 1) / variant.bodies_per_item;
+                        size_t global_size = (items + local_size - 1) / local_size * local_size;
+
+                        // Прогрев.
+                        kernel.execute(*clqueue, 1, &global_size, &local_size);
+                        clqueue->finish();
+
+                        QElapsedTimer timer;
+                        timer.start();
+                        for(int run = 0; run < TUNE_RUNS; run ++){
+                            kernel.execute(*clqueue, 1, &global_size, &local_size);
+                        }
+                        clqueue->finish();
+                        qint64 time = timer.nsecsElapsed();
+
+                        if(best_time < 0 || time < best_time){
+                            best_time = time;
+                            best = variant;
+                            best.local_size = local_size;
+                            best.tile_size = tile_size;
+                        }
+                    }
+                }
+
+                destroyCLObject(&kernel);
+                destroyCLObject(&program);
+            }
+        }
+    }// Если произошла ошибка.
+    catch(CLException& e){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, e.what());
+        destroyCLObject(&kernel);
+        destroyCLObject(&program);
+    }
+
+    destroyCLBuffer(&pos_in);
+    destroyCLBuffer(&pos_out);
+    destroyCLBuffer(&vel_in);
+    destroyCLBuffer(&vel_out);
+    destroyCLBuffer(&mass);
+
+    CLProgram::unloadCompiler();
+
+    if(!best.isValid()){
+        log(Log::WARNING, LOG_WHO, tr("Kernel tuning failed, using defaults"));
+        return false;
+    }
+
+    kernel_tuning = best;
+
+    log(Log::INFO, LOG_WHO, tr("Tuned kernel: local size %1, tile %2, unroll %3, %4 bodies per item (%5 ms)")
+                            .arg(best.local_size).arg(best.tile_size).arg(best.unroll).arg(best.bodies_per_item)
+                            .arg(best_time / TUNE_RUNS / 1e6, 0, 'f', 3));
+
     return true;
 }
 
 /**
- * @brief Создаёт, считывает и компилирует программу OpenCL.
- * @return true в случае успеха, иначе false.
+ * @brief Вычисляет множитель ускорения 1 / r^3 с учётом сглаживания.
+ * Повторяет soft_inv_r3 программы OpenCL в double.
+ * @param r2 Квадрат расстояния.
+ * @return Множитель ускорения.
  */
-bool NBody::createCLProgram()
+double NBody::softenedInvR3(double r2) const
 {
-    // Файл программы.
-    QFile file(clprogram_file_name);
-    // Если не удалось открыть файл.
-    if(!file.open(QIODevice::ReadOnly)){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, tr("Error open OpenCL program file"));
-        // Возврат.
-        return false;
+    bool soft = softening_length > 0.0f;
+    double eps = softening_length;
+    if(soft && nbody_softening == SOFTENING_PLUMMER) r2 += eps * eps;
+
+    // Нижняя граница квадрата расстояния, как в программе OpenCL.
+    r2 = std::max(r2, static_cast<double>(NBODY_RADIUS2_MIN));
+    double r = sqrt(r2);
+    double inv_r3 = 1.0 / (r * r * r);
+
+    if(soft && nbody_softening == SOFTENING_SPLINE){
+        double h = SOFTENING_SPLINE_RATIO * eps;
+        if(r < h){
+            double u = r / h;
+            double inv_h3 = 1.0 / (h * h * h);
+            if(u < 0.5){
+                inv_r3 = inv_h3 * (32.0 / 3.0 + u * u * (32.0 * u - 38.4));
+            }else{
+                inv_r3 = inv_h3 * (64.0 / 3.0 - 48.0 * u + 38.4 * u * u - 32.0 / 3.0 * u * u * u) -
+                         inv_r3 / 15.0;
+            }
+        }
     }
 
-    // Считаем код программы из файла.
-    QString source = file.readAll();
+    return inv_r3;
+}
 
-    // Закроем файл.
-    file.close();
+/**
+ * @brief Измеряет производительность и ошибку ускорений
+ * ядра прямого расчёта для доступных точностей суммирования.
+ * @param device Устройство OpenCL.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::measurePrecision(const CLDevice &device)
+{
+    // Названия точностей для лога.
+    static const char* precision_names[] = {"single", "compensated", "double"};
+
+    // Код программы.
+    QString source;
+    if(!readCLProgramSource(source)) return false;
+
+    // Число тел для замеров.
+    size_t count = std::min<size_t>(bodies_count, PRECISION_BODIES_COUNT);
+
+    // Тела распределены по Пламмеру - ускорения от близких
+    // и далёких звёзд различаются на порядки.
+    QVector<float> positions(count * 3);
+    QVector<float> velocities(count * 3, 0.0f);
+    QVector<float> masses(count);
+    quint32 seed = 12345;
+    for(size_t i = 0; i < count; i ++){
+        float u[4];
+        for(int k = 0; k < 4; k ++){
+            seed = seed * 1664525u + 1013904223u;
+            u[k] = (static_cast<float>(seed >> 8) + 0.5f) / 16777216.0f;
+        }
+        float u_r = std::min(std::max(u[0], 1e-3f), 0.999f);
+        float r = 10.0f / sqrt(pow(u_r, -2.0f / 3.0f) - 1.0f);
+        float z = 2.0f * u[1] - 1.0f;
+        float phi = 2.0f * static_cast<float>(M_PI) * u[2];
+        float rxy = sqrt(1.0f - z * z);
+        positions[i * 3]     = r * rxy * cos(phi);
+        positions[i * 3 + 1] = r * rxy * sin(phi);
+        positions[i * 3 + 2] = r * z;
+        masses[i] = 1.0f + 99.0f * u[3];
+    }
 
-    // Если файл пуст, либо произошла ошибка чтения.
-    if(source.isEmpty()){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, tr("Invalid OpenCL program from file"));
-        // Возврат.
-        return false;
+    // Точные ускорения.
+    QVector<double> reference(count * 3, 0.0);
+    for(size_t i = 0; i < count; i ++){
+        double ax = 0.0, ay = 0.0, az = 0.0;
+        for(size_t j = 0; j < count; j ++){
+            if(i == j) continue;
+            double dx = static_cast<double>(positions[j * 3])     - positions[i * 3];
+            double dy = static_cast<double>(positions[j * 3 + 1]) - positions[i * 3 + 1];
+            double dz = static_cast<double>(positions[j * 3 + 2]) - positions[i * 3 + 2];
+            double k = masses[j] * softenedInvR3(dx * dx + dy * dy + dz * dz);
+            ax += dx * k; ay += dy * k; az += dz * k;
+        }
+        reference[i * 3] = ax; reference[i * 3 + 1] = ay; reference[i * 3 + 2] = az;
     }
 
+    CLBuffer pos_in, pos_out, vel_in, vel_out, mass;
+    CLProgram program;
+    CLKernel kernel;
+
+    QVector<float> result(count * 3);
+
+    // Строки результатов замера.
+    QStringList report;
+
+    bool res = true;
+
     try{
-        // Попытаемся создать программу со считанным исходным кодом.
-        clprogram->create(*clcxt, source);
+        pos_in.create(*clcxt, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, positions.size() * sizeof(float), positions.data());
+        vel_in.create(*clcxt, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, velocities.size() * sizeof(float), velocities.data());
+        mass.create(*clcxt, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, masses.size() * sizeof(float), masses.data());
+        pos_out.create(*clcxt, CL_MEM_WRITE_ONLY, positions.size() * sizeof(float), nullptr);
+        vel_out.create(*clcxt, CL_MEM_WRITE_ONLY, velocities.size() * sizeof(float), nullptr);
+
+        for(int p = PRECISION_SINGLE; p <= program_precision; p ++){
+            Precision precision = static_cast<Precision>(p);
+
+            buildCLProgram(&program, source, clProgramOptions(kernel_tuning, precision));
+            kernel.create(program, clprogram_kernel_name);
+
+            size_t max_local_size = std::min(device.maxWorkGroupSize(), kernel.workGroupSize(device));
+            size_t local_size = kernel_tuning.isValid() ? kernel_tuning.local_size : PRECISION_LOCAL_SIZE;
+            local_size = std::min(local_size, max_local_size);
+            size_t tile_size = kernel_tuning.isValid() ? std::min(kernel_tuning.tile_size, local_size) : local_size;
+            size_t bodies_per_item = kernel_tuning.isValid() ? kernel_tuning.bodies_per_item : 1;
+
+            kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_COUNT, count);
+            kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_IN, pos_in.id());
+            kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_OUT, pos_out.id());
+            kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_IN, vel_in.id());
+            kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_OUT, vel_out.id());
+            kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_MASSES, mass.id());
+            kernel.setArg<float>(KERNEL_MAIN_ARG_DT, 1.0f);
+            kernel.setLocalArgSize(KERNEL_MAIN_ARG_POS_CACHE, tile_size * sizeof(float) * 3);
+            kernel.setLocalArgSize(KERNEL_MAIN_ARG_MASS_CACHE, tile_size * sizeof(float));
+            kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_CACHE_SIZE, tile_size);
+            kernel.setArg<float>(KERNEL_MAIN_ARG_DRIFT_PRE, 0.0f);
+            kernel.setArg<float>(KERNEL_MAIN_ARG_KICK, 1.0f);
+            kernel.setArg<float>(KERNEL_MAIN_ARG_DRIFT_POST, 0.0f);
+            kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_FIRST_BODY, 0);
+            kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_END_BODY, count);
+
+            size_t items = (count + bodies_per_item - 1) / bodies_per_item;
+            size_t global_size = (items + local_size - 1) / local_size * local_size;
+
+            // Прогрев и результат.
+            kernel.execute(*clqueue, 1, &global_size, &local_size);
+            vel_out.enqueueRead(*clqueue, true, 0, result.size() * sizeof(float), result.data());
+
+            QElapsedTimer timer;
+            timer.start();
+            for(int run = 0; run < PRECISION_RUNS; run ++){
+                kernel.execute(*clqueue, 1, &global_size, &local_size);
+            }
+            clqueue->finish();
+            qint64 time = timer.nsecsElapsed();
+
+            // Скорость после толчка единичной длительности -
+            // ускорение, умноженное на G.
+            double err_sum = 0.0;
+            double err_max = 0.0;
+            for(size_t i = 0; i < count; i ++){
+                double ref_len = 0.0, diff_len = 0.0;
+                for(int k = 0; k < 3; k ++){
+                    double ref = reference[i * 3 + k];
+                    double diff = static_cast<double>(result[i * 3 + k]) / PRECISION_G - ref;
+                    ref_len += ref * ref;
+                    diff_len += diff * diff;
+                }
+                double err = ref_len > 0.0 ? sqrt(diff_len / ref_len) : 0.0;
+                err_sum += err * err;
+                err_max = std::max(err_max, err);
+            }
+
+            double interactions = static_cast<double>(count) * count * PRECISION_RUNS;
+
+            QString line = tr("Precision %1 on %2 bodies: %3 G interactions/s, relative error rms %4, max %5")
+                           .arg(precision_names[p]).arg(count)
+                           .arg(time > 0 ? interactions / time : 0.0, 0, 'f', 2)
+                           .arg(sqrt(err_sum / count), 0, 'e', 2)
+                           .arg(err_max, 0, 'e', 2);
+            log(Log::INFO, LOG_WHO, line);
+            report << line;
+
+            destroyCLObject(&kernel);
+            destroyCLObject(&program);
+        }
     }// Если произошла ошибка.
     catch(CLException& e){
         // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, e.what());
-        // Возврат.
-        return false;
+        log(Log::WARNING, LOG_WHO, e.what());
+        destroyCLObject(&kernel);
+        destroyCLObject(&program);
+        res = false;
     }
 
+    destroyCLBuffer(&pos_in);
+    destroyCLBuffer(&pos_out);
+    destroyCLBuffer(&vel_in);
+    destroyCLBuffer(&vel_out);
+    destroyCLBuffer(&mass);
+
+    CLProgram::unloadCompiler();
+
+    // Запомним результаты для повторного использования.
+    if(res) precision_report = report.join("\n");
+
+    return res;
+}
+
+/**
+ * @brief Создаёт, считывает и компилирует программу OpenCL.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBody::createCLProgram()
+{
+    // Код программы.
+    QString source;
+
+    // Если не удалось считать код программы.
+    if(!readCLProgramSource(source)) return false;
+
     try{
-        // Попытаемся скомпилировать программу.
-        clprogram->build(clcxt->devices(), QStringList() << "-cl-mad-enable" << "-cl-fast-relaxed-math");
+        // Попытаемся создать и скомпилировать программу.
+        buildCLProgram(clprogram, source, clProgramOptions(kernel_tuning, program_precision));
     }// Если произошла ошибка.
     catch(CLException& e){
         // Сообщим об этом.
@@ -744,6 +3763,26 @@ bool NBody::createCLProgram()
     try{
         // Создадим ядро программы OpenCL.
         clkernel->create(*clprogram, clprogram_kernel_name);
+        // Создадим ядро метода Барнса-Хата.
+        clkernel_bh->create(*clprogram, clprogram_bh_kernel_name);
+        // Создадим ядра быстрого метода мультиполей.
+        clkernel_fmm->create(*clprogram, clprogram_fmm_kernel_name);
+        clkernel_integrate->create(*clprogram, clprogram_integrate_kernel_name);
+        // Создадим ядра блочной схемы индивидуальных шагов.
+        clkernel_block_step->create(*clprogram, clprogram_block_step_kernel_name);
+        clkernel_block_force->create(*clprogram, clprogram_block_force_kernel_name);
+        // Создадим ядра метода Эрмита.
+        clkernel_hermite_predict->create(*clprogram, clprogram_hermite_predict_kernel_name);
+        clkernel_hermite_correct->create(*clprogram, clprogram_hermite_correct_kernel_name);
+        // Создадим ядра расчёта на упакованных данных.
+        clkernel_packed->create(*clprogram, clprogram_packed_kernel_name);
+        clkernel_pack->create(*clprogram, clprogram_pack_kernel_name);
+        clkernel_unpack->create(*clprogram, clprogram_unpack_kernel_name);
+        // Создадим ядра симметричного расчёта.
+        if(pairs_threads != 0){
+            clkernel_pairs->create(*clprogram, clprogram_pairs_kernel_name);
+            clkernel_pairs_reduce->create(*clprogram, clprogram_pairs_reduce_kernel_name);
+        }
     }// Если произошла ошибка.
     catch(CLException& e){
         // Сообщим об этом.
@@ -783,6 +3822,9 @@ bool NBody::createCLProgram()
         // Нет смысла в кэше больше чем число рабочих элементов.
         if(cache_count > work_items) cache_count = work_items;
 
+        // Подобранный размер плитки.
+        if(kernel_tuning.isValid()) cache_count = std::min<size_t>(cache_count, kernel_tuning.tile_size);
+
     }// Если произошла ошибка.
     catch(CLException& e){
         // Сообщим об этом.
@@ -791,6 +3833,48 @@ bool NBody::createCLProgram()
 
     log(Log::INFO, LOG_WHO, tr("Number of cached data: %1").arg(cache_count));
 
+    // Размер кэша ядер, вычисляющих рывки.
+    size_t jerk_cache_count = 1;
+
+    try{
+        CLDevice device = clcxt->devices().first();
+
+        // Размер рабочей группы.
+        jerk_local_size = std::min(device.maxWorkGroupSize(),
+                                   std::min(clkernel_block_force->workGroupSize(device),
+                                            clkernel_hermite_correct->workGroupSize(device)));
+        // Глобальный размер покрывает все тела.
+        jerk_global_size = (bodies_count + jerk_local_size - 1) / jerk_local_size * jerk_local_size;
+
+        // Кэшируются позиции, скорости и массы.
+        size_t local_mem = device.localMemSize() - std::max(clkernel_block_force->localMemSize(device),
+                                                            clkernel_hermite_correct->localMemSize(device));
+        jerk_cache_count = std::max<size_t>(1, local_mem / (sizeof(float) * 7));
+        if(jerk_cache_count > jerk_local_size) jerk_cache_count = jerk_local_size;
+    }// Если произошла ошибка.
+    catch(CLException& e){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, e.what());
+        // Возврат.
+        return false;
+    }
+
+    // Размер кэша ядра упакованных данных.
+    size_t packed_cache_count = 1;
+
+    try{
+        CLDevice device = clcxt->devices().first();
+
+        // Кэшируются векторы (x, y, z, m).
+        size_t local_mem = device.localMemSize() - clkernel_packed->localMemSize(device);
+        packed_cache_count = std::max<size_t>(1, local_mem / (sizeof(float) * 4));
+        packed_cache_count = std::min(packed_cache_count, clkernel_packed->workGroupSize(device));
+    }// Если произошла ошибка.
+    catch(CLException& e){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, e.what());
+    }
+
     try{
         // Установим неизменяемые аргументы.
         // Буфер масс.
@@ -798,6 +3882,52 @@ bool NBody::createCLProgram()
         clkernel->setLocalArgSize(KERNEL_MAIN_ARG_POS_CACHE, cache_count * sizeof(float) * 3);
         clkernel->setLocalArgSize(KERNEL_MAIN_ARG_MASS_CACHE, cache_count * sizeof(float));
         clkernel->setArg<unsigned int>(KERNEL_MAIN_ARG_CACHE_SIZE, cache_count);
+        // Буфер масс ядра метода Барнса-Хата.
+        clkernel_bh->setArg<cl_mem>(KERNEL_BH_ARG_MASSES, cl_mass_buf->id());
+        // Буферы ядер быстрого метода мультиполей.
+        clkernel_fmm->setArg<cl_mem>(KERNEL_FMM_ARG_MASSES, cl_mass_buf->id());
+        clkernel_integrate->setArg<cl_mem>(KERNEL_INTEGRATE_ARG_ACCELERATIONS, cl_acc_buf->id());
+        // Буферы ядер симметричного расчёта.
+        if(pairs_threads != 0){
+            clkernel_pairs->setArg<cl_mem>(KERNEL_PAIRS_ARG_MASSES, cl_mass_buf->id());
+            clkernel_pairs->setArg<cl_mem>(KERNEL_PAIRS_ARG_PARTIAL, cl_pairs_buf->id());
+            clkernel_pairs->setArg<unsigned int>(KERNEL_PAIRS_ARG_BLOCK_SIZE, PAIRS_BLOCK_SIZE);
+            clkernel_pairs_reduce->setArg<cl_mem>(KERNEL_PAIRS_REDUCE_ARG_PARTIAL, cl_pairs_buf->id());
+            clkernel_pairs_reduce->setArg<unsigned int>(KERNEL_PAIRS_REDUCE_ARG_THREADS, pairs_threads);
+            clkernel_pairs_reduce->setArg<cl_mem>(KERNEL_PAIRS_REDUCE_ARG_ACCELERATIONS, cl_acc_buf->id());
+        }
+        // Буферы ядер блочной схемы.
+        clkernel_block_step->setArg<cl_mem>(KERNEL_BLOCK_STEP_ARG_ACCELERATIONS, cl_block_acc_buf->id());
+        clkernel_block_step->setArg<cl_mem>(KERNEL_BLOCK_STEP_ARG_RUNGS, cl_block_rung_buf->id());
+        clkernel_block_step->setArg<cl_mem>(KERNEL_BLOCK_STEP_ARG_ACTIVE, cl_block_active_buf->id());
+        clkernel_block_step->setArg<cl_mem>(KERNEL_BLOCK_STEP_ARG_COUNTERS, cl_block_counters_buf->id());
+        clkernel_block_force->setArg<cl_mem>(KERNEL_BLOCK_FORCE_ARG_MASSES, cl_mass_buf->id());
+        clkernel_block_force->setArg<cl_mem>(KERNEL_BLOCK_FORCE_ARG_ACCELERATIONS, cl_block_acc_buf->id());
+        clkernel_block_force->setArg<cl_mem>(KERNEL_BLOCK_FORCE_ARG_ACTIVE, cl_block_active_buf->id());
+        clkernel_block_force->setArg<cl_mem>(KERNEL_BLOCK_FORCE_ARG_COUNTERS, cl_block_counters_buf->id());
+        clkernel_block_force->setArg<float>(KERNEL_BLOCK_FORCE_ARG_ETA, BLOCK_TIME_STEP_ETA);
+        clkernel_block_force->setLocalArgSize(KERNEL_BLOCK_FORCE_ARG_POS_CACHE, jerk_cache_count * sizeof(float) * 3);
+        clkernel_block_force->setLocalArgSize(KERNEL_BLOCK_FORCE_ARG_VEL_CACHE, jerk_cache_count * sizeof(float) * 3);
+        clkernel_block_force->setLocalArgSize(KERNEL_BLOCK_FORCE_ARG_MASS_CACHE, jerk_cache_count * sizeof(float));
+        clkernel_block_force->setArg<unsigned int>(KERNEL_BLOCK_FORCE_ARG_CACHE_SIZE, jerk_cache_count);
+        // Буферы ядер метода Эрмита.
+        if(program_integrator == INTEGRATOR_HERMITE){
+            clkernel_hermite_predict->setArg<cl_mem>(KERNEL_HERMITE_PREDICT_ARG_ACCELERATIONS, cl_hermite_acc_buf->id());
+            clkernel_hermite_predict->setArg<cl_mem>(KERNEL_HERMITE_PREDICT_ARG_JERKS, cl_hermite_jerk_buf->id());
+            clkernel_hermite_predict->setArg<cl_mem>(KERNEL_HERMITE_PREDICT_ARG_POSITIONS_PRED, cl_hermite_pos_buf->id());
+            clkernel_hermite_predict->setArg<cl_mem>(KERNEL_HERMITE_PREDICT_ARG_VELOCITIES_PRED, cl_hermite_vel_buf->id());
+            clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_ACCELERATIONS, cl_hermite_acc_buf->id());
+            clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_JERKS, cl_hermite_jerk_buf->id());
+        }
+        clkernel_hermite_correct->setArg<cl_mem>(KERNEL_HERMITE_CORRECT_ARG_MASSES, cl_mass_buf->id());
+        clkernel_hermite_correct->setLocalArgSize(KERNEL_HERMITE_CORRECT_ARG_POS_CACHE, jerk_cache_count * sizeof(float) * 3);
+        clkernel_hermite_correct->setLocalArgSize(KERNEL_HERMITE_CORRECT_ARG_VEL_CACHE, jerk_cache_count * sizeof(float) * 3);
+        clkernel_hermite_correct->setLocalArgSize(KERNEL_HERMITE_CORRECT_ARG_MASS_CACHE, jerk_cache_count * sizeof(float));
+        clkernel_hermite_correct->setArg<unsigned int>(KERNEL_HERMITE_CORRECT_ARG_CACHE_SIZE, jerk_cache_count);
+        // Кэш и буфер масс ядер упакованных данных.
+        clkernel_packed->setLocalArgSize(KERNEL_PACKED_ARG_BODY_CACHE, packed_cache_count * sizeof(float) * 4);
+        clkernel_packed->setArg<unsigned int>(KERNEL_PACKED_ARG_CACHE_SIZE, packed_cache_count);
+        clkernel_pack->setArg<cl_mem>(KERNEL_PACK_ARG_MASSES, cl_mass_buf->id());
     }// Если произошла ошибка.
     catch(CLException& e){
         // Сообщим об этом.
@@ -821,59 +3951,356 @@ bool NBody::destroyCLObject(T *clobj)
     return false;
 }
 
-void NBody::switchCurrentBuffers()
-{
-    if(++ current_out >= switch_buffers_count) current_out = 0;
-    if(++ current_in >= switch_buffers_count) current_in = 0;
+void NBody::switchCurrentBuffers()
+{
+    if(++ current_out >= switch_buffers_count) current_out = 0;
+    if(++ current_in >= switch_buffers_count) current_in = 0;
+}
+
+void NBody::markBodiesChanged()
+{
+    // Данные тел передаются расчёту на процессоре,
+    // упакованным буферам и буферам отображения,
+    // ускорения пересчитываются.
+    native_sync = true;
+    packed_sync = true;
+    display_sync = true;
+    acc_reset = true;
+}
+
+bool NBody::createGLBuffers()
+{
+    // Без OpenGL данные хранятся в буферах OpenCL,
+    // либо, при расчёте на процессоре, в памяти.
+    if(headless){
+        for(int i = 0; i < static_cast<int>(shared_buffers_count); i ++){
+            headless_buffers[i].fill(0.0f, bodies_count * sharedItemSize(i));
+        }
+        return true;
+    }
+
+    bool res = false;
+
+    // Функции синхронизации не обязательны.
+    init_gl_functions();
+
+    QVector<float> init_data(bodies_count * 3);
+
+    res = createGLBuffer(gl_mass_buf,  NBodyGLBuffer::StaticDraw, sizeof(float), init_data.data()) &&
+          createGLBuffer(gl_index_buf, NBodyGLBuffer::StaticDraw, sizeof(unsigned int));
+    if(!res){
+        destroyGLBuffers();
+        return false;
+    }
+
+    for(size_t i = 0; i < switch_buffers_count; i ++){
+        res = createGLBuffer(gl_pos_buf[i], NBodyGLBuffer::StaticDraw, sizeof(float) * 3, init_data.data()) &&
+              createGLBuffer(gl_vel_buf[i], NBodyGLBuffer::StaticDraw, sizeof(float) * 3, init_data.data());
+        if(!res){
+            destroyGLBuffers();
+            return false;
+        }
+    }
+
+    if(program_pipelined){
+        for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT; i ++){
+            res = createGLBuffer(gl_display_buf[i], NBodyGLBuffer::StreamDraw, sizeof(float) * 3, init_data.data());
+            if(!res){
+                destroyGLBuffers();
+                return false;
+            }
+        }
+    }
+
+    if(!gl_index_buf->bind()){
+        destroyGLBuffers();
+        return false;
+    }
+        unsigned int* ptr = static_cast<unsigned int*>(gl_index_buf->map(NBodyGLBuffer::WriteOnly));
+
+        if(ptr == nullptr){
+            destroyGLBuffers();
+            return false;
+        }
+
+        for(unsigned int i = 0; i < bodies_count; i ++){
+            ptr[i] = i;
+        }
+    gl_index_buf->unmap();
+    gl_index_buf->release();
+
+    NBodyGLBuffer::release(NBodyGLBuffer::VertexBuffer);
+    NBodyGLBuffer::release(NBodyGLBuffer::IndexBuffer);
+
+    return true;
+}
+
+bool NBody::init_gl_functions()
+{
+    if(glFenceSync != nullptr && glDeleteSync != nullptr) return true;
+
+    const QGLContext* cxt = QGLContext::currentContext();
+
+    if(cxt == nullptr) return false;
+
+    glFenceSync = reinterpret_cast<PFNGLFENCESYNCPROC>(cxt->getProcAddress("glFenceSync"));
+    glDeleteSync = reinterpret_cast<PFNGLDELETESYNCPROC>(cxt->getProcAddress("glDeleteSync"));
+
+    return glFenceSync != nullptr && glDeleteSync != nullptr;
+}
+
+bool NBody::acquireGLObjects()
+{
+    // Если все буферы уже захвачены - ждать OpenGL не нужно.
+    bool need_acquire = false;
+    for(size_t i = 0; i < shared_buffers_count; i ++){
+        if(!gl_acquired[i]) need_acquire = true;
+    }
+    if(!need_acquire) return true;
+
+    // Подождём завершения операций OpenGL.
+    enqueueWaitGL(clqueue, clglevent);
+
+    for(size_t i = 0; i < shared_buffers_count; i ++){
+        if(!gl_acquired[i]){
+            sharedCLBuffer(static_cast<int>(i))->enqueueAcquireGLObject(*clqueue);
+            gl_acquired[i] = true;
+        }
+    }
+
+    return true;
+}
+
+void NBody::enqueueWaitGL(CLCommandQueue *queue, CLEvent *event)
+{
+    // Объект синхронизации после команд OpenGL.
+    GLsync sync = nullptr;
+
+    if(gl_cl_sync && QGLContext::currentContext() != nullptr){
+        sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    if(sync != nullptr){
+        glFlush();
+        try{
+            if(event->isValid()) event->release();
+            event->createFromGLSync(*clcxt, reinterpret_cast<cl_GLsync>(sync));
+            queue->waitForEvent(*event);
+        }catch(CLException& e){
+            log(Log::WARNING, LOG_WHO, e.what());
+            glFinish();
+        }
+        glDeleteSync(sync);
+    }else{
+        // Подождём завершения операций OpenGL.
+        glFinish();
+    }
+}
+
+bool NBody::syncDisplay()
+{
+    // Данные изменяются редко - скопируем синхронно.
+    glFinish();
+
+    size_t slot = (display_front + 1) % DISPLAY_BUFFERS_COUNT;
+
+    cl_display_buf[slot]->enqueueAcquireGLObject(*clqueue);
+    cl_pos_buf[current_in]->enqueueCopy(*clqueue, *cl_display_buf[slot], 0, 0,
+                                        simulated_bodies_count * sizeof(float) * 3);
+    cl_display_buf[slot]->enqueueReleaseGLObject(*clqueue);
+
+    if(!clqueue->finish()) return false;
+
+    display_frames[slot] = ++ display_frame;
+    display_front = slot;
+    display_sync = false;
+
+    return true;
+}
+
+void NBody::enqueueDisplayTransfer()
+{
+    // Запишем в самый старый буфер, кроме отображаемого.
+    size_t slot = DISPLAY_BUFFERS_COUNT;
+    for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT; i ++){
+        if(i == display_front) continue;
+        if(slot == DISPLAY_BUFFERS_COUNT || display_frames[i] < display_frames[slot]) slot = i;
+    }
+
+    // Копирование начнётся после расчёта
+    // и после отрисовки прошлых кадров.
+    cltransfer_queue->waitForEvent(*clevent);
+    enqueueWaitGL(cltransfer_queue, cltransfer_glevent);
+
+    if(cldisplay_events[slot]->isValid()) cldisplay_events[slot]->release();
+
+    cl_display_buf[slot]->enqueueAcquireGLObject(*cltransfer_queue);
+    cl_pos_buf[current_in]->enqueueCopy(*cltransfer_queue, *cl_display_buf[slot], 0, 0,
+                                        simulated_bodies_count * sizeof(float) * 3);
+    cl_display_buf[slot]->enqueueReleaseGLObject(*cltransfer_queue, nullptr, cldisplay_events[slot]);
+
+    display_frames[slot] = ++ display_frame;
+
+    cltransfer_queue->flush();
+}
+
+bool NBody::createRecordBuffers()
+{
+    // Массы, позиции и скорости.
+    size_t size = bodies_count * 7;
+
+    // Расчёт на процессоре - обычная память хоста.
+    if(native_backend){
+        for(size_t i = 0; i < TRAJECTORY_SLOTS_COUNT; i ++){
+            record_host[i].resize(size);
+            record_ptr[i] = record_host[i].data();
+        }
+        return true;
+    }
+
+    // Закреплённая память хоста отображается один раз,
+    // чтение в неё идёт без промежуточного копирования.
+    try{
+        for(size_t i = 0; i < TRAJECTORY_SLOTS_COUNT; i ++){
+            if(!cl_record_buf[i]->create(*clcxt, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                         size * sizeof(float), nullptr)) return false;
+            record_ptr[i] = static_cast<float*>(cl_record_buf[i]->enqueueMap(*clqueue, true,
+                                                CL_MAP_READ | CL_MAP_WRITE, 0, size * sizeof(float)));
+            if(record_ptr[i] == nullptr) return false;
+        }
+    }catch(CLException& e){
+        log(Log::ERROR, LOG_WHO, e.what());
+        return false;
+    }
+
+    return true;
+}
+
+void NBody::destroyRecordBuffers()
+{
+    // Дождёмся записи кадров из буферов.
+    if(trajectory_recorder) trajectory_recorder->flush();
+
+    for(size_t i = 0; i < TRAJECTORY_SLOTS_COUNT; i ++){
+        if(record_ptr[i] != nullptr && cl_record_buf[i]->isValid()){
+            try{
+                cl_record_buf[i]->enqueueUnMap(*clqueue, record_ptr[i]);
+                clqueue->finish();
+            }catch(CLException& e){
+                log(Log::WARNING, LOG_WHO, e.what());
+            }
+        }
+        record_ptr[i] = nullptr;
+        record_host[i].clear();
+        destroyCLBuffer(cl_record_buf[i]);
+        destroyCLObject(clrecord_events[i]);
+    }
+}
+
+size_t NBody::nextFrameSteps() const
+{
+    if(trajectory_recorder == nullptr) return steps_per_frame;
+
+    // Запуск заканчивается на шаге записи кадра.
+    size_t interval = trajectory_recorder->interval();
+    return qMin<size_t>(steps_per_frame, interval - record_step % interval);
+}
+
+bool NBody::recordDue(size_t steps) const
+{
+    if(trajectory_recorder == nullptr) return false;
+
+    return (record_step + steps) % trajectory_recorder->interval() == 0;
+}
+
+void NBody::enqueueRecordFrame()
+{
+    // Свободный буфер кадра, ожидание - только если запись отстала.
+    int slot = trajectory_recorder->acquireSlot();
+    if(slot < 0){
+        log(Log::ERROR, LOG_WHO, tr("Trajectory recording stopped"));
+        trajectory_recorder = nullptr;
+        return;
+    }
+
+    size_t count = simulated_bodies_count;
+    float* ptr = record_ptr[slot];
+    CLEvent* event = clrecord_events[slot];
+
+    if(event->isValid()) event->release();
+
+    // Чтение без ожидания, поток записи дождётся события.
+    cl_mass_buf->enqueueRead(*clqueue, false, 0, count * sizeof(float), ptr);
+    cl_pos_buf[current_in]->enqueueRead(*clqueue, false, 0, count * sizeof(float) * 3, ptr + count);
+    cl_vel_buf[current_in]->enqueueRead(*clqueue, false, 0, count * sizeof(float) * 3, ptr + count * 4,
+                                        nullptr, event);
+
+    trajectory_recorder->submit(slot, ptr, count, record_step, event);
+}
+
+void NBody::recordNativeFrame(size_t count)
+{
+    int slot = trajectory_recorder->acquireSlot();
+    if(slot < 0) return;
+
+    float* ptr = record_ptr[slot];
+
+    cpu_engine->getMasses(ptr, count);
+    qCopy(native_positions.constBegin(), native_positions.constEnd(), ptr + count);
+    qCopy(native_velocities.constBegin(), native_velocities.constEnd(), ptr + count * 4);
+
+    trajectory_recorder->submit(slot, ptr, count, record_step, nullptr);
+}
+
+bool NBody::releaseGLObject(int index) const
+{
+    if(index < 0 || !gl_acquired[index]) return false;
+
+    gl_acquired[index] = false;
+
+    try{
+        sharedCLBuffer(index)->enqueueReleaseGLObject(*clqueue);
+    }catch(CLException& e){
+        log(Log::WARNING, LOG_WHO, e.what());
+    }
+
+    return true;
 }
 
-bool NBody::createGLBuffers()
+bool NBody::releaseGLObjects() const
 {
     bool res = false;
 
-    QVector<float> init_data(bodies_count * 3);
-
-    res = createGLBuffer(gl_mass_buf,  NBodyGLBuffer::StaticDraw, sizeof(float), init_data.data()) &&
-          createGLBuffer(gl_index_buf, NBodyGLBuffer::StaticDraw, sizeof(unsigned int));
-    if(!res){
-        destroyGLBuffers();
-        return false;
+    for(size_t i = 0; i < shared_buffers_count; i ++){
+        if(releaseGLObject(static_cast<int>(i))) res = true;
     }
 
-    for(size_t i = 0; i < switch_buffers_count; i ++){
-        res = createGLBuffer(gl_pos_buf[i], NBodyGLBuffer::StaticDraw, sizeof(float) * 3, init_data.data()) &&
-              createGLBuffer(gl_vel_buf[i], NBodyGLBuffer::StaticDraw, sizeof(float) * 3, init_data.data());
-        if(!res){
-            destroyGLBuffers();
-            return false;
-        }
-    }
+    return res;
+}
 
-    if(!gl_index_buf->bind()){
-        destroyGLBuffers();
+bool NBody::prepareGLAccess(NBodyGLBuffer *buf) const
+{
+    if(!releaseGLObject(sharedBufferIndex(buf))) return true;
+
+    try{
+        clqueue->finish();
+    }catch(CLException& e){
+        log(Log::ERROR, LOG_WHO, e.what());
         return false;
     }
-        unsigned int* ptr = static_cast<unsigned int*>(gl_index_buf->map(NBodyGLBuffer::WriteOnly));
-
-        if(ptr == nullptr){
-            destroyGLBuffers();
-            return false;
-        }
-
-        for(unsigned int i = 0; i < bodies_count; i ++){
-            ptr[i] = i;
-        }
-    gl_index_buf->unmap();
-    gl_index_buf->release();
-
-    NBodyGLBuffer::release(NBodyGLBuffer::VertexBuffer);
-    NBodyGLBuffer::release(NBodyGLBuffer::IndexBuffer);
 
     return true;
 }
 
 bool NBody::destroyGLBuffers()
 {
+    if(headless){
+        for(int i = 0; i < static_cast<int>(shared_buffers_count); i ++){
+            headless_buffers[i].clear();
+        }
+        return true;
+    }
+
     glFinish();
 
     destroyGLBuffer(gl_index_buf);
@@ -882,6 +4309,9 @@ bool NBody::destroyGLBuffers()
         destroyGLBuffer(gl_pos_buf[i]);
         destroyGLBuffer(gl_vel_buf[i]);
     }
+    for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT; i ++){
+        destroyGLBuffer(gl_display_buf[i]);
+    }
     return true;
 }
 
@@ -905,68 +4335,53 @@ bool NBody::destroyGLBuffer(NBodyGLBuffer *buf)
 
 bool NBody::setGLBufferData(NBodyGLBuffer *buf, const QVector<QVector3D> &data, size_t offset)
 {
-    if(!buf->isCreated()) return false;
-    if((offset + static_cast<size_t>(data.size())) * 3 > static_cast<size_t>(buf->size())) return false;
-
-    if(!buf->bind()) return false;
-        float* ptr = static_cast<float*>(buf->map(NBodyGLBuffer::WriteOnly));
-
-        if(ptr == nullptr) return false;
-
-        ptr += offset * 3;
-
-        for(size_t i = 0; i < static_cast<size_t>(data.size()); i ++){
-            ptr[0] = data.at(i).x();
-            ptr[1] = data.at(i).y();
-            ptr[2] = data.at(i).z();
-            ptr += 3;
-        }
-    buf->unmap();
-    buf->release();
+    // Преобразуем векторы в непрерывный массив
+    // и передадим его одной записью.
+    QVector<float> values(data.size() * 3);
+    float* ptr = values.data();
+
+    for(int i = 0; i < data.size(); i ++){
+        const QVector3D& v = data.at(i);
+        ptr[0] = v.x();
+        ptr[1] = v.y();
+        ptr[2] = v.z();
+        ptr += 3;
+    }
 
-    return true;
+    return setGLBufferData(buf, values.constData(), offset * 3, values.size());
 }
 
 bool NBody::setGLBufferData(NBodyGLBuffer *buf, const QVector<Point3f> &data, size_t offset)
 {
-    if(!buf->isCreated()) return false;
-    if((offset + static_cast<size_t>(data.size())) * 3 > static_cast<size_t>(buf->size())) return false;
-
-    if(!buf->bind()) return false;
-    buf->write(offset * sizeof(float) * 3, data.data(), data.size() * sizeof(Point3f));
-    buf->release();
-
-    return true;
+    return setGLBufferData(buf, reinterpret_cast<const float*>(data.constData()), offset * 3, data.size() * 3);
 }
 
 bool NBody::setGLBufferData(NBodyGLBuffer *buf, const QVector<qreal> &data, size_t offset)
 {
-    if(!buf->isCreated()) return false;
-    if((offset + static_cast<size_t>(data.size())) > static_cast<size_t>(buf->size())) return false;
-
-    if(!buf->bind()) return false;
-        float* ptr = static_cast<float*>(buf->map(NBodyGLBuffer::WriteOnly));
-
-        if(ptr == nullptr) return false;
-
-        ptr += offset;
-
-        for(size_t i = 0; i < static_cast<size_t>(data.size()); i ++){
-            ptr[i] = data.at(i);
-        }
-    buf->unmap();
-    buf->release();
+    QVector<float> values(data.size());
+    qCopy(data.constBegin(), data.constEnd(), values.begin());
 
-    return true;
+    return setGLBufferData(buf, values.constData(), offset, values.size());
 }
 
 bool NBody::setGLBufferData(NBodyGLBuffer *buf, const QVector<float> &data, size_t offset)
 {
+    return setGLBufferData(buf, data.constData(), offset, data.size());
+}
+
+bool NBody::setGLBufferData(NBodyGLBuffer *buf, const float *data, size_t offset, size_t count)
+{
+    if(headless){
+        return writeHeadlessData(buf, data, offset, count);
+    }
+
     if(!buf->isCreated()) return false;
-    if((offset + static_cast<size_t>(data.size())) > static_cast<size_t>(buf->size())) return false;
+    if(offset + count > static_cast<size_t>(buf->size())) return false;
+
+    if(!prepareGLAccess(buf)) return false;
 
     if(!buf->bind()) return false;
-    buf->write(offset * sizeof(float), data.data(), data.size() * sizeof(float));
+    buf->write(offset * sizeof(float), data, count * sizeof(float));
     buf->release();
 
     return true;
@@ -974,11 +4389,22 @@ bool NBody::setGLBufferData(NBodyGLBuffer *buf, const QVector<float> &data, size
 
 bool NBody::getGLBufferData(NBodyGLBuffer *buf, QVector<QVector3D> &data, size_t offset, size_t count) const
 {
+    if(headless){
+        QVector<float> values(count * 3);
+        if(!readHeadlessData(buf, values.data(), offset * 3, values.size())) return false;
+        for(size_t i = 0; i < count; i ++){
+            data.append(QVector3D(values[i * 3], values[i * 3 + 1], values[i * 3 + 2]));
+        }
+        return true;
+    }
+
     if(!buf->isCreated()) return false;
     if((offset + count) * 3 > static_cast<size_t>(buf->size())) return false;
 
+    if(!prepareGLAccess(buf)) return false;
+
     if(!buf->bind()) return false;
-        float* ptr = static_cast<float*>(buf->map(NBodyGLBuffer::WriteOnly));
+        float* ptr = static_cast<float*>(buf->map(NBodyGLBuffer::ReadOnly));
 
         if(ptr == nullptr) return false;
 
@@ -996,9 +4422,17 @@ bool NBody::getGLBufferData(NBodyGLBuffer *buf, QVector<QVector3D> &data, size_t
 
 bool NBody::getGLBufferData(NBodyGLBuffer *buf, QVector<Point3f> &data, size_t offset, size_t count) const
 {
+    if(headless){
+        size_t old_size = data.size();
+        data.resize(old_size + count);
+        return readHeadlessData(buf, reinterpret_cast<float*>(data.data() + old_size), offset * 3, count * 3);
+    }
+
     if(!buf->isCreated()) return false;
     if((offset + count) * 3 > static_cast<size_t>(buf->size())) return false;
 
+    if(!prepareGLAccess(buf)) return false;
+
     if(!buf->bind()) return false;
     data.resize(data.size() + count);
     buf->read(offset * sizeof(float) * 3, data.data(), count * sizeof(Point3f));
@@ -1009,11 +4443,22 @@ bool NBody::getGLBufferData(NBodyGLBuffer *buf, QVector<Point3f> &data, size_t o
 
 bool NBody::getGLBufferData(NBodyGLBuffer *buf, QVector<qreal> &data, size_t offset, size_t count) const
 {
+    if(headless){
+        QVector<float> values(count);
+        if(!readHeadlessData(buf, values.data(), offset, values.size())) return false;
+        for(size_t i = 0; i < count; i ++){
+            data.append(values[i]);
+        }
+        return true;
+    }
+
     if(!buf->isCreated()) return false;
     if((offset + count) > static_cast<size_t>(buf->size())) return false;
 
+    if(!prepareGLAccess(buf)) return false;
+
     if(!buf->bind()) return false;
-        float* ptr = static_cast<float*>(buf->map(NBodyGLBuffer::WriteOnly));
+        float* ptr = static_cast<float*>(buf->map(NBodyGLBuffer::ReadOnly));
 
         if(ptr == nullptr) return false;
 
@@ -1030,9 +4475,17 @@ bool NBody::getGLBufferData(NBodyGLBuffer *buf, QVector<qreal> &data, size_t off
 
 bool NBody::getGLBufferData(NBodyGLBuffer *buf, QVector<float> &data, size_t offset, size_t count) const
 {
+    if(headless){
+        size_t old_size = data.size();
+        data.resize(old_size + count);
+        return readHeadlessData(buf, data.data() + old_size, offset, count);
+    }
+
     if(!buf->isCreated()) return false;
     if((offset + count) > static_cast<size_t>(buf->size())) return false;
 
+    if(!prepareGLAccess(buf)) return false;
+
     if(!buf->bind()) return false;
     data.resize(data.size() + count);
     buf->read(offset * sizeof(float), data.data(), count * sizeof(float));
@@ -1041,10 +4494,202 @@ bool NBody::getGLBufferData(NBodyGLBuffer *buf, QVector<float> &data, size_t off
     return true;
 }
 
+int NBody::sharedBufferIndex(const NBodyGLBuffer *buf) const
+{
+    if(buf == gl_mass_buf) return 0;
+    for(size_t i = 0; i < switch_buffers_count; i ++){
+        if(buf == gl_pos_buf[i]) return static_cast<int>(1 + i);
+        if(buf == gl_vel_buf[i]) return static_cast<int>(1 + switch_buffers_count + i);
+    }
+    return -1;
+}
+
+size_t NBody::sharedItemSize(int index) const
+{
+    // Массы - по одному числу, позиции и скорости - по три.
+    return index == 0 ? 1 : 3;
+}
+
+CLBuffer* NBody::sharedCLBuffer(int index) const
+{
+    if(index == 0) return cl_mass_buf;
+    if(index <= static_cast<int>(switch_buffers_count)) return cl_pos_buf[index - 1];
+    return cl_vel_buf[index - 1 - switch_buffers_count];
+}
+
+bool NBody::writeHeadlessData(NBodyGLBuffer *buf, const float *data, size_t offset, size_t count)
+{
+    int index = sharedBufferIndex(buf);
+    if(index < 0) return false;
+    if(offset + count > bodies_count * sharedItemSize(index)) return false;
+    if(count == 0) return true;
+
+    if(native_backend){
+        qCopy(data, data + count, headless_buffers[index].begin() + offset);
+        return true;
+    }
+
+    try{
+        // Буфер в памяти хоста записывается через отображение.
+        if(zero_copy){
+            unmapHostBuffers();
+            void* ptr = sharedCLBuffer(index)->enqueueMap(*clqueue, true, CL_MAP_WRITE,
+                                                          offset * sizeof(float), count * sizeof(float));
+            memcpy(ptr, data, count * sizeof(float));
+            sharedCLBuffer(index)->enqueueUnMap(*clqueue, ptr);
+        }else{
+            sharedCLBuffer(index)->enqueueWrite(*clqueue, true, offset * sizeof(float), count * sizeof(float), data);
+        }
+    }catch(CLException& e){
+        log(Log::ERROR, LOG_WHO, e.what());
+        return false;
+    }
+
+    return true;
+}
+
+bool NBody::readHeadlessData(NBodyGLBuffer *buf, float *data, size_t offset, size_t count) const
+{
+    int index = sharedBufferIndex(buf);
+    if(index < 0) return false;
+    if(offset + count > bodies_count * sharedItemSize(index)) return false;
+    if(count == 0) return true;
+
+    if(native_backend){
+        qCopy(headless_buffers[index].constBegin() + offset,
+              headless_buffers[index].constBegin() + offset + count, data);
+        return true;
+    }
+
+    // Уже отображённый буфер читается напрямую.
+    if(host_mapped[index] != nullptr){
+        memcpy(data, static_cast<const float*>(host_mapped[index]) + offset, count * sizeof(float));
+        return true;
+    }
+
+    try{
+        // Буфер в памяти хоста читается через отображение.
+        if(zero_copy){
+            void* ptr = sharedCLBuffer(index)->enqueueMap(*clqueue, true, CL_MAP_READ,
+                                                          offset * sizeof(float), count * sizeof(float));
+            memcpy(data, ptr, count * sizeof(float));
+            sharedCLBuffer(index)->enqueueUnMap(*clqueue, ptr);
+        }else{
+            sharedCLBuffer(index)->enqueueRead(*clqueue, true, offset * sizeof(float), count * sizeof(float), data);
+        }
+    }catch(CLException& e){
+        log(Log::ERROR, LOG_WHO, e.what());
+        return false;
+    }
+
+    return true;
+}
+
+int NBody::bodyDataIndex(BodyData data) const
+{
+    switch(data){
+    case BODY_DATA_MASSES:
+        return 0;
+    case BODY_DATA_POSITIONS:
+        return static_cast<int>(1 + current_in);
+    case BODY_DATA_VELOCITIES:
+        return static_cast<int>(1 + switch_buffers_count + current_in);
+    }
+    return -1;
+}
+
+const float* NBody::mapBodyData(BodyData data) const
+{
+    if(!isReady() || isRunning() || !headless) return nullptr;
+
+    int index = bodyDataIndex(data);
+    if(index < 0) return nullptr;
+
+    // Расчёт на процессоре хранит данные на хосте.
+    if(native_backend) return headless_buffers[index].constData();
+
+    if(!zero_copy) return nullptr;
+
+    if(host_mapped[index] == nullptr){
+        try{
+            host_mapped[index] = sharedCLBuffer(index)->enqueueMap(*clqueue, true, CL_MAP_READ, 0,
+                                                                   bodies_count * sharedItemSize(index) * sizeof(float));
+        }catch(CLException& e){
+            log(Log::ERROR, LOG_WHO, e.what());
+            host_mapped[index] = nullptr;
+        }
+    }
+
+    return static_cast<const float*>(host_mapped[index]);
+}
+
+void NBody::unmapBodyData(BodyData data) const
+{
+    int index = bodyDataIndex(data);
+    if(index < 0 || host_mapped[index] == nullptr) return;
+
+    try{
+        sharedCLBuffer(index)->enqueueUnMap(*clqueue, host_mapped[index]);
+    }catch(CLException& e){
+        log(Log::WARNING, LOG_WHO, e.what());
+    }
+    host_mapped[index] = nullptr;
+}
+
+bool NBody::isZeroCopy() const
+{
+    return zero_copy;
+}
+
+void NBody::unmapHostBuffers() const
+{
+    for(size_t i = 0; i < shared_buffers_count; i ++){
+        if(host_mapped[i] == nullptr) continue;
+        try{
+            sharedCLBuffer(static_cast<int>(i))->enqueueUnMap(*clqueue, host_mapped[i]);
+        }catch(CLException& e){
+            log(Log::WARNING, LOG_WHO, e.what());
+        }
+        host_mapped[i] = nullptr;
+    }
+}
+
+bool NBody::createHostArena()
+{
+    destroyHostArena();
+
+    // Каждый буфер - в своём разделе, выровненном по странице,
+    // как требуют реализации для размещения без копирования.
+    size_t max_size = bodies_count * sizeof(float) * 3;
+    host_arena_section = (max_size + HOST_ARENA_ALIGNMENT - 1) / HOST_ARENA_ALIGNMENT * HOST_ARENA_ALIGNMENT;
+
+    host_arena = static_cast<char*>(qMallocAligned(host_arena_section * shared_buffers_count, HOST_ARENA_ALIGNMENT));
+    if(host_arena == nullptr){
+        host_arena_section = 0;
+        return false;
+    }
+    memset(host_arena, 0x0, host_arena_section * shared_buffers_count);
+
+    return true;
+}
+
+void NBody::destroyHostArena()
+{
+    if(host_arena) qFreeAligned(host_arena);
+    host_arena = nullptr;
+    host_arena_section = 0;
+}
+
 bool NBody::createCLBuffers()
 {
     bool res = false;
 
+    // Память хоста для буферов без копирования.
+    if(zero_copy && !createHostArena()){
+        log(Log::WARNING, LOG_WHO, tr("Error allocating host memory, zero-copy buffers disabled"));
+        zero_copy = false;
+    }
+
     res = createCLBuffer(cl_mass_buf, CL_MEM_READ_WRITE, gl_mass_buf);
     if(!res) return false;
 
@@ -1056,22 +4701,152 @@ bool NBody::createCLBuffers()
             return false;
         }
     }
+
+    // Буферы отображения.
+    if(program_pipelined){
+        try{
+            for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT && res; i ++){
+                res = cl_display_buf[i]->createFromGLBuffer(*clcxt, CL_MEM_WRITE_ONLY, gl_display_buf[i]->bufferId());
+            }
+        }catch(CLException& e){
+            log(Log::ERROR, LOG_WHO, e.what());
+            res = false;
+        }
+        if(!res){
+            destroyCLBuffers();
+            return false;
+        }
+    }
+
+    // Буфер индексов тел октодерева,
+    // буфер листьев тел FMM, буфер ускорений
+    // и буферы блочной схемы.
+    try{
+        res = cl_tree_indices_buf->create(*clcxt, CL_MEM_READ_ONLY, bodies_count * sizeof(qint32), nullptr) &&
+              cl_fmm_leaf_of_buf->create(*clcxt, CL_MEM_READ_ONLY, bodies_count * sizeof(qint32), nullptr) &&
+              cl_acc_buf->create(*clcxt, CL_MEM_READ_ONLY, bodies_count * sizeof(float) * 3, nullptr) &&
+              cl_block_acc_buf->create(*clcxt, CL_MEM_READ_WRITE, bodies_count * sizeof(float) * 4, nullptr) &&
+              cl_block_rung_buf->create(*clcxt, CL_MEM_READ_WRITE, bodies_count * sizeof(qint32), nullptr) &&
+              cl_block_active_buf->create(*clcxt, CL_MEM_READ_WRITE, bodies_count * sizeof(qint32), nullptr) &&
+              cl_block_counters_buf->create(*clcxt, CL_MEM_READ_WRITE, block_counters.size() * sizeof(qint32), nullptr);
+    }catch(CLException& e){
+        log(Log::ERROR, LOG_WHO, e.what());
+        res = false;
+    }
+    if(!res){
+        destroyCLBuffers();
+        return false;
+    }
+    // Буферы метода Эрмита нужны только ему.
+    if(program_integrator == INTEGRATOR_HERMITE){
+        try{
+            res = cl_hermite_pos_buf->create(*clcxt, CL_MEM_READ_WRITE, bodies_count * sizeof(float) * 3, nullptr) &&
+                  cl_hermite_vel_buf->create(*clcxt, CL_MEM_READ_WRITE, bodies_count * sizeof(float) * 3, nullptr) &&
+                  cl_hermite_acc_buf->create(*clcxt, CL_MEM_READ_WRITE, bodies_count * sizeof(float) * 4, nullptr) &&
+                  cl_hermite_jerk_buf->create(*clcxt, CL_MEM_READ_WRITE, bodies_count * sizeof(float) * 4, nullptr);
+        }catch(CLException& e){
+            log(Log::ERROR, LOG_WHO, e.what());
+            res = false;
+        }
+        if(!res){
+            destroyCLBuffers();
+            return false;
+        }
+    }
+    // Частичные суммы ускорений симметричного расчёта.
+    if(pairs_threads != 0){
+        try{
+            res = cl_pairs_buf->create(*clcxt, CL_MEM_READ_WRITE, pairs_threads * bodies_count * sizeof(float) * 3, nullptr);
+        }catch(CLException& e){
+            log(Log::ERROR, LOG_WHO, e.what());
+            res = false;
+        }
+        if(!res){
+            destroyCLBuffers();
+            return false;
+        }
+    }
+    // Упакованные позиции и массы.
+    if(program_packed){
+        try{
+            for(size_t i = 0; i < switch_buffers_count && res; i ++){
+                res = cl_packed_buf[i]->create(*clcxt, CL_MEM_READ_WRITE, bodies_count * sizeof(float) * 4, nullptr);
+            }
+        }catch(CLException& e){
+            log(Log::ERROR, LOG_WHO, e.what());
+            res = false;
+        }
+        if(!res){
+            destroyCLBuffers();
+            return false;
+        }
+    }
+    // Буферы дерева будут созданы при первом построении.
+    tree_nodes_capacity = 0;
+    fmm_leaves_capacity = 0;
+    fmm_near_capacity = 0;
+    fmm_locals_capacity = 0;
+    fmm_exps_capacity = 0;
+
     return true;
 }
 
 bool NBody::destroyCLBuffers()
 {
+    if(clqueue->isValid()) unmapHostBuffers();
     destroyCLBuffer(cl_mass_buf);
     for(size_t i = 0; i < switch_buffers_count; i ++){
         destroyCLBuffer(cl_pos_buf[i]);
         destroyCLBuffer(cl_vel_buf[i]);
     }
+    destroyCLBuffer(cl_tree_nodes_buf);
+    destroyCLBuffer(cl_tree_indices_buf);
+    destroyCLBuffer(cl_acc_buf);
+    destroyCLBuffer(cl_pairs_buf);
+    destroyCLBuffer(cl_fmm_leaves_buf);
+    destroyCLBuffer(cl_fmm_leaf_of_buf);
+    destroyCLBuffer(cl_fmm_near_buf);
+    destroyCLBuffer(cl_fmm_locals_buf);
+    destroyCLBuffer(cl_fmm_exps_buf);
+    destroyCLBuffer(cl_block_acc_buf);
+    destroyCLBuffer(cl_block_rung_buf);
+    destroyCLBuffer(cl_block_active_buf);
+    destroyCLBuffer(cl_block_counters_buf);
+    destroyCLBuffer(cl_hermite_pos_buf);
+    destroyCLBuffer(cl_hermite_vel_buf);
+    destroyCLBuffer(cl_hermite_acc_buf);
+    destroyCLBuffer(cl_hermite_jerk_buf);
+    for(size_t i = 0; i < switch_buffers_count; i ++){
+        destroyCLBuffer(cl_packed_buf[i]);
+    }
+    for(size_t i = 0; i < DISPLAY_BUFFERS_COUNT; i ++){
+        destroyCLBuffer(cl_display_buf[i]);
+    }
+    destroyHostArena();
+    tree_nodes_capacity = 0;
+    fmm_leaves_capacity = 0;
+    fmm_near_capacity = 0;
+    fmm_locals_capacity = 0;
+    fmm_exps_capacity = 0;
     return true;
 }
 
 bool NBody::createCLBuffer(CLBuffer *clbuf, cl_mem_flags flags, NBodyGLBuffer *glbuf)
 {
     try{
+        // Без OpenGL - обычный буфер, заполненный нулями.
+        if(headless){
+            int index = sharedBufferIndex(glbuf);
+            // Буфер в своём разделе памяти хоста.
+            if(zero_copy){
+                return clbuf->create(*clcxt, flags | CL_MEM_USE_HOST_PTR,
+                                     bodies_count * sharedItemSize(index) * sizeof(float),
+                                     host_arena + host_arena_section * index);
+            }
+            QVector<float> init_data(bodies_count * sharedItemSize(index));
+            return clbuf->create(*clcxt, flags | CL_MEM_COPY_HOST_PTR,
+                                 init_data.size() * sizeof(float), init_data.data());
+        }
         return clbuf->createFromGLBuffer(*clcxt, flags, glbuf->bufferId());
     }catch(CLException& e){
         log(Log::ERROR, LOG_WHO, e.what());
@@ -1083,3 +4858,16 @@ bool NBody::destroyCLBuffer(CLBuffer *buf)
 {
     return destroyCLObject(buf);
 }
+
+bool NBody::reserveCLBuffer(CLBuffer *buf, size_t &capacity, size_t size)
+{
+    if(size <= capacity && buf->isValid()) return true;
+
+    // Уничтожим старый буфер.
+    destroyCLBuffer(buf);
+    // Выделим память с запасом, чтобы не пересоздавать буфер каждый шаг.
+    // Пустой буфер создать нельзя.
+    capacity = qMax<size_t>(size + size / 2, sizeof(qint32));
+
+    return buf->create(*clcxt, CL_MEM_READ_ONLY, capacity, nullptr);
+}
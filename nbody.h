@@ -3,9 +3,12 @@
 
 #include <QObject>
 #include <QVector>
+#include <QStringList>
 #include <QVector3D>
+#include <QFutureWatcher>
 #include <CL/opencl.h>
 #include "point3f.h"
+#include "trajectoryrecorder.h"
 
 #ifdef CUSTOM_GLBUFFER
 #include "glbuffer.h"
@@ -14,6 +17,7 @@ typedef GLBuffer NBodyGLBuffer;
 #include <QGLBuffer>
 typedef QGLBuffer NBodyGLBuffer;
 #endif
+#include <GL/glext.h>
 
 
 class CLPlatform;
@@ -24,11 +28,29 @@ class CLCommandQueue;
 class CLProgram;
 class CLKernel;
 class CLEvent;
+class Octree;
+class TreeBuilder;
+class FmmBuilder;
+class Fmm;
+class ParticleMesh;
+class CpuEngine;
 
 
 //! Число измерений.
 #define NDRANGE_DIMENSIONS 1
 
+//! Максимальное число уровней индивидуальных шагов.
+#define BLOCK_RUNGS_MAX 10
+
+//! Число маркеров границ этапов шага для профилирования.
+#define PROFILE_MARKERS_COUNT 4
+
+//! Число буферов отображения в конвейерном режиме.
+#define DISPLAY_BUFFERS_COUNT 3
+
+//! Выравнивание разделов памяти тел на хосте (страница).
+#define HOST_ARENA_ALIGNMENT 4096
+
 
 /**
  * @class NBody.
@@ -38,6 +60,141 @@ class NBody : public QObject
 {
     Q_OBJECT
 public:
+    /**
+     * @brief Метод расчёта взаимодействия.
+     */
+    enum Solver {
+        SOLVER_ALL_PAIRS = 0, //!< Прямой расчёт взаимодействия всех пар.
+        SOLVER_BARNES_HUT = 1, //!< Приближённый расчёт методом Барнса-Хата.
+        SOLVER_FMM = 2, //!< Приближённый расчёт быстрым методом мультиполей.
+        SOLVER_PM = 3 //!< Расчёт дальнодействия методом частица-сетка.
+    };
+
+    /**
+     * @brief Метод интегрирования.
+     */
+    enum Integrator {
+        INTEGRATOR_EULER = 0, //!< Полунеявный метод Эйлера.
+        INTEGRATOR_LEAPFROG = 1, //!< Метод с перешагиванием 2-го порядка.
+        INTEGRATOR_HERMITE = 2, //!< Метод Эрмита 4-го порядка.
+        INTEGRATOR_YOSHIDA = 3 //!< Метод Йошиды 4-го порядка.
+    };
+
+    /**
+     * @brief Точность суммирования ускорений прямого расчёта.
+     */
+    enum Precision {
+        PRECISION_SINGLE = 0, //!< Суммирование в float.
+        PRECISION_COMPENSATED = 1, //!< Суммы плиток в float, суммирование плиток по Кэхэну.
+        PRECISION_DOUBLE = 2 //!< Суммирование в double (cl_khr_fp64).
+    };
+
+    /**
+     * @brief Модель сглаживания гравитации на малых расстояниях.
+     */
+    enum Softening {
+        SOFTENING_NONE = 0, //!< Без сглаживания.
+        SOFTENING_PLUMMER = 1, //!< Сглаживание Пламмера.
+        SOFTENING_SPLINE = 2 //!< Кубический сплайн, как в Gadget.
+    };
+
+    /**
+     * @brief Данные тел для прямого доступа.
+     */
+    enum BodyData {
+        BODY_DATA_MASSES = 0, //!< Массы.
+        BODY_DATA_POSITIONS = 1, //!< Позиции (x, y, z).
+        BODY_DATA_VELOCITIES = 2 //!< Скорости (x, y, z).
+    };
+
+    /**
+     * @brief Данные тел в виде отдельных непрерывных массивов.
+     * Массивы не копируются; отсутствующий массив (nullptr)
+     * не записывается.
+     */
+    struct BodiesView {
+        const float* masses; //!< Массы.
+        const float* positions; //!< Позиции (x, y, z).
+        const float* velocities; //!< Скорости (x, y, z).
+        size_t count; //!< Число тел.
+
+        /**
+         * @brief Конструктор.
+         * @param masses Массы.
+         * @param positions Позиции.
+         * @param velocities Скорости.
+         * @param count Число тел.
+         */
+        BodiesView(const float* masses = nullptr, const float* positions = nullptr,
+                   const float* velocities = nullptr, size_t count = 0);
+    };
+
+    /**
+     * @brief Параметры ядра прямого расчёта, подобранные под устройство.
+     */
+    struct KernelTuning {
+        size_t local_size; //!< Размер рабочей группы.
+        size_t tile_size; //!< Число тел в кэше.
+        int unroll; //!< Число развёрнутых итераций внутреннего цикла.
+        int bodies_per_item; //!< Число тел одного work-item'а.
+
+        /**
+         * @brief Конструктор. Создаёт недействительные параметры.
+         */
+        KernelTuning();
+
+        /**
+         * @brief Получение флага действительности параметров.
+         * @return Флаг действительности параметров.
+         */
+        bool isValid() const;
+
+        /**
+         * @brief Преобразование в строку для сохранения.
+         * @return Строка параметров.
+         */
+        QString toString() const;
+
+        /**
+         * @brief Преобразование из строки.
+         * @param str Строка параметров.
+         * @return Параметры, недействительные при ошибке.
+         */
+        static KernelTuning fromString(const QString& str);
+    };
+
+    /**
+     * @brief Профиль шага симуляции.
+     * Времена этапов измеряются событиями OpenCL
+     * (при расчёте на процессоре - таймером).
+     * Производительность оценивается по числу
+     * пар тел прямого расчёта, в том числе для
+     * приближённых методов.
+     */
+    struct Profile {
+        double acquire_time; //!< Захват буферов OpenGL, мс.
+        double compute_time; //!< Расчёт ускорений и интегрирование, мс.
+        double force_time; //!< Расчёт ускорений, мс.
+        double integrate_time; //!< Интегрирование отдельными ядрами, мс.
+        double unpack_time; //!< Распаковка позиций для отрисовки, мс.
+        double release_time; //!< Освобождение буферов OpenGL, мс.
+        double device_time; //!< Время на устройстве, мс.
+        double total_time; //!< Время от постановки в очередь до завершения, мс.
+        double interactions; //!< Взаимодействий пар тел в секунду.
+        double gflops; //!< Производительность, GFLOP/s.
+
+        /**
+         * @brief Конструктор. Создаёт пустой профиль.
+         */
+        Profile();
+
+        /**
+         * @brief Получение флага действительности профиля.
+         * @return Флаг действительности профиля.
+         */
+        bool isValid() const;
+    };
+
     /**
      * @brief Конструктор.
      * @param parent Объект-родитель.
@@ -80,6 +237,293 @@ public:
      */
     void setTimeStep(float dt);
 
+    /**
+     * @brief Получение числа шагов за один запуск симуляции.
+     * @return Число шагов.
+     */
+    size_t stepsPerFrame() const;
+
+    /**
+     * @brief Установка числа шагов за один запуск симуляции.
+     * Шаги ставятся в очередь подряд, буферы OpenGL
+     * захватываются и освобождаются один раз.
+     * @param steps Число шагов.
+     */
+    void setStepsPerFrame(size_t steps);
+
+    /**
+     * @brief Получение метода расчёта.
+     * @return Метод расчёта.
+     */
+    Solver solver() const;
+
+    /**
+     * @brief Установка метода расчёта.
+     * @param s Метод расчёта.
+     */
+    void setSolver(Solver s);
+
+    /**
+     * @brief Получение параметра точности метода Барнса-Хата.
+     * @return Параметр точности.
+     */
+    float barnesHutTheta() const;
+
+    /**
+     * @brief Установка параметра точности метода Барнса-Хата.
+     * Ячейка размера s на расстоянии r заменяется
+     * центром масс при s / r < theta.
+     * @param theta Параметр точности.
+     */
+    void setBarnesHutTheta(float theta);
+
+    /**
+     * @brief Получение флага построения дерева на устройстве.
+     * @return Флаг построения дерева на устройстве.
+     */
+    bool gpuTreeBuild() const;
+
+    /**
+     * @brief Установка флага построения дерева на устройстве.
+     * Если устройство не поддерживает построение,
+     * дерево строится на хосте.
+     * @param enabled Флаг построения дерева на устройстве.
+     */
+    void setGpuTreeBuild(bool enabled);
+
+    /**
+     * @brief Получение порядка разложения быстрого метода мультиполей.
+     * @return Порядок разложения.
+     */
+    size_t fmmOrder() const;
+
+    /**
+     * @brief Установка порядка разложения быстрого метода мультиполей.
+     * Параметр точности общий с методом Барнса-Хата.
+     * @param order Порядок разложения.
+     */
+    void setFmmOrder(size_t order);
+
+    /**
+     * @brief Получение флага расчёта FMM на устройстве.
+     * @return Флаг расчёта на устройстве.
+     */
+    bool fmmDeviceEvaluation() const;
+
+    /**
+     * @brief Установка флага расчёта FMM на устройстве.
+     * При построении дерева на устройстве разложения и списки
+     * ближних листьев также строятся на устройстве, иначе
+     * на устройстве вычисляется только ближнее поле.
+     * Без флага всё вычисляется на хосте всеми ядрами процессора.
+     * @param enabled Флаг расчёта на устройстве.
+     */
+    void setFmmDeviceEvaluation(bool enabled);
+
+    /**
+     * @brief Получение размера сетки метода частица-сетка.
+     * @return Число узлов сетки по измерению.
+     */
+    size_t pmGridSize() const;
+
+    /**
+     * @brief Установка размера сетки метода частица-сетка.
+     * @param size Число узлов сетки по измерению, степень двойки.
+     */
+    void setPmGridSize(size_t size);
+
+    /**
+     * @brief Получение флага распределения масс TSC.
+     * @return true для TSC, false для CIC.
+     */
+    bool pmTsc() const;
+
+    /**
+     * @brief Установка флага распределения масс TSC.
+     * @param tsc true для TSC, false для CIC.
+     */
+    void setPmTsc(bool tsc);
+
+    /**
+     * @brief Получение метода интегрирования.
+     * @return Метод интегрирования.
+     */
+    Integrator integrator() const;
+
+    /**
+     * @brief Установка метода интегрирования.
+     * Метод передаётся программе OpenCL опцией компиляции
+     * и вступает в силу при создании системы.
+     * @param i Метод интегрирования.
+     */
+    void setIntegrator(Integrator i);
+
+    /**
+     * @brief Получение точности суммирования ускорений.
+     * @return Точность суммирования ускорений.
+     */
+    Precision precision() const;
+
+    /**
+     * @brief Установка точности суммирования ускорений.
+     * Позиции и скорости хранятся в float, повышенная точность
+     * касается сумм ускорений прямого расчёта всех пар.
+     * Если устройство не поддерживает cl_khr_fp64,
+     * вместо двойной точности используется компенсированное суммирование.
+     * Вступает в силу при создании системы.
+     * @param p Точность суммирования ускорений.
+     */
+    void setPrecision(Precision p);
+
+    /**
+     * @brief Получение модели сглаживания.
+     * @return Модель сглаживания.
+     */
+    Softening softening() const;
+
+    /**
+     * @brief Установка модели сглаживания.
+     * Модель передаётся программе OpenCL опцией компиляции
+     * и вступает в силу при создании системы.
+     * @param s Модель сглаживания.
+     */
+    void setSoftening(Softening s);
+
+    /**
+     * @brief Получение длины сглаживания.
+     * @return Длина сглаживания.
+     */
+    float softeningLength() const;
+
+    /**
+     * @brief Установка длины сглаживания.
+     * Вступает в силу при создании системы.
+     * @param length Длина сглаживания.
+     */
+    void setSofteningLength(float length);
+
+    /**
+     * @brief Получение флага упакованного хранения тел.
+     * @return Флаг упакованного хранения тел.
+     */
+    bool packedLayout() const;
+
+    /**
+     * @brief Установка флага упакованного хранения тел.
+     * Позиции и массы хранятся на устройстве векторами (x, y, z, m),
+     * позиции для отрисовки распаковываются после шага.
+     * Используется прямым расчётом всех пар без индивидуальных шагов
+     * и вступает в силу при создании системы.
+     * @param packed Флаг упакованного хранения тел.
+     */
+    void setPackedLayout(bool packed);
+
+    /**
+     * @brief Получение флага расчёта на нескольких устройствах.
+     * @return Флаг расчёта на нескольких устройствах.
+     */
+    bool multiDevice() const;
+
+    /**
+     * @brief Установка флага расчёта на нескольких устройствах.
+     * Все устройства платформы объединяются в один контекст,
+     * тела прямого расчёта делятся между ними пропорционально
+     * измеренной производительности.
+     * Вступает в силу при создании системы.
+     * @param enabled Флаг расчёта на нескольких устройствах.
+     */
+    void setMultiDevice(bool enabled);
+
+    /**
+     * @brief Получение флага подбора параметров ядра.
+     * @return Флаг подбора параметров ядра.
+     */
+    bool autoTune() const;
+
+    /**
+     * @brief Установка флага подбора параметров ядра.
+     * Если параметры не заданы, при создании системы
+     * перебираются варианты ядра прямого расчёта
+     * и выбирается самый быстрый.
+     * @param enabled Флаг подбора параметров ядра.
+     */
+    void setAutoTune(bool enabled);
+
+    /**
+     * @brief Получение параметров ядра прямого расчёта.
+     * @return Параметры ядра.
+     */
+    const KernelTuning& kernelTuning() const;
+
+    /**
+     * @brief Установка параметров ядра прямого расчёта.
+     * Вступают в силу при создании системы.
+     * @param tuning Параметры ядра.
+     */
+    void setKernelTuning(const KernelTuning& tuning);
+
+    /**
+     * @brief Получение ключа для сохранения параметров ядра.
+     * Параметры подбираются для текущих точности
+     * и сглаживания и группы числа тел.
+     * @param device Устройство OpenCL.
+     * @param bodies Число тел.
+     * @return Ключ из имени устройства, версии драйвера,
+     * точности, сглаживания и группы числа тел.
+     */
+    QString tuningKey(const CLDevice& device, size_t bodies) const;
+
+    /**
+     * @brief Получение результатов замера точностей суммирования.
+     * @return Результаты замера, по строке на точность,
+     * либо пустая строка, если замер не выполнялся.
+     */
+    const QString& precisionReport() const;
+
+    /**
+     * @brief Установка результатов замера точностей суммирования,
+     * сохранённых ранее для устройства с ключом tuningKey().
+     * Если результаты заданы, замер при создании системы не выполняется.
+     * @param report Результаты замера.
+     */
+    void setPrecisionReport(const QString& report);
+
+    /**
+     * @brief Получение флага профилирования.
+     * @return Флаг профилирования.
+     */
+    bool profiling() const;
+
+    /**
+     * @brief Установка флага профилирования.
+     * Очередь команд создаётся с CL_QUEUE_PROFILING_ENABLE,
+     * поэтому флаг вступает в силу при создании системы.
+     * @param enabled Флаг профилирования.
+     */
+    void setProfiling(bool enabled);
+
+    /**
+     * @brief Получение профиля последнего шага.
+     * @return Профиль шага, недействительный,
+     * если профилирование отключено.
+     */
+    const Profile& profile() const;
+
+    /**
+     * @brief Получение числа уровней индивидуальных шагов.
+     * @return Число уровней.
+     */
+    size_t blockRungs() const;
+
+    /**
+     * @brief Установка числа уровней индивидуальных шагов.
+     * Тело на уровне k имеет шаг timeStep() / 2^k,
+     * уровень выбирается по отношению ускорения к рывку.
+     * 0 - общий шаг для всех тел.
+     * @param rungs Число уровней, не больше BLOCK_RUNGS_MAX.
+     */
+    void setBlockRungs(size_t rungs);
+
     /**
      * @brief Получение контекста OpenCL.
      * @return Контекст OpenCL.
@@ -95,6 +539,37 @@ public:
      */
     bool create(const CLPlatform &platform, const CLDevice &device, size_t bodies);
 
+    /**
+     * @brief Инициализация системы NBody без OpenCL.
+     * Расчёт выполняется на процессоре,
+     * результаты передаются в те же буферы OpenGL.
+     * @param bodies Число тел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool createNative(size_t bodies);
+
+    /**
+     * @brief Получение флага расчёта на процессоре без OpenCL.
+     * @return Флаг расчёта на процессоре.
+     */
+    bool isNative() const;
+
+    /**
+     * @brief Получение флага работы без OpenGL.
+     * @return Флаг работы без OpenGL.
+     */
+    bool isHeadless() const;
+
+    /**
+     * @brief Установка флага работы без OpenGL.
+     * Буферы OpenCL создаются без буферов OpenGL,
+     * данные тел доступны только через методы get/set,
+     * буферы OpenGL (posBuffer() и др.) не создаются.
+     * Устанавливается до создания системы.
+     * @param enabled Флаг работы без OpenGL.
+     */
+    void setHeadless(bool enabled);
+
     /**
      * @brief Уничтожение системы NBody.
      * @return true в случае успеха, иначе false.
@@ -227,6 +702,62 @@ public:
      */
     bool getVelocities(QVector<Point3f>& data, size_t offset = 0, size_t count = 0) const;
 
+    /**
+     * @brief Установка данных тел из массива одной записью,
+     * например, прямо из отображённого в память файла.
+     * @param data Данные тел.
+     * @param values Значения: массы или векторы (x, y, z).
+     * @param count Число тел.
+     * @param offset Смещение.
+     * @return true в случае успеха, иначе false.
+     */
+    bool setBodyData(BodyData data, const float* values, size_t count, size_t offset = 0);
+
+    /**
+     * @brief Установка данных тел из массивов,
+     * каждый массив передаётся одной записью.
+     * @param bodies Данные тел.
+     * @param offset Смещение.
+     * @return true в случае успеха, иначе false.
+     */
+    bool setBodies(const BodiesView& bodies, size_t offset = 0);
+
+    /**
+     * @brief Асинхронная установка данных тел из массивов.
+     * При расчёте OpenCL в буферах устройства запись ставится
+     * в очередь без ожидания, иначе выполняется сразу.
+     * По окончании, в том числе при ошибке, посылается
+     * сигнал bodiesUploaded(); до него массивы должны
+     * оставаться действительными.
+     * @param bodies Данные тел.
+     * @param offset Смещение.
+     * @return true в случае успеха, иначе false.
+     */
+    bool setBodiesAsync(const BodiesView& bodies, size_t offset = 0);
+
+    /**
+     * @brief Отображает данные тел в память хоста без копирования.
+     * Доступно без OpenGL, когда буферы расположены в памяти хоста:
+     * при расчёте на процессоре без OpenCL или на устройстве
+     * с общей с хостом памятью. После использования данные
+     * необходимо освободить вызовом unmapBodyData().
+     * @param data Данные тел.
+     * @return Указатель на данные или nullptr, если прямой доступ недоступен.
+     */
+    const float* mapBodyData(BodyData data) const;
+
+    /**
+     * @brief Освобождает данные тел, отображённые mapBodyData().
+     * @param data Данные тел.
+     */
+    void unmapBodyData(BodyData data) const;
+
+    /**
+     * @brief Получение флага размещения буферов OpenCL в памяти хоста.
+     * @return Флаг размещения буферов OpenCL в памяти хоста.
+     */
+    bool isZeroCopy() const;
+
     /**
      * @brief Получение индексного буфера.
      * @return Индексный буфер.
@@ -251,28 +782,105 @@ public:
      */
     NBodyGLBuffer* velBuffer();
 
+    /**
+     * @brief Получение буфера позиций для отрисовки.
+     * В конвейерном режиме - последний готовый буфер
+     * отображения, отстающий от расчёта на шаг,
+     * иначе - буфер позиций.
+     * @return Буфер позиций для отрисовки.
+     */
+    NBodyGLBuffer* drawBuffer();
+
+    /**
+     * @brief Получение флага конвейерного режима.
+     * @return Флаг конвейерного режима.
+     */
+    bool pipelined() const;
+
+    /**
+     * @brief Установка флага конвейерного режима.
+     * Результаты шагов копируются отдельной очередью
+     * в кольцо буферов отображения, и кадр рисуется
+     * во время расчёта следующего шага.
+     * Вступает в силу при создании системы.
+     * @param enabled Флаг конвейерного режима.
+     */
+    void setPipelined(bool enabled);
+
+    /**
+     * @brief Получение флага отрисовки во время расчёта.
+     * @return true, если буфер отрисовки не используется расчётом.
+     */
+    bool canDrawWhileRunning() const;
+
+    /**
+     * @brief Установка записи траектории.
+     * Каждые recorder->interval() шагов состояние системы
+     * читается с устройства без ожидания в кольцо буферов
+     * закреплённой памяти хоста и записывается потоком записи.
+     * Число шагов за запуск ограничивается так, чтобы
+     * запуск заканчивался на шаге записи кадра.
+     * @param recorder Запись траектории или nullptr для остановки.
+     * @return true в случае успеха, иначе false.
+     */
+    bool setTrajectoryRecorder(TrajectoryRecorder* recorder);
+
+    /**
+     * @brief Получение записи траектории.
+     * @return Запись траектории или nullptr.
+     */
+    TrajectoryRecorder* trajectoryRecorder() const;
+
 signals:
     /**
      * @brief Сигнал окончания симуляции.
      */
     void simulationFinished();
 
+    /**
+     * @brief Сигнал готовности нового буфера отображения.
+     */
+    void displayUpdated();
+
+    /**
+     * @brief Сигнал окончания асинхронной установки данных тел.
+     * @param success Флаг успешной записи.
+     */
+    void bodiesUploaded(bool success);
+
 public slots:
 
     /**
-     * @brief Запускает расчёт симуляции очередного шага.
+     * @brief Запускает расчёт симуляции очередных stepsPerFrame() шагов.
      * Использует установленное время шага.
      * @return true в случае успеха, иначе false.
      */
     bool simulate();
 
     /**
-     * @brief Запускает расчёт симуляции очередного шага.
+     * @brief Запускает расчёт симуляции очередных stepsPerFrame() шагов.
      * @param dt Время шага.
      * @return true в случае успеха, иначе false.
      */
     bool simulate(float dt);
 
+private slots:
+    /**
+     * @brief Слот завершения шага на процессоре.
+     */
+    void on_nativeStepFinished();
+
+    /**
+     * @brief Слот завершения команд шага в очереди OpenCL.
+     */
+    void on_simulationCompleted();
+
+    /**
+     * @brief Слот завершения асинхронной записи данных тел в OpenCL.
+     * @param status Статус выполнения команды.
+     */
+    void on_bodiesUploaded(int status);
+
 private:
     /**
      * @brief Число объектов.
@@ -290,122 +898,822 @@ private:
     float time_step;
 
     /**
-     * @brief Флаг готовности.
+     * @brief Число шагов за один запуск симуляции.
      */
-    bool is_ready;
+    size_t steps_per_frame;
 
     /**
-     * @brief Текущие буферы для чтения.
+     * @brief Число шагов последнего запуска симуляции.
      */
-    size_t current_in;
+    size_t frame_steps;
 
     /**
-     * @brief Текущие буферы для записи.
+     * @brief Метод расчёта.
      */
-    size_t current_out;
+    Solver nbody_solver;
 
     /**
-     * @brief Число буферов для переключения чтения/записи.
+     * @brief Параметр точности метода Барнса-Хата.
      */
-    static const size_t switch_buffers_count = 2;
+    float bh_theta;
 
     /**
-     * @brief Индексный буфер OpenGL.
+     * @brief Флаг построения дерева на устройстве.
      */
-    NBodyGLBuffer* gl_index_buf;
+    bool gpu_tree_build;
 
     /**
-     * @brief Буфер масс OpenGL.
+     * @brief Флаг попытки создания построителя дерева.
      */
-    NBodyGLBuffer* gl_mass_buf;
+    bool tree_builder_tried;
 
     /**
-     * @brief Буферы позиций OpenGL.
+     * @brief Флаг попытки создания построителя разложений FMM.
      */
-    NBodyGLBuffer* gl_pos_buf[switch_buffers_count];
+    bool fmm_builder_tried;
 
     /**
-     * @brief Буферы скоростей OpenGL.
+     * @brief Флаг расчёта FMM на устройстве.
      */
-    NBodyGLBuffer* gl_vel_buf[switch_buffers_count];
+    bool fmm_device_eval;
 
     /**
-     * @brief Контекст OpenCL.
+     * @brief Число уровней индивидуальных шагов.
      */
-    CLContext* clcxt;
+    size_t block_rungs;
 
     /**
-     * @brief Очередь команд OpenCL.
+     * @brief Флаг необходимости вычислить сохраняемые ускорения
+     * всех тел перед шагом блочной схемы или метода Эрмита.
      */
-    CLCommandQueue* clqueue;
+    bool acc_reset;
 
     /**
-     * @brief Программа OpenCL.
+     * @brief Метод интегрирования.
      */
-    CLProgram* clprogram;
+    Integrator nbody_integrator;
 
     /**
-     * @brief Ядро OpenCL.
+     * @brief Метод интегрирования, с которым собрана программа OpenCL.
      */
-    CLKernel* clkernel;
+    Integrator program_integrator;
 
     /**
-     * @brief Событие OpenCL.
+     * @brief Точность суммирования ускорений.
      */
-    CLEvent* clevent;
+    Precision nbody_precision;
 
     /**
-     * @brief Буфер масс OpenCL.
+     * @brief Точность суммирования, с которой собрана программа OpenCL.
      */
-    CLBuffer* cl_mass_buf;
+    Precision program_precision;
 
     /**
-     * @brief Буферы позиций OpenCL.
+     * @brief Модель сглаживания.
      */
-    CLBuffer* cl_pos_buf[switch_buffers_count];
+    Softening nbody_softening;
 
     /**
-     * @brief Буферы скоростей OpenCL.
+     * @brief Длина сглаживания.
      */
-    CLBuffer* cl_vel_buf[switch_buffers_count];
+    float softening_length;
 
     /**
-     * @brief Глобальный размер измерений.
+     * @brief Флаг упакованного хранения тел.
      */
-    size_t global_dims[NDRANGE_DIMENSIONS];
+    bool packed_layout;
 
     /**
-     * @brief Локальный размер измерений.
+     * @brief Флаг создания упакованных буферов.
      */
-    size_t local_dims[NDRANGE_DIMENSIONS];
+    bool program_packed;
 
     /**
-     * @brief Инициализирует OpenCL.
-     * @param platform Платформа OpenCL.
-     * @param device Устройство OpenCL.
-     * @return true в случае успеха, иначе false.
+     * @brief Флаг необходимости упаковать позиции и массы
+     * из общих буферов перед шагом.
      */
-    bool initOpenCL(const CLPlatform& platform, const CLDevice& device);
+    bool packed_sync;
 
     /**
-     * @brief Завершает OpenCL.
-     * @return true в случае успеха, иначе false.
+     * @brief Флаг конвейерного режима.
      */
-    bool termOpenCL();
+    bool pipelined_mode;
 
     /**
-     * @brief Вычисляет размеры измерений X,Y.
-     * @return true в случае успеха, иначе false.
+     * @brief Флаг конвейерного режима созданной системы.
      */
-    bool calculateDimsSizes();
+    bool program_pipelined;
 
     /**
-     * @brief Уничтожает объект OpenCL.
-     * @param clobj Объект OpenCL.
-     * @return true в случае успеха, иначе false.
+     * @brief Флаг изменения данных вне расчёта -
+     * буферы отображения устарели.
      */
-    template <typename T>
-    bool destroyCLObject(T* clobj);
+    bool display_sync;
+
+    /**
+     * @brief Буферы отображения позиций OpenGL.
+     */
+    NBodyGLBuffer* gl_display_buf[DISPLAY_BUFFERS_COUNT];
+
+    /**
+     * @brief Номера кадров в буферах отображения.
+     */
+    size_t display_frames[DISPLAY_BUFFERS_COUNT];
+
+    /**
+     * @brief Номер последнего кадра.
+     */
+    size_t display_frame;
+
+    /**
+     * @brief Индекс отрисовываемого буфера отображения.
+     */
+    size_t display_front;
+
+    /**
+     * @brief Флаг готовности.
+     */
+    bool is_ready;
+
+    /**
+     * @brief Флаг расчёта на процессоре без OpenCL.
+     */
+    bool native_backend;
+
+    /**
+     * @brief Флаг необходимости передать данные буферов OpenGL
+     * расчёту на процессоре.
+     */
+    bool native_sync;
+
+    /**
+     * @brief Флаг работы без OpenGL.
+     */
+    bool headless;
+
+    /**
+     * @brief Текущие буферы для чтения.
+     */
+    size_t current_in;
+
+    /**
+     * @brief Текущие буферы для записи.
+     */
+    size_t current_out;
+
+    /**
+     * @brief Число буферов для переключения чтения/записи.
+     */
+    static const size_t switch_buffers_count = 2;
+
+    /**
+     * @brief Число общих буферов OpenGL и OpenCL:
+     * массы, позиции и скорости.
+     */
+    static const size_t shared_buffers_count = 1 + switch_buffers_count * 2;
+
+    /**
+     * @brief Индексный буфер OpenGL.
+     */
+    NBodyGLBuffer* gl_index_buf;
+
+    /**
+     * @brief Буфер масс OpenGL.
+     */
+    NBodyGLBuffer* gl_mass_buf;
+
+    /**
+     * @brief Буферы позиций OpenGL.
+     */
+    NBodyGLBuffer* gl_pos_buf[switch_buffers_count];
+
+    /**
+     * @brief Буферы скоростей OpenGL.
+     */
+    NBodyGLBuffer* gl_vel_buf[switch_buffers_count];
+
+    /**
+     * @brief Данные буферов при работе без OpenGL и OpenCL:
+     * массы, позиции и скорости.
+     */
+    QVector<float> headless_buffers[shared_buffers_count];
+
+    /**
+     * @brief Флаг размещения общих буферов OpenCL
+     * в памяти хоста (CL_MEM_USE_HOST_PTR).
+     */
+    bool zero_copy;
+
+    /**
+     * @brief Память хоста общих буферов OpenCL,
+     * разделы выровнены по странице.
+     */
+    char* host_arena;
+
+    /**
+     * @brief Размер раздела памяти хоста каждого общего буфера.
+     */
+    size_t host_arena_section;
+
+    /**
+     * @brief Отображённые в память хоста общие буферы OpenCL.
+     */
+    mutable void* host_mapped[shared_buffers_count];
+
+    /**
+     * @brief Флаги захвата общих буферов OpenCL.
+     * Буферы остаются захваченными между шагами,
+     * пока OpenGL к ним не обращается.
+     */
+    mutable bool gl_acquired[shared_buffers_count];
+
+    /**
+     * @brief Флаг синхронизации OpenGL и OpenCL
+     * через объекты синхронизации (cl_khr_gl_event).
+     */
+    bool gl_cl_sync;
+
+    /**
+     * @brief Событие OpenCL завершения команд OpenGL.
+     */
+    CLEvent* clglevent;
+
+    /**
+     * @brief События OpenCL границ этапов шага для профилирования.
+     * Окончание последнего этапа отмечает clevent.
+     */
+    CLEvent* clprofile_events[PROFILE_MARKERS_COUNT];
+
+    /**
+     * @brief События OpenCL запусков ядер интегрирования шага.
+     */
+    QVector<CLEvent*> clintegrate_events;
+
+    /**
+     * @brief Число запусков ядер интегрирования шага.
+     */
+    size_t integrate_launches;
+
+    /**
+     * @brief Число расчётов ускорений всех тел за шаг.
+     */
+    size_t profile_force_passes;
+
+    /**
+     * @brief Флаг профилирования.
+     */
+    bool profiling_enabled;
+
+    /**
+     * @brief Флаг профилирования очереди команд OpenCL.
+     */
+    bool clqueue_profiling;
+
+    /**
+     * @brief Флаг ожидания профиля поставленного в очередь шага.
+     */
+    bool profile_pending;
+
+    /**
+     * @brief Профиль последнего шага.
+     */
+    Profile last_profile;
+
+    /**
+     * @brief Сумма профилей для периодического вывода в лог.
+     */
+    Profile profile_sum;
+
+    /**
+     * @brief Число просуммированных профилей.
+     */
+    size_t profile_frames;
+
+    /**
+     * @brief Время шагов на процессоре, нс.
+     */
+    qint64 native_step_time;
+
+    /**
+     * @brief Время интегрирования на процессоре, нс.
+     */
+    qint64 native_integrate_time;
+
+    /**
+     * @brief Ставит в очередь маркер границы этапа шага.
+     * @param marker Номер маркера.
+     */
+    void enqueueProfileMarker(size_t marker);
+
+    /**
+     * @brief Получение события для запуска ядра интегрирования.
+     * @return Событие, либо nullptr, если запуск не профилируется.
+     */
+    CLEvent* integrateProfileEvent();
+
+    /**
+     * @brief Получение числа расчётов ускорений всех тел
+     * очередного шага выбранным методом интегрирования.
+     * @return Число расчётов ускорений.
+     */
+    size_t forcePassesPerStep() const;
+
+    /**
+     * @brief Вычисляет профиль завершённого шага.
+     * @param device_time Время шага на устройстве, нс, если известно
+     * только оно, иначе отрицательное - времена этапов
+     * считываются из событий OpenCL.
+     * @param integrate_time Время интегрирования на устройстве, нс.
+     */
+    void updateProfile(qint64 device_time = -1, qint64 integrate_time = 0);
+
+    /**
+     * @brief Функции объектов синхронизации OpenGL.
+     */
+    static PFNGLFENCESYNCPROC glFenceSync;
+    static PFNGLDELETESYNCPROC glDeleteSync;
+
+    /**
+     * @brief Контекст OpenCL.
+     */
+    CLContext* clcxt;
+
+    /**
+     * @brief Очередь команд OpenCL.
+     */
+    CLCommandQueue* clqueue;
+
+    /**
+     * @brief Программа OpenCL.
+     */
+    CLProgram* clprogram;
+
+    /**
+     * @brief Ядро OpenCL.
+     */
+    CLKernel* clkernel;
+
+    /**
+     * @brief Ядро OpenCL метода Барнса-Хата.
+     */
+    CLKernel* clkernel_bh;
+
+    /**
+     * @brief Ядро OpenCL быстрого метода мультиполей.
+     */
+    CLKernel* clkernel_fmm;
+
+    /**
+     * @brief Ядро OpenCL интегрирования по готовым ускорениям.
+     */
+    CLKernel* clkernel_integrate;
+
+    /**
+     * @brief Ядро OpenCL шага блочной схемы.
+     */
+    CLKernel* clkernel_block_step;
+
+    /**
+     * @brief Ядро OpenCL ускорений активных тел блочной схемы.
+     */
+    CLKernel* clkernel_block_force;
+
+    /**
+     * @brief Ядро OpenCL предсказания метода Эрмита.
+     */
+    CLKernel* clkernel_hermite_predict;
+
+    /**
+     * @brief Ядро OpenCL коррекции метода Эрмита.
+     */
+    CLKernel* clkernel_hermite_correct;
+
+    /**
+     * @brief Ядро OpenCL подшага для упакованных данных.
+     */
+    CLKernel* clkernel_packed;
+
+    /**
+     * @brief Ядра OpenCL упаковки и распаковки данных.
+     */
+    CLKernel* clkernel_pack;
+    CLKernel* clkernel_unpack;
+
+    /**
+     * @brief Ядра OpenCL симметричного расчёта всех пар.
+     */
+    CLKernel* clkernel_pairs;
+    CLKernel* clkernel_pairs_reduce;
+
+    /**
+     * @brief Событие OpenCL.
+     */
+    CLEvent* clevent;
+
+    /**
+     * @brief Событие OpenCL окончания асинхронной записи данных тел.
+     */
+    CLEvent* clupload_event;
+
+    /**
+     * @brief Буфер масс OpenCL.
+     */
+    CLBuffer* cl_mass_buf;
+
+    /**
+     * @brief Буферы позиций OpenCL.
+     */
+    CLBuffer* cl_pos_buf[switch_buffers_count];
+
+    /**
+     * @brief Буферы скоростей OpenCL.
+     */
+    CLBuffer* cl_vel_buf[switch_buffers_count];
+
+    /**
+     * @brief Буфер узлов октодерева OpenCL.
+     */
+    CLBuffer* cl_tree_nodes_buf;
+
+    /**
+     * @brief Буфер индексов тел октодерева OpenCL.
+     */
+    CLBuffer* cl_tree_indices_buf;
+
+    /**
+     * @brief Размер буфера узлов октодерева в байтах.
+     */
+    size_t tree_nodes_capacity;
+
+    /**
+     * @brief Буфер ускорений OpenCL.
+     */
+    CLBuffer* cl_acc_buf;
+
+    /**
+     * @brief Буфер частичных сумм ускорений симметричного расчёта OpenCL.
+     */
+    CLBuffer* cl_pairs_buf;
+
+    /**
+     * @brief Число потоков симметричного расчёта,
+     * 0 - симметричный расчёт не используется.
+     */
+    size_t pairs_threads;
+
+    /**
+     * @brief Буфер листьев FMM OpenCL.
+     */
+    CLBuffer* cl_fmm_leaves_buf;
+
+    /**
+     * @brief Буфер листьев тел FMM OpenCL.
+     */
+    CLBuffer* cl_fmm_leaf_of_buf;
+
+    /**
+     * @brief Буфер списков ближних листьев FMM OpenCL.
+     */
+    CLBuffer* cl_fmm_near_buf;
+
+    /**
+     * @brief Буфер локальных разложений FMM OpenCL.
+     */
+    CLBuffer* cl_fmm_locals_buf;
+
+    /**
+     * @brief Буфер степеней членов разложения FMM OpenCL.
+     */
+    CLBuffer* cl_fmm_exps_buf;
+
+    /**
+     * @brief Размеры буферов FMM в байтах.
+     */
+    size_t fmm_leaves_capacity;
+    size_t fmm_near_capacity;
+    size_t fmm_locals_capacity;
+    size_t fmm_exps_capacity;
+
+    /**
+     * @brief Буфер ускорений и желаемых уровней блочной схемы OpenCL.
+     */
+    CLBuffer* cl_block_acc_buf;
+
+    /**
+     * @brief Буфер уровней шагов тел OpenCL.
+     */
+    CLBuffer* cl_block_rung_buf;
+
+    /**
+     * @brief Буфер индексов активных тел OpenCL.
+     */
+    CLBuffer* cl_block_active_buf;
+
+    /**
+     * @brief Буфер счётчиков активных тел подшагов OpenCL.
+     */
+    CLBuffer* cl_block_counters_buf;
+
+    /**
+     * @brief Буферы предсказанных позиций и скоростей метода Эрмита OpenCL.
+     */
+    CLBuffer* cl_hermite_pos_buf;
+    CLBuffer* cl_hermite_vel_buf;
+
+    /**
+     * @brief Буферы ускорений и рывков метода Эрмита OpenCL.
+     */
+    CLBuffer* cl_hermite_acc_buf;
+    CLBuffer* cl_hermite_jerk_buf;
+
+    /**
+     * @brief Буферы упакованных позиций и масс (x, y, z, m) OpenCL.
+     */
+    CLBuffer* cl_packed_buf[switch_buffers_count];
+
+    /**
+     * @brief Буферы отображения позиций OpenCL.
+     */
+    CLBuffer* cl_display_buf[DISPLAY_BUFFERS_COUNT];
+
+    /**
+     * @brief События окончания копирования в буферы отображения.
+     */
+    CLEvent* cldisplay_events[DISPLAY_BUFFERS_COUNT];
+
+    /**
+     * @brief Событие OpenCL завершения команд OpenGL для очереди копирования.
+     */
+    CLEvent* cltransfer_glevent;
+
+    /**
+     * @brief Очередь команд копирования в буферы отображения.
+     */
+    CLCommandQueue* cltransfer_queue;
+
+    /**
+     * @brief Запись траектории.
+     */
+    TrajectoryRecorder* trajectory_recorder;
+
+    /**
+     * @brief Число шагов с начала записи траектории.
+     */
+    quint64 record_step;
+
+    /**
+     * @brief Буферы закреплённой памяти кадров траектории OpenCL.
+     */
+    CLBuffer* cl_record_buf[TRAJECTORY_SLOTS_COUNT];
+
+    /**
+     * @brief Память хоста кадров траектории при расчёте на процессоре.
+     */
+    QVector<float> record_host[TRAJECTORY_SLOTS_COUNT];
+
+    /**
+     * @brief Данные кадров траектории в памяти хоста.
+     */
+    float* record_ptr[TRAJECTORY_SLOTS_COUNT];
+
+    /**
+     * @brief События окончания чтения кадров траектории.
+     */
+    CLEvent* clrecord_events[TRAJECTORY_SLOTS_COUNT];
+
+    /**
+     * @brief Создаёт буферы кадров траектории.
+     * @return true в случае успеха, иначе false.
+     */
+    bool createRecordBuffers();
+
+    /**
+     * @brief Дожидается записи кадров и уничтожает их буферы.
+     */
+    void destroyRecordBuffers();
+
+    /**
+     * @brief Получение числа шагов очередного запуска симуляции
+     * с учётом записи траектории.
+     * @return Число шагов.
+     */
+    size_t nextFrameSteps() const;
+
+    /**
+     * @brief Получение флага записи кадра после шагов запуска.
+     * @param steps Число шагов запуска.
+     * @return Флаг записи кадра.
+     */
+    bool recordDue(size_t steps) const;
+
+    /**
+     * @brief Ставит в очередь чтение текущего состояния
+     * в свободный буфер кадра без ожидания и передаёт кадр записи.
+     */
+    void enqueueRecordFrame();
+
+    /**
+     * @brief Копирует состояние расчёта на процессоре
+     * в свободный буфер кадра и передаёт кадр записи.
+     * Выполняется в потоке шага.
+     * @param count Число тел.
+     */
+    void recordNativeFrame(size_t count);
+
+    /**
+     * @brief Ставит в очередь копирования результат шага
+     * в свободный буфер отображения.
+     * Копирование ждёт окончания расчёта, расчёт следующего
+     * шага ждёт окончания копирования.
+     */
+    void enqueueDisplayTransfer();
+
+    /**
+     * @brief Синхронно копирует текущие позиции в буфер отображения.
+     * Используется после изменения данных вне расчёта.
+     * @return true в случае успеха, иначе false.
+     */
+    bool syncDisplay();
+
+    /**
+     * @brief Ставит в очередь ожидание завершения команд OpenGL.
+     * @param queue Очередь команд OpenCL.
+     * @param event Событие для объекта синхронизации OpenGL.
+     */
+    void enqueueWaitGL(CLCommandQueue* queue, CLEvent* event);
+
+    /**
+     * @brief Нули для сброса счётчиков активных тел.
+     */
+    QVector<qint32> block_counters;
+
+    /**
+     * @brief Локальный и глобальный размеры ядер, вычисляющих рывки.
+     */
+    size_t jerk_local_size;
+    size_t jerk_global_size;
+
+    /**
+     * @brief Октодерево.
+     */
+    Octree* octree;
+
+    /**
+     * @brief Построитель дерева на устройстве.
+     */
+    TreeBuilder* tree_builder;
+
+    /**
+     * @brief Построитель разложений FMM на устройстве.
+     */
+    FmmBuilder* fmm_builder;
+
+    /**
+     * @brief Быстрый метод мультиполей.
+     */
+    Fmm* fmm;
+
+    /**
+     * @brief Метод частица-сетка.
+     */
+    ParticleMesh* particle_mesh;
+
+    /**
+     * @brief Ускорения, вычисленные на хосте.
+     */
+    QVector<float> host_accelerations;
+
+    /**
+     * @brief Расчёт на процессоре.
+     */
+    CpuEngine* cpu_engine;
+
+    /**
+     * @brief Наблюдатель за шагом расчёта на процессоре.
+     */
+    QFutureWatcher<void>* native_watcher;
+
+    /**
+     * @brief Позиции, вычисленные на процессоре.
+     */
+    QVector<float> native_positions;
+
+    /**
+     * @brief Скорости, вычисленные на процессоре.
+     */
+    QVector<float> native_velocities;
+
+    /**
+     * @brief Позиции тел для построения октодерева.
+     */
+    QVector<float> tree_positions;
+
+    /**
+     * @brief Массы тел для построения октодерева.
+     */
+    QVector<float> tree_masses;
+
+    /**
+     * @brief Глобальный размер измерений.
+     */
+    size_t global_dims[NDRANGE_DIMENSIONS];
+
+    /**
+     * @brief Локальный размер измерений.
+     */
+    size_t local_dims[NDRANGE_DIMENSIONS];
+
+    /**
+     * @brief Глобальный размер измерений ядра прямого расчёта
+     * с учётом числа тел work-item'а.
+     */
+    size_t main_global_dims[NDRANGE_DIMENSIONS];
+
+    /**
+     * @brief Флаг подбора параметров ядра.
+     */
+    bool auto_tune;
+
+    /**
+     * @brief Параметры ядра прямого расчёта.
+     */
+    KernelTuning kernel_tuning;
+
+    /**
+     * @brief Результаты замера точностей суммирования,
+     * по строке на точность.
+     */
+    QString precision_report;
+
+    /**
+     * @brief Часть тел, рассчитываемая одним устройством.
+     */
+    struct DevicePart {
+        cl_device_id device_id; //!< Идентификатор устройства OpenCL.
+        CLCommandQueue* queue; //!< Очередь команд устройства.
+        CLEvent* events[2]; //!< События ядра предыдущего и текущего подшагов.
+        size_t local_size; //!< Размер рабочей группы.
+        size_t cache_size; //!< Число тел в кэше.
+        size_t first_body; //!< Первое тело части.
+        size_t bodies_count; //!< Число тел части.
+        double throughput; //!< Производительность, тел в нс.
+    };
+
+    /**
+     * @brief Флаг расчёта на нескольких устройствах.
+     */
+    bool multi_device;
+
+    /**
+     * @brief Части тел устройств контекста.
+     * Первая часть - основное устройство с очередью clqueue.
+     */
+    QVector<DevicePart> device_parts;
+
+    /**
+     * @brief Индекс событий текущего подшага в частях.
+     */
+    size_t device_parts_event;
+
+    /**
+     * @brief Флаг расчёта подшагов на нескольких устройствах.
+     */
+    bool device_parts_active;
+
+    /**
+     * @brief Флаг измеренной производительности устройств.
+     * До первого измерения используется оценка по
+     * числу вычислительных блоков и частоте.
+     */
+    bool device_parts_measured;
+
+    /**
+     * @brief Инициализирует OpenCL.
+     * @param platform Платформа OpenCL.
+     * @param device Устройство OpenCL.
+     * @return true в случае успеха, иначе false.
+     */
+    bool initOpenCL(const CLPlatform& platform, const CLDevice& device);
+
+    /**
+     * @brief Завершает OpenCL.
+     * @return true в случае успеха, иначе false.
+     */
+    bool termOpenCL();
+
+    /**
+     * @brief Вычисляет размеры измерений X,Y.
+     * @return true в случае успеха, иначе false.
+     */
+    bool calculateDimsSizes();
+
+    /**
+     * @brief Уничтожает объект OpenCL.
+     * @param clobj Объект OpenCL.
+     * @return true в случае успеха, иначе false.
+     */
+    template <typename T>
+    bool destroyCLObject(T* clobj);
 
     /**
      * @brief Создаёт, считывает и компилирует программу OpenCL.
@@ -413,17 +1721,341 @@ private:
      */
     bool createCLProgram();
 
+    /**
+     * @brief Считывает исходный код программы OpenCL.
+     * @param source Результат - исходный код.
+     * @return true в случае успеха, иначе false.
+     */
+    bool readCLProgramSource(QString& source);
+
+    /**
+     * @brief Получение опций компиляции программы OpenCL.
+     * @param tuning Параметры ядра прямого расчёта.
+     * @param precision Точность суммирования ускорений.
+     * @return Опции компиляции.
+     */
+    QStringList clProgramOptions(const KernelTuning& tuning, Precision precision) const;
+
+    /**
+     * @brief Получение имени файла кэша двоичного кода программы OpenCL.
+     * Имя - хэш исходного кода, опций компиляции,
+     * имени устройства и версии драйвера.
+     * @param source Исходный код.
+     * @param options Опции компиляции.
+     * @param device Устройство OpenCL.
+     * @return Имя файла кэша, пустая строка, если кэш недоступен.
+     */
+    static QString clProgramCacheFileName(const QString& source, const QStringList& options, const CLDevice& device);
+
+    /**
+     * @brief Создаёт и собирает программу OpenCL.
+     * Если в кэше есть двоичный код программы, компилятор не запускается,
+     * иначе программа компилируется и её двоичный код сохраняется в кэш.
+     * @param program Программа OpenCL.
+     * @param source Исходный код.
+     * @param options Опции компиляции.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки компиляции.
+     */
+    bool buildCLProgram(CLProgram* program, const QString& source, const QStringList& options);
+
+    /**
+     * @brief Подбирает параметры ядра прямого расчёта.
+     * Варианты ядра запускаются на временных буферах,
+     * результат сохраняется в kernel_tuning.
+     * @param device Устройство OpenCL.
+     * @return true в случае успеха, иначе false.
+     */
+    bool tuneKernel(const CLDevice& device);
+
+    /**
+     * @brief Измеряет производительность и ошибку ускорений
+     * ядра прямого расчёта для доступных точностей суммирования.
+     * Ускорения сравниваются с вычисленными на процессоре в double,
+     * результаты выводятся в лог.
+     * @param device Устройство OpenCL.
+     * @return true в случае успеха, иначе false.
+     */
+    bool measurePrecision(const CLDevice& device);
+
+    /**
+     * @brief Вычисляет множитель ускорения 1 / r^3 с учётом сглаживания
+     * так же, как программа OpenCL.
+     * @param r2 Квадрат расстояния.
+     * @return Множитель ускорения.
+     */
+    double softenedInvR3(double r2) const;
+
+    /**
+     * @brief Строит октодерево по текущим позициям
+     * и ставит в очередь расчёт методом Барнса-Хата.
+     * Буферы OpenGL должны быть захвачены.
+     * @param dt Время шага.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool enqueueBarnesHut(float dt);
+
+    /**
+     * @brief Считывает позиции, строит октодерево на хосте
+     * и передаёт его устройству.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool buildHostTree();
+
+    /**
+     * @brief Считывает текущие позиции и массы тел на хост.
+     * @throw CLException в случае ошибки.
+     */
+    void readHostBodies();
+
+    /**
+     * @brief Строит разложения быстрого метода мультиполей
+     * и ставит в очередь расчёт шага.
+     * Буферы OpenGL должны быть захвачены.
+     * @param dt Время шага.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool enqueueFmm(float dt);
+
+    /**
+     * @brief Ставит в очередь расчёт шага ядром FMM
+     * по уже установленным буферам листьев и разложений.
+     * @param dt Время шага.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool enqueueFmmEvaluate(float dt);
+
+    /**
+     * @brief Вычисляет ускорения методом частица-сетка
+     * и ставит в очередь расчёт шага.
+     * Буферы OpenGL должны быть захвачены.
+     * @param dt Время шага.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool enqueueParticleMesh(float dt);
+
+    /**
+     * @brief Передаёт устройству ускорения, вычисленные на хосте,
+     * и ставит в очередь интегрирование.
+     * @param dt Время шага.
+     * @throw CLException в случае ошибки.
+     */
+    void enqueueIntegrate(float dt);
+
+    /**
+     * @brief Ставит в очередь шаг прямого расчёта всех пар
+     * выбранным методом интегрирования.
+     * Буферы OpenGL должны быть захвачены.
+     * @param dt Время шага.
+     * @throw CLException в случае ошибки.
+     */
+    void enqueueAllPairs(float dt);
+
+    /**
+     * @brief Ставит в очередь подшаг сдвиг-толчок-сдвиг.
+     * @param dt Время шага.
+     * @param src Индекс буферов для чтения.
+     * @param dst Индекс буферов для записи.
+     * @param drift_pre Доля шага сдвига до толчка.
+     * @param kick Доля шага толчка.
+     * @param drift_post Доля шага сдвига после толчка.
+     * @throw CLException в случае ошибки.
+     */
+    void enqueueDriftKick(float dt, size_t src, size_t dst,
+                          float drift_pre, float kick, float drift_post);
+
+    /**
+     * @brief Ставит в очередь шаг метода Эрмита 4-го порядка.
+     * @param dt Время шага.
+     * @throw CLException в случае ошибки.
+     */
+    void enqueueHermite(float dt);
+
+    /**
+     * @brief Получение флага симметричного расчёта всех пар.
+     * Используется на процессорных устройствах OpenCL
+     * для полунеявного метода Эйлера.
+     * @return Флаг симметричного расчёта.
+     */
+    bool useSymmetricPairs() const;
+
+    /**
+     * @brief Ставит в очередь шаг полунеявным методом Эйлера
+     * с расчётом каждой пары тел один раз.
+     * Буферы OpenGL должны быть захвачены.
+     * @param dt Время шага.
+     * @throw CLException в случае ошибки.
+     */
+    void enqueueSymmetricPairs(float dt);
+
+    /**
+     * @brief Получение флага расчёта шага на упакованных данных.
+     * @return Флаг расчёта на упакованных данных.
+     */
+    bool usePackedLayout() const;
+
+    /**
+     * @brief Создаёт очереди команд дополнительных устройств контекста.
+     * @return true в случае успеха, иначе false.
+     */
+    bool createDeviceParts();
+
+    /**
+     * @brief Уничтожает очереди команд и события устройств.
+     */
+    void destroyDeviceParts();
+
+    /**
+     * @brief Вычисляет размеры рабочих групп и кэшей устройств.
+     * @return true в случае успеха, иначе false.
+     */
+    bool calculateDevicePartsSizes();
+
+    /**
+     * @brief Получение флага расчёта шага на нескольких устройствах.
+     * @return Флаг расчёта на нескольких устройствах.
+     */
+    bool useDeviceParts() const;
+
+    /**
+     * @brief Начинает расчёт шагов на нескольких устройствах.
+     * Перераспределяет тела по измеренной производительности
+     * и ставит в очередь точку синхронизации с основным устройством.
+     */
+    void beginDeviceParts();
+
+    /**
+     * @brief Заканчивает расчёт шагов на нескольких устройствах.
+     * Основная очередь ожидает завершения всех частей.
+     */
+    void endDeviceParts();
+
+    /**
+     * @brief Ставит в очереди устройств подшаг с установленными аргументами ядра.
+     * Каждое устройство ждёт окончания предыдущего подшага на всех устройствах.
+     */
+    void enqueueDeviceParts();
+
+    /**
+     * @brief Делит тела между устройствами пропорционально производительности.
+     */
+    void balanceDeviceParts();
+
+    /**
+     * @brief Ставит в очередь упаковку текущих позиций и масс.
+     * @throw CLException в случае ошибки.
+     */
+    void enqueuePackBodies();
+
+    /**
+     * @brief Ставит в очередь распаковку текущих позиций
+     * в буфер для отрисовки.
+     * @throw CLException в случае ошибки.
+     */
+    void enqueueUnpackPositions();
+
+    /**
+     * @brief Ставит в очередь шаг блочной схемы индивидуальных шагов.
+     * Буферы OpenGL должны быть захвачены.
+     * @param dt Время шага нулевого уровня.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool enqueueBlockSteps(float dt);
+
+    /**
+     * @brief Создаёт построитель дерева на устройстве при первом обращении.
+     * @return true если построитель готов, иначе false.
+     */
+    bool createTreeBuilder();
+
+    /**
+     * @brief Создаёт построитель разложений FMM на устройстве при первом обращении.
+     * @return true если построитель готов, иначе false.
+     */
+    bool createFmmBuilder();
+
+    /**
+     * @brief Запускает шаги расчёта на процессоре.
+     * @param dt Время шага.
+     * @return true в случае успеха, иначе false.
+     */
+    bool simulateNative(float dt);
+
+    /**
+     * @brief Передаёт данные буферов OpenGL расчёту на процессоре.
+     * @return true в случае успеха, иначе false.
+     */
+    bool syncNative();
+
+    /**
+     * @brief Шаги расчёта на процессоре.
+     * Выполняется в отдельном потоке.
+     * @param dt Время шага.
+     * @param steps Число шагов.
+     * @param record Флаг записи кадра траектории после шагов.
+     */
+    void nativeStep(float dt, size_t steps, bool record);
+
     /**
      * @brief Переключение буферов для чтения/записи.
      */
     void switchCurrentBuffers();
 
+    /**
+     * @brief Отмечает изменение данных тел:
+     * все производные от них представления
+     * будут обновлены перед следующим шагом.
+     */
+    void markBodiesChanged();
+
     /**
      * @brief Создаёт буферы OpenGL.
      * @return true в случае успеха, иначе false.
      */
     bool createGLBuffers();
 
+    /**
+     * @brief Получение адресов функций OpenGL.
+     * @return true в случае успеха, иначе false.
+     */
+    static bool init_gl_functions();
+
+    /**
+     * @brief Захватывает ещё не захваченные общие буферы.
+     * Ожидание команд OpenGL выполняется очередью OpenCL,
+     * если доступен объект синхронизации, иначе - glFinish().
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool acquireGLObjects();
+
+    /**
+     * @brief Освобождает общий буфер, если он захвачен.
+     * @param index Индекс общего буфера.
+     * @return true, если освобождение поставлено в очередь, иначе false.
+     */
+    bool releaseGLObject(int index) const;
+
+    /**
+     * @brief Освобождает все захваченные общие буферы.
+     * @return true, если освобождение поставлено в очередь, иначе false.
+     */
+    bool releaseGLObjects() const;
+
+    /**
+     * @brief Освобождает буфер для обращения к нему OpenGL
+     * и ждёт завершения команд OpenCL.
+     * @param buf Буфер OpenGL.
+     * @return true в случае успеха, иначе false.
+     */
+    bool prepareGLAccess(NBodyGLBuffer* buf) const;
+
     /**
      * @brief Уничтожает буферы OpenGL.
      * @return true в случае успеха, иначе false.
@@ -482,6 +2114,16 @@ private:
      */
     bool setGLBufferData(NBodyGLBuffer* buf, const QVector<float>& data, size_t offset = 0);
 
+    /**
+     * @brief Запись в буфер данных.
+     * @param buf Буфер.
+     * @param data Данные.
+     * @param offset Смещение в буфере, в числах.
+     * @param count Количество чисел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool setGLBufferData(NBodyGLBuffer* buf, const float* data, size_t offset, size_t count);
+
     /**
      * @brief Чтение из буфера данных.
      * @param buf Буфер.
@@ -522,6 +2164,72 @@ private:
      */
     bool getGLBufferData(NBodyGLBuffer* buf, QVector<float>& data, size_t offset = 0, size_t count = 0) const;
 
+    /**
+     * @brief Получение индекса общего с OpenCL буфера.
+     * @param buf Буфер.
+     * @return Индекс: 0 - массы, затем позиции и скорости, -1 при ошибке.
+     */
+    int sharedBufferIndex(const NBodyGLBuffer* buf) const;
+
+    /**
+     * @brief Получение числа компонент элемента буфера.
+     * @param index Индекс общего буфера.
+     * @return Число компонент.
+     */
+    size_t sharedItemSize(int index) const;
+
+    /**
+     * @brief Запись данных при работе без OpenGL.
+     * Данные записываются в буфер OpenCL, либо в память
+     * расчёта на процессоре.
+     * @param buf Буфер, вместо которого записываются данные.
+     * @param data Данные.
+     * @param offset Смещение в числах.
+     * @param count Количество чисел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool writeHeadlessData(NBodyGLBuffer* buf, const float* data, size_t offset, size_t count);
+
+    /**
+     * @brief Чтение данных при работе без OpenGL.
+     * @param buf Буфер, вместо которого читаются данные.
+     * @param data Результат - данные.
+     * @param offset Смещение в числах.
+     * @param count Количество чисел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool readHeadlessData(NBodyGLBuffer* buf, float* data, size_t offset, size_t count) const;
+
+    /**
+     * @brief Получение буфера OpenCL по индексу общего буфера.
+     * @param index Индекс буфера.
+     * @return Буфер OpenCL.
+     */
+    CLBuffer* sharedCLBuffer(int index) const;
+
+    /**
+     * @brief Получение индекса общего буфера данных тел.
+     * @param data Данные тел.
+     * @return Индекс общего буфера.
+     */
+    int bodyDataIndex(BodyData data) const;
+
+    /**
+     * @brief Выделяет память хоста общих буферов OpenCL.
+     * @return true в случае успеха, иначе false.
+     */
+    bool createHostArena();
+
+    /**
+     * @brief Освобождает память хоста общих буферов OpenCL.
+     */
+    void destroyHostArena();
+
+    /**
+     * @brief Освобождает все отображённые в память хоста общие буферы OpenCL.
+     */
+    void unmapHostBuffers() const;
+
     /**
      * @brief Создаёт буферы OpenCL.
      * @return true в случае успеха, иначе false.
@@ -549,6 +2257,16 @@ private:
      * @return true в случае успеха, иначе false.
      */
     bool destroyCLBuffer(CLBuffer* buf);
+
+    /**
+     * @brief Пересоздаёт буфер OpenCL с запасом, если он мал.
+     * @param buf Буфер OpenCL.
+     * @param capacity Текущий размер буфера в байтах.
+     * @param size Требуемый размер в байтах.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool reserveCLBuffer(CLBuffer* buf, size_t& capacity, size_t size);
 };
 
 #endif // CLGLNBODY_H
@@ -0,0 +1,638 @@
+#include "nbodyfile.h"
+#include "snapshotcodec.h"
+#include "log.h"
+#include <QFile>
+#include <QDataStream>
+#include <QByteArray>
+#include <QtEndian>
+#include <string.h>
+
+
+#define LOG_WHO "NBody File"
+
+//! Число слов, суммируемых без переполнения сумм Флетчера-64.
+#define CHECKSUM_BLOCK_WORDS 65536
+
+
+NBodyFile::NBodyFile()
+{
+    mapping = nullptr;
+    bodies_count = 0;
+    masses_ptr = nullptr;
+}
+
+NBodyFile::~NBodyFile()
+{
+    close();
+}
+
+/**
+ * @brief Открывает файл.
+ * @param filename Имя файла.
+ * @param verify Флаг проверки контрольных сумм разделов.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBodyFile::open(const QString &filename, bool verify)
+{
+    // Закроем предыдущий файл.
+    close();
+
+    file.setFileName(filename);
+    // Если не удалось открыть файл.
+    if(!file.open(QIODevice::ReadOnly)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error open file!"));
+        // Возврат.
+        return false;
+    }
+
+    // Подпись и версия формата файла.
+    quint32 file_magic, file_version;
+
+    // Поток данных.
+    QDataStream ds(&file);
+    // Установим версию,
+    // Это необходимо для корректной сериализации/десериализации.
+    ds.setVersion(QDataStream::Qt_4_8);
+
+    // Считаем подпись и версию формата.
+    ds >> file_magic >> file_version;
+
+    // Если формат некорректен.
+    if(file_magic != magic){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Invalid file magic!"));
+        close();
+        // Возврат.
+        return false;
+    }
+
+    // Файл с разделами отображается в память.
+    if(file_version == version2){
+        if(!mapSections(verify)){
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Если версия некорректна.
+    if(file_version != version){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Invalid file version!"));
+        close();
+        // Возврат.
+        return false;
+    }
+
+    // Число тел.
+    quint32 count;
+
+    // Считаем число тел.
+    ds >> count;
+
+    // Сообщим число тел в файле.
+    log(Log::INFO, LOG_WHO, tr("Bodies in file: %1").arg(count));
+
+    // Изменим размеры массивов под нужное число тел.
+    v1_masses.resize(count);
+    v1_positions.resize(count);
+    v1_velocities.resize(count);
+
+    // Если неудалось считать массы, позиции или векторы скоростей.
+    if(ds.readRawData(reinterpret_cast<char*>(v1_masses.data()), v1_masses.size() * sizeof(float)) == -1 ||
+       ds.readRawData(reinterpret_cast<char*>(v1_positions.data()), v1_positions.size() * sizeof(Point3f)) == -1 ||
+       ds.readRawData(reinterpret_cast<char*>(v1_velocities.data()), v1_velocities.size() * sizeof(Point3f)) == -1){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, tr("Error reading data!"));
+        close();
+        // Возврат.
+        return false;
+    }
+
+    bodies_count = count;
+    masses_ptr = v1_masses.constData();
+    positions_ptr.append(reinterpret_cast<const float*>(v1_positions.constData()));
+    velocities_ptr.append(reinterpret_cast<const float*>(v1_velocities.constData()));
+
+    file.close();
+
+    return true;
+}
+
+/**
+ * @brief Закрывает файл.
+ */
+void NBodyFile::close()
+{
+    if(mapping) file.unmap(mapping);
+    mapping = nullptr;
+    if(file.isOpen()) file.close();
+
+    bodies_count = 0;
+    masses_ptr = nullptr;
+    positions_ptr.clear();
+    velocities_ptr.clear();
+    frame_steps.clear();
+    v1_masses.clear();
+    v1_positions.clear();
+    v1_velocities.clear();
+    decoded.clear();
+}
+
+size_t NBodyFile::bodiesCount() const
+{
+    return bodies_count;
+}
+
+size_t NBodyFile::framesCount() const
+{
+    return positions_ptr.size();
+}
+
+quint64 NBodyFile::frameStep(size_t frame) const
+{
+    if(frame_steps.isEmpty()) return frame;
+    return frame_steps.at(frame);
+}
+
+const float *NBodyFile::masses() const
+{
+    return masses_ptr;
+}
+
+const float *NBodyFile::positions(size_t frame) const
+{
+    return positions_ptr.at(frame);
+}
+
+const float *NBodyFile::velocities(size_t frame) const
+{
+    return velocities_ptr.at(frame);
+}
+
+/**
+ * @brief Отображает файл версии 2 в память.
+ * @param verify Флаг проверки контрольных сумм разделов.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBodyFile::mapSections(bool verify)
+{
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+    // Данные разделов передаются в буферы без преобразования.
+    Q_UNUSED(verify);
+    log(Log::ERROR, LOG_WHO, tr("File version 2 requires little-endian host!"));
+    return false;
+#else
+    quint64 file_size = file.size();
+
+    if(file_size < sizeof(Header)){
+        log(Log::ERROR, LOG_WHO, tr("Invalid file header!"));
+        return false;
+    }
+
+    // Отобразим весь файл.
+    mapping = file.map(0, file_size);
+    if(mapping == nullptr){
+        log(Log::ERROR, LOG_WHO, tr("Error mapping file!"));
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, mapping, sizeof(Header));
+
+    quint64 header_size = qFromLittleEndian(header.header_size);
+    quint64 sections_count = qFromLittleEndian(header.sections_count);
+    quint64 frames_count = qFromLittleEndian(header.frames_count);
+    quint64 file_bodies_count = qFromLittleEndian(header.bodies_count);
+
+    bool compressed = (qFromLittleEndian(header.flags) & FILE_FLAG_COMPRESSED) != 0;
+
+    // Все числа заголовка проверяются по размеру файла
+    // до выделения памяти под них.
+    // Таблица разделов должна уместиться в заголовке,
+    // у каждого кадра - разделы позиций и скоростей.
+    if(header_size < sizeof(Header) || header_size > file_size ||
+       sections_count > (header_size - sizeof(Header)) / sizeof(Section) ||
+       frames_count == 0 || 1 + frames_count * 2 > sections_count){
+        log(Log::ERROR, LOG_WHO, tr("Invalid file header!"));
+        return false;
+    }
+
+    // Размер данных разделов.
+    quint64 data_size = file_size - header_size;
+
+    // Наименьшие размеры раздела масс и раздела позиций или скоростей кадра:
+    // несжатые данные записаны как есть, сжатые содержат хотя бы таблицу блоков.
+    quint64 masses_size = 0, vectors_size = 0;
+    bool valid = false;
+    if(compressed){
+        valid = file_bodies_count / SNAPSHOT_CODEC_CHUNK <= data_size / sizeof(quint32);
+        if(valid){
+            masses_size = sizeof(quint32) * (1 + (file_bodies_count + SNAPSHOT_CODEC_CHUNK - 1) / SNAPSHOT_CODEC_CHUNK);
+            vectors_size = sizeof(quint32) * (1 + (file_bodies_count * 3 + SNAPSHOT_CODEC_CHUNK - 1) / SNAPSHOT_CODEC_CHUNK);
+        }
+    }else{
+        valid = file_bodies_count <= data_size / sizeof(float);
+        if(valid){
+            masses_size = file_bodies_count * sizeof(float);
+            vectors_size = file_bodies_count * sizeof(float) * 3;
+        }
+    }
+
+    // Разделы не перекрываются, поэтому все кадры должны уместиться в файле.
+    if(!valid || masses_size > data_size ||
+       (vectors_size != 0 && frames_count > (data_size - masses_size) / (vectors_size * 2))){
+        log(Log::ERROR, LOG_WHO, tr("Invalid file header!"));
+        return false;
+    }
+
+    bodies_count = file_bodies_count;
+
+    // Размеры сжатых разделов: массы, затем позиции и скорости кадров.
+    QVector<quint64> compressed_sizes;
+    if(compressed) compressed_sizes.fill(0, 1 + frames_count * 2);
+
+    // Сообщим число тел в файле.
+    log(Log::INFO, LOG_WHO, tr("Bodies in file: %1, frames: %2").arg(bodies_count).arg(frames_count));
+
+    masses_ptr = nullptr;
+    positions_ptr.fill(nullptr, frames_count);
+    velocities_ptr.fill(nullptr, frames_count);
+
+    for(size_t i = 0; i < sections_count; i ++){
+        Section section;
+        memcpy(&section, mapping + sizeof(Header) + i * sizeof(Section), sizeof(Section));
+
+        quint32 type = qFromLittleEndian(section.type);
+        quint64 frame = qFromLittleEndian(section.frame);
+        quint64 offset = qFromLittleEndian(section.offset);
+        quint64 size = qFromLittleEndian(section.size);
+
+        // Если раздел вне файла или не выровнен.
+        if(offset % NBODY_FILE_ALIGNMENT != 0 || offset < header_size ||
+           offset > file_size || size > file_size - offset){
+            log(Log::ERROR, LOG_WHO, tr("Invalid file section %1!").arg(i));
+            return false;
+        }
+
+        const uchar* data = mapping + offset;
+
+        // Если данные повреждены.
+        // Сжатые разделы всё равно читаются целиком,
+        // поэтому проверяются всегда.
+        if((verify || compressed) && checksum(data, size) != qFromLittleEndian(section.checksum)){
+            log(Log::ERROR, LOG_WHO, tr("Checksum mismatch in file section %1!").arg(i));
+            return false;
+        }
+
+        // Размер данных раздела.
+        quint64 expected_size = 0;
+
+        switch(type){
+        case SECTION_MASSES:
+            expected_size = bodies_count * sizeof(float);
+            masses_ptr = reinterpret_cast<const float*>(data);
+            if(compressed) compressed_sizes[0] = expected_size = size;
+            break;
+        case SECTION_POSITIONS:
+            expected_size = bodies_count * sizeof(float) * 3;
+            if(frame < frames_count){
+                positions_ptr[frame] = reinterpret_cast<const float*>(data);
+                if(compressed) compressed_sizes[1 + frame * 2] = expected_size = size;
+            }
+            break;
+        case SECTION_VELOCITIES:
+            expected_size = bodies_count * sizeof(float) * 3;
+            if(frame < frames_count){
+                velocities_ptr[frame] = reinterpret_cast<const float*>(data);
+                if(compressed) compressed_sizes[2 + frame * 2] = expected_size = size;
+            }
+            break;
+        case SECTION_FRAME_INDEX:
+            expected_size = frames_count * sizeof(quint64);
+            if(size == expected_size){
+                frame_steps.resize(frames_count);
+                for(size_t j = 0; j < frames_count; j ++){
+                    frame_steps[j] = qFromLittleEndian<quint64>(data + j * sizeof(quint64));
+                }
+            }
+            break;
+        default:
+            // Неизвестные разделы пропускаются.
+            expected_size = size;
+            break;
+        }
+
+        // Если размер или кадр раздела некорректны.
+        if(size != expected_size ||
+           ((type == SECTION_POSITIONS || type == SECTION_VELOCITIES) && frame >= frames_count)){
+            log(Log::ERROR, LOG_WHO, tr("Invalid file section %1!").arg(i));
+            return false;
+        }
+    }
+
+    // Если нет масс, позиций или скоростей.
+    bool complete = masses_ptr != nullptr;
+    for(size_t i = 0; i < frames_count && complete; i ++){
+        complete = positions_ptr.at(i) != nullptr && velocities_ptr.at(i) != nullptr;
+    }
+    if(!complete){
+        log(Log::ERROR, LOG_WHO, tr("Missing file sections!"));
+        return false;
+    }
+
+    // Сжатые разделы распаковываются, отображение больше не нужно.
+    if(compressed){
+        if(!decodeSections(compressed_sizes)){
+            log(Log::ERROR, LOG_WHO, tr("Error decoding compressed data!"));
+            return false;
+        }
+        file.unmap(mapping);
+        mapping = nullptr;
+        file.close();
+    }
+
+    return true;
+#endif
+}
+
+/**
+ * @brief Распаковывает разделы данных сжатого файла.
+ * Указатели на данные разделов заменяются
+ * указателями на распакованные данные.
+ * @param sizes Размеры сжатых разделов.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBodyFile::decodeSections(const QVector<quint64> &sizes)
+{
+    size_t frames_count = positions_ptr.size();
+    size_t vec_count = bodies_count * 3;
+
+    decoded.resize(bodies_count + frames_count * vec_count * 2);
+
+    float* out_masses = decoded.data();
+    if(!SnapshotCodec::decode(reinterpret_cast<const char*>(masses_ptr), sizes.at(0),
+                              out_masses, bodies_count)){
+        return false;
+    }
+    masses_ptr = out_masses;
+
+    // Кадры сжаты разностью с предыдущим кадром,
+    // поэтому распаковываются по порядку.
+    for(size_t i = 0; i < frames_count; i ++){
+        float* out_positions = decoded.data() + bodies_count + i * vec_count * 2;
+        float* out_velocities = out_positions + vec_count;
+        const float* prev_positions = i > 0 ? out_positions - vec_count * 2 : nullptr;
+        const float* prev_velocities = i > 0 ? out_velocities - vec_count * 2 : nullptr;
+
+        if(!SnapshotCodec::decode(reinterpret_cast<const char*>(positions_ptr.at(i)), sizes.at(1 + i * 2),
+                                  out_positions, vec_count, prev_positions) ||
+           !SnapshotCodec::decode(reinterpret_cast<const char*>(velocities_ptr.at(i)), sizes.at(2 + i * 2),
+                                  out_velocities, vec_count, prev_velocities)){
+            return false;
+        }
+
+        positions_ptr[i] = out_positions;
+        velocities_ptr[i] = out_velocities;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Вычисляет контрольную сумму Флетчера-64
+ * по 32-битным словам.
+ * @param data Данные.
+ * @param size Размер, кратный 4 байтам.
+ * @return Контрольная сумма.
+ */
+quint64 NBodyFile::checksum(const void *data, size_t size)
+{
+    const quint32* words = static_cast<const quint32*>(data);
+    size_t count = size / sizeof(quint32);
+
+    quint64 sum1 = 0, sum2 = 0;
+
+    // Суммы приводятся по модулю раз в блок слов.
+    while(count > 0){
+        size_t block = qMin<size_t>(count, CHECKSUM_BLOCK_WORDS);
+        for(size_t i = 0; i < block; i ++){
+            sum1 += words[i];
+            sum2 += sum1;
+        }
+        sum1 %= 0xffffffffULL;
+        sum2 %= 0xffffffffULL;
+        words += block;
+        count -= block;
+    }
+
+    return (sum2 << 32) | sum1;
+}
+
+/**
+ * @brief Считывает тела из файла.
+ * @param filename Имя файла.
+ * @param masses Результат - массы.
+ * @param positions Результат - позиции.
+ * @param velocities Результат - векторы скоростей.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBodyFile::read(const QString &filename, QVector<float> &masses,
+                     QVector<Point3f> &positions, QVector<Point3f> &velocities)
+{
+    NBodyFile file;
+
+    if(!file.open(filename)) return false;
+
+    size_t count = file.bodiesCount();
+
+    masses.resize(count);
+    positions.resize(count);
+    velocities.resize(count);
+
+    memcpy(masses.data(), file.masses(), count * sizeof(float));
+    memcpy(positions.data(), file.positions(), count * sizeof(Point3f));
+    memcpy(velocities.data(), file.velocities(), count * sizeof(Point3f));
+
+    return true;
+}
+
+/**
+ * @brief Записывает тела в файл.
+ * @param filename Имя файла.
+ * @param masses Массы.
+ * @param positions Позиции.
+ * @param velocities Векторы скоростей.
+ * @param compress Флаг сжатия данных.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBodyFile::write(const QString &filename, const QVector<float> &masses,
+                      const QVector<Point3f> &positions, const QVector<Point3f> &velocities,
+                      bool compress)
+{
+    return write(filename, masses.constData(),
+                 reinterpret_cast<const float*>(positions.constData()),
+                 reinterpret_cast<const float*>(velocities.constData()),
+                 masses.size(), 1, nullptr, compress);
+}
+
+/**
+ * @brief Записывает тела в файл версии 2.
+ * @param filename Имя файла.
+ * @param masses Массы.
+ * @param positions Позиции (x, y, z) всех кадров подряд.
+ * @param velocities Векторы скоростей (x, y, z) всех кадров подряд.
+ * @param count Число тел.
+ * @param frames Число кадров.
+ * @param steps Номера шагов кадров для индекса кадров или nullptr.
+ * @param compress Флаг сжатия данных.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBodyFile::write(const QString &filename, const float *masses,
+                      const float *positions, const float *velocities, size_t count,
+                      size_t frames, const quint64 *steps, bool compress)
+{
+    if(frames == 0) return false;
+
+    // Файл.
+    QFile file(filename);
+    // Если не удалось открыть файл.
+    if(!file.open(QIODevice::WriteOnly)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error open file!"));
+        // Возврат.
+        return false;
+    }
+
+    // Массы, позиции и скорости кадров, индекс кадров.
+    size_t sections_count = 1 + frames * 2 + (steps ? 1 : 0);
+
+    // Таблица разделов и их данные.
+    QVector<Section> sections(sections_count);
+    QVector<const void*> sections_data(sections_count);
+
+    // Индекс кадров в порядке байт little-endian.
+    QVector<quint64> index;
+
+    sections[0].type = SECTION_MASSES;
+    sections[0].frame = 0;
+    sections[0].size = count * sizeof(float);
+    sections_data[0] = masses;
+
+    for(size_t i = 0; i < frames; i ++){
+        Section& pos = sections[1 + i * 2];
+        pos.type = SECTION_POSITIONS;
+        pos.frame = i;
+        pos.size = count * sizeof(float) * 3;
+        sections_data[1 + i * 2] = positions + i * count * 3;
+
+        Section& vel = sections[2 + i * 2];
+        vel.type = SECTION_VELOCITIES;
+        vel.frame = i;
+        vel.size = count * sizeof(float) * 3;
+        sections_data[2 + i * 2] = velocities + i * count * 3;
+    }
+
+    if(steps){
+        index.resize(frames);
+        for(size_t i = 0; i < frames; i ++){
+            index[i] = qToLittleEndian(steps[i]);
+        }
+
+        Section& idx = sections[sections_count - 1];
+        idx.type = SECTION_FRAME_INDEX;
+        idx.frame = 0;
+        idx.size = frames * sizeof(quint64);
+        sections_data[sections_count - 1] = index.constData();
+    }
+
+    // Сжатые разделы данных.
+    QVector<QByteArray> encoded;
+
+    if(compress){
+        // Массы, позиции и скорости кадров.
+        size_t data_sections = 1 + frames * 2;
+        encoded.resize(data_sections);
+
+        for(size_t i = 0; i < data_sections; i ++){
+            // Кадры сжимаются разностью с предыдущим кадром.
+            const float* data = static_cast<const float*>(sections_data.at(i));
+            const float* reference = i >= 3 ? static_cast<const float*>(sections_data.at(i - 2)) : nullptr;
+            size_t n = i == 0 ? count : count * 3;
+
+            encoded[i] = SnapshotCodec::encode(data, n, reference);
+            // Контрольная сумма считается по 32-битным словам.
+            encoded[i].append(QByteArray((4 - encoded.at(i).size() % 4) % 4, '\0'));
+        }
+
+        for(size_t i = 0; i < data_sections; i ++){
+            sections[i].size = encoded.at(i).size();
+            sections_data[i] = encoded.at(i).constData();
+        }
+
+        quint64 raw_size = count * sizeof(float) * (1 + frames * 6);
+        quint64 packed_size = 0;
+        for(size_t i = 0; i < data_sections; i ++) packed_size += encoded.at(i).size();
+
+        log(Log::INFO, LOG_WHO, tr("Compressed %1 bytes to %2 bytes").arg(raw_size).arg(packed_size));
+    }
+
+    // Заголовок.
+    Header header;
+    header.magic = qToBigEndian(magic);
+    header.version = qToBigEndian(version2);
+    header.header_size = qToLittleEndian<quint32>(sizeof(Header) + sections_count * sizeof(Section));
+    header.sections_count = qToLittleEndian<quint32>(sections_count);
+    header.bodies_count = qToLittleEndian<quint64>(count);
+    header.frames_count = qToLittleEndian<quint32>(frames);
+    header.flags = qToLittleEndian<quint32>(compress ? FILE_FLAG_COMPRESSED : 0);
+
+    // Разделы выравниваются по 4 КиБ.
+    quint64 offset = sizeof(Header) + sections_count * sizeof(Section);
+    for(size_t i = 0; i < sections_count; i ++){
+        Section& section = sections[i];
+        offset = (offset + NBODY_FILE_ALIGNMENT - 1) / NBODY_FILE_ALIGNMENT * NBODY_FILE_ALIGNMENT;
+
+        quint64 size = section.size;
+        section.checksum = qToLittleEndian(checksum(sections_data.at(i), size));
+        section.offset = qToLittleEndian(offset);
+        section.size = qToLittleEndian(size);
+        section.type = qToLittleEndian(section.type);
+        section.frame = qToLittleEndian(section.frame);
+
+        offset += size;
+    }
+
+    // Если не удалось записать заголовок или таблицу разделов.
+    if(file.write(reinterpret_cast<const char*>(&header), sizeof(Header)) != sizeof(Header) ||
+       file.write(reinterpret_cast<const char*>(sections.constData()), sections_count * sizeof(Section)) !=
+            static_cast<qint64>(sections_count * sizeof(Section))){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, tr("Error writing data!"));
+        // Возврат.
+        return false;
+    }
+
+    // Заполнение до начала раздела.
+    QByteArray padding(NBODY_FILE_ALIGNMENT, '\0');
+
+    for(size_t i = 0; i < sections_count; i ++){
+        quint64 section_offset = qFromLittleEndian(sections.at(i).offset);
+        quint64 section_size = qFromLittleEndian(sections.at(i).size);
+
+        qint64 gap = section_offset - file.pos();
+
+        // Если неудалось записать данные раздела.
+        if((gap > 0 && file.write(padding.constData(), gap) != gap) ||
+           file.write(static_cast<const char*>(sections_data.at(i)), section_size) !=
+                static_cast<qint64>(section_size)){
+            // Сообщим об этом.
+            log(Log::WARNING, LOG_WHO, tr("Error writing data!"));
+            // Возврат.
+            return false;
+        }
+    }
+
+    return true;
+}
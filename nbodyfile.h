@@ -0,0 +1,278 @@
+#ifndef NBODYFILE_H
+#define NBODYFILE_H
+
+#include <QVector>
+#include <QString>
+#include <QFile>
+#include <QCoreApplication>
+#include "point3f.h"
+
+
+//! Выравнивание разделов файла версии 2.
+#define NBODY_FILE_ALIGNMENT 4096
+
+
+/**
+ * @class NBodyFile.
+ * @brief Класс чтения и записи файлов данных тел (*.glx).
+ * Файл версии 1 содержит подпись и версию формата, число тел,
+ * затем массы, позиции и векторы скоростей.
+ * Файл версии 2 содержит заголовок фиксированного размера
+ * и таблицу разделов, за которыми следуют разделы,
+ * выровненные по 4 КиБ: массы, позиции и скорости
+ * каждого кадра в раскладке буферов устройства,
+ * и необязательный индекс кадров - номера шагов.
+ * Каждый раздел имеет контрольную сумму.
+ * Файл версии 2 отображается в память,
+ * и данные передаются в буферы прямо из отображения.
+ * Разделы данных сжатого файла версии 2 сжаты SnapshotCodec,
+ * позиции и скорости кадров - XOR-разностью с предыдущим кадром;
+ * такой файл распаковывается при открытии.
+ */
+class NBodyFile
+{
+    Q_DECLARE_TR_FUNCTIONS(NBodyFile)
+public:
+
+    /**
+     * @brief Подпись формата файла.
+     */
+    static const quint32 magic = 0x474c5859;
+
+    /**
+     * @brief Версия формата файла.
+     */
+    static const quint32 version = 0x100;
+
+    /**
+     * @brief Версия формата файла с разделами.
+     */
+    static const quint32 version2 = 0x200;
+
+    /**
+     * @brief Тип раздела файла версии 2.
+     */
+    enum SectionType {
+        SECTION_MASSES = 1, //!< Массы.
+        SECTION_POSITIONS = 2, //!< Позиции кадра (x, y, z).
+        SECTION_VELOCITIES = 3, //!< Скорости кадра (x, y, z).
+        SECTION_FRAME_INDEX = 4 //!< Номера шагов кадров.
+    };
+
+    /**
+     * @brief Флаги файла версии 2.
+     */
+    enum FileFlag {
+        FILE_FLAG_COMPRESSED = 1 //!< Разделы данных сжаты.
+    };
+
+    /**
+     * @brief Конструктор.
+     */
+    NBodyFile();
+
+    /**
+     * @brief Деструктор.
+     */
+    ~NBodyFile();
+
+    /**
+     * @brief Открывает файл.
+     * Файл версии 2 отображается в память,
+     * файл версии 1 считывается.
+     * @param filename Имя файла.
+     * @param verify Флаг проверки контрольных сумм разделов.
+     * Проверка читает весь файл, поэтому выключена по-умолчанию.
+     * Сжатые разделы распаковываются целиком и проверяются всегда.
+     * @return true в случае успеха, иначе false.
+     */
+    bool open(const QString& filename, bool verify = false);
+
+    /**
+     * @brief Закрывает файл.
+     */
+    void close();
+
+    /**
+     * @brief Получение числа тел.
+     * @return Число тел.
+     */
+    size_t bodiesCount() const;
+
+    /**
+     * @brief Получение числа кадров.
+     * @return Число кадров.
+     */
+    size_t framesCount() const;
+
+    /**
+     * @brief Получение номера шага кадра.
+     * @param frame Кадр.
+     * @return Номер шага.
+     */
+    quint64 frameStep(size_t frame) const;
+
+    /**
+     * @brief Получение масс.
+     * @return Массы.
+     */
+    const float* masses() const;
+
+    /**
+     * @brief Получение позиций кадра.
+     * @param frame Кадр.
+     * @return Позиции (x, y, z).
+     */
+    const float* positions(size_t frame = 0) const;
+
+    /**
+     * @brief Получение векторов скоростей кадра.
+     * @param frame Кадр.
+     * @return Векторы скоростей (x, y, z).
+     */
+    const float* velocities(size_t frame = 0) const;
+
+    /**
+     * @brief Считывает тела из файла.
+     * @param filename Имя файла.
+     * @param masses Результат - массы.
+     * @param positions Результат - позиции.
+     * @param velocities Результат - векторы скоростей.
+     * @return true в случае успеха, иначе false.
+     */
+    static bool read(const QString& filename, QVector<float>& masses,
+                     QVector<Point3f>& positions, QVector<Point3f>& velocities);
+
+    /**
+     * @brief Записывает тела в файл.
+     * @param filename Имя файла.
+     * @param masses Массы.
+     * @param positions Позиции.
+     * @param velocities Векторы скоростей.
+     * @param compress Флаг сжатия данных.
+     * @return true в случае успеха, иначе false.
+     */
+    static bool write(const QString& filename, const QVector<float>& masses,
+                      const QVector<Point3f>& positions, const QVector<Point3f>& velocities,
+                      bool compress = false);
+
+    /**
+     * @brief Записывает тела в файл версии 2.
+     * @param filename Имя файла.
+     * @param masses Массы.
+     * @param positions Позиции (x, y, z) всех кадров подряд.
+     * @param velocities Векторы скоростей (x, y, z) всех кадров подряд.
+     * @param count Число тел.
+     * @param frames Число кадров.
+     * @param steps Номера шагов кадров для индекса кадров или nullptr.
+     * @param compress Флаг сжатия данных.
+     * @return true в случае успеха, иначе false.
+     */
+    static bool write(const QString& filename, const float* masses,
+                      const float* positions, const float* velocities, size_t count,
+                      size_t frames = 1, const quint64* steps = nullptr, bool compress = false);
+
+private:
+    Q_DISABLE_COPY(NBodyFile)
+
+    /**
+     * @brief Заголовок файла версии 2.
+     * Подпись и версия записаны, как в версии 1,
+     * остальные поля - в порядке байт little-endian.
+     */
+    struct Header {
+        quint32 magic; //!< Подпись формата.
+        quint32 version; //!< Версия формата.
+        quint32 header_size; //!< Размер заголовка с таблицей разделов.
+        quint32 sections_count; //!< Число разделов.
+        quint64 bodies_count; //!< Число тел.
+        quint32 frames_count; //!< Число кадров.
+        quint32 flags; //!< Флаги файла.
+    };
+
+    /**
+     * @brief Запись таблицы разделов файла версии 2.
+     */
+    struct Section {
+        quint32 type; //!< Тип раздела.
+        quint32 frame; //!< Кадр.
+        quint64 offset; //!< Смещение от начала файла.
+        quint64 size; //!< Размер данных.
+        quint64 checksum; //!< Контрольная сумма данных.
+    };
+
+    /**
+     * @brief Вычисляет контрольную сумму Флетчера-64
+     * по 32-битным словам.
+     * @param data Данные.
+     * @param size Размер, кратный 4 байтам.
+     * @return Контрольная сумма.
+     */
+    static quint64 checksum(const void* data, size_t size);
+
+    /**
+     * @brief Отображает файл версии 2 в память.
+     * @param verify Флаг проверки контрольных сумм разделов.
+     * @return true в случае успеха, иначе false.
+     */
+    bool mapSections(bool verify);
+
+    /**
+     * @brief Распаковывает разделы данных сжатого файла.
+     * @param sizes Размеры сжатых разделов: массы,
+     * затем позиции и скорости каждого кадра.
+     * @return true в случае успеха, иначе false.
+     */
+    bool decodeSections(const QVector<quint64>& sizes);
+
+    /**
+     * @brief Файл.
+     */
+    QFile file;
+
+    /**
+     * @brief Отображение файла в память.
+     */
+    uchar* mapping;
+
+    /**
+     * @brief Число тел.
+     */
+    size_t bodies_count;
+
+    /**
+     * @brief Массы.
+     */
+    const float* masses_ptr;
+
+    /**
+     * @brief Позиции кадров.
+     */
+    QVector<const float*> positions_ptr;
+
+    /**
+     * @brief Векторы скоростей кадров.
+     */
+    QVector<const float*> velocities_ptr;
+
+    /**
+     * @brief Номера шагов кадров.
+     */
+    QVector<quint64> frame_steps;
+
+    /**
+     * @brief Данные файла версии 1: массы,
+     * позиции и векторы скоростей.
+     */
+    QVector<float> v1_masses;
+    QVector<Point3f> v1_positions;
+    QVector<Point3f> v1_velocities;
+
+    /**
+     * @brief Распакованные данные сжатого файла:
+     * массы, затем позиции и скорости каждого кадра.
+     */
+    QVector<float> decoded;
+};
+
+#endif // NBODYFILE_H
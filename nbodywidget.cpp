@@ -4,15 +4,18 @@
 #include "clplatform.h"
 #include "cldevice.h"
 #include "settings.h"
+#include "nbodyfile.h"
+#include "trajectoryrecorder.h"
+#include "trajectoryreader.h"
 #include <QGLFormat>
+#include <QGLShaderProgram>
 #include <QImage>
 #include <QMouseEvent>
 #include <QWheelEvent>
 #include <GL/glu.h>
 #include <QMatrix4x4>
-#include <QFile>
-#include <QDataStream>
 #include <QDebug>
+#include <math.h>
 
 
 #define LOG_WHO "NBody View"
@@ -21,10 +24,43 @@
 #define VIEW_DISTANCE_DEFAULT 5000.0f
 //#define VIEW_DISTANCE_DEFAULT 20000.0f
 
+//! Скорость воспроизведения траектории по умолчанию, кадров в секунду.
+#define REPLAY_RATE_DEFAULT 30.0
+//! Наибольшее время ожидания окончания отрисовки буфера кадра, нс.
+#define REPLAY_FENCE_TIMEOUT 1000000000
+
 
 
 PFNGLPOINTPARAMETERFARBPROC NBodyWidget::glPointParameterfARB;
 PFNGLPOINTPARAMETERFVARBPROC NBodyWidget::glPointParameterfvARB;
+PFNGLBUFFERSTORAGEPROC NBodyWidget::glBufferStorage;
+PFNGLMAPBUFFERRANGEPROC NBodyWidget::glMapBufferRange;
+PFNGLUNMAPBUFFERPROC NBodyWidget::glUnmapBuffer;
+PFNGLFENCESYNCPROC NBodyWidget::glFenceSync;
+PFNGLCLIENTWAITSYNCPROC NBodyWidget::glClientWaitSync;
+PFNGLDELETESYNCPROC NBodyWidget::glDeleteSync;
+
+
+/*
+ * Вершинная программа интерполяции позиций
+ * между соседними кадрами траектории.
+ * Размер точек вычисляется так же,
+ * как при GL_ARB_point_parameters.
+ */
+static const char* replay_vertex_shader =
+        "attribute vec3 next_position;\n"
+        "uniform float blend;\n"
+        "uniform float point_size;\n"
+        "uniform vec3 attenuation;\n"
+        "void main()\n"
+        "{\n"
+        "    vec4 position = vec4(mix(gl_Vertex.xyz, next_position, blend), 1.0);\n"
+        "    vec4 eye = gl_ModelViewMatrix * position;\n"
+        "    float d = length(eye.xyz);\n"
+        "    gl_PointSize = max(1.0, point_size / sqrt(attenuation.x + attenuation.y * d + attenuation.z * d * d));\n"
+        "    gl_Position = gl_ProjectionMatrix * eye;\n"
+        "    gl_FrontColor = gl_Color;\n"
+        "}\n";
 
 
 NBodyWidget::NBodyWidget(QWidget *parent) :
@@ -65,6 +101,23 @@ NBodyWidget::NBodyWidget(QWidget *parent) :
     // Соединение сигнала завершения симуляции и слота обработки завершения симуляции.
     connect(nbody, SIGNAL(simulationFinished()), this, SLOT(on_simulationFinished()));
     connect(nbody, SIGNAL(simulationFinished()), this, SIGNAL(simulationFinished()));
+    // Перерисовка при готовности нового кадра конвейерной отрисовки.
+    connect(nbody, SIGNAL(displayUpdated()), this, SLOT(update()));
+
+    recorder = new TrajectoryRecorder(this);
+
+    replay_reader = new TrajectoryReader(this);
+    // Перерисовка при загрузке кадра траектории.
+    connect(replay_reader, SIGNAL(frameLoaded()), this, SLOT(update()));
+
+    replay_persistent = false;
+    replay_program = nullptr;
+    replay_position = 0.0;
+    replay_rate = REPLAY_RATE_DEFAULT;
+    replay_playing = false;
+    replay_drawn_frame = -1;
+    replay_drawn_slots[0] = replay_drawn_slots[1] = -1;
+    replay_drawn_blend = 0.0f;
 
     sim_run = false;
 
@@ -73,6 +126,13 @@ NBodyWidget::NBodyWidget(QWidget *parent) :
 
     has_point_parameters = false;
 
+    has_buffer_storage = false;
+
+    point_size = 2.5f;
+    point_attenuation[0] = 1.0f;
+    point_attenuation[1] = 0.0f;
+    point_attenuation[2] = 0.0f;
+
     view_position = VIEW_DISTANCE_DEFAULT;
     old_event_x = 0.0f;
     old_event_y = 0.0f;
@@ -81,6 +141,12 @@ NBodyWidget::NBodyWidget(QWidget *parent) :
 NBodyWidget::~NBodyWidget()
 {
     makeCurrent();
+    stopRecording();
+    // Остановим чтение траектории до уничтожения буферов.
+    releaseReplaySlots(true);
+    replay_reader->close();
+    destroyReplayBuffers();
+    delete replay_program;
     nbody->destroy();
     if(has_point_sprite){
         deleteTexture(sprite_texture);
@@ -134,11 +200,21 @@ float NBodyWidget::timeStep() const
     return nbody->timeStep();
 }
 
+size_t NBodyWidget::stepsPerFrame() const
+{
+    return nbody->stepsPerFrame();
+}
+
 double NBodyWidget::simulationTime() const
 {
     return sim_time.count();
 }
 
+const NBody::Profile &NBodyWidget::simulationProfile() const
+{
+    return nbody->profile();
+}
+
 void NBodyWidget::setTimeStep(float dt)
 {
     nbody->setTimeStep(dt);
@@ -157,16 +233,6 @@ bool NBodyWidget::saveNBody(const QString &filename)
     // Сообщим что сохраняем данные.
     log(Log::INFO, LOG_WHO, tr("Saving file: %1").arg(filename));
 
-    // Файл.
-    QFile file(filename);
-    // Есом не удалось открыть файл.
-    if(!file.open(QIODevice::WriteOnly)){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, tr("Error open file!"));
-        // Возврат.
-        return false;
-    }
-
     // Получим число тел.
     size_t count = nbody->simulatedBodiesCount();
 
@@ -179,45 +245,12 @@ bool NBodyWidget::saveNBody(const QString &filename)
     if(!getBodies(0, count, mass, pos, vel)){
         // Сообщим об этом.
         log(Log::WARNING, LOG_WHO, tr("Error getting bodies!"));
-        // Закроем файл.
-        file.close();
-        // Возврат.
-        return false;
-    }
-
-    // Поток данных.
-    QDataStream ds(&file);
-    // Установим версию,
-    // Это необходимо для корректной сериализации/десериализации.
-    ds.setVersion(QDataStream::Qt_4_8);
-
-    // Запишем в файл подпись и версию формата, число тел.
-    ds << data_file_magic << data_file_version << static_cast<quint32>(count);
-
-    // Если не удалось записать.
-    if(ds.status() != QDataStream::Ok){
-        // Сообщим об этом.
-        log(Log::WARNING, LOG_WHO, tr("Error writing data!"));
-        // Закроем файл.
-        file.close();
-        // Возврат.
-        return false;
-    }
-    // Если неудалось записать массы, позиции или векторы скоростей.
-    if(ds.writeRawData(reinterpret_cast<char*>(mass.data()), mass.size() * sizeof(float)) == -1 ||
-       ds.writeRawData(reinterpret_cast<char*>(pos.data()), pos.size() * sizeof(Point3f)) == -1 ||
-       ds.writeRawData(reinterpret_cast<char*>(vel.data()), vel.size() * sizeof(Point3f)) == -1){
-
-        // Сообщим об этом.
-        log(Log::WARNING, LOG_WHO, tr("Error writing data!"));
-        // Закроем файл.
-        file.close();
         // Возврат.
         return false;
     }
 
-    // Закроем файл.
-    file.close();
+    // Если не удалось записать файл.
+    if(!NBodyFile::write(filename, mass, pos, vel, Settings::get().compressData())) return false;
 
     // Сообщим об успешном сохранении данных.
     log(Log::INFO, LOG_WHO, tr("File saved!"));
@@ -239,97 +272,34 @@ bool NBodyWidget::openNBody(const QString &filename)
     // Сообщим что загружаем данные.
     log(Log::INFO, LOG_WHO, tr("Opening file: %1").arg(filename));
 
-    // Файл.
-    QFile file(filename);
-    // Есом не удалось открыть файл.
-    if(!file.open(QIODevice::ReadOnly)){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, tr("Error open file!"));
-        // Возврат.
-        return false;
-    }
+    // Файл, отображённый в память.
+    NBodyFile file;
 
-    // Массив для временного хранения масс.
-    QVector<float> mass;
-    // Массивы для временного хранения позиций и векторов скоростей.
-    QVector<Point3f> pos, vel;
+    // Если не удалось открыть файл.
+    if(!file.open(filename)) return false;
 
-    // Подпись и версия формата файла.
-    quint32 magic, version;
     // Число тел.
-    unsigned int count;
-
-    // Поток данных.
-    QDataStream ds(&file);
-    // Установим версию,
-    // Это необходимо для корректной сериализации/десериализации.
-    ds.setVersion(QDataStream::Qt_4_8);
-
-    // Считаем подпись формата.
-    ds >> magic;
-
-    // Если формат некорректен.
-    if(magic != data_file_magic){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, tr("Invalid file magic!"));
-        // Закроем файл.
-        file.close();
-        // Возврат.
-        return false;
-    }
-
-    // Считаем версию формата.
-    ds >> version;
-
-    // Если версия некорректна.
-    if(version != data_file_version){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, tr("Invalid file version!"));
-        // Закроем файл.
-        file.close();
-        // Возврат.
-        return false;
-    }
-
-    // Считаем число тел.
-    ds >> count;
+    size_t count = file.bodiesCount();
 
     // Если система симуляции не имеет в распоряжении такое количество.
     if(nbody->bodiesCount() < count){
         // Сообщим об этом.
         log(Log::ERROR, LOG_WHO, tr("Insufficient number of bodies. Required: %1.").arg(count));
-        // Закроем файл.
-        file.close();
         // Возврат.
         return false;
     }
 
-    // Сообщим число тел в файле.
-    log(Log::INFO, LOG_WHO, tr("Bodies in file: %1").arg(count));
-
-    // Изменим размеры массивов под нужное число тел.
-    mass.resize(count);
-    pos.resize(count);
-    vel.resize(count);
+    bool has_glcontext = QGLContext::currentContext() != nullptr;
 
-    // Если неудалось считать массы, позиции или векторы скоростей.
-    if(ds.readRawData(reinterpret_cast<char*>(mass.data()), mass.size() * sizeof(float)) == -1 ||
-       ds.readRawData(reinterpret_cast<char*>(pos.data()), pos.size() * sizeof(Point3f)) == -1 ||
-       ds.readRawData(reinterpret_cast<char*>(vel.data()), vel.size() * sizeof(Point3f)) == -1){
+    if(!has_glcontext) makeCurrent();
 
-        // Сообщим об этом.
-        log(Log::WARNING, LOG_WHO, tr("Error reading data!"));
-        // Закроем файл.
-        file.close();
-        // Возврат.
-        return false;
-    }
+    // Передадим данные в буферы прямо из отображения файла.
+    bool res = nbody->setBodies(NBody::BodiesView(file.masses(), file.positions(), file.velocities(), count));
 
-    // Закроем файл.
-    file.close();
+    if(!has_glcontext) doneCurrent();
 
     // Если не удалось установить новые тела.
-    if(!setBodies(0, mass, pos, vel)){
+    if(!res){
         // Сообщим об этом.
         log(Log::WARNING, LOG_WHO, tr("Error setting bodies!"));
         // Возврат.
@@ -370,6 +340,16 @@ bool NBodyWidget::setBodies(size_t offset, const QVector<qreal> &masses, const Q
 }
 
 bool NBodyWidget::setBodies(size_t offset, const QVector<float> &masses, const QVector<Point3f> &positions, const QVector<Point3f> &velocities)
+{
+    if(masses.size() != positions.size() || masses.size() != velocities.size()) return false;
+
+    return setBodies(offset, NBody::BodiesView(masses.constData(),
+                                               reinterpret_cast<const float*>(positions.constData()),
+                                               reinterpret_cast<const float*>(velocities.constData()),
+                                               masses.size()));
+}
+
+bool NBodyWidget::setBodies(size_t offset, const NBody::BodiesView &bodies)
 {
     if(!nbody->isReady()) return false;
     if(nbody->isRunning()) return false;
@@ -378,9 +358,7 @@ bool NBodyWidget::setBodies(size_t offset, const QVector<float> &masses, const Q
 
     if(!has_glcontext) makeCurrent();
 
-    bool res = nbody->setMasses(masses, offset) &&
-               nbody->setPositions(positions, offset) &&
-               nbody->setVelocities(velocities, offset);
+    bool res = nbody->setBodies(bodies, offset);
 
     if(!has_glcontext) doneCurrent();
 
@@ -425,6 +403,161 @@ bool NBodyWidget::getBodies(size_t offset, size_t count, QVector<float> &masses,
     return res;
 }
 
+/**
+ * @brief Начинает запись траектории в файл.
+ * @param filename Имя файла.
+ * @param interval Число шагов между кадрами.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBodyWidget::startRecording(const QString &filename, size_t interval)
+{
+    // Если инициализация была неудачной - возврат.
+    if(!nbody->isReady()) return false;
+
+    // Закончим прежнюю запись.
+    stopRecording();
+
+    // Если не удалось создать файл.
+    if(!recorder->open(filename, interval, Settings::get().compressData())) return false;
+
+    // Дождёмся текущего шага, следующие шаги будут записываться.
+    nbody->wait();
+
+    // Если не удалось начать запись.
+    if(!nbody->setTrajectoryRecorder(recorder)){
+        recorder->close();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Заканчивает запись траектории.
+ */
+void NBodyWidget::stopRecording()
+{
+    if(!recorder->isOpen()) return;
+
+    // Дождёмся текущего шага и допишем кадры.
+    nbody->wait();
+    nbody->setTrajectoryRecorder(nullptr);
+
+    recorder->close();
+}
+
+bool NBodyWidget::isRecording() const
+{
+    return recorder->isOpen() && nbody->trajectoryRecorder() != nullptr;
+}
+
+/**
+ * @brief Начинает воспроизведение траектории из файла.
+ * @param filename Имя файла.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBodyWidget::openReplay(const QString &filename)
+{
+    // Закончим прежнее воспроизведение.
+    closeReplay();
+
+    // Остановим симуляцию и запись траектории.
+    stopRecording();
+    stopSimulation();
+
+    // Если не удалось открыть файл.
+    if(!replay_reader->open(filename)) return false;
+
+    // Доступность контекста OpenGL.
+    bool has_glcontext = QGLContext::currentContext() != nullptr;
+
+    // Если нет - сделаем текущим контекст, созданный QGLWidget.
+    if(!has_glcontext) makeCurrent();
+
+    // Память буферов для записи кадров.
+    QVector<float*> data;
+
+    bool res = createReplayBuffers(replay_reader->bodiesCount(), data);
+
+    if(res){
+        replay_position = 0.0;
+        replay_playing = false;
+        replay_drawn_frame = -1;
+        replay_drawn_blend = 0.0f;
+
+        // Запустим загрузку кадров.
+        replay_reader->startReading(data);
+    }else{
+        log(Log::ERROR, LOG_WHO, tr("Error creating replay buffers!"));
+        destroyReplayBuffers();
+        replay_reader->close();
+    }
+
+    // Если в начале функции небыло контекста OpenGL - уберём текущий контекст.
+    if(!has_glcontext) doneCurrent();
+
+    update();
+
+    emit nbodyStatusChanged();
+
+    return res;
+}
+
+/**
+ * @brief Заканчивает воспроизведение траектории.
+ */
+void NBodyWidget::closeReplay()
+{
+    if(!replay_reader->isOpen()) return;
+
+    bool has_glcontext = QGLContext::currentContext() != nullptr;
+    if(!has_glcontext) makeCurrent();
+
+    releaseReplaySlots(true);
+    // Остановим чтение до уничтожения буферов.
+    replay_reader->close();
+    destroyReplayBuffers();
+
+    if(!has_glcontext) doneCurrent();
+
+    replay_playing = false;
+
+    update();
+
+    emit nbodyStatusChanged();
+}
+
+bool NBodyWidget::isReplaying() const
+{
+    return replay_reader->isOpen();
+}
+
+size_t NBodyWidget::replayFramesCount() const
+{
+    return replay_reader->framesCount();
+}
+
+qreal NBodyWidget::replayPosition() const
+{
+    return replay_position;
+}
+
+quint64 NBodyWidget::replayStep() const
+{
+    if(replay_drawn_frame < 0) return 0;
+    return replay_reader->frameStep(replay_drawn_frame);
+}
+
+qreal NBodyWidget::replayRate() const
+{
+    return replay_rate;
+}
+
+bool NBodyWidget::isReplayPlaying() const
+{
+    return replay_playing;
+}
+
 void NBodyWidget::setSimulationRunning(bool running)
 {
     if(running){
@@ -436,7 +569,7 @@ void NBodyWidget::setSimulationRunning(bool running)
 
 void NBodyWidget::startSimulation()
 {
-    if(sim_run == false){
+    if(sim_run == false && !isReplaying()){
         sim_run = nbody->simulate();
     }
 }
@@ -459,6 +592,9 @@ bool NBodyWidget::recreateNBody()
     // Установим симуляцию как не выполняющуюся.
     sim_run = false;
 
+    // Закончим запись траектории.
+    stopRecording();
+
     // Доступность контекста OpenGL.
     bool has_glcontext = QGLContext::currentContext() != nullptr;
 
@@ -467,29 +603,81 @@ bool NBodyWidget::recreateNBody()
 
     // Установим шаг симуляции.
     nbody->setTimeStep(Settings::get().timeStep());
-
-    try{
-        // Получаем платформу и устройство OpenCL
-        // из настроек.
-        CLPlatform platform = CLPlatform::byName(Settings::get().clPlatformName());
-        CLDevice device = platform.deviceByName(Settings::get().clDeviceName());
-
+    // Установим метод расчёта.
+    nbody->setSolver(static_cast<NBody::Solver>(Settings::get().solver()));
+    nbody->setBarnesHutTheta(Settings::get().barnesHutTheta());
+    nbody->setGpuTreeBuild(Settings::get().gpuTreeBuild());
+    nbody->setFmmOrder(Settings::get().fmmOrder());
+    nbody->setFmmDeviceEvaluation(Settings::get().fmmDeviceEvaluation());
+    nbody->setPmGridSize(Settings::get().pmGridSize());
+    nbody->setPmTsc(Settings::get().pmTsc());
+    nbody->setBlockRungs(Settings::get().blockRungs());
+    nbody->setIntegrator(static_cast<NBody::Integrator>(Settings::get().integrator()));
+    nbody->setPrecision(static_cast<NBody::Precision>(Settings::get().precision()));
+    nbody->setSoftening(static_cast<NBody::Softening>(Settings::get().softening()));
+    nbody->setSofteningLength(Settings::get().softeningLength());
+    nbody->setStepsPerFrame(Settings::get().stepsPerFrame());
+    nbody->setPackedLayout(Settings::get().packedLayout());
+    nbody->setAutoTune(Settings::get().autoTune());
+    nbody->setProfiling(Settings::get().profiling());
+    nbody->setMultiDevice(Settings::get().multiDevice());
+    nbody->setPipelined(Settings::get().pipelined());
+
+    // Если расчёт на процессоре выбран явно.
+    if(Settings::get().nativeBackend()){
         // Уничтожаем возможно созданную ранее систему симуляции.
         nbody->destroy();
-
-        // Если не удалось создать систему симуляции.
-        if(!nbody->create(platform, device, Settings::get().bodiesCount())){
+        // Создаём систему без OpenCL.
+        res = nbody->createNative(Settings::get().bodiesCount());
+    }else{
+        try{
+            // Получаем платформу и устройство OpenCL
+            // из настроек.
+            CLPlatform platform = CLPlatform::byName(Settings::get().clPlatformName());
+            CLDevice device = platform.deviceByName(Settings::get().clDeviceName());
+
+            // Уничтожаем возможно созданную ранее систему симуляции.
+            nbody->destroy();
+
+            // Параметры ядра, подобранные ранее для устройства.
+            QString tuning_key = nbody->tuningKey(device, Settings::get().bodiesCount());
+            nbody->setKernelTuning(NBody::KernelTuning::fromString(Settings::get().kernelTuning(tuning_key)));
+            nbody->setPrecisionReport(Settings::get().precisionReport(tuning_key));
+
+            // Если не удалось создать систему симуляции.
+            if(!nbody->create(platform, device, Settings::get().bodiesCount())){
+                // Сообщим об этом.
+                log(Log::ERROR, LOG_WHO, tr("Error initializing NBody system"));
+                // Результат - отрицательный.
+                res = false;
+            }else{
+                // Запомним подобранные параметры и замер точностей.
+                if(nbody->kernelTuning().isValid()){
+                    Settings::get().setKernelTuning(tuning_key, nbody->kernelTuning().toString());
+                }
+                if(!nbody->precisionReport().isEmpty()){
+                    Settings::get().setPrecisionReport(tuning_key, nbody->precisionReport());
+                }
+            }
+        }//Если где-то произошла ошибка.
+        catch(CLException& e){
             // Сообщим об этом.
-            log(Log::ERROR, LOG_WHO, tr("Error initializing NBody system"));
+            log(Log::ERROR, LOG_WHO, e.what());
             // Результат - отрицательный.
             res = false;
         }
-    }//Если где-то произошла ошибка.
-    catch(CLException& e){
-        // Сообщим об этом.
-        log(Log::ERROR, LOG_WHO, e.what());
-        // Результат - отрицательный.
-        res = false;
+
+        // Если OpenCL недоступен - считаем на процессоре.
+        if(!res){
+            log(Log::WARNING, LOG_WHO, tr("OpenCL is unavailable, using native CPU backend"));
+            nbody->destroy();
+            res = nbody->createNative(Settings::get().bodiesCount());
+        }
+    }
+
+    // Если не удалось создать систему симуляции.
+    if(!res){
+        log(Log::ERROR, LOG_WHO, tr("Error initializing NBody system"));
     }
 
     // Если в начале функции небыло контекста OpenGL - уберём текущий контекст.
@@ -505,6 +693,50 @@ bool NBodyWidget::recreateNBody()
     return res;
 }
 
+/**
+ * @brief Перемотка траектории.
+ * @param position Позиция - номер кадра с дробной частью.
+ */
+void NBodyWidget::setReplayPosition(qreal position)
+{
+    if(!isReplaying()) return;
+
+    replay_position = qBound<qreal>(0.0, position, replayFramesCount() - 1);
+
+    update();
+}
+
+/**
+ * @brief Установка скорости воспроизведения.
+ * @param rate Скорость, кадров траектории в секунду.
+ */
+void NBodyWidget::setReplayRate(qreal rate)
+{
+    replay_rate = rate;
+}
+
+/**
+ * @brief Установка проигрывания траектории.
+ * @param playing Флаг проигрывания.
+ */
+void NBodyWidget::setReplayPlaying(bool playing)
+{
+    if(!isReplaying()) return;
+
+    qreal last_frame = replayFramesCount() - 1;
+
+    // С конца траектории проигрывание начинается сначала.
+    if(playing && replay_rate > 0.0 && replay_position >= last_frame) replay_position = 0.0;
+    if(playing && replay_rate < 0.0 && replay_position <= 0.0) replay_position = last_frame;
+
+    replay_playing = playing;
+    replay_clock.restart();
+
+    update();
+
+    emit nbodyStatusChanged();
+}
+
 /**
  * @brief Слот завершения симуляции.
  */
@@ -527,6 +759,9 @@ void NBodyWidget::initializeGL()
     static const char* gl_point_sprite_ext = "GL_ARB_point_sprite";
     // Имя расширения GL_ARB_point_parameters.
     static const char* gl_point_parameters_ext = "GL_ARB_point_parameters";
+    // Имена расширений GL_ARB_buffer_storage и GL_ARB_sync.
+    static const char* gl_buffer_storage_ext = "GL_ARB_buffer_storage";
+    static const char* gl_sync_ext = "GL_ARB_sync";
 
     // Сообщим об инициализации.
     log(Log::INFO, LOG_WHO, tr("Initializing OpenGL"));
@@ -570,16 +805,25 @@ void NBodyWidget::initializeGL()
         log(Log::WARNING, LOG_WHO, tr("GL_ARB_point_parameters is not supported!"));
     }
 
+    // Постоянно отображаемые буферы воспроизведения траектории
+    // требуют синхронизации окончания отрисовки.
+    has_buffer_storage = glexts.contains(gl_buffer_storage_ext) && glexts.contains(gl_sync_ext) &&
+                         glBufferStorage != nullptr && glMapBufferRange != nullptr &&
+                         glUnmapBuffer != nullptr && glFenceSync != nullptr &&
+                         glClientWaitSync != nullptr && glDeleteSync != nullptr;
+
     // Если возможно рисовать спрайты.
     if(has_point_sprite){
         // Разрешим генерацию текстурных координат для точек.
         glTexEnvf(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
         // Установим размер точек.
-        glPointSize(7.5f);//7.5
+        point_size = 7.5f;
+        glPointSize(point_size);//7.5
         //glPointSize(10.0f);//7.5
     }else{
         // Иначе будем рисовать точки поменьше и без текстуры.
-        glPointSize(2.5f);//2.5
+        point_size = 2.5f;
+        glPointSize(point_size);//2.5
         //glPointSize(3.5f);//2.5
     }
 
@@ -599,12 +843,17 @@ void NBodyWidget::initializeGL()
         glPointParameterfARB(GL_POINT_FADE_THRESHOLD_SIZE_ARB, fade);
         glPointParameterfvARB(GL_POINT_DISTANCE_ATTENUATION_ARB, atten);
 
+        for(int i = 0; i < 3; i ++) point_attenuation[i] = atten[i];
+
         log(Log::INFO, LOG_WHO, tr("Point size: %1 ... %2").arg(point_size_min).arg(point_size_max));
     }
 
     // Разрешение сглаживания точек.
     glEnable(GL_POINT_SMOOTH);
 
+    // Программа интерполяции кадров траектории.
+    createReplayProgram();
+
     // Переинициализируем систему симуляции.
     recreateNBody();
 }
@@ -625,8 +874,11 @@ void NBodyWidget::resizeGL(int width, int height)
  */
 void NBodyWidget::paintGL()
 {
+    // Флаг воспроизведения траектории.
+    bool replaying = isReplaying();
+
     // Если нет данных для визуализации, либо невозможно её выполнить - возврат.
-    if(!nbody->isReady() || nbody->isRunning()) return;
+    if(!replaying && (!nbody->isReady() || (nbody->isRunning() && !nbody->canDrawWhileRunning()))) return;
 
     // Очистим экран.
     glClear(GL_COLOR_BUFFER_BIT);
@@ -661,23 +913,31 @@ void NBodyWidget::paintGL()
         glEnable(GL_POINT_SPRITE);
     }
 
-    // Установим буфер позиций.
-    nbody->posBuffer()->bind();
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glVertexPointer(3, GL_FLOAT, 0, NULL);
+    // Кадр траектории рисуется из буферов воспроизведения.
+    if(replaying){
+        drawReplay();
+    }else{
+        // Буфер позиций для отрисовки.
+        NBodyGLBuffer* pos_buf = nbody->drawBuffer();
 
-    // Установим индексный буфер.
-    nbody->indexBuffer()->bind();
+        // Установим буфер позиций.
+        pos_buf->bind();
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, NULL);
 
-    // Отрисуем звзёды.
-    glDrawElements(GL_POINTS, nbody->simulatedBodiesCount(), GL_UNSIGNED_INT, nullptr);
+        // Установим индексный буфер.
+        nbody->indexBuffer()->bind();
 
-    // Сбросим установки индексного буфера.
-    nbody->indexBuffer()->release();
+        // Отрисуем звзёды.
+        glDrawElements(GL_POINTS, nbody->simulatedBodiesCount(), GL_UNSIGNED_INT, nullptr);
 
-    // Сбросим установки буфера позиций.
-    glDisableClientState(GL_VERTEX_ARRAY);
-    nbody->posBuffer()->release();
+        // Сбросим установки индексного буфера.
+        nbody->indexBuffer()->release();
+
+        // Сбросим установки буфера позиций.
+        glDisableClientState(GL_VERTEX_ARRAY);
+        pos_buf->release();
+    }
 
     // Если возможно текстурировать звёзды.
     if(has_point_sprite){
@@ -691,8 +951,12 @@ void NBodyWidget::paintGL()
         glDisable(GL_BLEND);
     }
 
-    // Если запущена непрерывная симуляция.
-    if(sim_run){
+    // Проигрывание траектории продолжается со следующей перерисовкой.
+    if(replaying && replay_playing) update();
+
+    // Если запущена непрерывная симуляция
+    // и прошлый шаг уже рассчитан.
+    if(!replaying && sim_run && !nbody->isRunning()){
         // Запустим вычисления.
         sim_run = nbody->simulate();
         // Если ошибка - пошлём сообщение.
@@ -702,6 +966,301 @@ void NBodyWidget::paintGL()
     }
 }
 
+/**
+ * @brief Отрисовка кадра траектории.
+ */
+void NBodyWidget::drawReplay()
+{
+    size_t frames_count = replay_reader->framesCount();
+    qreal last_frame = frames_count - 1;
+
+    // Новая позиция проигрывания.
+    qreal position = replay_position;
+    if(replay_playing){
+        position += replay_clock.nsecsElapsed() * 1e-9 * replay_rate;
+        position = qBound<qreal>(0.0, position, last_frame);
+    }
+    replay_clock.restart();
+
+    size_t frame = static_cast<size_t>(floor(position));
+    float blend = static_cast<float>(position - frame);
+
+    // Загрузка кадров вокруг текущего.
+    replay_reader->request(frame, replay_rate < 0.0);
+
+    // Интерполяция требует следующего кадра с тем же числом тел.
+    bool interpolate = replay_program != nullptr && blend > 0.0f && frame + 1 < frames_count &&
+                       replay_reader->frameBodiesCount(frame) == replay_reader->frameBodiesCount(frame + 1);
+
+    int slot = replay_reader->lockFrame(frame);
+    int next_slot = (slot >= 0 && interpolate) ? replay_reader->lockFrame(frame + 1) : -1;
+
+    if(slot >= 0 && (!interpolate || next_slot >= 0)){
+        // Прежние кадры больше не нужны.
+        releaseReplaySlots();
+
+        replay_drawn_frame = frame;
+        replay_drawn_slots[0] = slot;
+        replay_drawn_slots[1] = next_slot;
+        replay_drawn_blend = interpolate ? blend : 0.0f;
+
+        replay_position = position;
+
+        // В конце траектории проигрывание останавливается.
+        if(replay_playing && ((replay_rate > 0.0 && position >= last_frame) ||
+                              (replay_rate < 0.0 && position <= 0.0))){
+            replay_playing = false;
+            emit nbodyStatusChanged();
+        }
+
+        emit replayPositionChanged();
+    }else if(slot >= 0){
+        // Следующий кадр ещё загружается -
+        // нарисуем прежние кадры, проигрывание подождёт загрузки.
+        replay_reader->unlockFrame(slot);
+    }
+
+    if(replay_drawn_slots[0] < 0) return;
+
+    size_t stride = replay_reader->bodiesCount() * 3;
+
+    // Передадим кадры из памяти в буферы.
+    if(!replay_persistent){
+        for(int i = 0; i < 2; i ++){
+            int s = replay_drawn_slots[i];
+            qint64 f = replay_drawn_frame + i;
+
+            if(s < 0 || replay_uploaded.at(s) == f) continue;
+
+            NBodyGLBuffer* buf = replay_buffers.at(s);
+            buf->bind();
+            buf->write(0, replay_host.constData() + s * stride,
+                       replay_reader->frameBodiesCount(f) * sizeof(float) * 3);
+            buf->release();
+
+            replay_uploaded[s] = f;
+        }
+    }
+
+    // Позиции между кадрами вычисляются вершинной программой.
+    bool blending = replay_drawn_slots[1] >= 0;
+
+    if(blending){
+        replay_program->bind();
+        replay_program->setUniformValue("blend", replay_drawn_blend);
+        replay_program->setUniformValue("point_size", point_size);
+        replay_program->setUniformValue("attenuation", QVector3D(point_attenuation[0],
+                                                                 point_attenuation[1],
+                                                                 point_attenuation[2]));
+        glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+
+        NBodyGLBuffer* next_buf = replay_buffers.at(replay_drawn_slots[1]);
+        next_buf->bind();
+        replay_program->enableAttributeArray("next_position");
+        replay_program->setAttributeBuffer("next_position", GL_FLOAT, 0, 3);
+        next_buf->release();
+    }
+
+    // Установим буфер позиций.
+    NBodyGLBuffer* pos_buf = replay_buffers.at(replay_drawn_slots[0]);
+    pos_buf->bind();
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, NULL);
+
+    // Отрисуем звёзды.
+    glDrawArrays(GL_POINTS, 0, replay_reader->frameBodiesCount(replay_drawn_frame));
+
+    // Сбросим установки буфера позиций.
+    glDisableClientState(GL_VERTEX_ARRAY);
+    pos_buf->release();
+
+    if(blending){
+        replay_program->disableAttributeArray("next_position");
+        glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+        replay_program->release();
+    }
+
+    // Отметим окончание отрисовки постоянно отображаемых буферов.
+    if(replay_persistent){
+        for(int i = 0; i < 2; i ++){
+            int s = replay_drawn_slots[i];
+            if(s < 0) continue;
+            if(replay_fences.at(s) != nullptr) glDeleteSync(replay_fences.at(s));
+            replay_fences[s] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+}
+
+/**
+ * @brief Создаёт кольцо буферов воспроизведения.
+ * Если доступно GL_ARB_buffer_storage, буферы постоянно
+ * отображаются в память и кадры загружаются прямо в них,
+ * иначе кадры загружаются в память и передаются в буферы
+ * перед отрисовкой.
+ * @param count Число тел.
+ * @param data Результат - память буферов для записи кадров.
+ * @return true в случае успеха, иначе false.
+ */
+bool NBodyWidget::createReplayBuffers(size_t count, QVector<float *> &data)
+{
+    // Флаги постоянного отображения.
+    static const GLbitfield map_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    size_t bytes = count * sizeof(float) * 3;
+
+    replay_persistent = has_buffer_storage;
+
+    if(!replay_persistent){
+        replay_host.resize(count * 3 * REPLAY_SLOTS_COUNT);
+    }
+
+    for(size_t i = 0; i < REPLAY_SLOTS_COUNT; i ++){
+        NBodyGLBuffer* buf = new NBodyGLBuffer(NBodyGLBuffer::VertexBuffer);
+
+        replay_buffers.append(buf);
+        replay_uploaded.append(-1);
+        replay_fences.append(nullptr);
+
+        if(!buf->create() || !buf->bind()) return false;
+
+        if(replay_persistent){
+            glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, map_flags);
+            void* ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, map_flags);
+            buf->release();
+
+            if(ptr == nullptr) return false;
+
+            data.append(static_cast<float*>(ptr));
+        }else{
+            buf->setUsagePattern(NBodyGLBuffer::StreamDraw);
+            buf->allocate(bytes);
+            buf->release();
+
+            data.append(replay_host.data() + i * count * 3);
+        }
+    }
+
+    log(Log::INFO, LOG_WHO, replay_persistent ? tr("Replay buffers are persistently mapped") :
+                                                tr("Replay buffers are uploaded from host memory"));
+
+    return true;
+}
+
+/**
+ * @brief Уничтожает кольцо буферов воспроизведения.
+ */
+void NBodyWidget::destroyReplayBuffers()
+{
+    for(int i = 0; i < replay_buffers.size(); i ++){
+        NBodyGLBuffer* buf = replay_buffers.at(i);
+
+        if(replay_persistent && buf->isCreated() && buf->bind()){
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            buf->release();
+        }
+        if(replay_fences.at(i) != nullptr) glDeleteSync(replay_fences.at(i));
+
+        buf->destroy();
+        delete buf;
+    }
+
+    replay_buffers.clear();
+    replay_uploaded.clear();
+    replay_fences.clear();
+    replay_busy_slots.clear();
+    replay_host.clear();
+
+    replay_drawn_frame = -1;
+    replay_drawn_slots[0] = replay_drawn_slots[1] = -1;
+}
+
+/**
+ * @brief Освобождает буферы отрисованных кадров.
+ * Постоянно отображаемый буфер освобождается
+ * после окончания его отрисовки, до этого
+ * кадр остаётся захваченным.
+ * @param wait Флаг ожидания окончания отрисовки всех буферов.
+ */
+void NBodyWidget::releaseReplaySlots(bool wait)
+{
+    for(int i = 0; i < 2; i ++){
+        int s = replay_drawn_slots[i];
+        if(s < 0) continue;
+
+        replay_busy_slots.append(s);
+        replay_drawn_slots[i] = -1;
+    }
+
+    for(int i = 0; i < replay_busy_slots.size();){
+        int s = replay_busy_slots.at(i);
+
+        // Буфер ещё рисуется - проверим его при следующем вызове.
+        if(!replaySlotDrawn(s, wait)){
+            i ++;
+            continue;
+        }
+
+        replay_reader->unlockFrame(s);
+        replay_busy_slots.remove(i);
+    }
+}
+
+/**
+ * @brief Проверяет окончание отрисовки буфера.
+ * Синхронизация законченной отрисовки удаляется.
+ * @param slot Буфер.
+ * @param wait Флаг ожидания окончания отрисовки.
+ * @return true, если отрисовка закончена, иначе false.
+ */
+bool NBodyWidget::replaySlotDrawn(int slot, bool wait)
+{
+    GLsync fence = replay_fences.at(slot);
+
+    if(fence == nullptr) return true;
+
+    GLenum res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? REPLAY_FENCE_TIMEOUT : 0);
+
+    if(res == GL_TIMEOUT_EXPIRED || res == GL_WAIT_FAILED){
+        if(!wait) return false;
+
+        // Дождёмся окончания всех команд OpenGL,
+        // после этого буфер можно отображать и удалять.
+        log(Log::WARNING, LOG_WHO, res == GL_WAIT_FAILED ? tr("Waiting for replay buffer fence failed") :
+                                                           tr("Replay buffer fence timed out"));
+        glFinish();
+    }
+
+    glDeleteSync(fence);
+    replay_fences[slot] = nullptr;
+
+    return true;
+}
+
+/**
+ * @brief Создаёт программу интерполяции позиций.
+ * Без неё кадры траектории рисуются без интерполяции.
+ */
+void NBodyWidget::createReplayProgram()
+{
+    delete replay_program;
+    replay_program = nullptr;
+
+    if(!QGLShaderProgram::hasOpenGLShaderPrograms(context())){
+        log(Log::WARNING, LOG_WHO, tr("Shader programs are not supported, replay frames will not be interpolated!"));
+        return;
+    }
+
+    QGLShaderProgram* program = new QGLShaderProgram(context());
+
+    if(!program->addShaderFromSourceCode(QGLShader::Vertex, replay_vertex_shader) || !program->link()){
+        log(Log::WARNING, LOG_WHO, tr("Error building replay program: %1").arg(program->log()));
+        delete program;
+        return;
+    }
+
+    replay_program = program;
+}
+
 qreal NBodyWidget::calcNewValueExp(qreal old_value, qreal step, qreal scale)
 {
     qreal delta = step * scale;
@@ -726,7 +1285,7 @@ void NBodyWidget::mouseMoveEvent(QMouseEvent *event)
 
         view_rotation = q_rot_x * q_rot_y * view_rotation;
 
-        if(!nbody->isRunning()) update();
+        if(!nbody->isRunning() || nbody->canDrawWhileRunning()) update();
     }
 
     old_event_x = event->x();
@@ -741,7 +1300,7 @@ void NBodyWidget::wheelEvent(QWheelEvent *event)
 
     //qDebug() << "z:" << view_position;
 
-    if(!nbody->isRunning()) update();
+    if(!nbody->isRunning() || nbody->canDrawWhileRunning()) update();
 }
 
 bool NBodyWidget::init_gl_functions()
@@ -757,6 +1316,13 @@ bool NBodyWidget::init_gl_functions()
     glPointParameterfARB = reinterpret_cast<PFNGLPOINTPARAMETERFARBPROC>(cxt->getProcAddress("glPointParameterfARB"));
     glPointParameterfvARB = reinterpret_cast<PFNGLPOINTPARAMETERFVARBPROC>(cxt->getProcAddress("glPointParameterfvARB"));
 
+    glBufferStorage = reinterpret_cast<PFNGLBUFFERSTORAGEPROC>(cxt->getProcAddress("glBufferStorage"));
+    glMapBufferRange = reinterpret_cast<PFNGLMAPBUFFERRANGEPROC>(cxt->getProcAddress("glMapBufferRange"));
+    glUnmapBuffer = reinterpret_cast<PFNGLUNMAPBUFFERPROC>(cxt->getProcAddress("glUnmapBuffer"));
+    glFenceSync = reinterpret_cast<PFNGLFENCESYNCPROC>(cxt->getProcAddress("glFenceSync"));
+    glClientWaitSync = reinterpret_cast<PFNGLCLIENTWAITSYNCPROC>(cxt->getProcAddress("glClientWaitSync"));
+    glDeleteSync = reinterpret_cast<PFNGLDELETESYNCPROC>(cxt->getProcAddress("glDeleteSync"));
+
     initialized = true;
 
     return true;
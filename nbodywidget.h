@@ -7,14 +7,22 @@
 #include <QVector>
 #include <QVector3D>
 #include <QQuaternion>
+#include <QElapsedTimer>
 #include <chrono>
 #include "point3f.h"
+#include "nbody.h"
 
 
-class NBody;
 class QMouseEvent;
 class QWheelEvent;
 class QString;
+class TrajectoryRecorder;
+class TrajectoryReader;
+class QGLShaderProgram;
+
+
+//! Число буферов кольца воспроизведения траектории.
+#define REPLAY_SLOTS_COUNT 4
 
 
 /**
@@ -86,6 +94,12 @@ public:
      */
     float timeStep() const;
 
+    /**
+     * @brief Получение числа шагов за кадр.
+     * @return Число шагов.
+     */
+    size_t stepsPerFrame() const;
+
     /**
      * @brief Получение продолжительности
      * последней симуляции, с.
@@ -93,6 +107,12 @@ public:
      */
     double simulationTime() const;
 
+    /**
+     * @brief Получение профиля последнего шага симуляции.
+     * @return Профиль шага.
+     */
+    const NBody::Profile& simulationProfile() const;
+
     /**
      * @brief Установка шага симуляции.
      * @param dt Шаг симуляции.
@@ -133,6 +153,15 @@ public:
      */
     bool setBodies(size_t offset, const QVector<float>& masses, const QVector<Point3f>& positions, const QVector<Point3f>& velocities);
 
+    /**
+     * @brief Установка параметров тел из непрерывных массивов
+     * без промежуточного преобразования.
+     * @param offset Смещение номера первого тела.
+     * @param bodies Данные тел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool setBodies(size_t offset, const NBody::BodiesView& bodies);
+
     /**
      * @brief Получение параметров тел.
      * @param offset Смещение номера первого тела.
@@ -155,6 +184,75 @@ public:
      */
     bool getBodies(size_t offset, size_t count, QVector<float> &masses, QVector<Point3f> &positions, QVector<Point3f> &velocities);
 
+    /**
+     * @brief Начинает запись траектории в файл.
+     * Запись идёт во время симуляции в отдельном потоке.
+     * @param filename Имя файла.
+     * @param interval Число шагов между кадрами.
+     * @return true в случае успеха, иначе false.
+     */
+    bool startRecording(const QString& filename, size_t interval);
+
+    /**
+     * @brief Заканчивает запись траектории.
+     */
+    void stopRecording();
+
+    /**
+     * @brief Получение флага записи траектории.
+     * @return Флаг записи траектории.
+     */
+    bool isRecording() const;
+
+    /**
+     * @brief Начинает воспроизведение траектории из файла.
+     * Система симуляции при воспроизведении не используется.
+     * @param filename Имя файла.
+     * @return true в случае успеха, иначе false.
+     */
+    bool openReplay(const QString& filename);
+
+    /**
+     * @brief Заканчивает воспроизведение траектории.
+     */
+    void closeReplay();
+
+    /**
+     * @brief Получение флага воспроизведения траектории.
+     * @return Флаг воспроизведения траектории.
+     */
+    bool isReplaying() const;
+
+    /**
+     * @brief Получение числа кадров траектории.
+     * @return Число кадров.
+     */
+    size_t replayFramesCount() const;
+
+    /**
+     * @brief Получение позиции воспроизведения.
+     * @return Позиция - номер кадра с дробной частью.
+     */
+    qreal replayPosition() const;
+
+    /**
+     * @brief Получение номера шага отображаемого кадра.
+     * @return Номер шага.
+     */
+    quint64 replayStep() const;
+
+    /**
+     * @brief Получение скорости воспроизведения.
+     * @return Скорость, кадров траектории в секунду.
+     */
+    qreal replayRate() const;
+
+    /**
+     * @brief Получение флага проигрывания траектории.
+     * @return Флаг проигрывания.
+     */
+    bool isReplayPlaying() const;
+
 signals:
     /**
      * @brief Сигнал окончания симуляции.
@@ -166,6 +264,11 @@ signals:
      */
     void nbodyStatusChanged();
 
+    /**
+     * @brief Сигнал смены отображаемого кадра траектории.
+     */
+    void replayPositionChanged();
+
 public slots:
 
     /**
@@ -190,6 +293,25 @@ public slots:
      */
     bool recreateNBody();
 
+    /**
+     * @brief Перемотка траектории.
+     * @param position Позиция - номер кадра с дробной частью.
+     */
+    void setReplayPosition(qreal position);
+
+    /**
+     * @brief Установка скорости воспроизведения.
+     * Отрицательная скорость - воспроизведение назад.
+     * @param rate Скорость, кадров траектории в секунду.
+     */
+    void setReplayRate(qreal rate);
+
+    /**
+     * @brief Установка проигрывания траектории.
+     * @param playing Флаг проигрывания.
+     */
+    void setReplayPlaying(bool playing);
+
 private slots:
 
     /**
@@ -239,20 +361,124 @@ private:
     void wheelEvent(QWheelEvent* event);
 
     /**
-     * @brief Подпись формата файла.
+     * @brief Отрисовка кадра траектории.
+     * Продвигает позицию воспроизведения, занимает буферы
+     * нужных кадров и рисует их с интерполяцией позиций.
      */
-    static const quint32 data_file_magic = 0x474c5859;
+    void drawReplay();
 
     /**
-     * @brief Версия формата файла.
+     * @brief Создаёт кольцо буферов воспроизведения.
+     * @param count Число тел.
+     * @param data Результат - память буферов для записи кадров.
+     * @return true в случае успеха, иначе false.
      */
-    static const quint32 data_file_version = 0x100;
+    bool createReplayBuffers(size_t count, QVector<float*>& data);
+
+    /**
+     * @brief Уничтожает кольцо буферов воспроизведения.
+     */
+    void destroyReplayBuffers();
+
+    /**
+     * @brief Освобождает буферы отрисованных кадров.
+     * Буферы, отрисовка которых не закончена, остаются
+     * захваченными до следующего вызова.
+     * @param wait Флаг ожидания окончания отрисовки всех буферов.
+     */
+    void releaseReplaySlots(bool wait = false);
+
+    /**
+     * @brief Проверяет окончание отрисовки буфера.
+     * @param slot Буфер.
+     * @param wait Флаг ожидания окончания отрисовки.
+     * @return true, если отрисовка закончена, иначе false.
+     */
+    bool replaySlotDrawn(int slot, bool wait);
+
+    /**
+     * @brief Создаёт программу интерполяции позиций.
+     */
+    void createReplayProgram();
 
     /**
      * @brief Система симуляции.
      */
     NBody* nbody;
 
+    /**
+     * @brief Запись траектории.
+     */
+    TrajectoryRecorder* recorder;
+
+    /**
+     * @brief Чтение траектории для воспроизведения.
+     */
+    TrajectoryReader* replay_reader;
+
+    /**
+     * @brief Кольцо буферов позиций кадров.
+     */
+    QVector<NBodyGLBuffer*> replay_buffers;
+
+    /**
+     * @brief Память кадров, если буферы не отображаются постоянно.
+     */
+    QVector<float> replay_host;
+
+    /**
+     * @brief Кадры, переданные в буферы из памяти кадров.
+     */
+    QVector<qint64> replay_uploaded;
+
+    /**
+     * @brief Синхронизация окончания отрисовки буферов.
+     */
+    QVector<GLsync> replay_fences;
+
+    /**
+     * @brief Буферы прежних кадров, ожидающие окончания отрисовки.
+     */
+    QVector<int> replay_busy_slots;
+
+    /**
+     * @brief Флаг постоянного отображения буферов в память.
+     */
+    bool replay_persistent;
+
+    /**
+     * @brief Программа интерполяции позиций или nullptr.
+     */
+    QGLShaderProgram* replay_program;
+
+    /**
+     * @brief Позиция воспроизведения.
+     */
+    qreal replay_position;
+
+    /**
+     * @brief Скорость воспроизведения, кадров в секунду.
+     */
+    qreal replay_rate;
+
+    /**
+     * @brief Флаг проигрывания траектории.
+     */
+    bool replay_playing;
+
+    /**
+     * @brief Время с прошлого продвижения позиции.
+     */
+    QElapsedTimer replay_clock;
+
+    /**
+     * @brief Отрисованные кадр, буферы кадра
+     * и следующего кадра, доля следующего кадра.
+     */
+    qint64 replay_drawn_frame;
+    int replay_drawn_slots[2];
+    float replay_drawn_blend;
+
     /**
      * @brief Флаг непрерывного выполнения симуляции.
      */
@@ -268,6 +494,21 @@ private:
      */
     bool has_point_parameters;
 
+    /**
+     * @brief Флаг наличия расширений GL_ARB_buffer_storage и GL_ARB_sync.
+     */
+    bool has_buffer_storage;
+
+    /**
+     * @brief Размер точек.
+     */
+    float point_size;
+
+    /**
+     * @brief Коэффициенты ослабления размера точек с расстоянием.
+     */
+    float point_attenuation[3];
+
     /**
      * @brief Идентификатор текстуры.
      */
@@ -311,6 +552,12 @@ private:
 
     static PFNGLPOINTPARAMETERFARBPROC glPointParameterfARB;
     static PFNGLPOINTPARAMETERFVARBPROC glPointParameterfvARB;
+    static PFNGLBUFFERSTORAGEPROC glBufferStorage;
+    static PFNGLMAPBUFFERRANGEPROC glMapBufferRange;
+    static PFNGLUNMAPBUFFERPROC glUnmapBuffer;
+    static PFNGLFENCESYNCPROC glFenceSync;
+    static PFNGLCLIENTWAITSYNCPROC glClientWaitSync;
+    static PFNGLDELETESYNCPROC glDeleteSync;
 };
 
 #endif // NBODYWIDGET_H
@@ -75,6 +75,206 @@ void OCLSettingsDialog::setTimeStep(float dt)
     ui->dsbTimeStep->setValue(dt);
 }
 
+int OCLSettingsDialog::solver() const
+{
+    return ui->cbSolver->currentIndex();
+}
+
+void OCLSettingsDialog::setSolver(int s)
+{
+    ui->cbSolver->setCurrentIndex(s);
+}
+
+float OCLSettingsDialog::barnesHutTheta() const
+{
+    return ui->dsbTheta->value();
+}
+
+void OCLSettingsDialog::setBarnesHutTheta(float theta)
+{
+    ui->dsbTheta->setValue(theta);
+}
+
+bool OCLSettingsDialog::gpuTreeBuild() const
+{
+    return ui->cbGpuTreeBuild->isChecked();
+}
+
+void OCLSettingsDialog::setGpuTreeBuild(bool enabled)
+{
+    ui->cbGpuTreeBuild->setChecked(enabled);
+}
+
+int OCLSettingsDialog::fmmOrder() const
+{
+    return ui->sbFmmOrder->value();
+}
+
+void OCLSettingsDialog::setFmmOrder(int order)
+{
+    ui->sbFmmOrder->setValue(order);
+}
+
+bool OCLSettingsDialog::fmmDeviceEvaluation() const
+{
+    return ui->cbFmmDeviceEval->isChecked();
+}
+
+void OCLSettingsDialog::setFmmDeviceEvaluation(bool enabled)
+{
+    ui->cbFmmDeviceEval->setChecked(enabled);
+}
+
+int OCLSettingsDialog::pmGridSize() const
+{
+    return 32 << ui->cbPmGridSize->currentIndex();
+}
+
+void OCLSettingsDialog::setPmGridSize(int size)
+{
+    ui->cbPmGridSize->setCurrentIndex(size >= 128 ? 2 : (size >= 64 ? 1 : 0));
+}
+
+bool OCLSettingsDialog::pmTsc() const
+{
+    return ui->cbPmAssignment->currentIndex() == 1;
+}
+
+void OCLSettingsDialog::setPmTsc(bool tsc)
+{
+    ui->cbPmAssignment->setCurrentIndex(tsc ? 1 : 0);
+}
+
+bool OCLSettingsDialog::nativeBackend() const
+{
+    return ui->cbNativeBackend->isChecked();
+}
+
+void OCLSettingsDialog::setNativeBackend(bool enabled)
+{
+    ui->cbNativeBackend->setChecked(enabled);
+}
+
+int OCLSettingsDialog::blockRungs() const
+{
+    return ui->sbBlockRungs->value();
+}
+
+void OCLSettingsDialog::setBlockRungs(int rungs)
+{
+    ui->sbBlockRungs->setValue(rungs);
+}
+
+int OCLSettingsDialog::integrator() const
+{
+    return ui->cbIntegrator->currentIndex();
+}
+
+void OCLSettingsDialog::setIntegrator(int i)
+{
+    ui->cbIntegrator->setCurrentIndex(i);
+}
+
+int OCLSettingsDialog::stepsPerFrame() const
+{
+    return ui->sbStepsPerFrame->value();
+}
+
+void OCLSettingsDialog::setStepsPerFrame(int steps)
+{
+    ui->sbStepsPerFrame->setValue(steps);
+}
+
+bool OCLSettingsDialog::packedLayout() const
+{
+    return ui->cbPackedLayout->isChecked();
+}
+
+void OCLSettingsDialog::setPackedLayout(bool packed)
+{
+    ui->cbPackedLayout->setChecked(packed);
+}
+
+bool OCLSettingsDialog::autoTune() const
+{
+    return ui->cbAutoTune->isChecked();
+}
+
+void OCLSettingsDialog::setAutoTune(bool enabled)
+{
+    ui->cbAutoTune->setChecked(enabled);
+}
+
+bool OCLSettingsDialog::profiling() const
+{
+    return ui->cbProfiling->isChecked();
+}
+
+void OCLSettingsDialog::setProfiling(bool profiling)
+{
+    ui->cbProfiling->setChecked(profiling);
+}
+
+bool OCLSettingsDialog::multiDevice() const
+{
+    return ui->cbMultiDevice->isChecked();
+}
+
+void OCLSettingsDialog::setMultiDevice(bool enabled)
+{
+    ui->cbMultiDevice->setChecked(enabled);
+}
+
+bool OCLSettingsDialog::pipelined() const
+{
+    return ui->cbPipelined->isChecked();
+}
+
+void OCLSettingsDialog::setPipelined(bool enabled)
+{
+    ui->cbPipelined->setChecked(enabled);
+}
+
+int OCLSettingsDialog::precision() const
+{
+    return ui->cbPrecision->currentIndex();
+}
+
+void OCLSettingsDialog::setPrecision(int p)
+{
+    ui->cbPrecision->setCurrentIndex(p);
+}
+
+int OCLSettingsDialog::softening() const
+{
+    return ui->cbSoftening->currentIndex();
+}
+
+void OCLSettingsDialog::setSoftening(int s)
+{
+    ui->cbSoftening->setCurrentIndex(s);
+}
+
+float OCLSettingsDialog::softeningLength() const
+{
+    return static_cast<float>(ui->dsbSofteningLength->value());
+}
+
+void OCLSettingsDialog::setSofteningLength(float length)
+{
+    ui->dsbSofteningLength->setValue(length);
+}
+
+bool OCLSettingsDialog::compressData() const
+{
+    return ui->cbCompressData->isChecked();
+}
+
+void OCLSettingsDialog::setCompressData(bool compress)
+{
+    ui->cbCompressData->setChecked(compress);
+}
+
 void OCLSettingsDialog::on_cbPlatform_currentIndexChanged(int index)
 {
     if(index != -1){
@@ -43,6 +43,246 @@ public:
      */
     void setTimeStep(float dt);
 
+    /**
+     * @brief Получение метода расчёта.
+     * @return Метод расчёта.
+     */
+    int solver() const;
+
+    /**
+     * @brief Установка метода расчёта.
+     * @param s Метод расчёта.
+     */
+    void setSolver(int s);
+
+    /**
+     * @brief Получение параметра точности метода Барнса-Хата.
+     * @return Параметр точности.
+     */
+    float barnesHutTheta() const;
+
+    /**
+     * @brief Установка параметра точности метода Барнса-Хата.
+     * @param theta Параметр точности.
+     */
+    void setBarnesHutTheta(float theta);
+
+    /**
+     * @brief Получение флага построения дерева на устройстве.
+     * @return Флаг построения дерева на устройстве.
+     */
+    bool gpuTreeBuild() const;
+
+    /**
+     * @brief Установка флага построения дерева на устройстве.
+     * @param enabled Флаг построения дерева на устройстве.
+     */
+    void setGpuTreeBuild(bool enabled);
+
+    /**
+     * @brief Получение порядка разложения FMM.
+     * @return Порядок разложения.
+     */
+    int fmmOrder() const;
+
+    /**
+     * @brief Установка порядка разложения FMM.
+     * @param order Порядок разложения.
+     */
+    void setFmmOrder(int order);
+
+    /**
+     * @brief Получение флага вычисления ближнего поля FMM на устройстве.
+     * @return Флаг вычисления на устройстве.
+     */
+    bool fmmDeviceEvaluation() const;
+
+    /**
+     * @brief Установка флага вычисления ближнего поля FMM на устройстве.
+     * @param enabled Флаг вычисления на устройстве.
+     */
+    void setFmmDeviceEvaluation(bool enabled);
+
+    /**
+     * @brief Получение размера сетки метода частица-сетка.
+     * @return Число узлов сетки по измерению.
+     */
+    int pmGridSize() const;
+
+    /**
+     * @brief Установка размера сетки метода частица-сетка.
+     * @param size Число узлов сетки по измерению.
+     */
+    void setPmGridSize(int size);
+
+    /**
+     * @brief Получение флага распределения масс TSC.
+     * @return true для TSC, false для CIC.
+     */
+    bool pmTsc() const;
+
+    /**
+     * @brief Установка флага распределения масс TSC.
+     * @param tsc true для TSC, false для CIC.
+     */
+    void setPmTsc(bool tsc);
+
+    /**
+     * @brief Получение флага расчёта на процессоре без OpenCL.
+     * @return Флаг расчёта на процессоре.
+     */
+    bool nativeBackend() const;
+
+    /**
+     * @brief Установка флага расчёта на процессоре без OpenCL.
+     * @param enabled Флаг расчёта на процессоре.
+     */
+    void setNativeBackend(bool enabled);
+
+    /**
+     * @brief Получение числа уровней индивидуальных шагов.
+     * @return Число уровней.
+     */
+    int blockRungs() const;
+
+    /**
+     * @brief Установка числа уровней индивидуальных шагов.
+     * @param rungs Число уровней.
+     */
+    void setBlockRungs(int rungs);
+
+    /**
+     * @brief Получение метода интегрирования.
+     * @return Метод интегрирования.
+     */
+    int integrator() const;
+
+    /**
+     * @brief Установка метода интегрирования.
+     * @param i Метод интегрирования.
+     */
+    void setIntegrator(int i);
+
+    /**
+     * @brief Получение числа шагов за кадр.
+     * @return Число шагов.
+     */
+    int stepsPerFrame() const;
+
+    /**
+     * @brief Установка числа шагов за кадр.
+     * @param steps Число шагов.
+     */
+    void setStepsPerFrame(int steps);
+
+    /**
+     * @brief Получение флага упакованного хранения тел.
+     * @return Флаг упакованного хранения тел.
+     */
+    bool packedLayout() const;
+
+    /**
+     * @brief Установка флага упакованного хранения тел.
+     * @param packed Флаг упакованного хранения тел.
+     */
+    void setPackedLayout(bool packed);
+
+    /**
+     * @brief Получение флага подбора параметров ядра под устройство.
+     * @return Флаг подбора параметров ядра.
+     */
+    bool autoTune() const;
+
+    /**
+     * @brief Установка флага подбора параметров ядра под устройство.
+     * @param enabled Флаг подбора параметров ядра.
+     */
+    void setAutoTune(bool enabled);
+
+    /**
+     * @brief Получение флага профилирования ядер.
+     * @return Флаг профилирования ядер.
+     */
+    bool profiling() const;
+
+    /**
+     * @brief Установка флага профилирования ядер.
+     * @param profiling Флаг профилирования ядер.
+     */
+    void setProfiling(bool profiling);
+
+    /**
+     * @brief Получение флага расчёта на нескольких устройствах.
+     * @return Флаг расчёта на нескольких устройствах.
+     */
+    bool multiDevice() const;
+
+    /**
+     * @brief Установка флага расчёта на нескольких устройствах.
+     * @param enabled Флаг расчёта на нескольких устройствах.
+     */
+    void setMultiDevice(bool enabled);
+
+    /**
+     * @brief Получение флага конвейерной отрисовки.
+     * @return Флаг конвейерной отрисовки.
+     */
+    bool pipelined() const;
+
+    /**
+     * @brief Установка флага конвейерной отрисовки.
+     * @param enabled Флаг конвейерной отрисовки.
+     */
+    void setPipelined(bool enabled);
+
+    /**
+     * @brief Получение точности суммирования ускорений.
+     * @return Точность суммирования ускорений.
+     */
+    int precision() const;
+
+    /**
+     * @brief Установка точности суммирования ускорений.
+     * @param p Точность суммирования ускорений.
+     */
+    void setPrecision(int p);
+
+    /**
+     * @brief Получение модели сглаживания.
+     * @return Модель сглаживания.
+     */
+    int softening() const;
+
+    /**
+     * @brief Установка модели сглаживания.
+     * @param s Модель сглаживания.
+     */
+    void setSoftening(int s);
+
+    /**
+     * @brief Получение длины сглаживания.
+     * @return Длина сглаживания.
+     */
+    float softeningLength() const;
+
+    /**
+     * @brief Установка длины сглаживания.
+     * @param length Длина сглаживания.
+     */
+    void setSofteningLength(float length);
+
+    /**
+     * @brief Получение флага сжатия сохраняемых данных.
+     * @return Флаг сжатия сохраняемых данных.
+     */
+    bool compressData() const;
+
+    /**
+     * @brief Установка флага сжатия сохраняемых данных.
+     * @param compress Флаг сжатия сохраняемых данных.
+     */
+    void setCompressData(bool compress);
+
 private slots:
     void on_cbPlatform_currentIndexChanged(int index);
     void on_cbDevice_currentIndexChanged(int index);
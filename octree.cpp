@@ -0,0 +1,232 @@
+#include "octree.h"
+#include <algorithm>
+
+
+//! Максимальное число тел в листе по-умолчанию.
+#define OCTREE_LEAF_CAPACITY_DEFAULT 8
+//! Максимальная глубина дерева по-умолчанию.
+#define OCTREE_MAX_DEPTH_DEFAULT 32
+
+
+Octree::Octree()
+{
+    leaf_capacity = OCTREE_LEAF_CAPACITY_DEFAULT;
+    max_depth = OCTREE_MAX_DEPTH_DEFAULT;
+}
+
+Octree::~Octree()
+{
+}
+
+size_t Octree::leafCapacity() const
+{
+    return leaf_capacity;
+}
+
+void Octree::setLeafCapacity(size_t capacity)
+{
+    if(capacity == 0) capacity = 1;
+    leaf_capacity = capacity;
+}
+
+size_t Octree::maxDepth() const
+{
+    return max_depth;
+}
+
+void Octree::setMaxDepth(size_t depth)
+{
+    max_depth = depth;
+}
+
+/**
+ * @brief Построение дерева.
+ * @param positions Позиции тел (x, y, z).
+ * @param masses Массы тел.
+ * @param count Число тел.
+ * @return true в случае успеха, иначе false.
+ */
+bool Octree::build(const float *positions, const float *masses, size_t count)
+{
+    // Очистим предыдущее дерево.
+    clear();
+
+    // Нечего строить.
+    if(count == 0 || positions == nullptr || masses == nullptr) return false;
+
+    // Вычислим ограничивающий параллелепипед.
+    float min_x = positions[0], max_x = positions[0];
+    float min_y = positions[1], max_y = positions[1];
+    float min_z = positions[2], max_z = positions[2];
+
+    for(size_t i = 1; i < count; i ++){
+        const float* p = positions + i * 3;
+        min_x = std::min(min_x, p[0]); max_x = std::max(max_x, p[0]);
+        min_y = std::min(min_y, p[1]); max_y = std::max(max_y, p[1]);
+        min_z = std::min(min_z, p[2]); max_z = std::max(max_z, p[2]);
+    }
+
+    // Корневая ячейка - куб, содержащий все тела.
+    float half = std::max(max_x - min_x, std::max(max_y - min_y, max_z - min_z)) * 0.5f;
+    // Немного расширим, чтобы граничные тела попали внутрь.
+    half = half * 1.0001f + 1e-6f;
+
+    // Исходный порядок тел.
+    tree_indices.resize(count);
+    tmp_indices.resize(count);
+    for(size_t i = 0; i < count; i ++){
+        tree_indices[i] = static_cast<qint32>(i);
+    }
+
+    // Оценка числа узлов.
+    tree_nodes.reserve(static_cast<int>(count / leaf_capacity * 2 + 1));
+    tree_counts.reserve(tree_nodes.capacity());
+
+    // Построим дерево.
+    buildNode(positions, masses,
+              (min_x + max_x) * 0.5f, (min_y + max_y) * 0.5f, (min_z + max_z) * 0.5f,
+              half, 0, static_cast<qint32>(count), 0);
+
+    // Узлы, за поддеревом которых ничего нет, завершают обход.
+    qint32 nodes_count = tree_nodes.size();
+    for(qint32 i = 0; i < nodes_count; i ++){
+        if(tree_nodes[i].next >= nodes_count) tree_nodes[i].next = -1;
+    }
+
+    return true;
+}
+
+void Octree::clear()
+{
+    tree_nodes.clear();
+    tree_indices.clear();
+    tree_counts.clear();
+}
+
+const QVector<Octree::Node> &Octree::nodes() const
+{
+    return tree_nodes;
+}
+
+const QVector<qint32> &Octree::indices() const
+{
+    return tree_indices;
+}
+
+const QVector<qint32> &Octree::counts() const
+{
+    return tree_counts;
+}
+
+qint32 Octree::buildNode(const float *positions, const float *masses,
+                         float cx, float cy, float cz, float half,
+                         qint32 begin, qint32 end, size_t depth)
+{
+    // Индекс узла.
+    qint32 node_index = tree_nodes.size();
+    // Число тел в узле.
+    qint32 count = end - begin;
+
+    // Добавим узел, поля будут заполнены после построения потомков.
+    tree_nodes.append(Node());
+    tree_counts.append(count);
+
+    // Масса и взвешенная сумма позиций.
+    double sum_m = 0.0, sum_x = 0.0, sum_y = 0.0, sum_z = 0.0;
+    // Первый потомок.
+    qint32 child = 0;
+
+    // Если узел - лист.
+    if(static_cast<size_t>(count) <= leaf_capacity || depth >= max_depth){
+        for(qint32 i = begin; i < end; i ++){
+            const float* p = positions + tree_indices[i] * 3;
+            double m = masses[tree_indices[i]];
+            sum_m += m;
+            sum_x += p[0] * m;
+            sum_y += p[1] * m;
+            sum_z += p[2] * m;
+        }
+        // Лист хранит число своих тел со знаком минус.
+        child = -count;
+    }else{
+        // Число тел в каждом октанте.
+        qint32 octant_count[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        // Начало октанта в массиве индексов.
+        qint32 octant_begin[8];
+        // Текущая позиция записи в октант.
+        qint32 octant_pos[8];
+
+        // Посчитаем тела в октантах.
+        for(qint32 i = begin; i < end; i ++){
+            const float* p = positions + tree_indices[i] * 3;
+            int octant = (p[0] >= cx ? 1 : 0) | (p[1] >= cy ? 2 : 0) | (p[2] >= cz ? 4 : 0);
+            octant_count[octant] ++;
+        }
+
+        // Вычислим начала октантов.
+        octant_begin[0] = begin;
+        for(int o = 1; o < 8; o ++){
+            octant_begin[o] = octant_begin[o - 1] + octant_count[o - 1];
+        }
+        for(int o = 0; o < 8; o ++){
+            octant_pos[o] = octant_begin[o];
+        }
+
+        // Разложим тела по октантам.
+        for(qint32 i = begin; i < end; i ++){
+            const float* p = positions + tree_indices[i] * 3;
+            int octant = (p[0] >= cx ? 1 : 0) | (p[1] >= cy ? 2 : 0) | (p[2] >= cz ? 4 : 0);
+            tmp_indices[octant_pos[octant] ++] = tree_indices[i];
+        }
+        for(qint32 i = begin; i < end; i ++){
+            tree_indices[i] = tmp_indices[i];
+        }
+
+        // Половина размера потомка.
+        float quarter = half * 0.5f;
+
+        // Первый потомок следует сразу за узлом.
+        child = node_index + 1;
+
+        // Построим потомков.
+        for(int o = 0; o < 8; o ++){
+            if(octant_count[o] == 0) continue;
+
+            qint32 child_index = buildNode(positions, masses,
+                                           cx + ((o & 1) ? quarter : -quarter),
+                                           cy + ((o & 2) ? quarter : -quarter),
+                                           cz + ((o & 4) ? quarter : -quarter),
+                                           quarter, octant_begin[o], octant_begin[o] + octant_count[o],
+                                           depth + 1);
+
+            const Node& child_node = tree_nodes.at(child_index);
+            double m = child_node.com[3];
+            sum_m += m;
+            sum_x += child_node.com[0] * m;
+            sum_y += child_node.com[1] * m;
+            sum_z += child_node.com[2] * m;
+        }
+    }
+
+    // Заполним узел.
+    // Ссылку берём только сейчас - вектор мог перераспределить память.
+    Node& node = tree_nodes[node_index];
+
+    if(sum_m > 0.0){
+        node.com[0] = static_cast<float>(sum_x / sum_m);
+        node.com[1] = static_cast<float>(sum_y / sum_m);
+        node.com[2] = static_cast<float>(sum_z / sum_m);
+    }else{
+        node.com[0] = cx;
+        node.com[1] = cy;
+        node.com[2] = cz;
+    }
+    node.com[3] = static_cast<float>(sum_m);
+    node.size = half * 2.0f;
+    node.child = child;
+    // Следующий узел обхода - сразу за поддеревом.
+    node.next = tree_nodes.size();
+    node.first = begin;
+
+    return node_index;
+}
@@ -0,0 +1,152 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <stddef.h>
+
+
+/**
+ * @class Octree.
+ * @brief Класс октодерева для приближённого
+ * расчёта взаимодействия методом Барнса-Хата.
+ * Узлы хранятся в порядке обхода в глубину,
+ * каждый узел ссылается на первого потомка и
+ * на узел, следующий за его поддеревом,
+ * что позволяет обходить дерево без стека.
+ */
+class Octree
+{
+public:
+
+    /**
+     * @brief Узел дерева.
+     * Расположение полей совпадает
+     * со структурой tree_node_t в nbody.cl.
+     */
+    struct Node
+    {
+        float com[4]; //!< Центр масс (x, y, z) и масса (w).
+        float size;   //!< Размер ячейки.
+        qint32 child; //!< Индекс первого потомка, либо число тел листа со знаком минус.
+        qint32 next;  //!< Индекс узла, следующего за поддеревом, либо -1.
+        qint32 first; //!< Индекс первого тела узла в массиве индексов.
+    };
+
+    /**
+     * @brief Конструктор.
+     */
+    Octree();
+
+    /**
+     * @brief Деструктор.
+     */
+    ~Octree();
+
+    /**
+     * @brief Получение максимального числа тел в листе.
+     * @return Максимальное число тел в листе.
+     */
+    size_t leafCapacity() const;
+
+    /**
+     * @brief Установка максимального числа тел в листе.
+     * @param capacity Максимальное число тел в листе.
+     */
+    void setLeafCapacity(size_t capacity);
+
+    /**
+     * @brief Получение максимальной глубины дерева.
+     * @return Максимальная глубина дерева.
+     */
+    size_t maxDepth() const;
+
+    /**
+     * @brief Установка максимальной глубины дерева.
+     * @param depth Максимальная глубина дерева.
+     */
+    void setMaxDepth(size_t depth);
+
+    /**
+     * @brief Построение дерева.
+     * @param positions Позиции тел (x, y, z).
+     * @param masses Массы тел.
+     * @param count Число тел.
+     * @return true в случае успеха, иначе false.
+     */
+    bool build(const float* positions, const float* masses, size_t count);
+
+    /**
+     * @brief Очистка дерева.
+     */
+    void clear();
+
+    /**
+     * @brief Получение узлов дерева.
+     * @return Узлы дерева.
+     */
+    const QVector<Node>& nodes() const;
+
+    /**
+     * @brief Получение индексов тел в порядке обхода дерева.
+     * @return Индексы тел.
+     */
+    const QVector<qint32>& indices() const;
+
+    /**
+     * @brief Получение числа тел в поддеревьях узлов.
+     * @return Число тел в поддеревьях узлов.
+     */
+    const QVector<qint32>& counts() const;
+
+private:
+
+    /**
+     * @brief Максимальное число тел в листе.
+     */
+    size_t leaf_capacity;
+
+    /**
+     * @brief Максимальная глубина дерева.
+     */
+    size_t max_depth;
+
+    /**
+     * @brief Узлы дерева.
+     */
+    QVector<Node> tree_nodes;
+
+    /**
+     * @brief Индексы тел в порядке обхода дерева.
+     */
+    QVector<qint32> tree_indices;
+
+    /**
+     * @brief Число тел в поддеревьях узлов.
+     */
+    QVector<qint32> tree_counts;
+
+    /**
+     * @brief Временный массив для разбиения тел по октантам.
+     */
+    QVector<qint32> tmp_indices;
+
+    /**
+     * @brief Рекурсивно строит узел дерева.
+     * @param positions Позиции тел.
+     * @param masses Массы тел.
+     * @param cx Центр ячейки по X.
+     * @param cy Центр ячейки по Y.
+     * @param cz Центр ячейки по Z.
+     * @param half Половина размера ячейки.
+     * @param begin Индекс первого тела ячейки.
+     * @param end Индекс за последним телом ячейки.
+     * @param depth Глубина ячейки.
+     * @return Индекс построенного узла.
+     */
+    qint32 buildNode(const float* positions, const float* masses,
+                     float cx, float cy, float cz, float half,
+                     qint32 begin, qint32 end, size_t depth);
+};
+
+#endif // OCTREE_H
@@ -0,0 +1,456 @@
+#include "particlemesh.h"
+#include <QtConcurrentMap>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+
+//! Размер сетки по-умолчанию.
+#define PM_GRID_SIZE_DEFAULT 64
+//! Отступ от края сетки до тел в узлах.
+#define PM_GRID_MARGIN 2
+//! Число тел в задаче интерполяции.
+#define PM_INTERPOLATE_CHUNK 4096
+
+
+/**
+ * @brief Задача преобразования Фурье плоскости.
+ */
+struct PmPlaneTask
+{
+    typedef void result_type;
+
+    PmPlaneTask(ParticleMesh* p, int a, bool inv, size_t l)
+        : pm(p), axis(a), inverse(inv), lines(l) {}
+
+    void operator()(const qint32& plane) const
+    {
+        pm->transformPlane(axis, inverse, plane, lines);
+    }
+
+    ParticleMesh* pm;
+    int axis;
+    bool inverse;
+    size_t lines;
+};
+
+/**
+ * @brief Задача вычисления ускорений в узлах плоскости.
+ */
+struct PmDifferenceTask
+{
+    typedef void result_type;
+
+    PmDifferenceTask(ParticleMesh* p) : pm(p) {}
+
+    void operator()(const qint32& plane) const
+    {
+        pm->differencePlane(plane);
+    }
+
+    ParticleMesh* pm;
+};
+
+/**
+ * @brief Задача интерполяции ускорений в тела.
+ */
+struct PmInterpolateTask
+{
+    typedef void result_type;
+
+    PmInterpolateTask(const ParticleMesh* p, size_t n, float* acc)
+        : pm(p), count(n), accelerations(acc) {}
+
+    void operator()(const qint32& chunk) const
+    {
+        size_t begin = static_cast<size_t>(chunk) * PM_INTERPOLATE_CHUNK;
+        pm->interpolate(begin, std::min(begin + PM_INTERPOLATE_CHUNK, count), accelerations);
+    }
+
+    const ParticleMesh* pm;
+    size_t count;
+    float* accelerations;
+};
+
+
+/**
+ * @brief Создаёт последовательность индексов задач.
+ */
+static QVector<qint32> taskIndices(size_t count)
+{
+    QVector<qint32> res(static_cast<int>(count));
+    for(int i = 0; i < res.size(); i ++) res[i] = i;
+    return res;
+}
+
+
+ParticleMesh::ParticleMesh()
+{
+    grid_size = PM_GRID_SIZE_DEFAULT;
+    fft_size = 0;
+    mass_assignment = ASSIGNMENT_CIC;
+    cell_size = 1.0f;
+    origin[0] = origin[1] = origin[2] = 0.0f;
+    body_positions = nullptr;
+}
+
+ParticleMesh::~ParticleMesh()
+{
+}
+
+size_t ParticleMesh::gridSize() const
+{
+    return grid_size;
+}
+
+void ParticleMesh::setGridSize(size_t size)
+{
+    size_t n = PM_GRID_SIZE_MIN;
+    while(n < size && n < PM_GRID_SIZE_MAX) n <<= 1;
+
+    if(n == grid_size) return;
+
+    grid_size = n;
+    // Таблицы будут перестроены при следующем расчёте.
+    fft_size = 0;
+}
+
+ParticleMesh::Assignment ParticleMesh::assignment() const
+{
+    return mass_assignment;
+}
+
+void ParticleMesh::setAssignment(Assignment a)
+{
+    mass_assignment = a;
+}
+
+/**
+ * @brief Вычисляет ускорения тел.
+ * @param positions Позиции тел (x, y, z).
+ * @param masses Массы тел.
+ * @param count Число тел.
+ * @param accelerations Результат - ускорения (x, y, z).
+ * @return true в случае успеха, иначе false.
+ */
+bool ParticleMesh::compute(const float *positions, const float *masses, size_t count, float *accelerations)
+{
+    if(count == 0 || positions == nullptr || masses == nullptr || accelerations == nullptr) return false;
+
+    if(fft_size != grid_size * 2) buildTables();
+
+    size_t n = grid_size;
+    size_t nn = fft_size;
+
+    // Вычислим ограничивающий куб.
+    float bmin[3] = {positions[0], positions[1], positions[2]};
+    float bmax[3] = {positions[0], positions[1], positions[2]};
+
+    for(size_t i = 1; i < count; i ++){
+        const float* p = positions + i * 3;
+        for(int k = 0; k < 3; k ++){
+            bmin[k] = std::min(bmin[k], p[k]);
+            bmax[k] = std::max(bmax[k], p[k]);
+        }
+    }
+
+    float extent = std::max(bmax[0] - bmin[0], std::max(bmax[1] - bmin[1], bmax[2] - bmin[2]));
+    if(extent <= 0.0f) extent = 1.0f;
+
+    // Тела лежат внутри сетки с отступом,
+    // чтобы шаблоны распределения и разностей не выходили за край.
+    cell_size = extent / (n - 2 * PM_GRID_MARGIN - 1);
+    for(int k = 0; k < 3; k ++){
+        origin[k] = (bmin[k] + bmax[k]) * 0.5f - cell_size * (n - 1) * 0.5f;
+    }
+
+    body_positions = positions;
+
+    // Распределим массы.
+    deposit(masses, count);
+
+    // Перенесём массы в сетку свёртки,
+    // вторая половина по каждой оси остаётся нулевой.
+    grid.fill(Complex(0.0f, 0.0f), nn * nn * nn);
+    for(size_t z = 0; z < n; z ++){
+        for(size_t y = 0; y < n; y ++){
+            const float* src = density.constData() + (z * n + y) * n;
+            Complex* dst = grid.data() + (z * nn + y) * nn;
+            for(size_t x = 0; x < n; x ++){
+                dst[x] = Complex(src[x], 0.0f);
+            }
+        }
+    }
+
+    // Прямое преобразование, нулевые строки и плоскости пропускаются.
+    transformAxis(0, false, n, n);
+    transformAxis(1, false, n, nn);
+    transformAxis(2, false, nn, nn);
+
+    // Свёртка с функцией Грина.
+    // Функция Грина обратно пропорциональна шагу сетки,
+    // нормировка обратного преобразования учтена здесь же.
+    float scale = 1.0f / (cell_size * nn * nn * nn);
+    Complex* g = grid.data();
+    const float* gf = green.constData();
+    for(size_t i = 0; i < nn * nn * nn; i ++){
+        g[i] *= gf[i] * scale;
+    }
+
+    // Обратное преобразование, нужна лишь исходная часть сетки.
+    transformAxis(2, true, nn, nn);
+    transformAxis(1, true, n, nn);
+    transformAxis(0, true, n, n);
+
+    // Ускорения в узлах сетки.
+    mesh_accelerations.resize(n * n * n * 3);
+    QVector<qint32> planes = taskIndices(n);
+    QtConcurrent::blockingMap(planes, PmDifferenceTask(this));
+
+    // Интерполяция в тела.
+    QVector<qint32> chunks = taskIndices((count + PM_INTERPOLATE_CHUNK - 1) / PM_INTERPOLATE_CHUNK);
+    QtConcurrent::blockingMap(chunks, PmInterpolateTask(this, count, accelerations));
+
+    return true;
+}
+
+void ParticleMesh::buildTables()
+{
+    size_t nn = grid_size * 2;
+
+    fft_size = nn;
+
+    // Множители преобразования.
+    twiddles.resize(nn / 2);
+    for(size_t i = 0; i < nn / 2; i ++){
+        double a = -2.0 * M_PI * i / nn;
+        twiddles[i] = Complex(static_cast<float>(cos(a)), static_cast<float>(sin(a)));
+    }
+
+    // Функция Грина 1/r на сетке удвоенного размера
+    // с периодическим отражением - изолированные граничные условия.
+    grid.resize(nn * nn * nn);
+    for(size_t z = 0; z < nn; z ++){
+        double dz = static_cast<double>(std::min(z, nn - z));
+        for(size_t y = 0; y < nn; y ++){
+            double dy = static_cast<double>(std::min(y, nn - y));
+            for(size_t x = 0; x < nn; x ++){
+                double dx = static_cast<double>(std::min(x, nn - x));
+                double r = sqrt(dx * dx + dy * dy + dz * dz);
+                // Собственный узел - потенциал равномерно заполненной ячейки.
+                grid[(z * nn + y) * nn + x] = Complex(static_cast<float>(r > 0.0 ? 1.0 / r : 1.0), 0.0f);
+            }
+        }
+    }
+
+    transformAxis(0, false, nn, nn);
+    transformAxis(1, false, nn, nn);
+    transformAxis(2, false, nn, nn);
+
+    // Функция чётная - образ вещественный.
+    green.resize(nn * nn * nn);
+    for(size_t i = 0; i < nn * nn * nn; i ++){
+        green[i] = grid.at(i).real();
+    }
+}
+
+void ParticleMesh::deposit(const float *masses, size_t count)
+{
+    size_t n = grid_size;
+
+    density.fill(0.0f, n * n * n);
+
+    float* d = density.data();
+    float inv_h = 1.0f / cell_size;
+
+    int first[3];
+    float w[3][3];
+
+    for(size_t i = 0; i < count; i ++){
+        const float* p = body_positions + i * 3;
+        float m = masses[i];
+
+        for(int k = 0; k < 3; k ++){
+            weights((p[k] - origin[k]) * inv_h, first[k], w[k]);
+        }
+
+        for(int c = 0; c < 3; c ++){
+            for(int b = 0; b < 3; b ++){
+                float wzy = m * w[2][c] * w[1][b];
+                float* row = d + ((first[2] + c) * n + first[1] + b) * n + first[0];
+                row[0] += wzy * w[0][0];
+                row[1] += wzy * w[0][1];
+                row[2] += wzy * w[0][2];
+            }
+        }
+    }
+}
+
+void ParticleMesh::transformAxis(int axis, bool inverse, size_t planes, size_t lines)
+{
+    QVector<qint32> tasks = taskIndices(planes);
+    QtConcurrent::blockingMap(tasks, PmPlaneTask(this, axis, inverse, lines));
+}
+
+void ParticleMesh::transformPlane(int axis, bool inverse, size_t plane, size_t lines)
+{
+    size_t nn = fft_size;
+
+    // Шаг вдоль оси преобразования, шаг между строками и смещение плоскости.
+    size_t stride, line_stride, offset;
+    switch(axis){
+    case 0:
+        stride = 1;
+        line_stride = nn;
+        offset = plane * nn * nn;
+        break;
+    case 1:
+        stride = nn;
+        line_stride = 1;
+        offset = plane * nn * nn;
+        break;
+    default:
+        stride = nn * nn;
+        line_stride = 1;
+        offset = plane * nn;
+        break;
+    }
+
+    Complex* g = grid.data() + offset;
+
+    // Вдоль оси x строки непрерывны.
+    if(stride == 1){
+        for(size_t l = 0; l < lines; l ++){
+            fft(g + l * line_stride, inverse);
+        }
+        return;
+    }
+
+    // Иначе скопируем строку во временный буфер.
+    QVector<Complex> line(static_cast<int>(nn));
+    for(size_t l = 0; l < lines; l ++){
+        Complex* src = g + l * line_stride;
+        for(size_t i = 0; i < nn; i ++) line[i] = src[i * stride];
+        fft(line.data(), inverse);
+        for(size_t i = 0; i < nn; i ++) src[i * stride] = line.at(i);
+    }
+}
+
+void ParticleMesh::fft(Complex *data, bool inverse) const
+{
+    size_t nn = fft_size;
+
+    // Перестановка в бит-реверсном порядке.
+    for(size_t i = 1, j = 0; i < nn; i ++){
+        size_t bit = nn >> 1;
+        for(; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if(i < j) std::swap(data[i], data[j]);
+    }
+
+    // Бабочки.
+    for(size_t len = 2; len <= nn; len <<= 1){
+        size_t half = len >> 1;
+        size_t step = nn / len;
+        for(size_t i = 0; i < nn; i += len){
+            for(size_t k = 0; k < half; k ++){
+                Complex w = twiddles.at(k * step);
+                if(inverse) w = std::conj(w);
+                Complex u = data[i + k];
+                Complex v = data[i + k + half] * w;
+                data[i + k] = u + v;
+                data[i + k + half] = u - v;
+            }
+        }
+    }
+}
+
+void ParticleMesh::differencePlane(size_t z)
+{
+    size_t n = grid_size;
+    size_t nn = fft_size;
+
+    const Complex* g = grid.constData();
+    float inv_2h = 0.5f / cell_size;
+
+    // Потенциал в узле сетки.
+    #define PM_PHI(x, y, z) g[((z) * nn + (y)) * nn + (x)].real()
+
+    size_t z0 = z > 0 ? z - 1 : z;
+    size_t z1 = z + 1 < n ? z + 1 : z;
+
+    for(size_t y = 0; y < n; y ++){
+        size_t y0 = y > 0 ? y - 1 : y;
+        size_t y1 = y + 1 < n ? y + 1 : y;
+        float* acc = mesh_accelerations.data() + ((z * n + y) * n) * 3;
+        for(size_t x = 0; x < n; x ++){
+            size_t x0 = x > 0 ? x - 1 : x;
+            size_t x1 = x + 1 < n ? x + 1 : x;
+            // Ускорение - градиент потенциала Σ m / r.
+            acc[x * 3]     = (PM_PHI(x1, y, z) - PM_PHI(x0, y, z)) * inv_2h;
+            acc[x * 3 + 1] = (PM_PHI(x, y1, z) - PM_PHI(x, y0, z)) * inv_2h;
+            acc[x * 3 + 2] = (PM_PHI(x, y, z1) - PM_PHI(x, y, z0)) * inv_2h;
+        }
+    }
+
+    #undef PM_PHI
+}
+
+void ParticleMesh::interpolate(size_t begin, size_t end, float *accelerations) const
+{
+    size_t n = grid_size;
+
+    const float* ma = mesh_accelerations.constData();
+    float inv_h = 1.0f / cell_size;
+
+    int first[3];
+    float w[3][3];
+
+    for(size_t i = begin; i < end; i ++){
+        const float* p = body_positions + i * 3;
+
+        for(int k = 0; k < 3; k ++){
+            weights((p[k] - origin[k]) * inv_h, first[k], w[k]);
+        }
+
+        float acc[3] = {0.0f, 0.0f, 0.0f};
+
+        for(int c = 0; c < 3; c ++){
+            for(int b = 0; b < 3; b ++){
+                float wzy = w[2][c] * w[1][b];
+                const float* row = ma + (((first[2] + c) * n + first[1] + b) * n + first[0]) * 3;
+                for(int a = 0; a < 3; a ++){
+                    float wxyz = wzy * w[0][a];
+                    acc[0] += row[a * 3] * wxyz;
+                    acc[1] += row[a * 3 + 1] * wxyz;
+                    acc[2] += row[a * 3 + 2] * wxyz;
+                }
+            }
+        }
+
+        accelerations[i * 3]     = acc[0];
+        accelerations[i * 3 + 1] = acc[1];
+        accelerations[i * 3 + 2] = acc[2];
+    }
+}
+
+void ParticleMesh::weights(float u, int &first, float *weights) const
+{
+    if(mass_assignment == ASSIGNMENT_TSC){
+        // Ближайший узел и два соседних.
+        int i = static_cast<int>(floorf(u + 0.5f));
+        float d = u - i;
+        first = i - 1;
+        weights[0] = 0.5f * (0.5f - d) * (0.5f - d);
+        weights[1] = 0.75f - d * d;
+        weights[2] = 0.5f * (0.5f + d) * (0.5f + d);
+    }else{
+        // Два окружающих узла.
+        int i = static_cast<int>(floorf(u));
+        float f = u - i;
+        first = i;
+        weights[0] = 1.0f - f;
+        weights[1] = f;
+        weights[2] = 0.0f;
+    }
+}
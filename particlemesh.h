@@ -0,0 +1,209 @@
+#ifndef PARTICLEMESH_H
+#define PARTICLEMESH_H
+
+#include <QtGlobal>
+#include <QVector>
+#include <complex>
+#include <stddef.h>
+
+
+//! Минимальный размер сетки.
+#define PM_GRID_SIZE_MIN 16
+//! Максимальный размер сетки.
+#define PM_GRID_SIZE_MAX 128
+
+
+/**
+ * @class ParticleMesh.
+ * @brief Класс расчёта взаимодействия методом частица-сетка.
+ * Массы тел распределяются по узлам кубической сетки (CIC или TSC),
+ * потенциал находится свёрткой с функцией Грина 1/r
+ * через быстрое преобразование Фурье на сетке
+ * удвоенного размера (изолированные граничные условия),
+ * ускорения в узлах - центральными разностями потенциала,
+ * и интерполируются обратно в тела той же схемой.
+ * Преобразование Фурье и интерполяция распараллелены.
+ */
+class ParticleMesh
+{
+public:
+
+    /**
+     * @brief Схема распределения масс.
+     */
+    enum Assignment {
+        ASSIGNMENT_CIC = 0, //!< Облако в ячейке.
+        ASSIGNMENT_TSC = 1  //!< Треугольное облако.
+    };
+
+    /**
+     * @brief Конструктор.
+     */
+    ParticleMesh();
+
+    /**
+     * @brief Деструктор.
+     */
+    ~ParticleMesh();
+
+    /**
+     * @brief Получение размера сетки.
+     * @return Число узлов сетки по измерению.
+     */
+    size_t gridSize() const;
+
+    /**
+     * @brief Установка размера сетки.
+     * Размер округляется до степени двойки
+     * от PM_GRID_SIZE_MIN до PM_GRID_SIZE_MAX.
+     * @param size Число узлов сетки по измерению.
+     */
+    void setGridSize(size_t size);
+
+    /**
+     * @brief Получение схемы распределения масс.
+     * @return Схема распределения масс.
+     */
+    Assignment assignment() const;
+
+    /**
+     * @brief Установка схемы распределения масс.
+     * @param a Схема распределения масс.
+     */
+    void setAssignment(Assignment a);
+
+    /**
+     * @brief Вычисляет ускорения тел.
+     * Гравитационная постоянная не учитывается.
+     * @param positions Позиции тел (x, y, z).
+     * @param masses Массы тел.
+     * @param count Число тел.
+     * @param accelerations Результат - ускорения (x, y, z).
+     * @return true в случае успеха, иначе false.
+     */
+    bool compute(const float* positions, const float* masses, size_t count, float* accelerations);
+
+private:
+
+    typedef std::complex<float> Complex;
+
+    /**
+     * @brief Размер сетки.
+     */
+    size_t grid_size;
+
+    /**
+     * @brief Размер сетки свёртки, удвоенный.
+     */
+    size_t fft_size;
+
+    /**
+     * @brief Схема распределения масс.
+     */
+    Assignment mass_assignment;
+
+    /**
+     * @brief Шаг сетки.
+     */
+    float cell_size;
+
+    /**
+     * @brief Начало сетки.
+     */
+    float origin[3];
+
+    /**
+     * @brief Множители быстрого преобразования Фурье.
+     */
+    QVector<Complex> twiddles;
+
+    /**
+     * @brief Образ функции Грина для единичного шага сетки.
+     */
+    QVector<float> green;
+
+    /**
+     * @brief Сетка свёртки.
+     */
+    QVector<Complex> grid;
+
+    /**
+     * @brief Массы в узлах сетки.
+     */
+    QVector<float> density;
+
+    /**
+     * @brief Ускорения в узлах сетки.
+     */
+    QVector<float> mesh_accelerations;
+
+    /**
+     * @brief Позиции тел.
+     */
+    const float* body_positions;
+
+    /**
+     * @brief Строит множители и образ функции Грина.
+     */
+    void buildTables();
+
+    /**
+     * @brief Распределяет массы тел по сетке.
+     * @param masses Массы тел.
+     * @param count Число тел.
+     */
+    void deposit(const float* masses, size_t count);
+
+    /**
+     * @brief Выполняет преобразование Фурье вдоль оси.
+     * @param axis Ось.
+     * @param inverse Флаг обратного преобразования.
+     * @param planes Число обрабатываемых плоскостей.
+     * @param lines Число обрабатываемых строк в плоскости.
+     */
+    void transformAxis(int axis, bool inverse, size_t planes, size_t lines);
+
+    /**
+     * @brief Выполняет преобразование Фурье строк плоскости.
+     * @param axis Ось.
+     * @param inverse Флаг обратного преобразования.
+     * @param plane Плоскость.
+     * @param lines Число строк.
+     */
+    void transformPlane(int axis, bool inverse, size_t plane, size_t lines);
+
+    /**
+     * @brief Одномерное преобразование Фурье на месте.
+     * @param data Данные.
+     * @param inverse Флаг обратного преобразования.
+     */
+    void fft(Complex* data, bool inverse) const;
+
+    /**
+     * @brief Вычисляет ускорения в узлах плоскости сетки.
+     * @param z Плоскость.
+     */
+    void differencePlane(size_t z);
+
+    /**
+     * @brief Интерполирует ускорения в тела.
+     * @param begin Первое тело.
+     * @param end Тело за последним.
+     * @param accelerations Результат - ускорения.
+     */
+    void interpolate(size_t begin, size_t end, float* accelerations) const;
+
+    /**
+     * @brief Вычисляет веса узлов для координаты.
+     * @param u Координата в шагах сетки.
+     * @param first Результат - первый узел.
+     * @param weights Результат - веса трёх узлов.
+     */
+    void weights(float u, int& first, float* weights) const;
+
+    friend struct PmPlaneTask;
+    friend struct PmDifferenceTask;
+    friend struct PmInterpolateTask;
+};
+
+#endif // PARTICLEMESH_H
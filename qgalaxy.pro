@@ -57,7 +57,18 @@ SOURCES += main.cpp\
     point3f.cpp \
     editbodydialog.cpp \
     utils.cpp \
-    gensettingsdialog.cpp
+    gensettingsdialog.cpp \
+    octree.cpp \
+    treebuilder.cpp \
+    fmm.cpp \
+    fmmbuilder.cpp \
+    particlemesh.cpp \
+    cpuengine.cpp \
+    nbodyfile.cpp \
+    batchrunner.cpp \
+    trajectoryrecorder.cpp \
+    snapshotcodec.cpp \
+    trajectoryreader.cpp
 
 HEADERS  += mainwindow.h \
     log.h \
@@ -80,7 +91,19 @@ HEADERS  += mainwindow.h \
     spiralgalaxy.h \
     point3f.h \
     editbodydialog.h \
-    gensettingsdialog.h
+    gensettingsdialog.h \
+    octree.h \
+    treebuilder.h \
+    fmm.h \
+    fmmbuilder.h \
+    particlemesh.h \
+    cpuengine.h \
+    cpuenginekernels.h \
+    nbodyfile.h \
+    batchrunner.h \
+    trajectoryrecorder.h \
+    snapshotcodec.h \
+    trajectoryreader.h
 
 FORMS    += mainwindow.ui \
     oclsettingsdialog.ui \
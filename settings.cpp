@@ -11,6 +11,28 @@ static const char* param_bodies_count_name = "bodies_count";
 static const char* param_cl_platform_name = "cl_platform_name";
 static const char* param_cl_device_name = "cl_device_name";
 static const char* param_time_step_name = "time_step";
+static const char* param_solver = "solver";
+static const char* param_barnes_hut_theta = "barnes_hut_theta";
+static const char* param_gpu_tree_build = "gpu_tree_build";
+static const char* param_fmm_order = "fmm_order";
+static const char* param_fmm_device_eval = "fmm_device_eval";
+static const char* param_pm_grid_size = "pm_grid_size";
+static const char* param_pm_tsc = "pm_tsc";
+static const char* param_native_backend = "native_backend";
+static const char* param_block_rungs = "block_rungs";
+static const char* param_integrator_type = "integrator";
+static const char* param_steps_per_frame = "steps_per_frame";
+static const char* param_packed_layout = "packed_layout";
+static const char* param_auto_tune = "auto_tune";
+static const char* param_kernel_tuning_group = "kernel_tuning";
+static const char* param_precision_report_group = "precision_report";
+static const char* param_profiling = "profiling";
+static const char* param_multi_device = "multi_device";
+static const char* param_pipelined = "pipelined";
+static const char* param_precision_type = "precision";
+static const char* param_softening_type = "softening";
+static const char* param_softening_length = "softening_length";
+static const char* param_compress_data = "compress_data";
 
 static const char* param_star_mass_min = "star_mass_min";
 static const char* param_star_mass_max = "star_mass_max";
@@ -47,6 +69,38 @@ void Settings::read()
     cl_platform_name = settings.value(param_cl_platform_name, QString()).toString();
     cl_device_name = settings.value(param_cl_device_name, QString()).toString();
     time_step = settings.value(param_time_step_name, 100000.0f).toFloat();
+    solver_type = settings.value(param_solver, 0).toInt();
+    barnes_hut_theta = settings.value(param_barnes_hut_theta, 0.5f).toFloat();
+    gpu_tree_build = settings.value(param_gpu_tree_build, true).toBool();
+    fmm_order = settings.value(param_fmm_order, 4).toInt();
+    fmm_device_eval = settings.value(param_fmm_device_eval, true).toBool();
+    pm_grid_size = settings.value(param_pm_grid_size, 64).toInt();
+    pm_tsc = settings.value(param_pm_tsc, false).toBool();
+    native_backend = settings.value(param_native_backend, false).toBool();
+    block_rungs = settings.value(param_block_rungs, 0).toInt();
+    integrator_type = settings.value(param_integrator_type, 0).toInt();
+    steps_per_frame = settings.value(param_steps_per_frame, 1).toInt();
+    packed_layout = settings.value(param_packed_layout, false).toBool();
+    auto_tune = settings.value(param_auto_tune, true).toBool();
+    kernel_tunings.clear();
+    settings.beginGroup(param_kernel_tuning_group);
+    foreach(const QString& key, settings.childKeys()){
+        kernel_tunings[key] = settings.value(key).toString();
+    }
+    settings.endGroup();
+    precision_reports.clear();
+    settings.beginGroup(param_precision_report_group);
+    foreach(const QString& key, settings.childKeys()){
+        precision_reports[key] = settings.value(key).toString();
+    }
+    settings.endGroup();
+    profiling = settings.value(param_profiling, false).toBool();
+    multi_device = settings.value(param_multi_device, false).toBool();
+    pipelined_render = settings.value(param_pipelined, false).toBool();
+    precision_type = settings.value(param_precision_type, 0).toInt();
+    softening_type = settings.value(param_softening_type, 0).toInt();
+    softening_length = settings.value(param_softening_length, 0.1f).toFloat();
+    compress_data = settings.value(param_compress_data, false).toBool();
 
     star_mass_min = settings.value(param_star_mass_min, 1e1f).toFloat();
     star_mass_max = settings.value(param_star_mass_max, 1e2f).toFloat();
@@ -68,6 +122,36 @@ void Settings::write()
     settings.setValue(param_cl_platform_name, cl_platform_name);
     settings.setValue(param_cl_device_name, cl_device_name);
     settings.setValue(param_time_step_name, time_step);
+    settings.setValue(param_solver, solver_type);
+    settings.setValue(param_barnes_hut_theta, barnes_hut_theta);
+    settings.setValue(param_gpu_tree_build, gpu_tree_build);
+    settings.setValue(param_fmm_order, fmm_order);
+    settings.setValue(param_fmm_device_eval, fmm_device_eval);
+    settings.setValue(param_pm_grid_size, pm_grid_size);
+    settings.setValue(param_pm_tsc, pm_tsc);
+    settings.setValue(param_native_backend, native_backend);
+    settings.setValue(param_block_rungs, block_rungs);
+    settings.setValue(param_integrator_type, integrator_type);
+    settings.setValue(param_steps_per_frame, steps_per_frame);
+    settings.setValue(param_packed_layout, packed_layout);
+    settings.setValue(param_auto_tune, auto_tune);
+    settings.beginGroup(param_kernel_tuning_group);
+    for(QMap<QString, QString>::const_iterator it = kernel_tunings.begin(); it != kernel_tunings.end(); ++ it){
+        settings.setValue(it.key(), it.value());
+    }
+    settings.endGroup();
+    settings.beginGroup(param_precision_report_group);
+    for(QMap<QString, QString>::const_iterator it = precision_reports.begin(); it != precision_reports.end(); ++ it){
+        settings.setValue(it.key(), it.value());
+    }
+    settings.endGroup();
+    settings.setValue(param_profiling, profiling);
+    settings.setValue(param_multi_device, multi_device);
+    settings.setValue(param_pipelined, pipelined_render);
+    settings.setValue(param_precision_type, precision_type);
+    settings.setValue(param_softening_type, softening_type);
+    settings.setValue(param_softening_length, softening_length);
+    settings.setValue(param_compress_data, compress_data);
 
     settings.setValue(param_star_mass_min, star_mass_min);
     settings.setValue(param_star_mass_max, star_mass_max);
@@ -136,6 +220,248 @@ void Settings::setTimeStep(float dt)
     emit settingsChanged();
 }
 
+int Settings::solver() const
+{
+    return solver_type;
+}
+
+void Settings::setSolver(int s)
+{
+    solver_type = s;
+    emit settingsChanged();
+}
+
+float Settings::barnesHutTheta() const
+{
+    return barnes_hut_theta;
+}
+
+void Settings::setBarnesHutTheta(float theta)
+{
+    barnes_hut_theta = theta;
+    emit settingsChanged();
+}
+
+bool Settings::gpuTreeBuild() const
+{
+    return gpu_tree_build;
+}
+
+void Settings::setGpuTreeBuild(bool enabled)
+{
+    gpu_tree_build = enabled;
+    emit settingsChanged();
+}
+
+int Settings::fmmOrder() const
+{
+    return fmm_order;
+}
+
+void Settings::setFmmOrder(int order)
+{
+    fmm_order = order;
+    emit settingsChanged();
+}
+
+bool Settings::fmmDeviceEvaluation() const
+{
+    return fmm_device_eval;
+}
+
+void Settings::setFmmDeviceEvaluation(bool enabled)
+{
+    fmm_device_eval = enabled;
+    emit settingsChanged();
+}
+
+int Settings::pmGridSize() const
+{
+    return pm_grid_size;
+}
+
+void Settings::setPmGridSize(int size)
+{
+    pm_grid_size = size;
+    emit settingsChanged();
+}
+
+bool Settings::pmTsc() const
+{
+    return pm_tsc;
+}
+
+void Settings::setPmTsc(bool tsc)
+{
+    pm_tsc = tsc;
+    emit settingsChanged();
+}
+
+bool Settings::nativeBackend() const
+{
+    return native_backend;
+}
+
+void Settings::setNativeBackend(bool enabled)
+{
+    native_backend = enabled;
+    emit settingsChanged();
+}
+
+int Settings::blockRungs() const
+{
+    return block_rungs;
+}
+
+void Settings::setBlockRungs(int rungs)
+{
+    block_rungs = rungs;
+    emit settingsChanged();
+}
+
+int Settings::integrator() const
+{
+    return integrator_type;
+}
+
+void Settings::setIntegrator(int i)
+{
+    integrator_type = i;
+    emit settingsChanged();
+}
+
+int Settings::stepsPerFrame() const
+{
+    return steps_per_frame;
+}
+
+void Settings::setStepsPerFrame(int steps)
+{
+    steps_per_frame = steps;
+    emit settingsChanged();
+}
+
+bool Settings::packedLayout() const
+{
+    return packed_layout;
+}
+
+void Settings::setPackedLayout(bool packed)
+{
+    packed_layout = packed;
+    emit settingsChanged();
+}
+
+bool Settings::autoTune() const
+{
+    return auto_tune;
+}
+
+void Settings::setAutoTune(bool enabled)
+{
+    auto_tune = enabled;
+    emit settingsChanged();
+}
+
+QString Settings::kernelTuning(const QString &device_key) const
+{
+    return kernel_tunings.value(device_key);
+}
+
+void Settings::setKernelTuning(const QString &device_key, const QString &tuning)
+{
+    kernel_tunings[device_key] = tuning;
+    emit settingsChanged();
+}
+
+QString Settings::precisionReport(const QString &device_key) const
+{
+    return precision_reports.value(device_key);
+}
+
+void Settings::setPrecisionReport(const QString &device_key, const QString &report)
+{
+    precision_reports[device_key] = report;
+    emit settingsChanged();
+}
+
+bool Settings::profiling() const
+{
+    return profiling;
+}
+
+void Settings::setProfiling(bool profiling)
+{
+    profiling = profiling;
+    emit settingsChanged();
+}
+
+bool Settings::multiDevice() const
+{
+    return multi_device;
+}
+
+void Settings::setMultiDevice(bool enabled)
+{
+    multi_device = enabled;
+    emit settingsChanged();
+}
+
+bool Settings::pipelined() const
+{
+    return pipelined_render;
+}
+
+void Settings::setPipelined(bool enabled)
+{
+    pipelined_render = enabled;
+    emit settingsChanged();
+}
+
+int Settings::precision() const
+{
+    return precision_type;
+}
+
+void Settings::setPrecision(int p)
+{
+    precision_type = p;
+    emit settingsChanged();
+}
+
+int Settings::softening() const
+{
+    return softening_type;
+}
+
+void Settings::setSoftening(int s)
+{
+    softening_type = s;
+    emit settingsChanged();
+}
+
+float Settings::softeningLength() const
+{
+    return softening_length;
+}
+
+void Settings::setSofteningLength(float length)
+{
+    softening_length = length;
+    emit settingsChanged();
+}
+
+bool Settings::compressData() const
+{
+    return compress_data;
+}
+
+void Settings::setCompressData(bool compress)
+{
+    compress_data = compress;
+    emit settingsChanged();
+}
+
 float Settings::starMassMin() const
 {
     return star_mass_min;
@@ -4,6 +4,7 @@
 #include <QObject>
 #include <stddef.h>
 #include <QString>
+#include <QMap>
 
 
 
@@ -32,6 +33,72 @@ public:
     float timeStep() const;
     void setTimeStep(float dt);
 
+    int solver() const;
+    void setSolver(int s);
+
+    float barnesHutTheta() const;
+    void setBarnesHutTheta(float theta);
+
+    bool gpuTreeBuild() const;
+    void setGpuTreeBuild(bool enabled);
+
+    int fmmOrder() const;
+    void setFmmOrder(int order);
+
+    bool fmmDeviceEvaluation() const;
+    void setFmmDeviceEvaluation(bool enabled);
+
+    int pmGridSize() const;
+    void setPmGridSize(int size);
+
+    bool pmTsc() const;
+    void setPmTsc(bool tsc);
+
+    bool nativeBackend() const;
+    void setNativeBackend(bool enabled);
+
+    int blockRungs() const;
+    void setBlockRungs(int rungs);
+
+    int integrator() const;
+    void setIntegrator(int i);
+
+    int stepsPerFrame() const;
+    void setStepsPerFrame(int steps);
+
+    bool packedLayout() const;
+    void setPackedLayout(bool packed);
+
+    bool autoTune() const;
+    void setAutoTune(bool enabled);
+
+    QString kernelTuning(const QString& device_key) const;
+    void setKernelTuning(const QString& device_key, const QString& tuning);
+
+    QString precisionReport(const QString& device_key) const;
+    void setPrecisionReport(const QString& device_key, const QString& report);
+
+    bool profiling() const;
+    void setProfiling(bool profiling);
+
+    bool multiDevice() const;
+    void setMultiDevice(bool enabled);
+
+    bool pipelined() const;
+    void setPipelined(bool enabled);
+
+    int precision() const;
+    void setPrecision(int p);
+
+    int softening() const;
+    void setSoftening(int s);
+
+    float softeningLength() const;
+    void setSofteningLength(float length);
+
+    bool compressData() const;
+    void setCompressData(bool compress);
+
     float starMassMin() const;
     void setStarMassMin(float mass);
 
@@ -73,6 +140,28 @@ private:
     QString cl_platform_name;
     QString cl_device_name;
     float time_step;
+    int solver_type;
+    float barnes_hut_theta;
+    bool gpu_tree_build;
+    int fmm_order;
+    bool fmm_device_eval;
+    int pm_grid_size;
+    bool pm_tsc;
+    bool native_backend;
+    int block_rungs;
+    int integrator_type;
+    int steps_per_frame;
+    bool packed_layout;
+    bool auto_tune;
+    QMap<QString, QString> kernel_tunings;
+    QMap<QString, QString> precision_reports;
+    bool profiling;
+    bool multi_device;
+    bool pipelined_render;
+    int precision_type;
+    int softening_type;
+    float softening_length;
+    bool compress_data;
 
     float star_mass_min;
     float star_mass_max;
@@ -0,0 +1,381 @@
+#include "snapshotcodec.h"
+#include <QVector>
+#include <QtEndian>
+#include <QtConcurrentMap>
+#include <string.h>
+
+
+//! Число бит хеша таблицы совпадений.
+#define LZ_HASH_BITS 14
+//! Минимальная длина совпадения.
+#define LZ_MIN_MATCH 4
+//! Максимальное смещение совпадения.
+#define LZ_MAX_OFFSET 65535
+//! Признак блока, хранимого без словарного сжатия.
+#define CHUNK_STORED 0x80000000U
+
+
+/**
+ * @brief Блок сжатых данных.
+ */
+struct SnapshotCodecChunk
+{
+    const uchar* encoded; //!< Сжатые данные при распаковке.
+    QByteArray data; //!< Сжатые данные при сжатии.
+    size_t size; //!< Размер сжатых данных.
+    bool stored; //!< Признак хранения без словарного сжатия.
+    bool ok; //!< Признак успешной распаковки.
+};
+
+
+/**
+ * @brief Записывает последовательность: литералы и совпадение.
+ * Формат последовательности: байт длин (старшие 4 бита - число
+ * литералов, младшие - длина совпадения за вычетом минимальной),
+ * продолжение числа литералов, литералы, смещение совпадения (2 байта),
+ * продолжение длины совпадения. Последняя последовательность
+ * содержит только литералы.
+ * @return true в случае успеха, false если не хватает места.
+ */
+static bool lzEmit(uchar* dst, size_t capacity, size_t& out,
+                   const uchar* literals, size_t literals_count,
+                   size_t offset, size_t match_len)
+{
+    // Наибольший размер последовательности.
+    size_t need = 1 + literals_count / 255 + 1 + literals_count + 2 + match_len / 255 + 1;
+    if(out + need > capacity) return false;
+
+    size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    dst[out ++] = static_cast<uchar>((qMin<size_t>(literals_count, 15) << 4) |
+                                     qMin<size_t>(match_code, 15));
+
+    if(literals_count >= 15){
+        size_t rest = literals_count - 15;
+        for(; rest >= 255; rest -= 255) dst[out ++] = 255;
+        dst[out ++] = static_cast<uchar>(rest);
+    }
+
+    memcpy(dst + out, literals, literals_count);
+    out += literals_count;
+
+    if(match_len == 0) return true;
+
+    dst[out ++] = static_cast<uchar>(offset & 0xff);
+    dst[out ++] = static_cast<uchar>(offset >> 8);
+
+    if(match_code >= 15){
+        size_t rest = match_code - 15;
+        for(; rest >= 255; rest -= 255) dst[out ++] = 255;
+        dst[out ++] = static_cast<uchar>(rest);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Сжимает данные словарным методом.
+ * @return Размер сжатых данных или 0, если не хватает места.
+ */
+static size_t lzCompress(const uchar* src, size_t size, uchar* dst, size_t capacity)
+{
+    QVector<qint32> table(1 << LZ_HASH_BITS, -1);
+    qint32* positions = table.data();
+
+    size_t pos = 0, anchor = 0, out = 0;
+
+    while(pos + LZ_MIN_MATCH <= size){
+        quint32 sequence;
+        memcpy(&sequence, src + pos, sizeof(quint32));
+
+        quint32 hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+        qint32 candidate = positions[hash];
+        positions[hash] = static_cast<qint32>(pos);
+
+        if(candidate >= 0 && pos - candidate <= LZ_MAX_OFFSET &&
+           memcmp(src + candidate, src + pos, LZ_MIN_MATCH) == 0){
+            size_t len = LZ_MIN_MATCH;
+            while(pos + len < size && src[candidate + len] == src[pos + len]) len ++;
+
+            if(!lzEmit(dst, capacity, out, src + anchor, pos - anchor, pos - candidate, len)) return 0;
+
+            pos += len;
+            anchor = pos;
+        }else{
+            // В несжимаемых данных шаг поиска растёт.
+            pos += 1 + ((pos - anchor) >> 6);
+        }
+    }
+
+    // Оставшиеся литералы.
+    if(!lzEmit(dst, capacity, out, src + anchor, size - anchor, 0, 0)) return 0;
+
+    return out;
+}
+
+/**
+ * @brief Считывает продолжение длины.
+ * @return true в случае успеха, иначе false.
+ */
+static bool lzReadLength(const uchar* src, size_t size, size_t& in, size_t& len)
+{
+    uchar b;
+    do{
+        if(in >= size) return false;
+        b = src[in ++];
+        len += b;
+    }while(b == 255);
+    return true;
+}
+
+/**
+ * @brief Распаковывает данные, сжатые словарным методом.
+ * @return true в случае успеха, иначе false.
+ */
+static bool lzDecompress(const uchar* src, size_t size, uchar* dst, size_t dst_size)
+{
+    size_t in = 0, out = 0;
+
+    while(in < size){
+        uchar token = src[in ++];
+
+        size_t literals_count = token >> 4;
+        if(literals_count == 15 && !lzReadLength(src, size, in, literals_count)) return false;
+
+        if(literals_count > size - in || literals_count > dst_size - out) return false;
+        memcpy(dst + out, src + in, literals_count);
+        in += literals_count;
+        out += literals_count;
+
+        // Последняя последовательность.
+        if(in == size) break;
+
+        if(size - in < 2) return false;
+        size_t offset = src[in] | (static_cast<size_t>(src[in + 1]) << 8);
+        in += 2;
+
+        size_t len = token & 15;
+        if(len == 15 && !lzReadLength(src, size, in, len)) return false;
+        len += LZ_MIN_MATCH;
+
+        if(offset == 0 || offset > out || len > dst_size - out) return false;
+
+        // Совпадение может перекрываться с копией.
+        const uchar* match = dst + out - offset;
+        for(size_t i = 0; i < len; i ++){
+            dst[out + i] = match[i];
+        }
+        out += len;
+    }
+
+    return out == dst_size;
+}
+
+
+/**
+ * @brief Задача сжатия блока.
+ */
+struct SnapshotCodecEncodeTask
+{
+    typedef void result_type;
+
+    SnapshotCodecEncodeTask(const float* d, size_t c, const float* r, SnapshotCodecChunk* ch)
+        : data(d), count(c), reference(r), chunks(ch) {}
+
+    void operator()(const qint32& chunk) const
+    {
+        size_t begin = static_cast<size_t>(chunk) * SNAPSHOT_CODEC_CHUNK;
+        size_t n = qMin<size_t>(SNAPSHOT_CODEC_CHUNK, count - begin);
+        size_t bytes = n * sizeof(float);
+
+        // Разложим байты чисел по плоскостям.
+        QByteArray planes(bytes, Qt::Uninitialized);
+        uchar* p = reinterpret_cast<uchar*>(planes.data());
+
+        for(size_t i = 0; i < n; i ++){
+            quint32 word;
+            memcpy(&word, data + begin + i, sizeof(quint32));
+            if(reference){
+                quint32 prev;
+                memcpy(&prev, reference + begin + i, sizeof(quint32));
+                word ^= prev;
+            }
+            p[i] = static_cast<uchar>(word);
+            p[n + i] = static_cast<uchar>(word >> 8);
+            p[n * 2 + i] = static_cast<uchar>(word >> 16);
+            p[n * 3 + i] = static_cast<uchar>(word >> 24);
+        }
+
+        SnapshotCodecChunk& result = chunks[chunk];
+
+        result.data.resize(bytes);
+        size_t size = lzCompress(p, bytes, reinterpret_cast<uchar*>(result.data.data()), bytes);
+
+        // Несжимаемый блок хранится плоскостями.
+        if(size == 0 || size >= bytes){
+            result.data = planes;
+            result.size = bytes;
+            result.stored = true;
+        }else{
+            result.data.resize(size);
+            result.size = size;
+            result.stored = false;
+        }
+    }
+
+    const float* data;
+    size_t count;
+    const float* reference;
+    SnapshotCodecChunk* chunks;
+};
+
+
+/**
+ * @brief Задача распаковки блока.
+ */
+struct SnapshotCodecDecodeTask
+{
+    typedef void result_type;
+
+    SnapshotCodecDecodeTask(float* d, size_t c, const float* r, SnapshotCodecChunk* ch)
+        : data(d), count(c), reference(r), chunks(ch) {}
+
+    void operator()(const qint32& chunk) const
+    {
+        size_t begin = static_cast<size_t>(chunk) * SNAPSHOT_CODEC_CHUNK;
+        size_t n = qMin<size_t>(SNAPSHOT_CODEC_CHUNK, count - begin);
+        size_t bytes = n * sizeof(float);
+
+        SnapshotCodecChunk& source = chunks[chunk];
+
+        QByteArray buffer;
+        const uchar* p = source.encoded;
+
+        if(source.stored){
+            if(source.size != bytes){
+                source.ok = false;
+                return;
+            }
+        }else{
+            buffer.resize(bytes);
+            if(!lzDecompress(source.encoded, source.size, reinterpret_cast<uchar*>(buffer.data()), bytes)){
+                source.ok = false;
+                return;
+            }
+            p = reinterpret_cast<const uchar*>(buffer.constData());
+        }
+
+        // Соберём числа из плоскостей.
+        for(size_t i = 0; i < n; i ++){
+            quint32 word = static_cast<quint32>(p[i]) |
+                           (static_cast<quint32>(p[n + i]) << 8) |
+                           (static_cast<quint32>(p[n * 2 + i]) << 16) |
+                           (static_cast<quint32>(p[n * 3 + i]) << 24);
+            if(reference){
+                quint32 prev;
+                memcpy(&prev, reference + begin + i, sizeof(quint32));
+                word ^= prev;
+            }
+            memcpy(data + begin + i, &word, sizeof(quint32));
+        }
+
+        source.ok = true;
+    }
+
+    float* data;
+    size_t count;
+    const float* reference;
+    SnapshotCodecChunk* chunks;
+};
+
+
+/**
+ * @brief Сжимает массив чисел.
+ * @param data Данные.
+ * @param count Количество чисел.
+ * @param reference Данные предыдущего кадра для XOR-разности или nullptr.
+ * @return Сжатые данные.
+ */
+QByteArray SnapshotCodec::encode(const float *data, size_t count, const float *reference)
+{
+    size_t chunks_count = (count + SNAPSHOT_CODEC_CHUNK - 1) / SNAPSHOT_CODEC_CHUNK;
+
+    QVector<SnapshotCodecChunk> chunks(chunks_count);
+    QVector<qint32> indices(chunks_count);
+    for(size_t i = 0; i < chunks_count; i ++) indices[i] = i;
+
+    // Блоки сжимаются параллельно.
+    QtConcurrent::blockingMap(indices, SnapshotCodecEncodeTask(data, count, reference, chunks.data()));
+
+    size_t table_size = sizeof(quint32) * (1 + chunks_count);
+    size_t total = table_size;
+    for(size_t i = 0; i < chunks_count; i ++) total += chunks.at(i).size;
+
+    QByteArray encoded(total, Qt::Uninitialized);
+    uchar* out = reinterpret_cast<uchar*>(encoded.data());
+
+    qToLittleEndian<quint32>(chunks_count, out);
+
+    size_t offset = table_size;
+    for(size_t i = 0; i < chunks_count; i ++){
+        const SnapshotCodecChunk& chunk = chunks.at(i);
+        qToLittleEndian<quint32>(chunk.size | (chunk.stored ? CHUNK_STORED : 0),
+                                 out + sizeof(quint32) * (1 + i));
+        memcpy(out + offset, chunk.data.constData(), chunk.size);
+        offset += chunk.size;
+    }
+
+    return encoded;
+}
+
+/**
+ * @brief Распаковывает массив чисел.
+ * @param encoded Сжатые данные.
+ * @param size Размер сжатых данных.
+ * @param data Результат.
+ * @param count Количество чисел.
+ * @param reference Данные предыдущего кадра, использованные при сжатии, или nullptr.
+ * @return true в случае успеха, иначе false.
+ */
+bool SnapshotCodec::decode(const char *encoded, size_t size, float *data, size_t count,
+                           const float *reference)
+{
+    const uchar* in = reinterpret_cast<const uchar*>(encoded);
+
+    if(size < sizeof(quint32)) return false;
+
+    size_t chunks_count = qFromLittleEndian<quint32>(in);
+    if(chunks_count != (count + SNAPSHOT_CODEC_CHUNK - 1) / SNAPSHOT_CODEC_CHUNK) return false;
+
+    size_t table_size = sizeof(quint32) * (1 + chunks_count);
+    if(size < table_size) return false;
+
+    QVector<SnapshotCodecChunk> chunks(chunks_count);
+    QVector<qint32> indices(chunks_count);
+
+    // Найдём начала блоков.
+    size_t offset = table_size;
+    for(size_t i = 0; i < chunks_count; i ++){
+        quint32 entry = qFromLittleEndian<quint32>(in + sizeof(quint32) * (1 + i));
+
+        SnapshotCodecChunk& chunk = chunks[i];
+        chunk.size = entry & ~CHUNK_STORED;
+        chunk.stored = (entry & CHUNK_STORED) != 0;
+        chunk.encoded = in + offset;
+        chunk.ok = false;
+
+        if(chunk.size > size - offset) return false;
+        offset += chunk.size;
+
+        indices[i] = i;
+    }
+
+    // Блоки распаковываются параллельно.
+    QtConcurrent::blockingMap(indices, SnapshotCodecDecodeTask(data, count, reference, chunks.data()));
+
+    for(size_t i = 0; i < chunks_count; i ++){
+        if(!chunks.at(i).ok) return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef SNAPSHOTCODEC_H
+#define SNAPSHOTCODEC_H
+
+#include <QByteArray>
+#include <stddef.h>
+
+
+//! Число чисел в блоке сжатия.
+#define SNAPSHOT_CODEC_CHUNK 65536
+
+
+/**
+ * @class SnapshotCodec.
+ * @brief Класс сжатия без потерь массивов чисел с плавающей точкой.
+ * Массив делится на блоки, сжимаемые независимо в нескольких потоках.
+ * В блоке числа могут заменяться на XOR-разность с предыдущим
+ * кадром, затем байты чисел раскладываются по плоскостям
+ * (старшие байты - порядок и знак - к старшим), и плоскости
+ * сжимаются словарным методом семейства LZ77.
+ * Несжимаемый блок хранится без словарного сжатия.
+ * Формат: число блоков, размеры сжатых блоков (старший бит -
+ * признак хранения без сжатия), данные блоков.
+ * Все поля в порядке байт little-endian.
+ */
+class SnapshotCodec
+{
+public:
+    /**
+     * @brief Сжимает массив чисел.
+     * @param data Данные.
+     * @param count Количество чисел.
+     * @param reference Данные предыдущего кадра для XOR-разности или nullptr.
+     * @return Сжатые данные.
+     */
+    static QByteArray encode(const float* data, size_t count, const float* reference = nullptr);
+
+    /**
+     * @brief Распаковывает массив чисел.
+     * @param encoded Сжатые данные.
+     * @param size Размер сжатых данных.
+     * @param data Результат.
+     * @param count Количество чисел.
+     * @param reference Данные предыдущего кадра, использованные при сжатии, или nullptr.
+     * @return true в случае успеха, иначе false.
+     */
+    static bool decode(const char* encoded, size_t size, float* data, size_t count,
+                       const float* reference = nullptr);
+};
+
+#endif // SNAPSHOTCODEC_H
@@ -0,0 +1,55 @@
+#-------------------------------------------------
+#
+# Проверка ядер OpenCL на совпадающих
+# и почти совпадающих телах и сглаживания силы.
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_kernel_softening
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+SRCDIR = $$PWD/../..
+
+INCLUDEPATH += $$SRCDIR
+DEFINES += SRCDIR=\\\"$$SRCDIR/\\\"
+
+QMAKE_CXXFLAGS += -std=c++0x -U__STRICT_ANSI__
+
+# OpenGL нужен только clcontext.cpp (контекст, общий с OpenGL).
+linux-g++ {
+    LIBS += -lGL -lOpenCL
+}
+
+win32 {
+    LIBS += -lOpenGL32 -lOpenCL
+}
+
+SOURCES += tst_kernel_softening.cpp \
+    $$SRCDIR/clplatform.cpp \
+    $$SRCDIR/cldevice.cpp \
+    $$SRCDIR/clcontext.cpp \
+    $$SRCDIR/clcommandqueue.cpp \
+    $$SRCDIR/clevent.cpp \
+    $$SRCDIR/clbuffer.cpp \
+    $$SRCDIR/clexception.cpp \
+    $$SRCDIR/clprogram.cpp \
+    $$SRCDIR/clkernel.cpp \
+    $$SRCDIR/vendor.cpp \
+    $$SRCDIR/utils.cpp
+
+HEADERS += $$SRCDIR/clplatform.h \
+    $$SRCDIR/cldevice.h \
+    $$SRCDIR/clcontext.h \
+    $$SRCDIR/clcommandqueue.h \
+    $$SRCDIR/clevent.h \
+    $$SRCDIR/clbuffer.h \
+    $$SRCDIR/clexception.h \
+    $$SRCDIR/clprogram.h \
+    $$SRCDIR/clkernel.h \
+    $$SRCDIR/vendor.h \
+    $$SRCDIR/utils.h
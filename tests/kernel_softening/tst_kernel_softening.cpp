@@ -0,0 +1,356 @@
+#include <QtTest>
+#include <QFile>
+#include <QVector>
+#include <QStringList>
+#include <qnumeric.h>
+#include <math.h>
+#include "clplatform.h"
+#include "cldevice.h"
+#include "clcontext.h"
+#include "clcommandqueue.h"
+#include "clbuffer.h"
+#include "clprogram.h"
+#include "clkernel.h"
+#include "clexception.h"
+#include "utils.h"
+
+
+// Аргументы kernel_main, как в nbody.cpp.
+#define KERNEL_MAIN_ARG_COUNT 0
+#define KERNEL_MAIN_ARG_POSITIONS_IN 1
+#define KERNEL_MAIN_ARG_POSITIONS_OUT 2
+#define KERNEL_MAIN_ARG_VELOCITIES_IN 3
+#define KERNEL_MAIN_ARG_VELOCITIES_OUT 4
+#define KERNEL_MAIN_ARG_MASSES 5
+#define KERNEL_MAIN_ARG_DT 6
+#define KERNEL_MAIN_ARG_POS_CACHE 7
+#define KERNEL_MAIN_ARG_MASS_CACHE 8
+#define KERNEL_MAIN_ARG_CACHE_SIZE 9
+#define KERNEL_MAIN_ARG_DRIFT_PRE 10
+#define KERNEL_MAIN_ARG_KICK 11
+#define KERNEL_MAIN_ARG_DRIFT_POST 12
+#define KERNEL_MAIN_ARG_FIRST_BODY 13
+#define KERNEL_MAIN_ARG_END_BODY 14
+
+//! Число тел.
+#define BODIES_COUNT 2
+
+//! Масса тяжёлого тела (чёрная дыра).
+#define HEAVY_MASS 1e7f
+
+//! Гравитационная постоянная программы OpenCL.
+#define KERNEL_G 4.4932e-15
+
+//! Сглаживание, как в nbody.cl.
+#define SOFTENING_PLUMMER 1
+#define SOFTENING_SPLINE 2
+
+//! Отношение радиуса ядра сплайна к длине сглаживания.
+#define SOFTENING_SPLINE_RATIO 2.8
+
+//! Длина сглаживания.
+#define SOFTENING_LENGTH 0.1f
+
+//! Допустимая относительная ошибка ускорения.
+#define ACCEL_TOLERANCE 1e-3
+
+//! Допустимая относительная ошибка ускорения с native_rsqrt.
+#define ACCEL_TOLERANCE_NATIVE 1e-2
+
+
+Q_DECLARE_METATYPE(QStringList)
+
+
+/**
+ * @class KernelSofteningTest.
+ * @brief Проверка ядра прямого расчёта на совпадающих
+ * и почти совпадающих телах без сглаживания:
+ * ускорения должны оставаться конечными.
+ */
+class KernelSofteningTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void closeBodies_data();
+    void closeBodies();
+
+    void softenedForce_data();
+    void softenedForce();
+
+private:
+    /**
+     * @brief Вычисляет ожидаемое ускорение от тела единичной массы.
+     * @param softening Тип сглаживания.
+     * @param eps Длина сглаживания.
+     * @param r Расстояние.
+     * @return Модуль ускорения без гравитационной постоянной.
+     */
+    static double expectedAccel(int softening, double eps, double r);
+
+    /**
+     * @brief Выполняет один шаг двух тел.
+     * @param options Опции сборки программы.
+     * @param separation Расстояние между телами по оси x.
+     * @param positions Результат - позиции.
+     * @param velocities Результат - скорости.
+     * @throw CLException в случае ошибки.
+     */
+    void step(const QStringList& options, float separation,
+              QVector<float>& positions, QVector<float>& velocities);
+
+    CLPlatform platform;
+    CLDevice device;
+    CLContext context;
+    CLCommandQueue queue;
+    QString source;
+};
+
+
+void KernelSofteningTest::initTestCase()
+{
+    QFile file(SRCDIR "nbody.cl");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    source = file.readAll();
+    file.close();
+
+    QList<CLPlatform> platforms;
+    try{
+        platforms = CLPlatform::getPlatforms();
+    }catch(CLException&){
+    }
+
+    for(int i = 0; i < platforms.size() && !device.isValid(); i ++){
+        QList<CLDevice> devices;
+        try{
+            devices = platforms.at(i).getDevices();
+        }catch(CLException&){
+            continue;
+        }
+        if(!devices.isEmpty()){
+            platform = platforms.at(i);
+            device = devices.first();
+        }
+    }
+
+    if(!device.isValid()) QSKIP("No OpenCL devices", SkipAll);
+
+    try{
+        context.create(platform, CLDeviceList() << device);
+        queue.create(context, device);
+    }catch(CLException& e){
+        QFAIL(e.what());
+    }
+}
+
+void KernelSofteningTest::cleanupTestCase()
+{
+    if(queue.isValid()) queue.release();
+    if(context.isValid()) context.release();
+}
+
+void KernelSofteningTest::closeBodies_data()
+{
+    QTest::addColumn<QStringList>("options");
+    QTest::addColumn<float>("separation");
+
+    // Опции сборки как при двойной и одинарной точности.
+    QStringList precise = QStringList() << "-cl-mad-enable";
+    QStringList fast = QStringList() << "-cl-mad-enable" << "-cl-fast-relaxed-math" << "-DNBODY_NATIVE_RSQRT";
+
+    QTest::newRow("coincident") << precise << 0.0f;
+    QTest::newRow("1e-15 apart") << precise << 1e-15f;
+    QTest::newRow("coincident, native rsqrt") << fast << 0.0f;
+    QTest::newRow("1e-15 apart, native rsqrt") << fast << 1e-15f;
+}
+
+void KernelSofteningTest::closeBodies()
+{
+    QFETCH(QStringList, options);
+    QFETCH(float, separation);
+
+    QVector<float> positions, velocities;
+    try{
+        step(options, separation, positions, velocities);
+    }catch(CLException& e){
+        QFAIL(e.what());
+    }
+
+    for(int i = 0; i < BODIES_COUNT * 3; i ++){
+        QVERIFY2(qIsFinite(positions[i]), qPrintable(QString("position %1 = %2").arg(i).arg(positions[i])));
+        QVERIFY2(qIsFinite(velocities[i]), qPrintable(QString("velocity %1 = %2").arg(i).arg(velocities[i])));
+    }
+
+    if(separation == 0.0f){
+        // Совпадающие тела не притягиваются.
+        for(int i = 0; i < BODIES_COUNT * 3; i ++){
+            QCOMPARE(velocities[i], 0.0f);
+        }
+    }else{
+        // Тела притягиваются друг к другу.
+        QVERIFY(velocities[0] > 0.0f);
+        QVERIFY(velocities[3] < 0.0f);
+    }
+}
+
+void KernelSofteningTest::softenedForce_data()
+{
+    QTest::addColumn<QStringList>("options");
+    QTest::addColumn<int>("softening");
+    QTest::addColumn<float>("separation");
+
+    QStringList precise = QStringList() << "-cl-mad-enable";
+    QStringList fast = QStringList() << "-cl-mad-enable" << "-cl-fast-relaxed-math" << "-DNBODY_NATIVE_RSQRT";
+
+    QString length = QString("-DNBODY_SOFTENING_LENGTH=%1f").arg(static_cast<double>(SOFTENING_LENGTH), 0, 'e', 8);
+    QStringList plummer = QStringList() << QString("-DNBODY_SOFTENING=%1").arg(SOFTENING_PLUMMER) << length;
+    QStringList spline = QStringList() << QString("-DNBODY_SOFTENING=%1").arg(SOFTENING_SPLINE) << length;
+
+    float eps = SOFTENING_LENGTH;
+
+    QTest::newRow("plummer, r = eps / 10") << precise + plummer << SOFTENING_PLUMMER << eps * 0.1f;
+    QTest::newRow("plummer, r = eps") << precise + plummer << SOFTENING_PLUMMER << eps;
+    QTest::newRow("plummer, r = 10 eps") << precise + plummer << SOFTENING_PLUMMER << eps * 10.0f;
+    QTest::newRow("plummer, r = eps, native rsqrt") << fast + plummer << SOFTENING_PLUMMER << eps;
+
+    // Внутри ядра сплайна: u < 0.5 и 0.5 <= u < 1.
+    QTest::newRow("spline, r = eps") << precise + spline << SOFTENING_SPLINE << eps;
+    QTest::newRow("spline, r = 2 eps") << precise + spline << SOFTENING_SPLINE << eps * 2.0f;
+    // За радиусом ядра 2.8 eps - ньютоновская сила.
+    QTest::newRow("spline, r = 3 eps") << precise + spline << SOFTENING_SPLINE << eps * 3.0f;
+    QTest::newRow("spline, r = 10 eps") << precise + spline << SOFTENING_SPLINE << eps * 10.0f;
+    QTest::newRow("spline, r = 3 eps, native rsqrt") << fast + spline << SOFTENING_SPLINE << eps * 3.0f;
+}
+
+void KernelSofteningTest::softenedForce()
+{
+    QFETCH(QStringList, options);
+    QFETCH(int, softening);
+    QFETCH(float, separation);
+
+    QVector<float> positions, velocities;
+    try{
+        step(options, separation, positions, velocities);
+    }catch(CLException& e){
+        QFAIL(e.what());
+    }
+
+    // Лёгкое тело за единичный шаг получает скорость,
+    // равную ускорению от тяжёлого, направленному к нему.
+    double accel = -velocities[3] / (KERNEL_G * HEAVY_MASS);
+    double expected = expectedAccel(softening, SOFTENING_LENGTH, separation);
+
+    double tolerance = options.contains("-DNBODY_NATIVE_RSQRT") ? ACCEL_TOLERANCE_NATIVE : ACCEL_TOLERANCE;
+
+    QVERIFY2(qAbs(accel - expected) <= expected * tolerance,
+             qPrintable(QString("accel %1, expected %2").arg(accel, 0, 'e', 6).arg(expected, 0, 'e', 6)));
+
+    // За радиусом ядра сплайна сила ньютоновская.
+    if(softening == SOFTENING_SPLINE && separation >= SOFTENING_SPLINE_RATIO * SOFTENING_LENGTH){
+        double newton = 1.0 / (static_cast<double>(separation) * separation);
+        QVERIFY2(qAbs(accel - newton) <= newton * tolerance,
+                 qPrintable(QString("accel %1, newtonian %2").arg(accel, 0, 'e', 6).arg(newton, 0, 'e', 6)));
+    }
+}
+
+double KernelSofteningTest::expectedAccel(int softening, double eps, double r)
+{
+    // Сглаживание Пламмера: r / (r^2 + eps^2)^(3/2).
+    if(softening == SOFTENING_PLUMMER){
+        return r / pow(r * r + eps * eps, 1.5);
+    }
+
+    // Сплайн Монагана с радиусом ядра h = 2.8 eps.
+    double h = SOFTENING_SPLINE_RATIO * eps;
+    if(r >= h) return 1.0 / (r * r);
+
+    double u = r / h;
+    double inv_h3 = 1.0 / (h * h * h);
+    double inv_r3 = 1.0 / (r * r * r);
+    if(u < 0.5){
+        inv_r3 = inv_h3 * (32.0 / 3.0 + u * u * (32.0 * u - 38.4));
+    }else{
+        inv_r3 = inv_h3 * (64.0 / 3.0 - 48.0 * u + 38.4 * u * u - 32.0 / 3.0 * u * u * u) -
+                 inv_r3 / 15.0;
+    }
+    return r * inv_r3;
+}
+
+void KernelSofteningTest::step(const QStringList &options, float separation,
+                               QVector<float> &positions, QVector<float> &velocities)
+{
+    positions.fill(0.0f, BODIES_COUNT * 3);
+    velocities.fill(0.0f, BODIES_COUNT * 3);
+    positions[3] = separation;
+
+    QVector<float> masses;
+    masses << HEAVY_MASS << 1.0f;
+
+    CLBuffer pos_in, pos_out, vel_in, vel_out, mass;
+    CLProgram program;
+    CLKernel kernel;
+
+    // Объекты OpenCL освобождаются явно.
+    struct Releaser {
+        CLBuffer* buffers[5];
+        CLProgram* program;
+        CLKernel* kernel;
+        ~Releaser()
+        {
+            if(kernel->isValid()) kernel->release();
+            if(program->isValid()) program->release();
+            for(size_t i = 0; i < 5; i ++){
+                if(buffers[i]->isValid()) buffers[i]->release();
+            }
+        }
+    } releaser = {{&pos_in, &pos_out, &vel_in, &vel_out, &mass}, &program, &kernel};
+
+    pos_in.create(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, positions.size() * sizeof(float), positions.data());
+    vel_in.create(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, velocities.size() * sizeof(float), velocities.data());
+    mass.create(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, masses.size() * sizeof(float), masses.data());
+    pos_out.create(context, CL_MEM_WRITE_ONLY, positions.size() * sizeof(float), nullptr);
+    vel_out.create(context, CL_MEM_WRITE_ONLY, velocities.size() * sizeof(float), nullptr);
+
+    // Нижняя граница квадрата расстояния, как в nbody.cpp.
+    QStringList build_options = options;
+    build_options << QString("-DNBODY_RADIUS2_MIN=%1f").arg(static_cast<double>(NBODY_RADIUS2_MIN), 0, 'e', 9);
+
+    program.create(context, source);
+    try{
+        program.build(CLDeviceList() << device, build_options);
+    }catch(CLException&){
+        qWarning() << program.buildLog(device);
+        throw;
+    }
+    kernel.create(program, "kernel_main");
+
+    size_t local_size = BODIES_COUNT;
+    size_t global_size = BODIES_COUNT;
+
+    kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_COUNT, BODIES_COUNT);
+    kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_IN, pos_in.id());
+    kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_POSITIONS_OUT, pos_out.id());
+    kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_IN, vel_in.id());
+    kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_VELOCITIES_OUT, vel_out.id());
+    kernel.setArg<cl_mem>(KERNEL_MAIN_ARG_MASSES, mass.id());
+    kernel.setArg<float>(KERNEL_MAIN_ARG_DT, 1.0f);
+    kernel.setLocalArgSize(KERNEL_MAIN_ARG_POS_CACHE, local_size * sizeof(float) * 3);
+    kernel.setLocalArgSize(KERNEL_MAIN_ARG_MASS_CACHE, local_size * sizeof(float));
+    kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_CACHE_SIZE, local_size);
+    kernel.setArg<float>(KERNEL_MAIN_ARG_DRIFT_PRE, 0.0f);
+    kernel.setArg<float>(KERNEL_MAIN_ARG_KICK, 1.0f);
+    kernel.setArg<float>(KERNEL_MAIN_ARG_DRIFT_POST, 0.0f);
+    kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_FIRST_BODY, 0);
+    kernel.setArg<unsigned int>(KERNEL_MAIN_ARG_END_BODY, BODIES_COUNT);
+
+    kernel.execute(queue, 1, &global_size, &local_size);
+
+    pos_out.enqueueRead(queue, true, 0, positions.size() * sizeof(float), positions.data());
+    vel_out.enqueueRead(queue, true, 0, velocities.size() * sizeof(float), velocities.data());
+}
+
+QTEST_MAIN(KernelSofteningTest)
+
+#include "tst_kernel_softening.moc"
@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# Проверка сжатия снимков: восстановление данных,
+# разбор повреждённых данных и степень сжатия.
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = tst_snapshot_codec
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+SRCDIR = $$PWD/../..
+
+INCLUDEPATH += $$SRCDIR
+
+QMAKE_CXXFLAGS += -std=c++0x -U__STRICT_ANSI__
+
+SOURCES += tst_snapshot_codec.cpp \
+    $$SRCDIR/snapshotcodec.cpp
+
+HEADERS += $$SRCDIR/snapshotcodec.h
@@ -0,0 +1,478 @@
+#include <QtTest>
+#include <QByteArray>
+#include <QVector>
+#include <QtEndian>
+#include <math.h>
+#include <string.h>
+#include "snapshotcodec.h"
+
+
+//! Признак блока, хранимого без словарного сжатия, как в snapshotcodec.cpp.
+#define CHUNK_STORED 0x80000000U
+
+//! Число тел снимка Пламмера, не кратное размеру блока.
+#define PLUMMER_BODIES 100000
+
+//! Шаг по времени между кадрами снимка Пламмера.
+#define PLUMMER_DT 1e-3f
+
+//! Наибольшая доля сжатых масс равных тел.
+#define MASSES_RATIO_MAX 0.05
+
+//! Наибольшая доля сжатого ключевого кадра с массами.
+#define KEY_FRAME_RATIO_MAX 0.9
+
+//! Наибольшая доля сжатых позиций разностного кадра.
+#define DELTA_FRAME_RATIO_MAX 0.75
+
+//! Число защитных чисел за концом результата.
+#define GUARD_COUNT 64
+
+//! Значение защитных чисел.
+#define GUARD_WORD 0xdeadbeefU
+
+
+/**
+ * @class SnapshotCodecTest.
+ * @brief Проверка сжатия снимков: данные восстанавливаются
+ * без потерь, повреждённые данные отвергаются без выхода
+ * за пределы буферов, снимок Пламмера сжимается.
+ */
+class SnapshotCodecTest : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief Вид данных.
+     */
+    enum DataKind {
+        DATA_RANDOM = 0, //!< Случайные биты - блоки не сжимаются.
+        DATA_CONSTANT = 1, //!< Одно число - блоки сжимаются словарным методом.
+        DATA_NEAR_REFERENCE = 2 //!< Данные кадра с изменёнными младшими битами.
+    };
+
+private slots:
+    void roundTrip_data();
+    void roundTrip();
+
+    void truncated_data();
+    void truncated();
+
+    void corruptTable_data();
+    void corruptTable();
+
+    void malformedStream_data();
+    void malformedStream();
+
+    void corruptPayload();
+
+    void plummerRatio();
+
+private:
+    /**
+     * @brief Получение случайного 32-битного слова.
+     * @return Слово.
+     */
+    static quint32 randomWord();
+
+    /**
+     * @brief Получение случайного числа в интервале (0, 1).
+     * @return Число.
+     */
+    static double randomUniform();
+
+    /**
+     * @brief Заполнение массива.
+     * @param kind Вид данных.
+     * @param count Количество чисел.
+     * @param reference Данные кадра для DATA_NEAR_REFERENCE.
+     * @return Данные.
+     */
+    static QVector<float> makeData(int kind, size_t count, const QVector<float>& reference = QVector<float>());
+
+    /**
+     * @brief Распаковка в буфер с защитными числами за концом.
+     * @param encoded Сжатые данные.
+     * @param size Размер сжатых данных.
+     * @param count Количество чисел.
+     * @param reference Данные предыдущего кадра или nullptr.
+     * @param data Результат.
+     * @return Результат SnapshotCodec::decode().
+     */
+    static bool guardedDecode(const char* encoded, size_t size, size_t count,
+                              const float* reference, QVector<float>& data);
+
+    /**
+     * @brief Сжатые данные из блока случайных чисел,
+     * хранимого без сжатия, и сжимаемого блока.
+     * @param data Результат - исходные данные.
+     * @return Сжатые данные.
+     */
+    static QByteArray mixedEncoded(QVector<float>& data);
+
+    /**
+     * @brief Получение записи таблицы блоков.
+     * @param encoded Сжатые данные.
+     * @param chunk Блок.
+     * @return Запись.
+     */
+    static quint32 chunkEntry(const QByteArray& encoded, size_t chunk);
+};
+
+void SnapshotCodecTest::roundTrip_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("delta");
+    QTest::addColumn<int>("kind");
+    QTest::addColumn<bool>("stored");
+
+    QTest::newRow("empty") << 0 << false << static_cast<int>(DATA_CONSTANT) << false;
+    QTest::newRow("stored, one chunk") << 1000 << false << static_cast<int>(DATA_RANDOM) << true;
+    QTest::newRow("lz, one chunk") << 1000 << false << static_cast<int>(DATA_CONSTANT) << false;
+    QTest::newRow("stored, full chunk") << SNAPSHOT_CODEC_CHUNK << false << static_cast<int>(DATA_RANDOM) << true;
+    // Последний блок неполный.
+    QTest::newRow("stored, partial last chunk") << SNAPSHOT_CODEC_CHUNK * 2 + 123 << false << static_cast<int>(DATA_RANDOM) << true;
+    QTest::newRow("lz, partial last chunk") << SNAPSHOT_CODEC_CHUNK * 2 + 123 << false << static_cast<int>(DATA_CONSTANT) << false;
+    QTest::newRow("stored, one number past chunk") << SNAPSHOT_CODEC_CHUNK + 1 << false << static_cast<int>(DATA_RANDOM) << true;
+    // Разностные кадры.
+    QTest::newRow("delta, stored") << SNAPSHOT_CODEC_CHUNK + 1 << true << static_cast<int>(DATA_RANDOM) << true;
+    QTest::newRow("delta, lz") << SNAPSHOT_CODEC_CHUNK + 100 << true << static_cast<int>(DATA_NEAR_REFERENCE) << false;
+    QTest::newRow("delta, lz, partial last chunk") << SNAPSHOT_CODEC_CHUNK * 3 - 7 << true << static_cast<int>(DATA_NEAR_REFERENCE) << false;
+}
+
+void SnapshotCodecTest::roundTrip()
+{
+    QFETCH(int, count);
+    QFETCH(bool, delta);
+    QFETCH(int, kind);
+    QFETCH(bool, stored);
+
+    qsrand(count + kind);
+
+    QVector<float> reference;
+    if(delta) reference = makeData(DATA_RANDOM, count);
+
+    QVector<float> data = makeData(kind, count, reference);
+    const float* ref = delta ? reference.constData() : nullptr;
+
+    QByteArray encoded = SnapshotCodec::encode(data.constData(), count, ref);
+
+    // Таблица блоков: число блоков и размеры.
+    size_t chunks_count = (count + SNAPSHOT_CODEC_CHUNK - 1) / SNAPSHOT_CODEC_CHUNK;
+    QVERIFY(static_cast<size_t>(encoded.size()) >= sizeof(quint32) * (1 + chunks_count));
+    QCOMPARE(static_cast<size_t>(qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(encoded.constData()))),
+             chunks_count);
+
+    size_t total = sizeof(quint32) * (1 + chunks_count);
+    for(size_t i = 0; i < chunks_count; i ++){
+        quint32 entry = chunkEntry(encoded, i);
+        QVERIFY2(((entry & CHUNK_STORED) != 0) == stored, qPrintable(QString("chunk %1").arg(i)));
+        total += entry & ~CHUNK_STORED;
+    }
+    QCOMPARE(static_cast<size_t>(encoded.size()), total);
+
+    QVector<float> decoded;
+    QVERIFY(guardedDecode(encoded.constData(), encoded.size(), count, ref, decoded));
+    QVERIFY(memcmp(decoded.constData(), data.constData(), count * sizeof(float)) == 0);
+
+    // Без кадра разностные данные не восстанавливаются.
+    if(delta){
+        QVERIFY(guardedDecode(encoded.constData(), encoded.size(), count, nullptr, decoded));
+        QVERIFY(memcmp(decoded.constData(), data.constData(), count * sizeof(float)) != 0);
+    }
+
+    // Число чисел должно совпадать с числом блоков.
+    if(count != 0){
+        QVERIFY(!guardedDecode(encoded.constData(), encoded.size(), count + SNAPSHOT_CODEC_CHUNK, ref, decoded));
+    }
+}
+
+void SnapshotCodecTest::truncated_data()
+{
+    QTest::addColumn<int>("cut");
+
+    // Сколько байт отрезается от конца.
+    QTest::newRow("last byte") << 1;
+    QTest::newRow("100 bytes") << 100;
+    QTest::newRow("last chunk") << -1;
+    QTest::newRow("all chunks") << -2;
+    QTest::newRow("chunk table") << -3;
+    QTest::newRow("chunk count") << -4;
+}
+
+void SnapshotCodecTest::truncated()
+{
+    QFETCH(int, cut);
+
+    QVector<float> data;
+    QByteArray encoded = mixedEncoded(data);
+
+    size_t table_size = sizeof(quint32) * 3;
+    size_t size = encoded.size();
+
+    switch(cut){
+    case -1: size -= chunkEntry(encoded, 1) & ~CHUNK_STORED; break;
+    case -2: size = table_size; break;
+    case -3: size = table_size - 1; break;
+    case -4: size = sizeof(quint32) - 1; break;
+    default: size -= cut; break;
+    }
+
+    QVector<float> decoded;
+    QVERIFY(!guardedDecode(encoded.constData(), size, data.size(), nullptr, decoded));
+}
+
+void SnapshotCodecTest::corruptTable_data()
+{
+    QTest::addColumn<int>("position");
+    QTest::addColumn<quint32>("value");
+
+    // Блок 0 хранится без сжатия, блок 1 сжат.
+    QVector<float> data;
+    QByteArray encoded = mixedEncoded(data);
+    quint32 stored_entry = chunkEntry(encoded, 0);
+    quint32 lz_entry = chunkEntry(encoded, 1);
+
+    QTest::newRow("chunk count + 1") << 0 << 3U;
+    QTest::newRow("chunk count - 1") << 0 << 1U;
+    QTest::newRow("chunk count max") << 0 << 0xffffffffU;
+    QTest::newRow("chunk size past end") << 4 << (0x7fffffffU | CHUNK_STORED);
+    QTest::newRow("stored chunk size - 1") << 4 << (stored_entry - 1);
+    QTest::newRow("stored chunk as lz") << 4 << (stored_entry & ~CHUNK_STORED);
+    QTest::newRow("lz chunk as stored") << 8 << (lz_entry | CHUNK_STORED);
+    QTest::newRow("lz chunk empty") << 8 << 0U;
+}
+
+void SnapshotCodecTest::corruptTable()
+{
+    QFETCH(int, position);
+    QFETCH(quint32, value);
+
+    QVector<float> data;
+    QByteArray encoded = mixedEncoded(data);
+
+    qToLittleEndian<quint32>(value, reinterpret_cast<uchar*>(encoded.data()) + position);
+
+    QVector<float> decoded;
+    QVERIFY(!guardedDecode(encoded.constData(), encoded.size(), data.size(), nullptr, decoded));
+}
+
+void SnapshotCodecTest::malformedStream_data()
+{
+    QTest::addColumn<QByteArray>("stream");
+    QTest::addColumn<bool>("valid");
+
+    // Последовательности словарного метода для блока из 4 чисел (16 байт):
+    // байт длин, литералы, смещение совпадения, продолжение длины.
+    QTest::newRow("valid: literal and overlapping match")
+            << QByteArray("\x1b" "a" "\x01\x00", 4) << true;
+    QTest::newRow("match before output start")
+            << QByteArray("\x00" "\x01\x00", 3) << false;
+    QTest::newRow("zero match offset")
+            << QByteArray("\x1b" "a" "\x00\x00", 4) << false;
+    QTest::newRow("match past output end")
+            << QByteArray("\x1f" "a" "\x01\x00" "\x20", 5) << false;
+    QTest::newRow("missing match length")
+            << QByteArray("\x1f" "a" "\x01\x00", 4) << false;
+    QTest::newRow("missing match offset")
+            << QByteArray("\x1b" "a" "\x01", 3) << false;
+    QTest::newRow("missing literals length")
+            << QByteArray("\xf0", 1) << false;
+    QTest::newRow("literals past input end")
+            << QByteArray("\x50" "ab", 3) << false;
+    QTest::newRow("literals past output end")
+            << QByteArray("\xf0" "\x02" "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 38) << false;
+    QTest::newRow("short output")
+            << QByteArray("\x30" "abc", 4) << false;
+}
+
+void SnapshotCodecTest::malformedStream()
+{
+    QFETCH(QByteArray, stream);
+    QFETCH(bool, valid);
+
+    const size_t count = 4;
+
+    // Один сжатый блок.
+    QByteArray encoded(sizeof(quint32) * 2, '\0');
+    qToLittleEndian<quint32>(1, reinterpret_cast<uchar*>(encoded.data()));
+    qToLittleEndian<quint32>(stream.size(), reinterpret_cast<uchar*>(encoded.data()) + sizeof(quint32));
+    encoded.append(stream);
+
+    QVector<float> decoded;
+    QCOMPARE(guardedDecode(encoded.constData(), encoded.size(), count, nullptr, decoded), valid);
+
+    if(valid){
+        // Все байты плоскостей - 'a'.
+        for(size_t i = 0; i < count; i ++){
+            quint32 word;
+            memcpy(&word, decoded.constData() + i, sizeof(quint32));
+            QCOMPARE(word, 0x61616161U);
+        }
+    }
+}
+
+void SnapshotCodecTest::corruptPayload()
+{
+    QVector<float> data;
+    QByteArray encoded = mixedEncoded(data);
+
+    // Данные сжатого блока.
+    size_t begin = sizeof(quint32) * 3 + (chunkEntry(encoded, 0) & ~CHUNK_STORED);
+    size_t end = encoded.size();
+
+    qsrand(1);
+
+    // Повреждённые данные могут распаковаться в другие числа,
+    // но не должны выводить за пределы буферов.
+    for(int i = 0; i < 1000; i ++){
+        QByteArray corrupt = encoded;
+        size_t position = begin + static_cast<size_t>(qrand()) % (end - begin);
+        corrupt[static_cast<int>(position)] = static_cast<char>(qrand());
+
+        QVector<float> decoded;
+        guardedDecode(corrupt.constData(), corrupt.size(), data.size(), nullptr, decoded);
+    }
+}
+
+void SnapshotCodecTest::plummerRatio()
+{
+    // Модель Пламмера в единицах N-тел: радиусы по обратной функции
+    // распределения массы, модули скоростей выборкой с отклонением.
+    const size_t count = PLUMMER_BODIES;
+
+    qsrand(PLUMMER_BODIES);
+
+    QVector<float> masses(count, 1.0f / count);
+    QVector<float> positions(count * 3), velocities(count * 3);
+
+    for(size_t i = 0; i < count; i ++){
+        double r = 1.0 / sqrt(pow(randomUniform(), -2.0 / 3.0) - 1.0);
+
+        double z = 2.0 * randomUniform() - 1.0;
+        double phi = 2.0 * M_PI * randomUniform();
+        double s = sqrt(1.0 - z * z);
+
+        positions[i * 3] = r * s * cos(phi);
+        positions[i * 3 + 1] = r * s * sin(phi);
+        positions[i * 3 + 2] = r * z;
+
+        double q, g;
+        do{
+            q = randomUniform();
+            g = 0.1 * randomUniform();
+        }while(g > q * q * pow(1.0 - q * q, 3.5));
+
+        double v = q * sqrt(2.0) * pow(1.0 + r * r, -0.25);
+
+        z = 2.0 * randomUniform() - 1.0;
+        phi = 2.0 * M_PI * randomUniform();
+        s = sqrt(1.0 - z * z);
+
+        velocities[i * 3] = v * s * cos(phi);
+        velocities[i * 3 + 1] = v * s * sin(phi);
+        velocities[i * 3 + 2] = v * z;
+    }
+
+    // Следующий кадр - позиции после шага.
+    QVector<float> next(count * 3);
+    for(size_t i = 0; i < count * 3; i ++){
+        next[i] = positions[i] + velocities[i] * PLUMMER_DT;
+    }
+
+    QByteArray masses_encoded = SnapshotCodec::encode(masses.constData(), count);
+    QByteArray positions_encoded = SnapshotCodec::encode(positions.constData(), count * 3);
+    QByteArray velocities_encoded = SnapshotCodec::encode(velocities.constData(), count * 3);
+    QByteArray next_encoded = SnapshotCodec::encode(next.constData(), count * 3, positions.constData());
+
+    double vectors_size = count * 3 * sizeof(float);
+
+    double masses_ratio = masses_encoded.size() / static_cast<double>(count * sizeof(float));
+    double key_ratio = (masses_encoded.size() + positions_encoded.size() + velocities_encoded.size()) /
+                       (count * sizeof(float) + vectors_size * 2);
+    double delta_ratio = next_encoded.size() / vectors_size;
+
+    qDebug("masses %.4f, key frame %.4f, delta frame positions %.4f", masses_ratio, key_ratio, delta_ratio);
+
+    QVERIFY2(masses_ratio <= MASSES_RATIO_MAX, qPrintable(QString("masses ratio %1").arg(masses_ratio)));
+    QVERIFY2(key_ratio <= KEY_FRAME_RATIO_MAX, qPrintable(QString("key frame ratio %1").arg(key_ratio)));
+    QVERIFY2(delta_ratio <= DELTA_FRAME_RATIO_MAX, qPrintable(QString("delta frame ratio %1").arg(delta_ratio)));
+
+    // Сжатие без потерь.
+    QVector<float> decoded;
+    QVERIFY(guardedDecode(next_encoded.constData(), next_encoded.size(), count * 3, positions.constData(), decoded));
+    QVERIFY(memcmp(decoded.constData(), next.constData(), count * 3 * sizeof(float)) == 0);
+    QVERIFY(guardedDecode(velocities_encoded.constData(), velocities_encoded.size(), count * 3, nullptr, decoded));
+    QVERIFY(memcmp(decoded.constData(), velocities.constData(), count * 3 * sizeof(float)) == 0);
+}
+
+quint32 SnapshotCodecTest::randomWord()
+{
+    return (static_cast<quint32>(qrand()) << 16) ^ static_cast<quint32>(qrand());
+}
+
+double SnapshotCodecTest::randomUniform()
+{
+    return (qrand() + 0.5) / (RAND_MAX + 1.0);
+}
+
+QVector<float> SnapshotCodecTest::makeData(int kind, size_t count, const QVector<float> &reference)
+{
+    QVector<float> data(count);
+
+    for(size_t i = 0; i < count; i ++){
+        quint32 word = 0;
+        switch(kind){
+        case DATA_RANDOM:
+            word = randomWord();
+            break;
+        case DATA_CONSTANT:
+            word = 0x3f800000U;
+            break;
+        case DATA_NEAR_REFERENCE:
+            memcpy(&word, reference.constData() + i, sizeof(quint32));
+            word ^= randomWord() & 0xff;
+            break;
+        }
+        memcpy(data.data() + i, &word, sizeof(quint32));
+    }
+
+    return data;
+}
+
+bool SnapshotCodecTest::guardedDecode(const char *encoded, size_t size, size_t count,
+                                      const float *reference, QVector<float> &data)
+{
+    QVector<quint32> buffer(count + GUARD_COUNT, GUARD_WORD);
+
+    bool res = SnapshotCodec::decode(encoded, size, reinterpret_cast<float*>(buffer.data()), count, reference);
+
+    for(size_t i = count; i < count + GUARD_COUNT; i ++){
+        if(buffer.at(i) != GUARD_WORD) QTest::qFail("write past output end", __FILE__, __LINE__);
+    }
+
+    data.resize(count);
+    memcpy(data.data(), buffer.constData(), count * sizeof(float));
+
+    return res;
+}
+
+QByteArray SnapshotCodecTest::mixedEncoded(QVector<float> &data)
+{
+    qsrand(SNAPSHOT_CODEC_CHUNK);
+
+    // Блок случайных чисел и неполный блок одного числа.
+    data = makeData(DATA_RANDOM, SNAPSHOT_CODEC_CHUNK) + makeData(DATA_CONSTANT, 1000);
+
+    return SnapshotCodec::encode(data.constData(), data.size());
+}
+
+quint32 SnapshotCodecTest::chunkEntry(const QByteArray &encoded, size_t chunk)
+{
+    return qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(encoded.constData()) +
+                                      sizeof(quint32) * (1 + chunk));
+}
+
+QTEST_MAIN(SnapshotCodecTest)
+
+#include "tst_snapshot_codec.moc"
@@ -0,0 +1,4 @@
+TEMPLATE = subdirs
+
+SUBDIRS += kernel_softening \
+    snapshot_codec
@@ -0,0 +1,435 @@
+#include "trajectoryreader.h"
+#include "trajectoryrecorder.h"
+#include "snapshotcodec.h"
+#include "log.h"
+#include <QDataStream>
+#include <QMutexLocker>
+#include <string.h>
+
+
+#define LOG_WHO "Trajectory Reader"
+
+//! Версия формата траектории без флагов кадров.
+#define TRAJECTORY_VERSION_1 0x100
+
+
+TrajectoryReader::TrajectoryReader(QObject *parent) :
+    QThread(parent)
+{
+    bodies_count = 0;
+    window_frame = 0;
+    window_backward = false;
+    stopping = false;
+    read_error = false;
+    decoded_frame = -1;
+}
+
+TrajectoryReader::~TrajectoryReader()
+{
+    close();
+}
+
+/**
+ * @brief Открывает файл и строит индекс кадров.
+ * @param filename Имя файла.
+ * @return true в случае успеха, иначе false.
+ */
+bool TrajectoryReader::open(const QString &filename)
+{
+    // Закроем предыдущий файл.
+    close();
+
+    file.setFileName(filename);
+    // Если не удалось открыть файл.
+    if(!file.open(QIODevice::ReadOnly)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error open file!"));
+        // Возврат.
+        return false;
+    }
+
+    // Подпись и версия формата файла.
+    quint32 file_magic, file_version;
+
+    // Поток данных.
+    QDataStream ds(&file);
+    // Установим версию,
+    // Это необходимо для корректной сериализации/десериализации.
+    ds.setVersion(QDataStream::Qt_4_8);
+
+    // Считаем подпись и версию формата.
+    ds >> file_magic >> file_version;
+
+    // Если формат некорректен.
+    if(ds.status() != QDataStream::Ok || file_magic != TrajectoryRecorder::magic ||
+       (file_version != TrajectoryRecorder::version && file_version != TRAJECTORY_VERSION_1)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Invalid file format!"));
+        close();
+        // Возврат.
+        return false;
+    }
+
+    qint64 file_size = file.size();
+
+    // Построим индекс по заголовкам кадров.
+    // Недописанный последний кадр пропускается.
+    for(;;){
+        FrameInfo info;
+        info.flags = 0;
+
+        ds >> info.step >> info.count;
+        if(file_version != TRAJECTORY_VERSION_1){
+            ds >> info.flags >> info.size;
+        }else{
+            info.size = static_cast<quint64>(info.count) * sizeof(float) * 7;
+        }
+
+        if(ds.status() != QDataStream::Ok) break;
+
+        info.offset = file.pos();
+
+        if(info.size > static_cast<quint64>(file_size - info.offset)) break;
+
+        // Кадр-разность распаковывается от опорного кадра.
+        if(info.flags & TrajectoryRecorder::FRAME_DELTA){
+            if(frames.isEmpty() || frames.last().count != info.count) break;
+            info.keyframe = frames.last().keyframe;
+        }else{
+            info.keyframe = frames.size();
+        }
+
+        frames.append(info);
+        bodies_count = qMax<size_t>(bodies_count, info.count);
+
+        file.seek(info.offset + info.size);
+    }
+
+    // Если нет ни одного кадра.
+    if(frames.isEmpty() || bodies_count == 0){
+        log(Log::ERROR, LOG_WHO, tr("No frames in file!"));
+        close();
+        return false;
+    }
+
+    log(Log::INFO, LOG_WHO, tr("Trajectory: %1 frames, %2 bodies").arg(frames.size()).arg(bodies_count));
+
+    return true;
+}
+
+/**
+ * @brief Останавливает чтение и закрывает файл.
+ */
+void TrajectoryReader::close()
+{
+    stopReading();
+
+    if(file.isOpen()) file.close();
+
+    frames.clear();
+    bodies_count = 0;
+    encoded.clear();
+    decoded.clear();
+    decoded_next.clear();
+    decoded_frame = -1;
+}
+
+bool TrajectoryReader::isOpen() const
+{
+    return file.isOpen();
+}
+
+size_t TrajectoryReader::framesCount() const
+{
+    return frames.size();
+}
+
+size_t TrajectoryReader::bodiesCount() const
+{
+    return bodies_count;
+}
+
+size_t TrajectoryReader::frameBodiesCount(size_t frame) const
+{
+    return frames.at(frame).count;
+}
+
+quint64 TrajectoryReader::frameStep(size_t frame) const
+{
+    return frames.at(frame).step;
+}
+
+/**
+ * @brief Запускает поток чтения.
+ * @param buffers Буферы кольца.
+ */
+void TrajectoryReader::startReading(const QVector<float *> &buffers)
+{
+    stopReading();
+
+    ring.resize(buffers.size());
+    for(int i = 0; i < ring.size(); i ++){
+        Slot& slot = ring[i];
+        slot.data = buffers.at(i);
+        slot.frame = -1;
+        slot.ready = false;
+        slot.locks = 0;
+    }
+
+    window_frame = 0;
+    window_backward = false;
+    stopping = false;
+    read_error = false;
+
+    start();
+}
+
+/**
+ * @brief Останавливает поток чтения.
+ */
+void TrajectoryReader::stopReading()
+{
+    if(!isRunning()) return;
+
+    mutex.lock();
+    stopping = true;
+    changed.wakeAll();
+    mutex.unlock();
+
+    wait();
+
+    ring.clear();
+}
+
+/**
+ * @brief Задаёт текущий кадр окна загрузки.
+ */
+void TrajectoryReader::request(size_t frame, bool backward)
+{
+    QMutexLocker locker(&mutex);
+
+    if(window_frame == frame && window_backward == backward) return;
+
+    window_frame = frame;
+    window_backward = backward;
+    changed.wakeAll();
+}
+
+/**
+ * @brief Занимает буфер с загруженным кадром.
+ * @return Индекс буфера или -1.
+ */
+int TrajectoryReader::lockFrame(size_t frame)
+{
+    QMutexLocker locker(&mutex);
+
+    for(int i = 0; i < ring.size(); i ++){
+        Slot& slot = ring[i];
+        if(slot.ready && slot.frame == static_cast<qint64>(frame)){
+            slot.locks ++;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Освобождает буфер кадра.
+ */
+void TrajectoryReader::unlockFrame(int slot)
+{
+    QMutexLocker locker(&mutex);
+
+    if(slot < 0 || slot >= ring.size()) return;
+
+    if(ring[slot].locks > 0) ring[slot].locks --;
+    changed.wakeAll();
+}
+
+/**
+ * @brief Получение кадра окна загрузки.
+ * Вперёд: текущий кадр и следующие за ним.
+ * Назад: текущий, следующий для интерполяции
+ * и предшествующие текущему.
+ */
+qint64 TrajectoryReader::windowFrame(size_t index) const
+{
+    qint64 frame;
+
+    if(!window_backward || index == 0){
+        frame = static_cast<qint64>(window_frame) + index;
+    }else if(index == 1){
+        frame = static_cast<qint64>(window_frame) + 1;
+    }else{
+        frame = static_cast<qint64>(window_frame) - static_cast<qint64>(index - 1);
+    }
+
+    if(frame < 0 || frame >= frames.size()) return -1;
+
+    return frame;
+}
+
+bool TrajectoryReader::inWindow(qint64 frame) const
+{
+    if(frame < 0) return false;
+
+    for(int i = 0; i < ring.size(); i ++){
+        if(windowFrame(i) == frame) return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Поиск кадра для загрузки и свободного буфера.
+ */
+bool TrajectoryReader::findWork(int &slot, size_t &frame) const
+{
+    if(read_error) return false;
+
+    for(int i = 0; i < ring.size(); i ++){
+        qint64 wanted = windowFrame(i);
+        if(wanted < 0) continue;
+
+        // Кадр уже загружен или загружается.
+        bool present = false;
+        for(int j = 0; j < ring.size() && !present; j ++){
+            present = ring.at(j).frame == wanted;
+        }
+        if(present) continue;
+
+        // Свободный буфер: не занят владельцем,
+        // не загружается и не нужен окну.
+        for(int j = 0; j < ring.size(); j ++){
+            const Slot& s = ring.at(j);
+            if(s.locks == 0 && (s.frame < 0 || (s.ready && !inWindow(s.frame)))){
+                slot = j;
+                frame = wanted;
+                return true;
+            }
+        }
+
+        // Свободных буферов нет.
+        return false;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Функция потока чтения.
+ */
+void TrajectoryReader::run()
+{
+    for(;;){
+        int slot = -1;
+        size_t frame = 0;
+
+        mutex.lock();
+        while(!stopping && !findWork(slot, frame)){
+            changed.wait(&mutex);
+        }
+        if(stopping){
+            mutex.unlock();
+            break;
+        }
+        ring[slot].frame = frame;
+        ring[slot].ready = false;
+        float* data = ring.at(slot).data;
+        mutex.unlock();
+
+        bool res = readFrame(frame, data);
+
+        mutex.lock();
+        if(res){
+            ring[slot].ready = true;
+        }else{
+            ring[slot].frame = -1;
+            read_error = true;
+        }
+        mutex.unlock();
+
+        if(res){
+            emit frameLoaded();
+        }else{
+            log(Log::WARNING, LOG_WHO, tr("Error reading frame %1!").arg(frame));
+        }
+    }
+}
+
+/**
+ * @brief Считывает позиции кадра.
+ * @param frame Кадр.
+ * @param positions Результат - позиции.
+ * @return true в случае успеха, иначе false.
+ */
+bool TrajectoryReader::readFrame(size_t frame, float *positions)
+{
+    const FrameInfo& info = frames.at(frame);
+
+    qint64 size = static_cast<qint64>(info.count) * sizeof(float) * 3;
+
+    // Позиции несжатого кадра следуют за массами.
+    if(!(info.flags & TrajectoryRecorder::FRAME_COMPRESSED)){
+        return file.seek(info.offset + static_cast<qint64>(info.count) * sizeof(float)) &&
+               file.read(reinterpret_cast<char*>(positions), size) == size;
+    }
+
+    if(decoded_frame != static_cast<qint64>(frame)){
+        // Распакуем от опорного кадра, если предыдущий
+        // распакованный кадр нельзя продолжить.
+        size_t first = info.keyframe;
+        if(decoded_frame >= static_cast<qint64>(info.keyframe) &&
+           decoded_frame < static_cast<qint64>(frame)){
+            first = decoded_frame + 1;
+        }
+
+        for(size_t i = first; i <= frame; i ++){
+            if(!decodeFrame(i)){
+                decoded_frame = -1;
+                return false;
+            }
+        }
+    }
+
+    memcpy(positions, decoded.constData() + info.count, size);
+
+    return true;
+}
+
+/**
+ * @brief Распаковывает сжатый кадр.
+ * @param frame Кадр.
+ * @return true в случае успеха, иначе false.
+ */
+bool TrajectoryReader::decodeFrame(size_t frame)
+{
+    const FrameInfo& info = frames.at(frame);
+
+    size_t values_count = static_cast<size_t>(info.count) * 7;
+    bool delta = (info.flags & TrajectoryRecorder::FRAME_DELTA) != 0;
+
+    // Разность применяется к предыдущему кадру.
+    if(delta && (decoded_frame != static_cast<qint64>(frame) - 1 ||
+                 static_cast<size_t>(decoded.size()) != values_count)){
+        return false;
+    }
+
+    encoded.resize(info.size);
+    if(!file.seek(info.offset) ||
+       file.read(encoded.data(), info.size) != static_cast<qint64>(info.size)){
+        return false;
+    }
+
+    decoded_next.resize(values_count);
+    if(!SnapshotCodec::decode(encoded.constData(), info.size, decoded_next.data(), values_count,
+                              delta ? decoded.constData() : nullptr)){
+        return false;
+    }
+
+    decoded.swap(decoded_next);
+    decoded_frame = frame;
+
+    return true;
+}
@@ -0,0 +1,259 @@
+#ifndef TRAJECTORYREADER_H
+#define TRAJECTORYREADER_H
+
+#include <QThread>
+#include <QString>
+#include <QFile>
+#include <QVector>
+#include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+
+
+/**
+ * @class TrajectoryReader.
+ * @brief Класс чтения файла траектории (*.glxt) для воспроизведения.
+ * При открытии строится индекс кадров, затем поток чтения
+ * заранее загружает позиции кадров вокруг текущего
+ * в кольцо буферов владельца (например, отображённых
+ * буферов OpenGL). Буфер, занятый владельцем для отрисовки,
+ * не перезаписывается до освобождения.
+ * Сжатые кадры-разности распаковываются от ближайшего
+ * опорного кадра.
+ */
+class TrajectoryReader : public QThread
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief Конструктор.
+     * @param parent Объект-родитель.
+     */
+    explicit TrajectoryReader(QObject *parent = 0);
+
+    /**
+     * @brief Деструктор.
+     */
+    ~TrajectoryReader();
+
+    /**
+     * @brief Открывает файл и строит индекс кадров.
+     * @param filename Имя файла.
+     * @return true в случае успеха, иначе false.
+     */
+    bool open(const QString& filename);
+
+    /**
+     * @brief Останавливает чтение и закрывает файл.
+     */
+    void close();
+
+    /**
+     * @brief Получение флага открытия файла.
+     * @return Флаг открытия файла.
+     */
+    bool isOpen() const;
+
+    /**
+     * @brief Получение числа кадров.
+     * @return Число кадров.
+     */
+    size_t framesCount() const;
+
+    /**
+     * @brief Получение наибольшего числа тел в кадре.
+     * @return Число тел.
+     */
+    size_t bodiesCount() const;
+
+    /**
+     * @brief Получение числа тел кадра.
+     * @param frame Кадр.
+     * @return Число тел.
+     */
+    size_t frameBodiesCount(size_t frame) const;
+
+    /**
+     * @brief Получение номера шага кадра.
+     * @param frame Кадр.
+     * @return Номер шага.
+     */
+    quint64 frameStep(size_t frame) const;
+
+    /**
+     * @brief Запускает поток чтения.
+     * @param buffers Буферы кольца, каждый
+     * на bodiesCount() позиций (x, y, z).
+     */
+    void startReading(const QVector<float*>& buffers);
+
+    /**
+     * @brief Останавливает поток чтения.
+     */
+    void stopReading();
+
+    /**
+     * @brief Задаёт текущий кадр, вокруг которого
+     * загружаются кадры.
+     * @param frame Кадр.
+     * @param backward Флаг воспроизведения в обратную сторону.
+     */
+    void request(size_t frame, bool backward);
+
+    /**
+     * @brief Занимает буфер с загруженным кадром.
+     * @param frame Кадр.
+     * @return Индекс буфера или -1, если кадр ещё не загружен.
+     */
+    int lockFrame(size_t frame);
+
+    /**
+     * @brief Освобождает буфер кадра.
+     * @param slot Индекс буфера.
+     */
+    void unlockFrame(int slot);
+
+signals:
+    /**
+     * @brief Сигнал загрузки кадра.
+     */
+    void frameLoaded();
+
+protected:
+    /**
+     * @brief Функция потока чтения.
+     */
+    void run();
+
+private:
+    /**
+     * @brief Запись индекса кадров.
+     */
+    struct FrameInfo {
+        qint64 offset; //!< Смещение данных кадра.
+        quint64 step; //!< Номер шага.
+        quint32 count; //!< Число тел.
+        quint32 flags; //!< Флаги кадра.
+        quint64 size; //!< Размер данных.
+        size_t keyframe; //!< Опорный кадр.
+    };
+
+    /**
+     * @brief Буфер кольца.
+     */
+    struct Slot {
+        float* data; //!< Позиции.
+        qint64 frame; //!< Кадр или -1.
+        bool ready; //!< Признак окончания загрузки.
+        int locks; //!< Число захватов владельцем.
+    };
+
+    /**
+     * @brief Получение кадра окна загрузки.
+     * @param index Номер кадра в окне по приоритету.
+     * @return Кадр или -1.
+     */
+    qint64 windowFrame(size_t index) const;
+
+    /**
+     * @brief Получение флага попадания кадра в окно загрузки.
+     * @param frame Кадр.
+     * @return Флаг попадания в окно.
+     */
+    bool inWindow(qint64 frame) const;
+
+    /**
+     * @brief Поиск кадра для загрузки и свободного буфера.
+     * @param slot Результат - индекс буфера.
+     * @param frame Результат - кадр.
+     * @return true если есть что загружать, иначе false.
+     */
+    bool findWork(int& slot, size_t& frame) const;
+
+    /**
+     * @brief Считывает позиции кадра.
+     * @param frame Кадр.
+     * @param positions Результат - позиции.
+     * @return true в случае успеха, иначе false.
+     */
+    bool readFrame(size_t frame, float* positions);
+
+    /**
+     * @brief Распаковывает сжатый кадр
+     * в данные последнего распакованного кадра.
+     * @param frame Кадр.
+     * @return true в случае успеха, иначе false.
+     */
+    bool decodeFrame(size_t frame);
+
+    /**
+     * @brief Файл траектории.
+     */
+    QFile file;
+
+    /**
+     * @brief Индекс кадров.
+     */
+    QVector<FrameInfo> frames;
+
+    /**
+     * @brief Наибольшее число тел в кадре.
+     */
+    size_t bodies_count;
+
+    /**
+     * @brief Буферы кольца.
+     */
+    QVector<Slot> ring;
+
+    /**
+     * @brief Текущий кадр окна загрузки.
+     */
+    size_t window_frame;
+
+    /**
+     * @brief Флаг воспроизведения в обратную сторону.
+     */
+    bool window_backward;
+
+    /**
+     * @brief Флаг завершения потока чтения.
+     */
+    bool stopping;
+
+    /**
+     * @brief Флаг ошибки чтения.
+     */
+    bool read_error;
+
+    /**
+     * @brief Сжатые данные кадра.
+     * Используются только потоком чтения.
+     */
+    QByteArray encoded;
+
+    /**
+     * @brief Данные последнего распакованного кадра
+     * и буфер распаковки следующего.
+     * Используются только потоком чтения.
+     */
+    QVector<float> decoded;
+    QVector<float> decoded_next;
+
+    /**
+     * @brief Последний распакованный кадр или -1.
+     */
+    qint64 decoded_frame;
+
+    /**
+     * @brief Мьютекс буферов и окна загрузки.
+     */
+    mutable QMutex mutex;
+
+    /**
+     * @brief Условие изменения буферов или окна загрузки.
+     */
+    QWaitCondition changed;
+};
+
+#endif // TRAJECTORYREADER_H
@@ -0,0 +1,278 @@
+#include "trajectoryrecorder.h"
+#include "clevent.h"
+#include "clexception.h"
+#include "snapshotcodec.h"
+#include "log.h"
+#include <QDataStream>
+#include <QMutexLocker>
+#include <string.h>
+
+
+#define LOG_WHO "Trajectory Recorder"
+
+
+TrajectoryRecorder::TrajectoryRecorder(QObject *parent) :
+    QThread(parent)
+{
+    frame_interval = 1;
+    compress_frames = false;
+    next_slot = 0;
+    frames_written = 0;
+    stopping = false;
+    write_error = false;
+    for(size_t i = 0; i < TRAJECTORY_SLOTS_COUNT; i ++){
+        slot_busy[i] = false;
+    }
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+    close();
+}
+
+/**
+ * @brief Создаёт файл и запускает поток записи.
+ * @param filename Имя файла.
+ * @param interval Число шагов между кадрами.
+ * @param compress Флаг сжатия кадров.
+ * @return true в случае успеха, иначе false.
+ */
+bool TrajectoryRecorder::open(const QString &filename, size_t interval, bool compress)
+{
+    // Закроем предыдущий файл.
+    close();
+
+    file.setFileName(filename);
+    // Если не удалось открыть файл.
+    if(!file.open(QIODevice::WriteOnly)){
+        // Сообщим об этом.
+        log(Log::ERROR, LOG_WHO, tr("Error open file!"));
+        // Возврат.
+        return false;
+    }
+
+    // Поток данных.
+    QDataStream ds(&file);
+    // Установим версию,
+    // Это необходимо для корректной сериализации/десериализации.
+    ds.setVersion(QDataStream::Qt_4_8);
+
+    // Запишем в файл подпись и версию формата.
+    ds << magic << version;
+
+    // Если не удалось записать.
+    if(ds.status() != QDataStream::Ok){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, tr("Error writing data!"));
+        file.close();
+        // Возврат.
+        return false;
+    }
+
+    frame_interval = qMax<size_t>(interval, 1);
+    compress_frames = compress;
+    previous_frame.clear();
+    next_slot = 0;
+    frames_written = 0;
+    stopping = false;
+    write_error = false;
+    for(size_t i = 0; i < TRAJECTORY_SLOTS_COUNT; i ++){
+        slot_busy[i] = false;
+    }
+
+    // Запустим поток записи.
+    start();
+
+    log(Log::INFO, LOG_WHO, tr("Recording trajectory: %1 (every %2 steps)").arg(filename).arg(frame_interval));
+
+    return true;
+}
+
+/**
+ * @brief Дописывает оставшиеся кадры и закрывает файл.
+ */
+void TrajectoryRecorder::close()
+{
+    if(!file.isOpen()) return;
+
+    // Остановим поток после записи очереди.
+    mutex.lock();
+    stopping = true;
+    changed.wakeAll();
+    mutex.unlock();
+
+    wait();
+
+    file.close();
+
+    log(Log::INFO, LOG_WHO, tr("Trajectory saved: %1 frames").arg(frames_written));
+}
+
+bool TrajectoryRecorder::isOpen() const
+{
+    return file.isOpen();
+}
+
+size_t TrajectoryRecorder::interval() const
+{
+    return frame_interval;
+}
+
+quint64 TrajectoryRecorder::framesCount() const
+{
+    QMutexLocker locker(&mutex);
+    return frames_written;
+}
+
+/**
+ * @brief Получение следующего свободного буфера кадра.
+ * Кадры записываются по порядку, поэтому буферы
+ * освобождаются по кругу.
+ * @return Индекс буфера или -1 в случае ошибки записи.
+ */
+int TrajectoryRecorder::acquireSlot()
+{
+    QMutexLocker locker(&mutex);
+
+    if(!isRunning() || stopping) return -1;
+
+    // Поток записи отстаёт - подождём.
+    while(slot_busy[next_slot] && !write_error){
+        changed.wait(&mutex);
+    }
+
+    if(write_error) return -1;
+
+    int slot = next_slot;
+    next_slot = (next_slot + 1) % TRAJECTORY_SLOTS_COUNT;
+
+    return slot;
+}
+
+/**
+ * @brief Передаёт кадр потоку записи.
+ */
+void TrajectoryRecorder::submit(int slot, const float *data, size_t count, quint64 step, const CLEvent *event)
+{
+    Frame frame;
+    frame.slot = slot;
+    frame.data = data;
+    frame.count = count;
+    frame.step = step;
+    frame.event = event;
+
+    QMutexLocker locker(&mutex);
+
+    slot_busy[slot] = true;
+    frames.enqueue(frame);
+    changed.wakeAll();
+}
+
+/**
+ * @brief Ожидает записи всех переданных кадров.
+ */
+void TrajectoryRecorder::flush()
+{
+    QMutexLocker locker(&mutex);
+
+    while(!frames.isEmpty() && isRunning()){
+        changed.wait(&mutex);
+    }
+}
+
+/**
+ * @brief Функция потока записи.
+ */
+void TrajectoryRecorder::run()
+{
+    for(;;){
+        mutex.lock();
+        while(frames.isEmpty() && !stopping){
+            changed.wait(&mutex);
+        }
+        // Очередь записана и запись завершается.
+        if(frames.isEmpty()){
+            mutex.unlock();
+            break;
+        }
+        // Кадр остаётся в очереди до окончания записи,
+        // его буфер занят.
+        Frame frame = frames.head();
+        bool skip = write_error;
+        mutex.unlock();
+
+        bool res = skip || writeFrame(frame);
+
+        mutex.lock();
+        frames.dequeue();
+        slot_busy[frame.slot] = false;
+        if(!skip){
+            if(res) frames_written ++;
+            else write_error = true;
+        }
+        changed.wakeAll();
+        mutex.unlock();
+    }
+
+    // Разбудим ожидающих освобождения буферов.
+    mutex.lock();
+    changed.wakeAll();
+    mutex.unlock();
+}
+
+/**
+ * @brief Записывает кадр в файл.
+ * @param frame Кадр.
+ * @return true в случае успеха, иначе false.
+ */
+bool TrajectoryRecorder::writeFrame(const Frame &frame)
+{
+    // Дождёмся чтения данных с устройства.
+    if(frame.event != nullptr && frame.event->isValid()){
+        try{
+            frame.event->wait();
+        }catch(CLException& e){
+            log(Log::ERROR, LOG_WHO, e.what());
+            return false;
+        }
+    }
+
+    // Число чисел кадра.
+    size_t values_count = frame.count * 7;
+
+    quint32 flags = 0;
+    QByteArray encoded;
+    const char* data = reinterpret_cast<const char*>(frame.data);
+    size_t size = values_count * sizeof(float);
+
+    if(compress_frames){
+        // Опорный кадр сжимается без разности.
+        bool delta = static_cast<size_t>(previous_frame.size()) == values_count &&
+                     frames_written % TRAJECTORY_KEYFRAME_INTERVAL != 0;
+
+        encoded = SnapshotCodec::encode(frame.data, values_count, delta ? previous_frame.constData() : nullptr);
+        data = encoded.constData();
+        size = encoded.size();
+        flags = FRAME_COMPRESSED | (delta ? FRAME_DELTA : 0);
+
+        previous_frame.resize(values_count);
+        memcpy(previous_frame.data(), frame.data, values_count * sizeof(float));
+    }
+
+    // Поток данных.
+    QDataStream ds(&file);
+    ds.setVersion(QDataStream::Qt_4_8);
+
+    // Номер шага, число тел, флаги и размер данных кадра.
+    ds << frame.step << static_cast<quint32>(frame.count) << flags << static_cast<quint64>(size);
+
+    // Если неудалось записать заголовок или данные кадра.
+    if(ds.status() != QDataStream::Ok || ds.writeRawData(data, size) == -1){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, tr("Error writing data!"));
+        // Возврат.
+        return false;
+    }
+
+    return true;
+}
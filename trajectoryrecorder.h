@@ -0,0 +1,210 @@
+#ifndef TRAJECTORYRECORDER_H
+#define TRAJECTORYRECORDER_H
+
+#include <QThread>
+#include <QString>
+#include <QFile>
+#include <QQueue>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+
+class CLEvent;
+
+
+//! Число буферов кадров записи траектории.
+#define TRAJECTORY_SLOTS_COUNT 3
+
+//! Число кадров между опорными кадрами сжатой траектории.
+#define TRAJECTORY_KEYFRAME_INTERVAL 16
+
+
+/**
+ * @class TrajectoryRecorder.
+ * @brief Класс записи траектории системы в файл (*.glxt).
+ * Файл содержит подпись и версию формата, затем кадры,
+ * дописываемые в конец: номер шага, число тел, флаги кадра,
+ * размер данных и данные - массы, позиции и векторы скоростей.
+ * Данные сжатого кадра сжаты SnapshotCodec, кадры между
+ * опорными - XOR-разностью с предыдущим кадром.
+ * Данные кадров находятся в кольце буферов владельца,
+ * запись выполняется отдельным потоком по готовности
+ * события чтения данных с устройства.
+ */
+class TrajectoryRecorder : public QThread
+{
+    Q_OBJECT
+public:
+
+    /**
+     * @brief Подпись формата файла.
+     */
+    static const quint32 magic = 0x474c5854;
+
+    /**
+     * @brief Версия формата файла.
+     */
+    static const quint32 version = 0x200;
+
+    /**
+     * @brief Флаги кадра.
+     */
+    enum FrameFlag {
+        FRAME_COMPRESSED = 1, //!< Данные сжаты.
+        FRAME_DELTA = 2 //!< Данные сжаты разностью с предыдущим кадром.
+    };
+
+    /**
+     * @brief Конструктор.
+     * @param parent Объект-родитель.
+     */
+    explicit TrajectoryRecorder(QObject *parent = 0);
+
+    /**
+     * @brief Деструктор.
+     */
+    ~TrajectoryRecorder();
+
+    /**
+     * @brief Создаёт файл и запускает поток записи.
+     * @param filename Имя файла.
+     * @param interval Число шагов между кадрами.
+     * @param compress Флаг сжатия кадров.
+     * @return true в случае успеха, иначе false.
+     */
+    bool open(const QString& filename, size_t interval, bool compress = false);
+
+    /**
+     * @brief Дописывает оставшиеся кадры и закрывает файл.
+     */
+    void close();
+
+    /**
+     * @brief Получение флага записи.
+     * @return Флаг записи.
+     */
+    bool isOpen() const;
+
+    /**
+     * @brief Получение числа шагов между кадрами.
+     * @return Число шагов между кадрами.
+     */
+    size_t interval() const;
+
+    /**
+     * @brief Получение числа записанных кадров.
+     * @return Число записанных кадров.
+     */
+    quint64 framesCount() const;
+
+    /**
+     * @brief Получение следующего свободного буфера кадра.
+     * Если все буферы ещё записываются - ожидает освобождения.
+     * @return Индекс буфера или -1 в случае ошибки записи.
+     */
+    int acquireSlot();
+
+    /**
+     * @brief Передаёт кадр потоку записи.
+     * @param slot Индекс буфера кадра.
+     * @param data Данные: массы, позиции (x, y, z), скорости (x, y, z).
+     * @param count Число тел.
+     * @param step Номер шага.
+     * @param event Событие готовности данных или nullptr.
+     * Событие должно существовать до освобождения буфера кадра.
+     */
+    void submit(int slot, const float* data, size_t count, quint64 step, const CLEvent* event);
+
+    /**
+     * @brief Ожидает записи всех переданных кадров.
+     */
+    void flush();
+
+protected:
+    /**
+     * @brief Функция потока записи.
+     */
+    void run();
+
+private:
+    /**
+     * @brief Кадр в очереди записи.
+     */
+    struct Frame {
+        int slot; //!< Индекс буфера.
+        const float* data; //!< Данные.
+        size_t count; //!< Число тел.
+        quint64 step; //!< Номер шага.
+        const CLEvent* event; //!< Событие готовности данных.
+    };
+
+    /**
+     * @brief Записывает кадр в файл.
+     * @param frame Кадр.
+     * @return true в случае успеха, иначе false.
+     */
+    bool writeFrame(const Frame& frame);
+
+    /**
+     * @brief Файл траектории.
+     */
+    QFile file;
+
+    /**
+     * @brief Число шагов между кадрами.
+     */
+    size_t frame_interval;
+
+    /**
+     * @brief Флаг сжатия кадров.
+     */
+    bool compress_frames;
+
+    /**
+     * @brief Данные предыдущего кадра для сжатия разностью.
+     * Используются только потоком записи.
+     */
+    QVector<float> previous_frame;
+
+    /**
+     * @brief Очередь кадров на запись.
+     */
+    QQueue<Frame> frames;
+
+    /**
+     * @brief Флаги занятости буферов кадров.
+     */
+    bool slot_busy[TRAJECTORY_SLOTS_COUNT];
+
+    /**
+     * @brief Индекс следующего буфера кадра.
+     */
+    int next_slot;
+
+    /**
+     * @brief Число записанных кадров.
+     */
+    quint64 frames_written;
+
+    /**
+     * @brief Флаг завершения потока записи.
+     */
+    bool stopping;
+
+    /**
+     * @brief Флаг ошибки записи.
+     */
+    bool write_error;
+
+    /**
+     * @brief Мьютекс очереди и буферов кадров.
+     */
+    mutable QMutex mutex;
+
+    /**
+     * @brief Условие изменения очереди или буферов кадров.
+     */
+    QWaitCondition changed;
+};
+
+#endif // TRAJECTORYRECORDER_H
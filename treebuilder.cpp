@@ -0,0 +1,372 @@
+#include "treebuilder.h"
+#include "log.h"
+#include "octree.h"
+#include "clcontext.h"
+#include "cldevice.h"
+#include "clprogram.h"
+#include "clcommandqueue.h"
+#include "clbuffer.h"
+#include "clkernel.h"
+#include "clexception.h"
+#include <algorithm>
+
+
+#define LOG_WHO "TreeBuilder"
+
+//! Число значений разряда поразрядной сортировки.
+#define RADIX_DIGITS 16
+//! Число бит разряда поразрядной сортировки.
+#define RADIX_BITS 4
+//! Максимальный размер рабочей группы.
+#define TREE_LOCAL_SIZE_MAX 256
+//! Максимальное число групп поразрядной сортировки.
+#define TREE_RADIX_GROUPS_MAX 1024
+//! Минимальное число порций ключей на группу сортировки.
+#define TREE_RADIX_TILES_PER_GROUP 4
+
+
+
+TreeBuilder::TreeBuilder(QObject *parent) :
+    QObject(parent)
+{
+    is_valid = false;
+    bodies_count = 0;
+    key_size = 0;
+    radix_passes = 0;
+    local_size = 0;
+    bounds_groups = 0;
+    radix_groups = 0;
+
+    kernel_bounds = new CLKernel();
+    kernel_bounds_merge = new CLKernel();
+    kernel_morton = new CLKernel();
+    kernel_histogram = new CLKernel();
+    kernel_scan = new CLKernel();
+    kernel_scatter = new CLKernel();
+    kernel_internal = new CLKernel();
+    kernel_summarize = new CLKernel();
+
+    for(size_t i = 0; i < 2; i ++){
+        keys_buf[i] = new CLBuffer();
+        values_buf[i] = new CLBuffer();
+    }
+    hist_buf = new CLBuffer();
+    partial_buf = new CLBuffer();
+    bounds_buf = new CLBuffer();
+    parents_buf = new CLBuffer();
+    split_buf = new CLBuffer();
+    last_buf = new CLBuffer();
+    flags_buf = new CLBuffer();
+    boxes_buf = new CLBuffer();
+    nodes_buf = new CLBuffer();
+}
+
+TreeBuilder::~TreeBuilder()
+{
+    destroy();
+
+    delete kernel_bounds;
+    delete kernel_bounds_merge;
+    delete kernel_morton;
+    delete kernel_histogram;
+    delete kernel_scan;
+    delete kernel_scatter;
+    delete kernel_internal;
+    delete kernel_summarize;
+
+    for(size_t i = 0; i < 2; i ++){
+        delete keys_buf[i];
+        delete values_buf[i];
+    }
+    delete hist_buf;
+    delete partial_buf;
+    delete bounds_buf;
+    delete parents_buf;
+    delete split_buf;
+    delete last_buf;
+    delete flags_buf;
+    delete boxes_buf;
+    delete nodes_buf;
+}
+
+/**
+ * @brief Создаёт ядра и буферы построения дерева.
+ * @param cxt Контекст OpenCL.
+ * @param device Устройство OpenCL.
+ * @param program Скомпилированная программа OpenCL.
+ * @param bodies Максимальное число тел.
+ * @param morton64 Флаг использования 63-битных кодов Мортона.
+ * @return true в случае успеха, иначе false.
+ */
+bool TreeBuilder::create(const CLContext &cxt, const CLDevice &device, const CLProgram &program,
+                         size_t bodies, bool morton64)
+{
+    // Уничтожим ранее созданное.
+    destroy();
+
+    if(bodies == 0) return false;
+
+    bodies_count = bodies;
+    key_size = morton64 ? sizeof(cl_ulong) : sizeof(cl_uint);
+    // Число проходов чётно - результат сортировки
+    // всегда оказывается в первых буферах.
+    radix_passes = key_size * 8 / RADIX_BITS;
+
+    try{
+        // Создадим ядра.
+        kernel_bounds->create(program, "kernel_tree_bounds");
+        kernel_bounds_merge->create(program, "kernel_tree_bounds_merge");
+        kernel_morton->create(program, "kernel_tree_morton");
+        kernel_histogram->create(program, "kernel_radix_histogram");
+        kernel_scan->create(program, "kernel_radix_scan");
+        kernel_scatter->create(program, "kernel_radix_scatter");
+        kernel_internal->create(program, "kernel_tree_internal");
+        kernel_summarize->create(program, "kernel_tree_summarize");
+
+        // Выберем размер рабочей группы -
+        // наибольшую степень двойки, допустимую для всех ядер.
+        size_t max_local = std::min(static_cast<size_t>(TREE_LOCAL_SIZE_MAX), device.maxWorkGroupSize());
+        max_local = std::min(max_local, kernel_bounds->workGroupSize(device));
+        max_local = std::min(max_local, kernel_bounds_merge->workGroupSize(device));
+        max_local = std::min(max_local, kernel_morton->workGroupSize(device));
+        max_local = std::min(max_local, kernel_histogram->workGroupSize(device));
+        max_local = std::min(max_local, kernel_scan->workGroupSize(device));
+        max_local = std::min(max_local, kernel_scatter->workGroupSize(device));
+
+        local_size = 1;
+        while(local_size * 2 <= max_local) local_size *= 2;
+
+        // Если группа меньше числа значений разряда.
+        if(local_size < RADIX_DIGITS){
+            // Сообщим об этом.
+            log(Log::WARNING, LOG_WHO, tr("Work group size %1 is too small for device tree build").arg(local_size));
+            destroy();
+            return false;
+        }
+
+        // Число групп для вычисления границ.
+        bounds_groups = std::min((bodies_count + local_size - 1) / local_size,
+                                 static_cast<size_t>(device.maxComputeUnits()) * 4);
+        if(bounds_groups == 0) bounds_groups = 1;
+
+        // Число групп сортировки.
+        radix_groups = std::min((bodies_count + local_size - 1) / local_size,
+                                static_cast<size_t>(TREE_RADIX_GROUPS_MAX));
+        if(radix_groups == 0) radix_groups = 1;
+
+        // Создадим буферы.
+        size_t nodes_count = bodies_count * 2 - 1;
+
+        bool res = createBuffer(cxt, keys_buf[0], bodies_count * key_size) &&
+                   createBuffer(cxt, keys_buf[1], bodies_count * key_size) &&
+                   createBuffer(cxt, values_buf[0], bodies_count * sizeof(cl_int)) &&
+                   createBuffer(cxt, values_buf[1], bodies_count * sizeof(cl_int)) &&
+                   createBuffer(cxt, hist_buf, radix_groups * RADIX_DIGITS * sizeof(cl_uint)) &&
+                   createBuffer(cxt, partial_buf, bounds_groups * 2 * sizeof(cl_float4)) &&
+                   createBuffer(cxt, bounds_buf, 2 * sizeof(cl_float4)) &&
+                   createBuffer(cxt, parents_buf, nodes_count * sizeof(cl_int)) &&
+                   createBuffer(cxt, split_buf, bodies_count * sizeof(cl_int)) &&
+                   createBuffer(cxt, last_buf, bodies_count * sizeof(cl_int)) &&
+                   createBuffer(cxt, flags_buf, bodies_count * sizeof(cl_int)) &&
+                   createBuffer(cxt, boxes_buf, nodes_count * 2 * sizeof(cl_float4)) &&
+                   createBuffer(cxt, nodes_buf, nodes_count * sizeof(Octree::Node));
+
+        if(!res){
+            log(Log::ERROR, LOG_WHO, tr("Error creating tree buffers"));
+            destroy();
+            return false;
+        }
+
+        // Установим неизменяемые аргументы.
+        kernel_bounds->setArg<cl_mem>(2, partial_buf->id());
+        kernel_bounds->setLocalArgSize(3, local_size * sizeof(cl_float4));
+        kernel_bounds->setLocalArgSize(4, local_size * sizeof(cl_float4));
+
+        kernel_bounds_merge->setArg<cl_uint>(0, bounds_groups);
+        kernel_bounds_merge->setArg<cl_mem>(1, partial_buf->id());
+        kernel_bounds_merge->setArg<cl_mem>(2, bounds_buf->id());
+        kernel_bounds_merge->setLocalArgSize(3, local_size * sizeof(cl_float4));
+        kernel_bounds_merge->setLocalArgSize(4, local_size * sizeof(cl_float4));
+
+        kernel_morton->setArg<cl_mem>(2, bounds_buf->id());
+        kernel_morton->setArg<cl_mem>(3, keys_buf[0]->id());
+        kernel_morton->setArg<cl_mem>(4, values_buf[0]->id());
+
+        kernel_histogram->setArg<cl_mem>(4, hist_buf->id());
+
+        kernel_scan->setArg<cl_mem>(1, hist_buf->id());
+        kernel_scan->setLocalArgSize(2, local_size * sizeof(cl_uint));
+
+        kernel_scatter->setArg<cl_mem>(7, hist_buf->id());
+        kernel_scatter->setLocalArgSize(8, local_size * key_size);
+        kernel_scatter->setLocalArgSize(9, local_size * sizeof(cl_int));
+        kernel_scatter->setLocalArgSize(10, local_size * sizeof(cl_uint));
+
+        kernel_internal->setArg<cl_mem>(1, keys_buf[0]->id());
+        kernel_internal->setArg<cl_mem>(2, nodes_buf->id());
+        kernel_internal->setArg<cl_mem>(3, parents_buf->id());
+        kernel_internal->setArg<cl_mem>(4, split_buf->id());
+        kernel_internal->setArg<cl_mem>(5, last_buf->id());
+        kernel_internal->setArg<cl_mem>(6, flags_buf->id());
+
+        kernel_summarize->setArg<cl_mem>(3, values_buf[0]->id());
+        kernel_summarize->setArg<cl_mem>(4, nodes_buf->id());
+        kernel_summarize->setArg<cl_mem>(5, boxes_buf->id());
+        kernel_summarize->setArg<cl_mem>(6, parents_buf->id());
+        kernel_summarize->setArg<cl_mem>(7, split_buf->id());
+        kernel_summarize->setArg<cl_mem>(8, last_buf->id());
+        kernel_summarize->setArg<cl_mem>(9, flags_buf->id());
+
+    }// Если произошла ошибка.
+    catch(CLException& e){
+        // Сообщим об этом.
+        log(Log::WARNING, LOG_WHO, e.what());
+        destroy();
+        return false;
+    }
+
+    log(Log::INFO, LOG_WHO, tr("Device tree build: %1-bit Morton codes, work group size %2")
+                            .arg(morton64 ? 63 : 30).arg(local_size));
+
+    is_valid = true;
+
+    return true;
+}
+
+bool TreeBuilder::destroy()
+{
+    is_valid = false;
+
+    CLKernel* kernels[] = {kernel_bounds, kernel_bounds_merge, kernel_morton, kernel_histogram,
+                           kernel_scan, kernel_scatter, kernel_internal, kernel_summarize};
+    CLBuffer* buffers[] = {keys_buf[0], keys_buf[1], values_buf[0], values_buf[1],
+                           hist_buf, partial_buf, bounds_buf, parents_buf, split_buf,
+                           last_buf, flags_buf, boxes_buf, nodes_buf};
+
+    for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i ++){
+        try{
+            if(kernels[i]->isValid()) kernels[i]->release();
+        }catch(CLException& e){
+            log(Log::WARNING, LOG_WHO, e.what());
+        }
+    }
+
+    for(size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); i ++){
+        try{
+            if(buffers[i]->isValid()) buffers[i]->release();
+        }catch(CLException& e){
+            log(Log::WARNING, LOG_WHO, e.what());
+        }
+    }
+
+    return true;
+}
+
+bool TreeBuilder::isValid() const
+{
+    return is_valid;
+}
+
+/**
+ * @brief Ставит в очередь построение дерева.
+ * @param queue Очередь команд OpenCL.
+ * @param positions Буфер позиций тел.
+ * @param masses Буфер масс тел.
+ * @param count Число тел.
+ * @return true в случае успеха, иначе false.
+ */
+bool TreeBuilder::enqueueBuild(const CLCommandQueue &queue, const CLBuffer &positions,
+                               const CLBuffer &masses, size_t count)
+{
+    if(!is_valid || count == 0 || count > bodies_count) return false;
+
+    size_t global_size = 0;
+
+    // Ограничивающий параллелепипед.
+    kernel_bounds->setArg<cl_uint>(0, count);
+    kernel_bounds->setArg<cl_mem>(1, positions.id());
+    global_size = bounds_groups * local_size;
+    kernel_bounds->execute(queue, 1, &global_size, &local_size);
+
+    global_size = local_size;
+    kernel_bounds_merge->execute(queue, 1, &global_size, &local_size);
+
+    // Коды Мортона.
+    kernel_morton->setArg<cl_uint>(0, count);
+    kernel_morton->setArg<cl_mem>(1, positions.id());
+    global_size = (count + local_size - 1) / local_size * local_size;
+    kernel_morton->execute(queue, 1, &global_size, &local_size);
+
+    // Поразрядная сортировка.
+    // Число групп - чтобы каждой досталось несколько порций ключей.
+    size_t groups = (count + local_size * TREE_RADIX_TILES_PER_GROUP - 1) /
+                    (local_size * TREE_RADIX_TILES_PER_GROUP);
+    groups = std::max(static_cast<size_t>(1), std::min(groups, radix_groups));
+    cl_uint block_size = (count + groups - 1) / groups;
+
+    kernel_histogram->setArg<cl_uint>(0, count);
+    kernel_histogram->setArg<cl_uint>(3, block_size);
+    kernel_scan->setArg<cl_uint>(0, groups * RADIX_DIGITS);
+    kernel_scatter->setArg<cl_uint>(0, count);
+    kernel_scatter->setArg<cl_uint>(6, block_size);
+
+    size_t src = 0;
+    for(size_t pass = 0; pass < radix_passes; pass ++){
+        size_t dst = 1 - src;
+        cl_uint shift = pass * RADIX_BITS;
+
+        kernel_histogram->setArg<cl_mem>(1, keys_buf[src]->id());
+        kernel_histogram->setArg<cl_uint>(2, shift);
+        global_size = groups * local_size;
+        kernel_histogram->execute(queue, 1, &global_size, &local_size);
+
+        global_size = local_size;
+        kernel_scan->execute(queue, 1, &global_size, &local_size);
+
+        kernel_scatter->setArg<cl_mem>(1, keys_buf[src]->id());
+        kernel_scatter->setArg<cl_mem>(2, values_buf[src]->id());
+        kernel_scatter->setArg<cl_mem>(3, keys_buf[dst]->id());
+        kernel_scatter->setArg<cl_mem>(4, values_buf[dst]->id());
+        kernel_scatter->setArg<cl_uint>(5, shift);
+        global_size = groups * local_size;
+        kernel_scatter->execute(queue, 1, &global_size, &local_size);
+
+        src = dst;
+    }
+
+    // Внутренние узлы.
+    if(count > 1){
+        kernel_internal->setArg<cl_int>(0, count);
+        global_size = count - 1;
+        kernel_internal->execute(queue, 1, &global_size, nullptr);
+    }
+
+    // Листья, центры масс и размеры узлов.
+    kernel_summarize->setArg<cl_int>(0, count);
+    kernel_summarize->setArg<cl_mem>(1, positions.id());
+    kernel_summarize->setArg<cl_mem>(2, masses.id());
+    global_size = count;
+    kernel_summarize->execute(queue, 1, &global_size, nullptr);
+
+    return true;
+}
+
+CLBuffer *TreeBuilder::nodesBuffer()
+{
+    return nodes_buf;
+}
+
+CLBuffer *TreeBuilder::indicesBuffer()
+{
+    return values_buf[0];
+}
+
+CLBuffer *TreeBuilder::parentsBuffer()
+{
+    return parents_buf;
+}
+
+bool TreeBuilder::createBuffer(const CLContext &cxt, CLBuffer *buf, size_t size)
+{
+    return buf->create(cxt, CL_MEM_READ_WRITE, size, nullptr);
+}
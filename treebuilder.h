@@ -0,0 +1,208 @@
+#ifndef TREEBUILDER_H
+#define TREEBUILDER_H
+
+#include <QObject>
+#include <stddef.h>
+
+
+class CLContext;
+class CLDevice;
+class CLProgram;
+class CLCommandQueue;
+class CLBuffer;
+class CLKernel;
+
+
+/**
+ * @class TreeBuilder.
+ * @brief Класс построения дерева тел на устройстве OpenCL.
+ * Тела сортируются по кодам Мортона поразрядной сортировкой,
+ * по отсортированным кодам строится бинарное дерево,
+ * узлы которого совместимы с Octree::Node.
+ * Данные не покидают устройство.
+ */
+class TreeBuilder : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief Конструктор.
+     * @param parent Объект-родитель.
+     */
+    explicit TreeBuilder(QObject *parent = 0);
+
+    /**
+     * @brief Деструктор.
+     */
+    ~TreeBuilder();
+
+    /**
+     * @brief Создаёт ядра и буферы построения дерева.
+     * @param cxt Контекст OpenCL.
+     * @param device Устройство OpenCL.
+     * @param program Скомпилированная программа OpenCL.
+     * @param bodies Максимальное число тел.
+     * @param morton64 Флаг использования 63-битных кодов Мортона,
+     * должен совпадать с опцией компиляции программы.
+     * @return true в случае успеха, иначе false.
+     */
+    bool create(const CLContext& cxt, const CLDevice& device, const CLProgram& program,
+                size_t bodies, bool morton64);
+
+    /**
+     * @brief Уничтожает ядра и буферы.
+     * @return true в случае успеха, иначе false.
+     */
+    bool destroy();
+
+    /**
+     * @brief Получение флага готовности.
+     * @return Флаг готовности.
+     */
+    bool isValid() const;
+
+    /**
+     * @brief Ставит в очередь построение дерева.
+     * @param queue Очередь команд OpenCL.
+     * @param positions Буфер позиций тел.
+     * @param masses Буфер масс тел.
+     * @param count Число тел.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool enqueueBuild(const CLCommandQueue& queue, const CLBuffer& positions,
+                      const CLBuffer& masses, size_t count);
+
+    /**
+     * @brief Получение буфера узлов дерева.
+     * @return Буфер узлов дерева.
+     */
+    CLBuffer* nodesBuffer();
+
+    /**
+     * @brief Получение буфера индексов тел в порядке обхода дерева.
+     * @return Буфер индексов тел.
+     */
+    CLBuffer* indicesBuffer();
+
+    /**
+     * @brief Получение буфера родителей узлов, -1 у корня.
+     * @return Буфер родителей узлов.
+     */
+    CLBuffer* parentsBuffer();
+
+private:
+    /**
+     * @brief Флаг готовности.
+     */
+    bool is_valid;
+
+    /**
+     * @brief Максимальное число тел.
+     */
+    size_t bodies_count;
+
+    /**
+     * @brief Размер ключа в байтах.
+     */
+    size_t key_size;
+
+    /**
+     * @brief Число проходов поразрядной сортировки.
+     */
+    size_t radix_passes;
+
+    /**
+     * @brief Размер рабочей группы.
+     */
+    size_t local_size;
+
+    /**
+     * @brief Число групп вычисления ограничивающего параллелепипеда.
+     */
+    size_t bounds_groups;
+
+    /**
+     * @brief Максимальное число групп поразрядной сортировки.
+     */
+    size_t radix_groups;
+
+    /**
+     * @brief Ядра построения дерева.
+     */
+    CLKernel* kernel_bounds;
+    CLKernel* kernel_bounds_merge;
+    CLKernel* kernel_morton;
+    CLKernel* kernel_histogram;
+    CLKernel* kernel_scan;
+    CLKernel* kernel_scatter;
+    CLKernel* kernel_internal;
+    CLKernel* kernel_summarize;
+
+    /**
+     * @brief Буферы ключей сортировки.
+     */
+    CLBuffer* keys_buf[2];
+
+    /**
+     * @brief Буферы значений сортировки (индексов тел).
+     */
+    CLBuffer* values_buf[2];
+
+    /**
+     * @brief Буфер гистограммы разрядов.
+     */
+    CLBuffer* hist_buf;
+
+    /**
+     * @brief Буфер промежуточных границ.
+     */
+    CLBuffer* partial_buf;
+
+    /**
+     * @brief Буфер ограничивающего параллелепипеда.
+     */
+    CLBuffer* bounds_buf;
+
+    /**
+     * @brief Буфер родителей узлов.
+     */
+    CLBuffer* parents_buf;
+
+    /**
+     * @brief Буфер правых потомков по точкам разбиения.
+     */
+    CLBuffer* split_buf;
+
+    /**
+     * @brief Буфер последних тел узлов.
+     */
+    CLBuffer* last_buf;
+
+    /**
+     * @brief Буфер флагов посещения узлов.
+     */
+    CLBuffer* flags_buf;
+
+    /**
+     * @brief Буфер ограничивающих параллелепипедов узлов.
+     */
+    CLBuffer* boxes_buf;
+
+    /**
+     * @brief Буфер узлов дерева.
+     */
+    CLBuffer* nodes_buf;
+
+    /**
+     * @brief Создаёт буфер OpenCL.
+     * @param cxt Контекст OpenCL.
+     * @param buf Буфер OpenCL.
+     * @param size Размер в байтах.
+     * @return true в случае успеха, иначе false.
+     * @throw CLException в случае ошибки.
+     */
+    bool createBuffer(const CLContext& cxt, CLBuffer* buf, size_t size);
+};
+
+#endif // TREEBUILDER_H
@@ -1,5 +1,10 @@
 #include "utils.h"
 #include <math.h>
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
 
 namespace utils{
 
@@ -33,4 +38,18 @@ qreal degrees(qreal rads)
     return rads * 180.0 / M_PI;
 }
 
+quint64 physicalMemory()
+{
+#if defined(Q_OS_WIN)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if(GlobalMemoryStatusEx(&status)) return status.ullTotalPhys;
+#elif defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if(pages > 0 && page_size > 0) return static_cast<quint64>(pages) * static_cast<quint64>(page_size);
+#endif
+    return 0;
+}
+
 }
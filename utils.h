@@ -14,6 +14,13 @@
         }\
     }while(0)
 
+//! Нижняя граница квадрата расстояния в силе тяготения.
+//! Общая для ядер OpenCL (передаётся опцией -DNBODY_RADIUS2_MIN),
+//! расчёта на процессоре и эталонного расчёта в double.
+//! При ней m / r^3 остаётся конечным в float для масс до ~1e14,
+//! и совпадающие или почти совпадающие тела не дают inf и NaN.
+#define NBODY_RADIUS2_MIN 1e-16f
+
 namespace utils{
 
 /**
@@ -59,6 +66,12 @@ qreal radians(qreal degrs);
  */
 qreal degrees(qreal rads);
 
+/**
+ * @brief Получение объёма физической памяти.
+ * @return Объём памяти в байтах или 0, если он неизвестен.
+ */
+quint64 physicalMemory();
+
 }
 
 #endif // UTILS_H